@@ -9,6 +9,7 @@
 #ifndef NylonSock_NylonSock_hpp
 #define NylonSock_NylonSock_hpp
 
+#include "Datagram.h"
 #include "Socket.h"
 #include "Sustainable.h"
 
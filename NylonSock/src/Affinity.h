@@ -0,0 +1,181 @@
+//
+//  Affinity.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Affinity__
+#define __NylonSock__Affinity__
+
+#include "Socket.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ How affinity works:
+
+ setAffinity pins a Server or Client loop thread to a set of cpus, before it
+ does anything else, so its work and its caches stay there. With local_memory
+ the thread also asks for its memory from the numa node of its first cpu,
+ using set_mempolicy, which covers every buffer the loop allocates from then
+ on, the connections it accepts included. Memory made before the loop starts,
+ the io_uring buffer pool from setUring for one, is moved over with mbind.
+ Neither needs libnuma, and on a machine with one node they change nothing.
+
+ Made with AffinityOptions, a tcp Server's listener joins its port's
+ SO_REUSEPORT group with SO_INCOMING_CPU set to its first cpu. Several
+ Servers on one port, one per cpu, then share the connections, and linux
+ hands each one to the Server whose cpu took its packets off the network
+ card, so a connection is handled on the cpu its interrupts land on. Spread
+ the card's receive queues over the same cpus for this to pay off.
+ */
+
+namespace NylonSock
+{
+    //settings for Server::setAffinity, Client::setAffinity, and making a Server that is steered to
+    struct AffinityOptions
+    {
+        //cpus the loop thread may run on, empty for wherever the system puts it
+        std::vector<int> cpus;
+
+        //the loop thread's memory comes from the numa node of its first cpu
+        bool local_memory = true;
+    };
+
+    //throws if any of cpus can't be run on, so a bad setting shows before the loop starts
+    inline void checkCpus(const std::vector<int>& cpus)
+    {
+        if(cpus.empty() ) return;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) throw Error("Failed to look at the cpus allowed");
+        for(auto cpu : cpus)
+        {
+            if(cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed) ) throw Error("cpu " + std::to_string(cpu) + " isn't one this process may use", true);
+        }
+#else
+        throw Error("Pinning a thread to cpus needs linux", true);
+#endif
+    }
+
+    //pins the calling thread to cpus, if there are any. False if the system wouldn't
+    inline bool pinThread(const std::vector<int>& cpus)
+    {
+        if(cpus.empty() ) return true;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(auto cpu : cpus) CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    //the numa node cpu belongs to, -1 if the system doesn't say
+    inline int cpuNode(int cpu)
+    {
+#ifdef __linux__
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR* dir = opendir(path.c_str() );
+        if(dir == nullptr) return -1;
+
+        int node = -1;
+        while(dirent* entry = readdir(dir) )
+        {
+            std::string name = entry->d_name;
+            if(name.size() > 4 && name.compare(0, 4, "node") == 0 && name.find_first_not_of("0123456789", 4) == std::string::npos)
+            {
+                node = std::stoi(name.substr(4) );
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+#else
+        return -1;
+#endif
+    }
+
+#ifdef __linux__
+    namespace Numa
+    {
+        //linux/mempolicy.h values, without needing the header
+        constexpr int preferred = 1;
+        constexpr unsigned int move = 1 << 1;
+
+        //a node mask with only node set, and the maxnode the system calls want for it
+        inline std::vector<unsigned long> mask(int node, unsigned long& maxnode)
+        {
+            constexpr size_t bits = sizeof(unsigned long) * 8;
+            std::vector<unsigned long> mask(node / bits + 1, 0);
+            mask[node / bits] = 1UL << (node % bits);
+            maxnode = mask.size() * bits + 1;
+            return mask;
+        }
+    }
+#endif
+
+    //has the calling thread's memory come from node from now on. False if it can't
+    inline bool preferNode(int node)
+    {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+        if(node < 0) return false;
+
+        unsigned long maxnode;
+        auto mask = Numa::mask(node, maxnode);
+        return syscall(SYS_set_mempolicy, Numa::preferred, mask.data(), maxnode) == 0;
+#else
+        return false;
+#endif
+    }
+
+    //has the pages of addr, for size bytes, come from node, moving the ones already in memory.
+    //addr is page aligned. False if it can't
+    inline bool placeOnNode(void* addr, size_t size, int node)
+    {
+#if defined(__linux__) && defined(SYS_mbind)
+        if(node < 0 || addr == nullptr) return false;
+
+        unsigned long maxnode;
+        auto mask = Numa::mask(node, maxnode);
+        return syscall(SYS_mbind, addr, size, Numa::preferred, mask.data(), maxnode, Numa::move) == 0;
+#else
+        return false;
+#endif
+    }
+
+    //puts the calling thread where opts says. Returns the node its memory comes from, -1 if any
+    inline int applyAffinity(const AffinityOptions& opts)
+    {
+        pinThread(opts.cpus);
+        if(!opts.local_memory || opts.cpus.empty() ) return -1;
+
+        int node = cpuNode(opts.cpus.front() );
+        return preferNode(node) ? node : -1;
+    }
+
+    //joins sock's port's SO_REUSEPORT group as the one for connections cpu received. Before bind
+    inline void steerToCpu(const Socket& sock, int cpu)
+    {
+#if defined(__linux__) && defined(SO_REUSEPORT) && defined(SO_INCOMING_CPU)
+        constexpr int yes = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes) );
+        setsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu) );
+#else
+        throw Error("Steering connections by cpu needs linux", true);
+#endif
+    }
+}
+
+#endif /* defined(__NylonSock__Affinity__) */
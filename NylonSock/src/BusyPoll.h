@@ -0,0 +1,104 @@
+//
+//  BusyPoll.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__BusyPoll__
+#define __NylonSock__BusyPoll__
+
+#include "Affinity.h"
+#include "Socket.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ How busy polling works:
+
+ A loop with nothing to do sleeps in poll, or in io_uring_enter, and whatever
+ arrives next has to wake it first, which is where most of the jitter on a
+ quiet connection comes from. With setBusyPoll, a Server or Client loop about
+ to sleep first keeps checking for up to spin us without waiting, and only
+ sleeps if nothing turned up. A message that arrives inside the window is
+ picked up without a wakeup, at the price of a core kept busy for the whole
+ window after every pass. On poll each check is a poll with no timeout, on
+ an io_uring it is a look at the completion queue, with no system call.
+
+ busy_poll also sets SO_BUSY_POLL on every tcp socket, so the kernel polls
+ the network card's queue itself instead of waiting on its interrupt. Going
+ above net.core.busy_read needs CAP_NET_ADMIN, and without it the option is
+ left as it was. cpu pins the loop thread to one cpu, which keeps the spinning
+ there and its caches warm. setAffinity's cpus, when it was called, win over it.
+
+ Each check yields the cpu, so whatever shares it, the peer included, still
+ runs while the loop spins. Spinning only pays off when the peer and the
+ network run on other cpus. On a single cpu it costs cpu time and gains
+ nothing.
+ */
+
+namespace NylonSock
+{
+    //settings for Server::setBusyPoll and Client::setBusyPoll
+    struct BusyPollOptions
+    {
+        //us the loop keeps checking before it sleeps, 0 to sleep straight away
+        unsigned int spin = 50;
+
+        //us for SO_BUSY_POLL on each tcp socket, 0 to leave it. Only on linux
+        unsigned int busy_poll = 0;
+
+        //cpu the loop thread is pinned to, -1 for wherever the system puts it
+        int cpu = -1;
+    };
+
+    //throws if cpu can't be pinned to, so a bad setting shows before the loop starts
+    inline void checkCpu(int cpu)
+    {
+        if(cpu >= 0) checkCpus(std::vector<int>{cpu});
+    }
+
+    //pins the calling thread to cpu, if it isn't -1. False if the system wouldn't
+    inline bool pinThread(int cpu)
+    {
+        return cpu < 0 || pinThread(std::vector<int>{cpu});
+    }
+
+    //SO_BUSY_POLL for us on sock, as far as the process is allowed to
+    inline void setBusyPoll(const Socket& sock, unsigned int us)
+    {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+        if(us == 0) return;
+
+        int value = static_cast<int>(us);
+        try
+        {
+            setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value) );
+        }
+        catch(NylonSock::Error& e)
+        {
+            //past net.core.busy_read without CAP_NET_ADMIN
+        }
+#endif
+    }
+
+    //polls ps without waiting until something is ready, for up to us. True if something was,
+    //with ps filled in as poll would
+    inline bool spinPoll(PollFDs& ps, unsigned int us)
+    {
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+        do
+        {
+            if(poll(ps, 0) > 0) return true;
+
+            //a peer on the same cpu still gets to answer
+            std::this_thread::yield();
+        }
+        while(std::chrono::steady_clock::now() < end);
+
+        return false;
+    }
+}
+
+#endif /* defined(__NylonSock__BusyPoll__) */
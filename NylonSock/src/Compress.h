@@ -0,0 +1,260 @@
+//
+//  Compress.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Compress__
+#define __NylonSock__Compress__
+
+#include "Outbox.h"
+#include "Wire.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef NYLONSOCK_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+ How frames are compressed:
+
+ A side that turns compression on sends a hello naming the codecs it can
+ inflate and a hash of its dictionary. Once the peer's hello names a codec we
+ have, with the same dictionary, any message of at least min_size bytes goes
+ out as a compressed frame instead, if that comes out smaller.
+
+ Every message is compressed on its own, primed with the dictionary rather
+ than with the messages before it. That lets a broadcast be compressed once
+ and shared by every queue, and lets the Outbox drop, replace and reorder
+ messages without the peer losing track.
+
+ hello:      uint32_t dictionary hash, uint8_t for each codec
+ compressed: the message, laid out as for chunks in Outbox.h, deflated
+             A compressed message too big for one frame is sent in chunks
+
+ Codecs are only there when built with NYLONSOCK_ZLIB defined (and zlib linked).
+ */
+
+namespace NylonSock
+{
+    const std::string compress_hello = std::string{reserved_event_prefix} + "zh";
+    const std::string compressed_event = std::string{reserved_event_prefix} + "zc";
+
+    constexpr uint8_t codec_deflate = 1;
+
+    //settings for Server::setCompression and Client::setCompression
+    struct CompressionOptions
+    {
+        //messages smaller than this, counting the frame header, go out as they are
+        size_t min_size = 512;
+
+        //1 is the fastest, 9 the smallest
+        int level = 1;
+
+        //text messages are likely to share, like field names. Messages to a peer are
+        //only compressed when its dictionary is the same
+        std::string dictionary;
+    };
+
+    //fnv-1a, so both sides agree without needing zlib
+    inline uint32_t dictionaryHash(const std::string& dictionary)
+    {
+        uint32_t hash = 2166136261u;
+        for(char it : dictionary)
+        {
+            hash ^= static_cast<uint8_t>(it);
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+    inline std::string encodeCompressHello(const CompressionOptions& opts)
+    {
+        std::string data = packInt<uint32_t>(dictionaryHash(opts.dictionary) );
+#ifdef NYLONSOCK_ZLIB
+        data += static_cast<char>(codec_deflate);
+#endif
+
+        return encodeFrame(compress_hello, data);
+    }
+
+    //true if the peer's hello says it inflates what we would send it
+    inline bool acceptsCompression(const std::string& hello, const CompressionOptions& opts)
+    {
+#ifdef NYLONSOCK_ZLIB
+        if(hello.size() < sizeof(uint32_t) ) return false;
+        if(unpackInt<uint32_t>(hello) != dictionaryHash(opts.dictionary) ) return false;
+
+        return hello.find(static_cast<char>(codec_deflate), sizeof(uint32_t) ) != std::string::npos;
+#else
+        return false;
+#endif
+    }
+
+    //one deflate stream, reset for every message
+    class Deflater
+    {
+    private:
+        CompressionOptions _opts;
+#ifdef NYLONSOCK_ZLIB
+        z_stream _stream;
+#endif
+
+    public:
+        Deflater(const CompressionOptions& opts) : _opts(opts)
+        {
+#ifdef NYLONSOCK_ZLIB
+            _stream = {};
+            //raw deflate, the frame already says how big it is
+            constexpr int window_bits = -15;
+            constexpr int mem_level = 8;
+            if(deflateInit2(&_stream, _opts.level, Z_DEFLATED, window_bits, mem_level, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                throw Error("Failed to start deflating", true);
+            }
+#endif
+        }
+
+        ~Deflater()
+        {
+#ifdef NYLONSOCK_ZLIB
+            deflateEnd(&_stream);
+#endif
+        }
+
+        Deflater(const Deflater&) = delete;
+        Deflater& operator=(const Deflater&) = delete;
+
+        //fills in out.packed, leaving it empty if compressing didn't help
+        void pack(Outgoing& out)
+        {
+            static const auto none = std::make_shared<const std::string>();
+            out.packed = none;
+
+#ifdef NYLONSOCK_ZLIB
+            //a whole frame is turned into the message layout by leaving out its data size
+            const std::string& bytes = *out.bytes;
+            size_t rest = out.chunked ? sizeof(sock_size_type) : frame_header_size;
+            size_t size = sizeof(sock_size_type) + bytes.size() - rest;
+
+            //room for the header of a whole frame, cut down later if it needs chunks
+            size_t prefix = frame_header_size + compressed_event.size();
+            std::string packed(prefix + deflateBound(&_stream, size), '\0');
+
+            deflateReset(&_stream);
+            if(!_opts.dictionary.empty() )
+            {
+                deflateSetDictionary(&_stream, reinterpret_cast<const Bytef*>(_opts.dictionary.data() ),
+                    static_cast<uInt>(_opts.dictionary.size() ) );
+            }
+
+            _stream.next_out = reinterpret_cast<Bytef*>(&packed[prefix]);
+            _stream.avail_out = static_cast<uInt>(packed.size() - prefix);
+            _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(bytes.data() ) );
+            _stream.avail_in = sizeof(sock_size_type);
+            if(deflate(&_stream, Z_NO_FLUSH) != Z_OK) return;
+
+            _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(bytes.data() + rest) );
+            _stream.avail_in = static_cast<uInt>(bytes.size() - rest);
+            if(deflate(&_stream, Z_FINISH) != Z_STREAM_END) return;
+
+            size_t deflated = _stream.total_out;
+            packed.resize(prefix + deflated);
+
+            bool whole = deflated <= maximum_sock_val && packed.size() <= chunk_size;
+            if(whole)
+            {
+                packed.replace(0, frame_header_size,
+                    packInt<sock_size_type>(static_cast<sock_size_type>(compressed_event.size() ) ) +
+                    packInt<sock_size_type>(static_cast<sock_size_type>(deflated) ) );
+                packed.replace(frame_header_size, compressed_event.size(), compressed_event);
+            }
+            else
+            {
+                packed.replace(0, prefix,
+                    packInt<sock_size_type>(static_cast<sock_size_type>(compressed_event.size() ) ) + compressed_event);
+            }
+
+            //a small message has to stay a single frame, see Outbox
+            if(packed.size() >= bytes.size() || (!out.chunked && !whole) ) return;
+
+            out.packed = std::make_shared<const std::string>(std::move(packed) );
+            out.packed_chunked = !whole;
+#endif
+        }
+    };
+
+    //one inflate stream, reset for every message
+    class Inflater
+    {
+    private:
+        std::string _dictionary;
+#ifdef NYLONSOCK_ZLIB
+        z_stream _stream;
+#endif
+
+    public:
+        Inflater(const std::string& dictionary) : _dictionary(dictionary)
+        {
+#ifdef NYLONSOCK_ZLIB
+            _stream = {};
+            if(inflateInit2(&_stream, -15) != Z_OK) throw Error("Failed to start inflating", true);
+#endif
+        }
+
+        ~Inflater()
+        {
+#ifdef NYLONSOCK_ZLIB
+            inflateEnd(&_stream);
+#endif
+        }
+
+        Inflater(const Inflater&) = delete;
+        Inflater& operator=(const Inflater&) = delete;
+
+        //returns false if data is malformed
+        //throws when it inflates to more than a message may hold
+        bool unpack(const std::string& data, std::string& event_name, std::string& message_data)
+        {
+#ifdef NYLONSOCK_ZLIB
+            inflateReset(&_stream);
+            if(!_dictionary.empty() )
+            {
+                inflateSetDictionary(&_stream, reinterpret_cast<const Bytef*>(_dictionary.data() ),
+                    static_cast<uInt>(_dictionary.size() ) );
+            }
+
+            //text usually inflates to a few times its size, grown from there if not
+            std::string message(std::min(maximum_message_layout, std::max<size_t>(4 * data.size(), 1024) ), '\0');
+            _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data() ) );
+            _stream.avail_in = static_cast<uInt>(data.size() );
+
+            size_t have = 0;
+            while(true)
+            {
+                _stream.next_out = reinterpret_cast<Bytef*>(&message[have]);
+                _stream.avail_out = static_cast<uInt>(message.size() - have);
+                int result = inflate(&_stream, Z_NO_FLUSH);
+                have = message.size() - _stream.avail_out;
+
+                if(result == Z_STREAM_END) break;
+                if( (result != Z_OK && result != Z_BUF_ERROR) || _stream.avail_out > 0) return false;
+
+                if(message.size() == maximum_message_layout) throw Error("Compressed message is too big", true);
+                message.resize(std::min(maximum_message_layout, 2 * message.size() ) );
+            }
+            message.resize(have);
+
+            return decodeMessage(message, event_name, message_data);
+#else
+            return false;
+#endif
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__Compress__) */
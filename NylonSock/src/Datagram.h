@@ -0,0 +1,752 @@
+//
+//  Datagram.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Datagram__
+#define __NylonSock__Datagram__
+
+#include "Socket.h"
+#include "Sustainable.h"
+#include "Wire.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ How datagrams work:
+
+ DatagramServer and DatagramClient talk over udp with the same frames and the
+ same on() and emit() as Server and Client. There is no connection, so a
+ message may be lost, duplicated or overtaken by a later one, and each one
+ has to fit in a single datagram. Every datagram holds one or more whole
+ frames.
+
+ A DatagramServer knows a peer by its address. The first datagram from a new
+ address makes a peer and calls onConnect. A peer that stays quiet for
+ peer_timeout is forgotten, after its "disconnect" event.
+
+ With sequenced on, each emit is wrapped in
+
+ dq: uint32_t epoch, uint64_t sequence, frame of the message
+
+ The sequence counts up per event name on the sending socket, and the epoch
+ is picked at random when the socket is made. The receiver drops a message
+ that is no newer than the last one it handled of that event from that peer,
+ so a late update never undoes a fresher one. A new epoch means the peer
+ started over, and its old numbers are forgotten.
+
+ The loop receives up to max_datagram_batch datagrams per system call, and
+ whatever on() functions emit is sent together once the batch is handled.
+ Emits from other threads go out right away.
+ */
+
+namespace NylonSock
+{
+    const std::string datagram_sequenced = std::string{reserved_event_prefix} + "dq";
+
+    //settings for DatagramServer and DatagramClient
+    struct DatagramOptions
+    {
+        //drops messages older than one already handled of the same event, see above
+        //both sides have to agree
+        bool sequenced = false;
+
+        //largest datagram sent or taken. Emits that don't fit throw TOO_BIG, and longer
+        //datagrams that arrive are dropped. The loop keeps a buffer this big per datagram in a batch
+        size_t max_size = max_datagram_size;
+
+        //datagrams waiting for room in the socket, past which the oldest are dropped
+        size_t max_queued = 4096;
+
+        //server only: ms a peer may stay quiet before it is forgotten, 0 to keep it forever
+        unsigned int peer_timeout = 30000;
+
+        //server only: addresses kept at once. Datagrams from new ones past this are dropped
+        size_t max_peers = 4096;
+    };
+
+    class DatagramChannel;
+
+    //who a DatagramSocket talks to, handed to its constructor
+    struct DatagramPeer
+    {
+        DatagramChannel* channel;
+        sockaddr_storage addr;
+
+        //0 for the server of a DatagramClient, as the socket is connected to it
+        socklen_t addr_size;
+    };
+
+    //a udp socket, shared by all of a DatagramServer's peers
+    class DatagramChannel
+    {
+    private:
+        struct Pending
+        {
+            const DatagramPeer* to;
+            std::shared_ptr<const std::string> bytes;
+        };
+
+        Socket _sock;
+        DatagramOptions _opts;
+
+        //guards the sending side
+        std::mutex _send_mtx;
+        std::deque<Pending> _pending;
+        std::vector<Datagram> _batch;
+        std::thread::id _loop;
+        uint32_t _epoch;
+        std::unordered_map<std::string, uint64_t> _next_seq;
+        std::atomic<uint64_t> _dropped;
+
+        //the receiving side, only touched by the loop
+        std::vector<char> _recv_buf;
+        std::vector<Datagram> _recv;
+
+        //caller holds _send_mtx
+        void push(const DatagramPeer& to, const std::shared_ptr<const std::string>& bytes)
+        {
+            if(_pending.size() >= _opts.max_queued)
+            {
+                _pending.pop_front();
+                ++_dropped;
+            }
+
+            _pending.push_back({&to, bytes});
+        }
+
+        //caller holds _send_mtx
+        void flushLocked()
+        {
+            while(!_pending.empty() )
+            {
+                size_t count = std::min(_pending.size(), max_datagram_batch);
+                _batch.resize(count);
+                for(size_t i = 0; i < count; ++i)
+                {
+                    auto& it = _pending[i];
+                    _batch[i].addr = it.to->addr;
+                    _batch[i].addr_size = it.to->addr_size;
+                    _batch[i].data = const_cast<char*>(it.bytes->data() );
+                    _batch[i].size = it.bytes->size();
+                }
+
+                size_t sent = trysendmany(_sock, _batch.data(), count);
+                _pending.erase(_pending.begin(), _pending.begin() + sent);
+                if(sent < count) return;
+            }
+        }
+
+        //the loop sends everything its on() functions emitted in one go once they are done
+        bool deferred() const {return std::this_thread::get_id() == _loop;}
+
+    public:
+        DatagramChannel(Socket&& sock, const DatagramOptions& opts) :
+            _sock(std::move(sock) ), _opts(opts), _epoch(std::random_device{}() ), _dropped(0)
+        {
+            _opts.max_size = std::min(_opts.max_size, max_datagram_size);
+            fcntl(_sock, O_NONBLOCK);
+        }
+
+        DatagramChannel(const DatagramChannel& that) = delete;
+        DatagramChannel& operator=(const DatagramChannel& that) = delete;
+
+        const Socket& socket() const {return _sock;}
+
+        //emits from this thread wait for flush()
+        void setLoop(std::thread::id loop)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _loop = loop;
+        }
+
+        //encodes one message as a datagram, which can be sent to any number of peers
+        std::shared_ptr<const std::string> prepare(const std::string& event_name, const SockData& data)
+        {
+            if(event_name.size() > maximum_sock_val)
+            {
+                throw TOO_BIG("The event name size of " + std::to_string(event_name.size() ) + " is too big.");
+            }
+
+            auto raw = data.getRaw();
+            if(frame_header_size + event_name.size() + raw.size() > _opts.max_size)
+            {
+                throw TOO_BIG("A datagram has to fit in " + std::to_string(_opts.max_size) + " bytes.");
+            }
+
+            auto frame = encodeFrame(event_name, raw);
+            if(_opts.sequenced)
+            {
+                uint64_t seq;
+                {
+                    std::lock_guard<std::mutex> lock{_send_mtx};
+                    seq = ++_next_seq[event_name];
+                }
+
+                frame = encodeFrame(datagram_sequenced, packInt<uint32_t>(_epoch) + packInt<uint64_t>(seq) + frame);
+                if(frame.size() > _opts.max_size)
+                {
+                    throw TOO_BIG("A datagram has to fit in " + std::to_string(_opts.max_size) + " bytes.");
+                }
+            }
+
+            return std::make_shared<const std::string>(std::move(frame) );
+        }
+
+        //to has to outlive the datagram's time in the queue
+        void send(const DatagramPeer& to, const std::shared_ptr<const std::string>& bytes)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            push(to, bytes);
+            if(!deferred() ) flushLocked();
+        }
+
+        //the same datagram to all of to, in as few system calls as the socket allows
+        void send(const std::vector<const DatagramPeer*>& to, const std::shared_ptr<const std::string>& bytes)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            for(auto it : to) push(*it, bytes);
+            if(!deferred() ) flushLocked();
+        }
+
+        //sends what is queued, as far as the socket takes it
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            flushLocked();
+        }
+
+        //true while datagrams wait for room in the socket
+        bool pending()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return !_pending.empty();
+        }
+
+        //forgets queued datagrams to a peer that is about to go away
+        void drop(const DatagramPeer& to)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            auto gone = std::remove_if(_pending.begin(), _pending.end(), [&to](const Pending& it) {return it.to == &to;});
+            _pending.erase(gone, _pending.end() );
+        }
+
+        //datagrams dropped because the queue was full
+        uint64_t dropped() const {return _dropped.load();}
+
+        //receives one batch, returning how many. They stay valid until the next receive()
+        size_t receive()
+        {
+            if(_recv.empty() )
+            {
+                //one more byte than a datagram may have, to tell one that was cut off
+                _recv_buf.resize(max_datagram_batch * (_opts.max_size + 1) );
+                _recv.resize(max_datagram_batch);
+            }
+
+            for(size_t i = 0; i < max_datagram_batch; ++i)
+            {
+                _recv[i].data = &_recv_buf[i * (_opts.max_size + 1)];
+                _recv[i].size = _opts.max_size + 1;
+            }
+
+            return recvmany(_sock, _recv.data(), max_datagram_batch);
+        }
+
+        //the ith datagram of the last receive(), nullptr if it was too long
+        const Datagram* received(size_t i) const
+        {
+            return _recv[i].size > _opts.max_size ? nullptr : &_recv[i];
+        }
+    };
+
+    //have to use CRTP, as with ClientSocket
+    template<class T>
+    class DatagramSocket
+    {
+    private:
+        DatagramPeer _peer;
+
+        std::unordered_map<std::string, SockFunc<T> > _functions;
+        std::unordered_map<std::string, NoFunc<T> > _nofunctions;
+
+        //the newest sequence number handled per event, for the peer's current epoch
+        bool _has_epoch;
+        uint32_t _epoch;
+        std::unordered_map<std::string, uint64_t> _last_seq;
+        uint64_t _stale;
+
+        std::chrono::steady_clock::time_point _last_seen;
+
+        T& impl() {return *static_cast<T*>(this);}
+
+        //false for a malformed message, or one older than what was already handled
+        bool unwrap(std::string& event_name, std::string& data)
+        {
+            constexpr size_t header_size = sizeof(uint32_t) + sizeof(uint64_t);
+            if(data.size() < header_size) return false;
+
+            uint32_t epoch = unpackInt<uint32_t>(data);
+            uint64_t seq = unpackInt<uint64_t>(data, sizeof(uint32_t) );
+
+            std::string inner = data.substr(header_size);
+            size_t pos = 0;
+            if(!decodeFrame(inner, pos, event_name, data) || pos != inner.size() ) return false;
+
+            //nothing is kept for events nobody listens to
+            if(_functions.find(event_name) == _functions.end() ) return false;
+
+            //the peer started over, so its old numbers mean nothing
+            if(!_has_epoch || epoch != _epoch)
+            {
+                _last_seq.clear();
+                _epoch = epoch;
+                _has_epoch = true;
+            }
+
+            auto& last = _last_seq[event_name];
+            if(seq <= last)
+            {
+                ++_stale;
+                return false;
+            }
+
+            last = seq;
+            return true;
+        }
+
+        void eventCall(const std::string& eventstr, SockData data)
+        {
+            auto efind = _functions.find(eventstr);
+            if(efind != _functions.end() ) (efind->second)(data, impl() );
+        }
+
+    public:
+        DatagramSocket(const DatagramPeer& peer) :
+            _peer(peer), _has_epoch(false), _epoch(0), _stale(0), _last_seen(std::chrono::steady_clock::now() ) {}
+
+        virtual ~DatagramSocket() = default;
+
+        DatagramSocket(const DatagramSocket& that) = delete;
+        DatagramSocket& operator=(const DatagramSocket& that) = delete;
+
+        //call before start(), or from the loop thread
+        void on(const std::string& event_name, SockFunc<T> func)
+        {
+            _functions[event_name] = func;
+        }
+
+        //only "disconnect", when a DatagramServer forgets the peer
+        void on(const std::string& event_name, NoFunc<T> func)
+        {
+            _nofunctions[event_name] = func;
+        }
+
+        //sends data to the peer, if the network doesn't lose it on the way
+        void emit(const std::string& event_name, const SockData& data)
+        {
+            _peer.channel->send(_peer, _peer.channel->prepare(event_name, data) );
+        }
+
+        const DatagramPeer& peer() const {return _peer;}
+
+        //the peer's address as ip and port, or an empty string for a DatagramClient's server
+        std::string address() const
+        {
+            if(_peer.addr_size == 0) return {};
+
+            char host[NI_MAXHOST];
+            char service[NI_MAXSERV];
+            if(getnameinfo(reinterpret_cast<const sockaddr*>(&_peer.addr), _peer.addr_size, host, sizeof(host),
+                service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+            {
+                return {};
+            }
+
+            return std::string{host} + ":" + service;
+        }
+
+        //messages dropped by sequencing for being older than one already handled
+        uint64_t stale() const {return _stale;}
+
+        std::chrono::steady_clock::time_point lastSeen() const {return _last_seen;}
+
+        //called by the loop with each datagram from the peer
+        void receive(const char* bytes, size_t size)
+        {
+            _last_seen = std::chrono::steady_clock::now();
+
+            std::string buf(bytes, size);
+            std::string event_name;
+            std::string data;
+            size_t pos = 0;
+            while(decodeFrame(buf, pos, event_name, data) )
+            {
+                if(event_name == datagram_sequenced)
+                {
+                    if(!unwrap(event_name, data) ) continue;
+                }
+                else if(isReservedEvent(event_name) )
+                {
+                    continue;
+                }
+
+                eventCall(event_name, data);
+            }
+        }
+
+        //called by the loop when a DatagramServer forgets the peer
+        void lost()
+        {
+            auto efind = _nofunctions.find("disconnect");
+            if(efind != _nofunctions.end() ) (efind->second)(impl() );
+        }
+    };
+
+    template<class UsrSock, class Dummy = void>
+    class DatagramServer;
+
+    template <class UsrSock>
+    class DatagramServer<UsrSock, typename std::enable_if<std::is_base_of<DatagramSocket<UsrSock>, UsrSock>::value>::type>
+    {
+    private:
+        using ServClientFunc = std::function<void (UsrSock&)>;
+
+        std::atomic<bool> _stop_thread;
+        std::unique_ptr<std::thread> _thread;
+        PollFDs _pollset;
+        Waker _waker;
+        DatagramOptions _opts;
+        std::unique_ptr<DatagramChannel> _channel;
+
+        //keyed by the bytes of the peer's address. Only the loop changes it, under _peers_mtx
+        std::unordered_map<std::string, std::unique_ptr<UsrSock> > _peers;
+        std::mutex _peers_mtx;
+        ServClientFunc _func;
+
+        std::chrono::steady_clock::time_point _next_sweep;
+
+        static Socket createServer(const std::string& port)
+        {
+            addrinfo hints = {0};
+            //ipv4 and ipv6 peers both reach an ipv6 socket
+            hints.ai_family = AF_INET6;
+            hints.ai_socktype = SOCK_DGRAM;
+            hints.ai_protocol = IPPROTO_UDP;
+            hints.ai_flags = AI_PASSIVE;
+
+            Socket sock{nullptr, port.c_str(), &hints};
+#ifdef PLAT_WIN
+            //needed because windows ipv6 doesn't accept ipv4
+            constexpr int n = 0;
+            setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &n, sizeof(n) );
+#endif
+            bind(sock);
+
+            return sock;
+        }
+
+        void dispatch(const Datagram& gram)
+        {
+            std::string key(reinterpret_cast<const char*>(&gram.addr), gram.addr_size);
+            auto found = _peers.find(key);
+            if(found == _peers.end() )
+            {
+                if(_peers.size() >= _opts.max_peers) return;
+
+                DatagramPeer peer{_channel.get(), gram.addr, gram.addr_size};
+                auto usr_sock = std::make_unique<UsrSock>(peer);
+                {
+                    std::lock_guard<std::mutex> lock{_peers_mtx};
+                    found = _peers.emplace(std::move(key), std::move(usr_sock) ).first;
+                }
+
+                if(_func) _func(*found->second);
+            }
+
+            found->second->receive(gram.data, gram.size);
+        }
+
+        //forgets peers that have been quiet for longer than peer_timeout
+        void sweep()
+        {
+            auto now = std::chrono::steady_clock::now();
+            if(_opts.peer_timeout == 0 || now < _next_sweep) return;
+
+            //a peer is forgotten up to a quarter of peer_timeout late
+            _next_sweep = now + std::chrono::milliseconds(std::max(_opts.peer_timeout / 4, 1u) );
+            auto limit = std::chrono::milliseconds(_opts.peer_timeout);
+            for(auto it = _peers.begin(); it != _peers.end(); )
+            {
+                if(now - it->second->lastSeen() < limit)
+                {
+                    ++it;
+                    continue;
+                }
+
+                it->second->lost();
+                _channel->drop(it->second->peer() );
+
+                std::lock_guard<std::mutex> lock{_peers_mtx};
+                it = _peers.erase(it);
+            }
+        }
+
+        void update()
+        {
+            constexpr int max_timeout = 100;
+
+            _pollset.clear();
+            _pollset.add_event(_channel->socket().port(), PollFDs::Events::NSPOLLIN);
+            _pollset.add_event(_waker.port(), PollFDs::Events::NSPOLLIN);
+            if(_channel->pending() ) _pollset.add_event(_channel->socket().port(), PollFDs::Events::NSPOLLOUT);
+
+            poll(_pollset, max_timeout);
+            if(_pollset.get_revent(_waker.port(), PollFDs::Events::NSPOLLIN) ) _waker.drain();
+
+            if(_pollset.get_revent(_channel->socket().port(), PollFDs::Events::NSPOLLIN) )
+            {
+                //a few batches at most, so the replies don't wait on a flood
+                constexpr int max_batches = 16;
+                for(int i = 0; i < max_batches; ++i)
+                {
+                    size_t count = _channel->receive();
+                    for(size_t j = 0; j < count; ++j)
+                    {
+                        auto gram = _channel->received(j);
+                        if(gram != nullptr) dispatch(*gram);
+                    }
+
+                    if(count < max_datagram_batch) break;
+                }
+            }
+
+            _channel->flush();
+            sweep();
+        }
+
+        void thr_update()
+        {
+            _channel->setLoop(std::this_thread::get_id() );
+            try
+            {
+                while(!_stop_thread.load() ) update();
+            }
+            catch(NylonSock::Error& e)
+            {
+                //the socket is broken, nothing more will come through it
+            }
+
+            _channel->setLoop({});
+            _stop_thread = true;
+        }
+
+    public:
+        DatagramServer(const std::string& port, const DatagramOptions& opts = {}) :
+            _stop_thread(true), _opts(opts), _channel(std::make_unique<DatagramChannel>(createServer(port), opts) )
+        {
+        }
+
+        DatagramServer(int port, const DatagramOptions& opts = {}) : DatagramServer(std::to_string(port), opts) {}
+
+        ~DatagramServer()
+        {
+            stop();
+            if(_thread != nullptr) _thread->join();
+        }
+
+        DatagramServer(const DatagramServer& that) = delete;
+
+        DatagramServer& operator=(const DatagramServer& that) = delete;
+
+        DatagramServer(DatagramServer&& that) = delete;
+
+        DatagramServer& operator=(DatagramServer&& that) = delete;
+
+        //called with each new peer, before its first datagram is handled
+        void onConnect(ServClientFunc func) {_func = func;}
+
+        //the same datagram to every peer, sent in as few system calls as possible
+        void emit(const std::string& event_name, const SockData& data)
+        {
+            auto bytes = _channel->prepare(event_name, data);
+
+            std::vector<const DatagramPeer*> to;
+            std::lock_guard<std::mutex> lock{_peers_mtx};
+            to.reserve(_peers.size() );
+            for(auto& it : _peers) to.push_back(&it.second->peer() );
+
+            _channel->send(to, bytes);
+        }
+
+        size_t count()
+        {
+            std::lock_guard<std::mutex> lock{_peers_mtx};
+            return _peers.size();
+        }
+
+        //datagrams dropped because the socket's queue was full
+        uint64_t dropped() const {return _channel->dropped();}
+
+        void start()
+        {
+            //Prevents making too many threads
+            if(!_stop_thread.load() ) return;
+
+            //reap a thread that exited on its own
+            if(_thread != nullptr) _thread->join();
+
+            _stop_thread = false;
+            _thread = std::make_unique<std::thread>(&DatagramServer::thr_update, this);
+        }
+
+        void stop()
+        {
+            _stop_thread = true;
+            _waker.wake();
+        }
+
+        bool status() const {return !_stop_thread.load();}
+    };
+
+    template <class T, class Dummy = void>
+    class DatagramClient;
+
+    template <class T>
+    class DatagramClient<T, typename std::enable_if<std::is_base_of<DatagramSocket<T>, T>::value>::type>
+    {
+    private:
+        std::atomic<bool> _stop_thread;
+        std::unique_ptr<std::thread> _thread;
+        PollFDs _pollset;
+        Waker _waker;
+        std::unique_ptr<DatagramChannel> _channel;
+        std::unique_ptr<T> _inter;
+
+        static Socket createListener(const std::string& ip, const std::string& port)
+        {
+            addrinfo hints = {0};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+
+            //connected, so only the server's datagrams come in
+            return {ip, port, &hints, true};
+        }
+
+        void update()
+        {
+            constexpr int poll_timeout = 250;
+
+            _pollset.clear();
+            _pollset.add_event(_channel->socket().port(), PollFDs::Events::NSPOLLIN);
+            _pollset.add_event(_waker.port(), PollFDs::Events::NSPOLLIN);
+            if(_channel->pending() ) _pollset.add_event(_channel->socket().port(), PollFDs::Events::NSPOLLOUT);
+
+            poll(_pollset, poll_timeout);
+            if(_pollset.get_revent(_waker.port(), PollFDs::Events::NSPOLLIN) ) _waker.drain();
+
+            if(_pollset.get_revent(_channel->socket().port(), PollFDs::Events::NSPOLLIN) )
+            {
+                constexpr int max_batches = 16;
+                for(int i = 0; i < max_batches; ++i)
+                {
+                    size_t count = _channel->receive();
+                    for(size_t j = 0; j < count; ++j)
+                    {
+                        auto gram = _channel->received(j);
+                        if(gram != nullptr) _inter->receive(gram->data, gram->size);
+                    }
+
+                    if(count < max_datagram_batch) break;
+                }
+            }
+
+            _channel->flush();
+        }
+
+        void thr_update()
+        {
+            _channel->setLoop(std::this_thread::get_id() );
+            try
+            {
+                while(!_stop_thread.load() ) update();
+            }
+            catch(NylonSock::Error& e)
+            {
+                //the socket is broken, nothing more will come through it
+            }
+
+            _channel->setLoop({});
+            _stop_thread = true;
+        }
+
+    public:
+        DatagramClient(const std::string& ip, const std::string& port, const DatagramOptions& opts = {}) :
+            _stop_thread(true), _channel(std::make_unique<DatagramChannel>(createListener(ip, port), opts) ),
+            _inter(std::make_unique<T>(DatagramPeer{_channel.get(), {}, 0}) )
+        {
+        }
+
+        DatagramClient(const std::string& ip, int port, const DatagramOptions& opts = {}) :
+            DatagramClient(ip, std::to_string(port), opts) {}
+
+        ~DatagramClient()
+        {
+            stop();
+            if(_thread != nullptr) _thread->join();
+        }
+
+        DatagramClient(const DatagramClient& that) = delete;
+
+        DatagramClient& operator=(const DatagramClient& that) = delete;
+
+        DatagramClient(DatagramClient&& that) = delete;
+
+        DatagramClient& operator=(DatagramClient&& that) = delete;
+
+        //call before start(), or from the loop thread
+        void on(const std::string& event_name, SockFunc<T> func) {_inter->on(event_name, func);}
+
+        //sends data to the server, if the network doesn't lose it on the way
+        void emit(const std::string& event_name, const SockData& data) {_inter->emit(event_name, data);}
+
+        //datagrams dropped because the socket's queue was full
+        uint64_t dropped() const {return _channel->dropped();}
+
+        void start()
+        {
+            //Prevents making too many threads
+            if(!_stop_thread.load() ) return;
+
+            //reap a thread that exited on its own
+            if(_thread != nullptr) _thread->join();
+
+            _stop_thread = false;
+            _thread = std::make_unique<std::thread>(&DatagramClient<T>::thr_update, this);
+        }
+
+        void stop()
+        {
+            _stop_thread = true;
+            _waker.wake();
+        }
+
+        bool status() const {return !_stop_thread.load();}
+
+        T& get() {return *_inter;}
+    };
+}
+
+#endif /* defined(__NylonSock__Datagram__) */
@@ -0,0 +1,169 @@
+//
+//  Files.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Files__
+#define __NylonSock__Files__
+
+#include "Socket.h"
+#include "Wire.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+
+#ifdef UNIX_HEADER
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ How files are sent:
+
+ emitFile sends a file, or part of one, as a chunked message (see Outbox.h)
+ that the peer can't tell from any other big emit. On linux, over a plain
+ socket, each chunk's header is written as usual and the file's bytes follow
+ it with sendfile, or splice for a pipe, so they never pass through the
+ process. Over a ring, or with reliable delivery, which keeps what it sent,
+ they are read into the chunk instead.
+
+ File chunks carry up to file_chunk_size bytes rather than chunk_size, as a
+ file is big by nature and each one costs a system call. A pipe is sent as
+ its bytes arrive, until size is reached or its writers close it. Emits
+ behind it wait while it is empty.
+
+ On the receiving side, onFile picks a file descriptor for an event, and
+ chunked messages for it are written there as each chunk arrives instead of
+ being put together in memory, so they aren't held to maximum_message_size.
+ */
+
+namespace NylonSock
+{
+    //the rest of the file, for emitFile's size
+    constexpr uint64_t whole_file = std::numeric_limits<uint64_t>::max();
+
+    //file bytes in one chunk, leaving room for the chunk header and a reliable wrapper
+    constexpr size_t file_chunk_size = maximum_sock_val - 64;
+
+#ifdef __linux__
+    constexpr bool zero_copy_files = true;
+#else
+    constexpr bool zero_copy_files = false;
+#endif
+
+    //what emitFile sends from, shared by its Outgoing and the socket sending it
+    struct FileSource
+    {
+        FileDescriptors fd;
+        uint64_t offset;
+
+        //bytes to send, for a pipe the most it may send
+        uint64_t size;
+        bool pipe;
+    };
+
+    inline std::shared_ptr<const FileSource> openFileSource(const std::string& path, uint64_t offset, uint64_t size)
+    {
+#ifdef UNIX_HEADER
+        //opening a fifo would otherwise wait for something to write to it
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if(fd < 0) throw Error("Failed to open " + path);
+
+        auto source = std::make_shared<FileSource>();
+        source->fd.push(fd);
+
+        struct stat info;
+        if(fstat(fd, &info) != 0) throw Error("Failed to look at " + path);
+
+        source->pipe = S_ISFIFO(info.st_mode);
+        if(source->pipe && offset != 0) throw Error("A pipe can't be sent from an offset", true);
+        if(!source->pipe)
+        {
+            if(!S_ISREG(info.st_mode) ) throw Error(path + " isn't a file or a pipe", true);
+
+            uint64_t file_size = static_cast<uint64_t>(info.st_size);
+            if(offset > file_size) throw Error("The offset is past the end of " + path, true);
+            size = std::min(size, file_size - offset);
+        }
+
+        source->offset = offset;
+        source->size = size;
+
+        return source;
+#else
+        throw Error("Sending files needs unix", true);
+#endif
+    }
+
+    //bytes a pipe holds right now. closed is set once it is empty and nothing writes to it any more
+    inline size_t pipeReadable(int fd, bool& closed)
+    {
+        closed = false;
+#ifdef UNIX_HEADER
+        int count = 0;
+        if(::ioctl(fd, FIONREAD, &count) != 0) throw Error("Failed to look at the pipe being sent");
+        if(count > 0) return static_cast<size_t>(count);
+
+        pollfd ps = {fd, POLLIN, 0};
+        closed = ::poll(&ps, 1, 0) > 0 && (ps.revents & POLLHUP) != 0;
+#endif
+        return 0;
+    }
+
+    //appends size bytes of source from offset to out, for when they can't go straight to the socket
+    //a pipe has to hold them already
+    inline void readFileSource(const FileSource& source, uint64_t offset, size_t size, std::string& out)
+    {
+#ifdef UNIX_HEADER
+        size_t start = out.size();
+        out.resize(start + size);
+
+        size_t done = 0;
+        while(done < size)
+        {
+            int fd = source.fd.get()[0];
+            auto got = source.pipe ? ::read(fd, &out[start + done], size - done) :
+                ::pread(fd, &out[start + done], size - done, static_cast<off_t>(offset + done) );
+            if(got < 0 && errno == EINTR) continue;
+
+            //the peer was promised size bytes
+            if(got <= 0) throw Error("Failed to read the file being sent", true);
+            done += static_cast<size_t>(got);
+        }
+#else
+        throw Error("Sending files needs unix", true);
+#endif
+    }
+
+    //writes all of data to fd, waiting for it if it is non blocking and full
+    inline void writeFile(int fd, const char* data, size_t size)
+    {
+#ifdef UNIX_HEADER
+        while(size > 0)
+        {
+            auto done = ::write(fd, data, size);
+            if(done < 0 && errno == EINTR) continue;
+            if(done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+            {
+                pollfd ps = {fd, POLLOUT, 0};
+                ::poll(&ps, 1, -1);
+                continue;
+            }
+            if(done < 0) throw Error("Failed to write a received file");
+
+            data += done;
+            size -= static_cast<size_t>(done);
+        }
+#else
+        throw Error("Receiving files needs unix", true);
+#endif
+    }
+}
+
+#endif /* defined(__NylonSock__Files__) */
@@ -0,0 +1,134 @@
+//
+//  Flow.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Flow__
+#define __NylonSock__Flow__
+
+#include "Wire.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+ How credit based flow control works:
+
+ A side that turns flow control on tells its peer how far it may go with a
+ grant: the total number of frames and bytes the peer may have sent since the
+ connection was made. Totals rather than increments mean a grant can't be
+ double counted, and frames the peer sent before the first grant arrived are
+ simply part of the count. A peer that never gets a grant sends freely.
+
+ Only frames meant for on() functions count, control frames always go out.
+ Bytes are counted as the size of the whole frame.
+
+ grant: uint64_t frames, uint64_t bytes
+ */
+
+namespace NylonSock
+{
+    const std::string flow_grant = std::string{reserved_event_prefix} + "cg";
+
+    //settings for Server::setFlowControl and Client::setFlowControl
+    struct FlowOptions
+    {
+        //frames the peer may have sent that we haven't finished with
+        uint64_t frames = 1024;
+
+        //bytes the peer may have sent that we haven't finished with
+        uint64_t bytes = 1 << 20;
+
+        //credit is handed back once the on() function returns. Turn this off
+        //to hand it back yourself with grant() once the work is really done
+        bool auto_grant = true;
+
+        //our own emits held while the peer has us out of credit. Past this, emit
+        //throws NO_CREDIT. Applies even when only the peer turned flow control on
+        size_t max_queued = 1024;
+    };
+
+    //both halves of a connection's flow control
+    class FlowCredit
+    {
+    private:
+        //sending half, what we've sent and what the peer allows
+        bool _limited;
+        uint64_t _sent_frames;
+        uint64_t _sent_bytes;
+        uint64_t _limit_frames;
+        uint64_t _limit_bytes;
+
+        //receiving half, what we're done with and what we last allowed
+        uint64_t _done_frames;
+        uint64_t _done_bytes;
+        uint64_t _granted_frames;
+        uint64_t _granted_bytes;
+
+    public:
+        FlowCredit() {reset();}
+
+        //a new connection starts counting from scratch
+        void reset()
+        {
+            _limited = false;
+            _sent_frames = _sent_bytes = _limit_frames = _limit_bytes = 0;
+            _done_frames = _done_bytes = _granted_frames = _granted_bytes = 0;
+        }
+
+        //true once the peer has sent a grant
+        bool limited() const {return _limited;}
+
+        //a frame is let through while any byte credit is left, so one bigger
+        //than the peer's whole window can't get stuck forever
+        bool canSend() const
+        {
+            return !_limited || (_sent_frames < _limit_frames && _sent_bytes < _limit_bytes);
+        }
+
+        void sent(size_t frame_size)
+        {
+            ++_sent_frames;
+            _sent_bytes += frame_size;
+        }
+
+        //more of a message already counted, whose size wasn't known up front
+        void sentMore(size_t bytes) {_sent_bytes += bytes;}
+
+        //false if the grant was malformed
+        bool receiveGrant(const std::string& datastr)
+        {
+            if(datastr.size() < 2 * sizeof(uint64_t) ) return false;
+
+            _limited = true;
+            _limit_frames = unpackInt<uint64_t>(datastr);
+            _limit_bytes = unpackInt<uint64_t>(datastr, sizeof(uint64_t) );
+
+            return true;
+        }
+
+        void done(uint64_t frames, uint64_t bytes)
+        {
+            _done_frames += frames;
+            _done_bytes += bytes;
+        }
+
+        //a new grant goes out once half a window has freed up, rather than for every frame
+        bool grantDue(const FlowOptions& opts) const
+        {
+            return _granted_frames == 0 ||
+                _done_frames + opts.frames >= _granted_frames + opts.frames / 2 + 1 ||
+                _done_bytes + opts.bytes >= _granted_bytes + opts.bytes / 2 + 1;
+        }
+
+        std::string takeGrant(const FlowOptions& opts)
+        {
+            _granted_frames = _done_frames + opts.frames;
+            _granted_bytes = _done_bytes + opts.bytes;
+
+            return encodeFrame(flow_grant, packInt<uint64_t>(_granted_frames) + packInt<uint64_t>(_granted_bytes) );
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__Flow__) */
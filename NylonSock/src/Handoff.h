@@ -0,0 +1,174 @@
+//
+//  Handoff.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Handoff__
+#define __NylonSock__Handoff__
+
+#include "Local.h"
+#include "Socket.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#ifdef UNIX_HEADER
+#include <unistd.h>
+#endif
+
+/*
+ How handoff works:
+
+ A Server can start on a listener it didn't make. inheritSystemd() takes one
+ that systemd's socket activation, or anything else following its LISTEN_FDS
+ convention, passed down. takeOver() gets one from the Server running before
+ this process, and with it that Server's connections.
+
+ The running Server calls setHandoff with a unix domain address to wait on.
+ Its successor starts, calls takeOver with that address, and the old loop
+ answers with its listener and goes on without one. Connections that come in
+ meanwhile wait in the listener's queue, which moves over whole, so nobody
+ is refused during a deploy. With connections on, the old loop also hands
+ over every tcp connection it holds nothing of, no half read or unsent
+ frame, so those clients carry on without reconnecting. To the old Server
+ they disconnect, and the new one sees them connect, so onConnect sets them
+ up like any other. The rest stay with the old Server until they leave,
+ and reconnect to the new one. Over the unix socket each record is one byte,
+ with the descriptors it passes along:
+
+ listener:    'L', the listening socket
+ connections: 'C', up to max_passed_fds connected sockets
+ end:         'E', nothing else follows
+
+ Only the bytes on the wire move, so anything a connection negotiated when it
+ was made doesn't. A Server with setReliable, setSharedMemory or setMulticast,
+ or one waiting on an io_uring, whose recv may have read ahead, hands over
+ only its listener.
+ */
+
+namespace NylonSock
+{
+    //settings for Server::setHandoff
+    struct HandoffOptions
+    {
+        //hands over established connections along with the listener
+        bool connections = false;
+    };
+
+    //sockets a Server starts on instead of listening itself
+    struct InheritedSockets
+    {
+        //the listening socket
+        FileDescriptors listener;
+        //established tcp connections, taken on as if just accepted
+        FileDescriptors connections;
+    };
+
+    namespace HandoffRecord
+    {
+        constexpr char listener = 'L';
+        constexpr char connections = 'C';
+        constexpr char end = 'E';
+    }
+
+    //true if fd is a socket that is listening
+    inline bool isListening(int fd)
+    {
+#if defined(UNIX_HEADER) && defined(SO_ACCEPTCONN)
+        int value = 0;
+        socklen_t size = sizeof(value);
+        return ::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &value, &size) == 0 && value != 0;
+#else
+        return false;
+#endif
+    }
+
+    //the index'th listener passed down by systemd socket activation. Throws if there isn't one
+    inline InheritedSockets inheritSystemd(size_t index = 0)
+    {
+#ifdef UNIX_HEADER
+        //sd_listen_fds(3)'s convention, so the descriptors aren't mistaken for a parent's
+        constexpr int first_fd = 3;
+        const char* pid = std::getenv("LISTEN_PID");
+        const char* count = std::getenv("LISTEN_FDS");
+        if(pid == nullptr || count == nullptr || std::strtol(pid, nullptr, 10) != ::getpid() )
+        {
+            throw Error("No sockets were passed down to this process", true);
+        }
+        if(index >= std::strtoul(count, nullptr, 10) ) throw Error("Fewer sockets were passed down than asked for", true);
+
+        int fd = first_fd + static_cast<int>(index);
+        if(!isListening(fd) ) throw Error("The socket passed down isn't listening", true);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        InheritedSockets inherited;
+        inherited.listener.push(fd);
+        return inherited;
+#else
+        throw Error("Socket activation needs unix", true);
+#endif
+    }
+
+    //connects to the Server that setHandoff on address, like "unix:/run/game-handoff.sock", and
+    //takes its listener and whatever connections it passes. Throws if none is there
+    inline InheritedSockets takeOver(const std::string& address)
+    {
+        if(!isUnixAddress(address) ) throw Error("A handoff goes over a unix domain socket", true);
+
+        Socket sock{unixPath(address), true};
+        InheritedSockets inherited;
+        while(true)
+        {
+            //one byte at a time, so each record's descriptors come with it
+            char record;
+            FileDescriptors fds;
+            recvfds(sock, &record, 1, fds);
+
+            if(record == HandoffRecord::end) break;
+            if(record == HandoffRecord::listener && inherited.listener.size() == 0 && fds.size() == 1)
+            {
+                inherited.listener = std::move(fds);
+            }
+            else if(record == HandoffRecord::connections)
+            {
+                for(auto fd : fds.release() ) inherited.connections.push(fd);
+            }
+            else throw Error("The handoff made no sense", true);
+        }
+
+        if(inherited.listener.size() == 0 || !isListening(inherited.listener.get().front() ) )
+        {
+            throw Error("The handoff had no listener", true);
+        }
+        return inherited;
+    }
+
+    namespace Handoff
+    {
+        //sends one record on a blocking socket
+        inline void send(const Socket& sock, char record, const std::vector<int>& fds)
+        {
+            if(trysendfds(sock, &record, 1, fds) != 1) throw Error("Failed to hand off", true);
+        }
+
+        inline void sendListener(const Socket& sock, int listener)
+        {
+            send(sock, HandoffRecord::listener, {listener});
+        }
+
+        //connections, then the end. Throws if the successor went away
+        inline void sendRest(const Socket& sock, const std::vector<int>& connections)
+        {
+            for(size_t i = 0; i < connections.size(); i += max_passed_fds)
+            {
+                auto last = connections.begin() + std::min(connections.size(), i + max_passed_fds);
+                send(sock, HandoffRecord::connections, std::vector<int>(connections.begin() + i, last) );
+            }
+            send(sock, HandoffRecord::end, {});
+        }
+    }
+}
+
+#endif /* defined(__NylonSock__Handoff__) */
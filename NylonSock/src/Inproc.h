@@ -0,0 +1,120 @@
+//
+//  Inproc.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Inproc__
+#define __NylonSock__Inproc__
+
+#include "SharedMemory.h"
+#include "Socket.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ How in-process connections work:
+
+ An address of inproc:name gives a Server or Client a connection that never
+ leaves the process. The Server registers name when it is made, and a Client
+ made with the same address asks it for a connection directly, with nothing
+ to resolve, bind or accept.
+
+ Each connection is a pair of rings, one each way, like the ones shared
+ memory switches to, only set up from the start. Frames are copied into a
+ ring and out again with no system call in between, so what is left to
+ measure is framing, dispatch and allocation. A pair of unix domain sockets
+ comes with it, which carries nothing, but tells each side when the other
+ goes away, the same as on any other connection.
+
+ Only on linux, and not for passing file descriptors.
+ */
+
+namespace NylonSock
+{
+    const std::string inproc_scheme = "inproc:";
+
+    inline bool isInprocAddress(const std::string& address)
+    {
+        return address.compare(0, inproc_scheme.size(), inproc_scheme) == 0;
+    }
+
+    inline std::string inprocName(const std::string& address) {return address.substr(inproc_scheme.size() );}
+
+    //one end of an in-process connection
+    struct InprocEnd
+    {
+        //only there to notice the other end going away
+        std::unique_ptr<Socket> sock;
+        std::unique_ptr<SharedRing> ring;
+    };
+
+    //the servers of this process, by name
+    class InprocListeners
+    {
+    public:
+        //makes a connection, queues one end for the server and hands back the other
+        using Acceptor = std::function<InprocEnd ()>;
+
+    private:
+        static std::mutex& mtx()
+        {
+            static std::mutex result;
+            return result;
+        }
+
+        static std::unordered_map<std::string, Acceptor>& table()
+        {
+            static std::unordered_map<std::string, Acceptor> result;
+            return result;
+        }
+
+    public:
+        static void listen(const std::string& name, Acceptor acceptor)
+        {
+            std::lock_guard<std::mutex> lock{mtx()};
+            if(!table().emplace(name, std::move(acceptor) ).second)
+            {
+                throw Error("Something already listens on " + inproc_scheme + name, true);
+            }
+        }
+
+        //once this returns, the acceptor isn't running and won't be called again
+        static void close(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock{mtx()};
+            table().erase(name);
+        }
+
+        //the connecting side's end
+        static InprocEnd connect(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock{mtx()};
+            auto found = table().find(name);
+            if(found == table().end() ) throw Error("Nothing listens on " + inproc_scheme + name, true);
+
+            return found->second();
+        }
+
+        //a connection with rings of ring_size each way, the accepting end first
+        static std::pair<InprocEnd, InprocEnd> pair(size_t ring_size)
+        {
+            auto socks = socketpair();
+
+            InprocEnd connecting;
+            connecting.sock = std::make_unique<Socket>(std::move(socks.first) );
+            connecting.ring = std::make_unique<SharedRing>(ring_size);
+
+            InprocEnd accepting;
+            accepting.sock = std::make_unique<Socket>(std::move(socks.second) );
+            accepting.ring = std::make_unique<SharedRing>(FileDescriptors::duplicate(connecting.ring->fds() ), connecting.ring->size() );
+
+            return {std::move(accepting), std::move(connecting)};
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__Inproc__) */
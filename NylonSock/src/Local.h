@@ -0,0 +1,60 @@
+//
+//  Local.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Local__
+#define __NylonSock__Local__
+
+#include "Socket.h"
+#include "Wire.h"
+
+#include <string>
+
+#ifdef UNIX_HEADER
+#include <unistd.h>
+#endif
+
+/*
+ How peers on the same host talk:
+
+ An address of unix:/path, or unix:@name for linux's abstract namespace,
+ gives a Server or Client a unix domain socket instead of tcp. Everything
+ else works the same.
+
+ Over a unix domain socket an emit may pass file descriptors along, so a big
+ blob can be handed over in a memfd or a file instead of being copied through
+ the socket. The message goes out as a single frame
+
+ fd: uint8_t number of file descriptors, frame of the message
+
+ with the descriptors attached to its first byte. They arrive no later than
+ that byte, so the receiver queues them as they come and hands each fd frame
+ the next ones in line.
+ */
+
+namespace NylonSock
+{
+    const std::string unix_scheme = "unix:";
+    const std::string fd_event = std::string{reserved_event_prefix} + "fd";
+
+    //descriptors the peer may send ahead of the frames they belong to, past which it is dropped
+    constexpr size_t max_queued_fds = 1024;
+
+    inline bool isUnixAddress(const std::string& address)
+    {
+        return address.compare(0, unix_scheme.size(), unix_scheme) == 0;
+    }
+
+    inline std::string unixPath(const std::string& address) {return address.substr(unix_scheme.size() );}
+
+    //takes away the socket file a unix domain server leaves behind
+    inline void removeUnixPath(const std::string& path)
+    {
+#ifdef UNIX_HEADER
+        if(!path.empty() && path[0] != '@') ::unlink(path.c_str() );
+#endif
+    }
+}
+
+#endif /* defined(__NylonSock__Local__) */
@@ -0,0 +1,526 @@
+//
+//  Multicast.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Multicast__
+#define __NylonSock__Multicast__
+
+#include "Socket.h"
+#include "Wire.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef UNIX_HEADER
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+/*
+ How multicast broadcasts work:
+
+ A Server with multicast on sends each Server::emit that fits in a datagram
+ once, to an ipv4 group, instead of once per client. Clients with it on keep
+ their tcp connection for everything else, and for whatever the group loses.
+
+ join:   empty, client to server, asking where the group is
+ info:   uint32_t session, uint16_t port, uint32_t max datagram size, group address
+ ready:  empty, client to server once the first datagram from the group arrived
+ start:  uint64_t first sequence number the client gets from the group
+ data:   uint32_t session, uint64_t sequence number, frame of the message
+ nack:   uint64_t first, uint64_t last sequence number missing
+ resend: uint64_t sequence number, frame of the message
+ gone:   uint64_t oldest sequence number still kept
+
+ data is the only one that goes to the group, the rest go over tcp. A data
+ without a frame is a heartbeat, sent when the group has been quiet, saying
+ what the newest number is.
+
+ A client doesn't count as a member until the group has been heard from, so
+ a network that drops multicast leaves it on tcp. From start on, the server
+ leaves it out when it broadcasts. start rides behind the broadcasts the
+ server already queued for it, so the two kinds stay in order.
+
+ The client hands messages over in order. One that arrives early is held
+ until those before it come, and if they don't within nack_delay they are
+ asked for over tcp. Messages the server no longer keeps are skipped. A
+ client that hears nothing from the group for a while asks for everything
+ newer than what it has every nack_retry, so broadcasts still arrive if the
+ group stops working.
+ */
+
+namespace NylonSock
+{
+    const std::string group_join = std::string{reserved_event_prefix} + "gj";
+    const std::string group_info = std::string{reserved_event_prefix} + "gi";
+    const std::string group_ready = std::string{reserved_event_prefix} + "gk";
+    const std::string group_start = std::string{reserved_event_prefix} + "gs";
+    const std::string group_data = std::string{reserved_event_prefix} + "gd";
+    const std::string group_nack = std::string{reserved_event_prefix} + "gn";
+    const std::string group_resend = std::string{reserved_event_prefix} + "gr";
+    const std::string group_gone = std::string{reserved_event_prefix} + "gg";
+
+    //settings for Server::setMulticast and Client::setMulticast
+    struct MulticastOptions
+    {
+        //server only: the ipv4 group broadcasts go to
+        std::string group = "239.255.42.99";
+
+        //server only: the group's udp port, 0 for the same number as the server's tcp port
+        unsigned short port = 0;
+
+        //address of the interface to send or join on, empty to let the system pick
+        //127.0.0.1 keeps everything on this host
+        std::string local_address;
+
+        //server only: routers a datagram may cross, 1 keeps it on the lan
+        unsigned char ttl = 1;
+
+        //server only: broadcasts whose datagram would be bigger go over tcp as before
+        //staying under the mtu keeps datagrams from being fragmented
+        size_t max_size = 1400;
+
+        //server only: broadcasts kept for clients that missed them
+        size_t history = 4096;
+
+        //server only: ms the group may be quiet before a heartbeat goes out
+        unsigned int heartbeat = 100;
+
+        //client only: ms a missing message has to turn up before it is asked for
+        unsigned int nack_delay = 10;
+
+        //client only: ms before asking again, and how often a client asks while the group is silent
+        unsigned int nack_retry = 100;
+
+        //client only: ms without hearing from the group before asking over tcp instead
+        unsigned int silence = 1000;
+
+        //client only: messages held while waiting for one that is missing. Past this, the
+        //missing ones are given up on
+        size_t max_reorder = 4096;
+    };
+
+    inline in_addr multicastAddress(const std::string& address)
+    {
+        in_addr result = {};
+        if(address.empty() ) return result;
+
+        if(::inet_pton(AF_INET, address.c_str(), &result) != 1)
+        {
+            throw Error("The multicast address " + address + " isn't an ipv4 address", true);
+        }
+
+        return result;
+    }
+
+    //the server's end, shared by every connection
+    class MulticastSender
+    {
+    private:
+        Socket _sock;
+        MulticastOptions _opts;
+        uint32_t _session;
+
+        //guards the sequence numbers and history, and which connections are members
+        std::mutex _mtx;
+        uint64_t _next_seq;
+        //frames of the newest broadcasts, the last one numbered _next_seq - 1
+        std::deque<std::shared_ptr<const std::string> > _history;
+        std::chrono::steady_clock::time_point _last_send;
+        std::string _info;
+
+        static Socket createSender(const MulticastOptions& opts, unsigned short port)
+        {
+            addrinfo hints = {0};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            hints.ai_flags = AI_NUMERICHOST;
+
+            Socket sock{opts.group, std::to_string(port), &hints};
+
+            int ttl = opts.ttl;
+            setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl) );
+
+            //clients on this host hear the group too
+            int loop = 1;
+            setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop) );
+
+            if(!opts.local_address.empty() )
+            {
+                in_addr local = multicastAddress(opts.local_address);
+                setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local) );
+            }
+
+            //connected after picking the interface, as connecting picks the route
+            connect(sock);
+            fcntl(sock, O_NONBLOCK);
+
+            return sock;
+        }
+
+        //caller holds _mtx
+        //a datagram the socket won't take is lost like any other, the clients ask for it
+        void send(const std::string& datagram)
+        {
+            Datagram gram = {};
+            gram.addr_size = 0;
+            gram.data = const_cast<char*>(datagram.data() );
+            gram.size = datagram.size();
+            trysendmany(_sock, &gram, 1);
+
+            _last_send = std::chrono::steady_clock::now();
+        }
+
+        //caller holds _mtx
+        std::string wrap(uint64_t seq, const std::string& frame) const
+        {
+            return encodeFrame(group_data, packInt<uint32_t>(_session) + packInt<uint64_t>(seq) + frame);
+        }
+
+    public:
+        //port is the server's tcp port, for when opts doesn't pick one
+        MulticastSender(const MulticastOptions& opts, unsigned short port) :
+            _sock(createSender(opts, opts.port != 0 ? opts.port : port) ), _opts(opts), _session(std::random_device{}() ),
+            _next_seq(1), _last_send(std::chrono::steady_clock::now() )
+        {
+            _opts.max_size = std::min<size_t>(_opts.max_size, max_datagram_size);
+            _opts.history = std::max<size_t>(_opts.history, 1);
+
+            unsigned short group_port = opts.port != 0 ? opts.port : port;
+            _info = packInt<uint32_t>(_session) + packInt<uint16_t>(group_port) +
+                packInt<uint32_t>(static_cast<uint32_t>(_opts.max_size) ) + opts.group;
+        }
+
+        MulticastSender(const MulticastSender& that) = delete;
+        MulticastSender& operator=(const MulticastSender& that) = delete;
+
+        //held across publishing a broadcast and deciding who still needs it over tcp
+        std::unique_lock<std::mutex> lock() {return std::unique_lock<std::mutex>{_mtx};}
+
+        //what a joining client is told
+        const std::string& info() const {return _info;}
+
+        //true if frame fits in a datagram
+        bool fits(const std::string& frame) const
+        {
+            constexpr size_t header_size = frame_header_size + sizeof(uint32_t) + sizeof(uint64_t);
+            return frame.size() + header_size + group_data.size() <= _opts.max_size;
+        }
+
+        //caller holds lock()
+        //the number the next broadcast gets
+        uint64_t nextSeq() const {return _next_seq;}
+
+        //caller holds lock()
+        void publish(const std::shared_ptr<const std::string>& frame)
+        {
+            _history.push_back(frame);
+            if(_history.size() > _opts.history) _history.pop_front();
+
+            send(wrap(_next_seq++, *frame) );
+        }
+
+        //tells the group the newest number, if it has been quiet for a heartbeat
+        void beat()
+        {
+            std::lock_guard<std::mutex> lock{_mtx};
+            if(std::chrono::steady_clock::now() - _last_send < std::chrono::milliseconds(_opts.heartbeat) ) return;
+
+            send(wrap(_next_seq - 1, "") );
+        }
+
+        //ms until the next heartbeat is due
+        int beatWait()
+        {
+            using namespace std::chrono;
+            std::lock_guard<std::mutex> lock{_mtx};
+            auto due = _last_send + milliseconds(_opts.heartbeat);
+            auto now = steady_clock::now();
+
+            return due <= now ? 0 : static_cast<int>(duration_cast<milliseconds>(due - now).count() ) + 1;
+        }
+
+        //the frames to answer a nack with, gone first if some are no longer kept
+        std::vector<std::string> resend(uint64_t first, uint64_t last)
+        {
+            std::lock_guard<std::mutex> lock{_mtx};
+            std::vector<std::string> frames;
+
+            uint64_t oldest = _next_seq - _history.size();
+            if(first < oldest)
+            {
+                frames.push_back(encodeFrame(group_gone, packInt<uint64_t>(oldest) ) );
+                first = oldest;
+            }
+
+            last = std::min(last, _next_seq - 1);
+            for(uint64_t seq = first; seq <= last && seq >= first; ++seq)
+            {
+                frames.push_back(encodeFrame(group_resend, packInt<uint64_t>(seq) + *_history[seq - oldest]) );
+            }
+
+            return frames;
+        }
+    };
+
+    //a client's end, turning datagrams and resends back into the broadcasts in order
+    //only touched by the loop thread
+    class MulticastReceiver
+    {
+    private:
+        //asked for, the system may cap it lower
+        static constexpr size_t receive_buffer = 4 << 20;
+
+        Socket _sock;
+        MulticastOptions _opts;
+        uint32_t _session;
+        size_t _max_size;
+
+        //told the server the group works, and where the server said to start
+        bool _heard;
+        bool _started;
+        uint64_t _expected;
+        //the newest number known to exist
+        uint64_t _latest;
+        //messages that came ahead of _expected
+        std::map<uint64_t, std::string> _held;
+
+        std::chrono::steady_clock::time_point _last_heard;
+        //time_point::max() while nothing is missing
+        std::chrono::steady_clock::time_point _nack_due;
+        //when a silent group may be asked about again
+        std::chrono::steady_clock::time_point _silence_due;
+
+        std::vector<char> _buffer;
+        std::vector<Datagram> _grams;
+
+        static Socket createReceiver(const std::string& group, unsigned short port, const std::string& local_address)
+        {
+            addrinfo hints = {0};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            hints.ai_flags = AI_NUMERICHOST;
+
+#ifdef PLAT_WIN
+            //windows only binds local addresses
+            hints.ai_flags |= AI_PASSIVE;
+            Socket sock{nullptr, std::to_string(port).c_str(), &hints};
+#else
+            //bound to the group, so nothing else sent to the port comes in
+            Socket sock{group, std::to_string(port), &hints};
+#endif
+
+            //every client on the host binds the same port
+            constexpr int y = 1;
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(y) );
+            bind(sock);
+
+            //bursts arrive faster than the loop drains them, and what doesn't fit is lost
+            int buffer_size = static_cast<int>(receive_buffer);
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size) );
+
+            ip_mreq request = {};
+            request.imr_multiaddr = multicastAddress(group);
+            request.imr_interface = multicastAddress(local_address);
+            setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request) );
+
+            fcntl(sock, O_NONBLOCK);
+
+            return sock;
+        }
+
+        static unsigned short infoPort(const std::string& info)
+        {
+            constexpr size_t info_size = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t);
+            if(info.size() <= info_size) throw Error("Malformed multicast group info", true);
+
+            return unpackInt<uint16_t>(info, sizeof(uint32_t) );
+        }
+
+        //moves held messages that are next in line to frames
+        void drain(std::vector<std::string>& frames)
+        {
+            uint64_t expected = _expected;
+            while(!_held.empty() && _held.begin()->first < _expected) _held.erase(_held.begin() );
+            while(!_held.empty() && _held.begin()->first == _expected)
+            {
+                frames.push_back(std::move(_held.begin()->second) );
+                _held.erase(_held.begin() );
+                ++_expected;
+            }
+
+            //past what we hold, skip what is missing rather than wait forever
+            if(_held.size() > _opts.max_reorder)
+            {
+                _expected = _held.begin()->first;
+                drain(frames);
+                return;
+            }
+
+            //what is still missing past a gap that just filled gets its own nack_delay
+            if(_latest < _expected) _nack_due = std::chrono::steady_clock::time_point::max();
+            else if(_nack_due == std::chrono::steady_clock::time_point::max() || _expected != expected)
+            {
+                _nack_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(_opts.nack_delay);
+            }
+        }
+
+        void add(uint64_t seq, std::string frame, std::vector<std::string>& frames)
+        {
+            _latest = std::max(_latest, seq);
+            if(_started && seq < _expected) return;
+
+            _held.emplace(seq, std::move(frame) );
+            if(_started) drain(frames);
+            else if(_held.size() > _opts.max_reorder) _held.erase(_held.begin() );
+        }
+
+    public:
+        //joins the group the server's info names
+        MulticastReceiver(const MulticastOptions& opts, const std::string& info) :
+            _sock(createReceiver(info.substr(2 * sizeof(uint32_t) + sizeof(uint16_t) ), infoPort(info), opts.local_address) ),
+            _opts(opts), _session(unpackInt<uint32_t>(info) ),
+            _max_size(std::min<size_t>(unpackInt<uint32_t>(info, sizeof(uint32_t) + sizeof(uint16_t) ), max_datagram_size) ),
+            _heard(false), _started(false), _expected(0), _latest(0),
+            _last_heard(std::chrono::steady_clock::now() ), _nack_due(std::chrono::steady_clock::time_point::max() ),
+            _silence_due(std::chrono::steady_clock::now() )
+        {
+            constexpr size_t batch = 16;
+            _buffer.resize(batch * (_max_size + 1) );
+            _grams.resize(batch);
+        }
+
+        MulticastReceiver(const MulticastReceiver& that) = delete;
+        MulticastReceiver& operator=(const MulticastReceiver& that) = delete;
+
+        SOCKET port() const {return _sock.port();}
+
+        //reads what the group sent, adding messages now in line to frames
+        //returns true the first time the group is heard from, when the server should be told
+        bool receive(std::vector<std::string>& frames)
+        {
+            bool first = false;
+            while(true)
+            {
+                for(size_t i = 0; i < _grams.size(); ++i)
+                {
+                    _grams[i].data = &_buffer[i * (_max_size + 1)];
+                    _grams[i].size = _max_size + 1;
+                }
+
+                size_t count = recvmany(_sock, _grams.data(), _grams.size() );
+                for(size_t i = 0; i < count; ++i)
+                {
+                    if(_grams[i].size > _max_size) continue;
+
+                    std::string gram(_grams[i].data, _grams[i].size);
+                    std::string event_name;
+                    std::string data;
+                    size_t pos = 0;
+                    constexpr size_t header_size = sizeof(uint32_t) + sizeof(uint64_t);
+                    if(!decodeFrame(gram, pos, event_name, data) || event_name != group_data || data.size() < header_size ||
+                        unpackInt<uint32_t>(data) != _session)
+                    {
+                        continue;
+                    }
+
+                    _last_heard = std::chrono::steady_clock::now();
+                    first = first || !_heard;
+                    _heard = true;
+
+                    uint64_t seq = unpackInt<uint64_t>(data, sizeof(uint32_t) );
+                    if(data.size() == header_size) _latest = std::max(_latest, seq);
+                    else add(seq, data.substr(header_size), frames);
+                }
+
+                if(count < _grams.size() ) break;
+            }
+
+            if(_started) drain(frames);
+
+            return first;
+        }
+
+        //the server counts us as a member from first on
+        void start(uint64_t first, std::vector<std::string>& frames)
+        {
+            _started = true;
+            _expected = first;
+            drain(frames);
+        }
+
+        void resent(uint64_t seq, std::string frame, std::vector<std::string>& frames)
+        {
+            add(seq, std::move(frame), frames);
+        }
+
+        //the server no longer keeps anything older than oldest
+        void gone(uint64_t oldest, std::vector<std::string>& frames)
+        {
+            if(!_started || oldest <= _expected) return;
+
+            _expected = oldest;
+            drain(frames);
+        }
+
+        //the first and last number of each run of missing messages, when a nack is due
+        std::vector<std::pair<uint64_t, uint64_t> > nackDue()
+        {
+            std::vector<std::pair<uint64_t, uint64_t> > missing;
+            if(!_started) return missing;
+
+            auto now = std::chrono::steady_clock::now();
+            auto retry = std::chrono::milliseconds(_opts.nack_retry);
+
+            //a silent group may have sent anything, so ask for whatever there is
+            if(now - _last_heard >= std::chrono::milliseconds(_opts.silence) )
+            {
+                if(now < _silence_due) return missing;
+
+                _silence_due = now + retry;
+                missing.emplace_back(_expected, std::numeric_limits<uint64_t>::max() );
+                return missing;
+            }
+
+            if(now < _nack_due) return missing;
+
+            _nack_due = now + retry;
+
+            //every gap between what is held at once, so a burst of losses costs one round trip
+            uint64_t first = _expected;
+            for(auto& it : _held)
+            {
+                if(it.first > first) missing.emplace_back(first, it.first - 1);
+                first = it.first + 1;
+            }
+            if(first <= _latest) missing.emplace_back(first, _latest);
+
+            return missing;
+        }
+
+        //ms until nackDue may say yes, -1 before the server says where to start
+        int nackWait()
+        {
+            using namespace std::chrono;
+            if(!_started) return -1;
+
+            auto now = steady_clock::now();
+            auto due = std::min(_nack_due, std::max(_last_heard + milliseconds(_opts.silence), _silence_due) );
+
+            return due <= now ? 0 : static_cast<int>(duration_cast<milliseconds>(due - now).count() ) + 1;
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__Multicast__) */
@@ -0,0 +1,465 @@
+//
+//  Outbox.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Outbox__
+#define __NylonSock__Outbox__
+
+#include "Socket.h"
+#include "Wire.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ How big messages are sent:
+
+ A message whose frame would be bigger than chunk_size goes out as a run of
+ chunk frames, so it takes turns on the socket with everything else instead
+ of holding it up. Joined back together, the chunk payloads hold
+
+ uint16_t of event name size in bytes
+ event name
+ data (the rest)
+
+ chunk: uint64_t message id, uint8_t flags, payload
+
+ Chunks of one message arrive in order, but a big message may be overtaken by
+ smaller ones emitted after it.
+ */
+
+namespace NylonSock
+{
+    struct FileSource;
+
+    const std::string chunk_event = std::string{reserved_event_prefix} + "ch";
+
+    //frames bigger than this are cut up
+    constexpr size_t chunk_size = 16384;
+
+    //big messages sent side by side in each lane, the rest wait their turn
+    constexpr size_t max_interleaved = 4;
+
+    //largest message laid out as above
+    constexpr size_t maximum_message_layout = sizeof(sock_size_type) + maximum_sock_val + maximum_message_size;
+
+    constexpr uint8_t chunk_first = 1;
+    constexpr uint8_t chunk_last = 2;
+
+    //which lane an emit waits in. Only changes the order things leave in, the peer can't tell
+    enum class Priority : uint8_t
+    {
+        HIGH, NORMAL, LOW
+    };
+
+    constexpr size_t priority_count = 3;
+
+    //a lane with something waiting gets a turn once this many frames or chunks
+    //from other lanes have gone ahead of it
+    constexpr size_t starvation_limit = 16;
+
+    //settings for a single emit
+    struct EmitOptions
+    {
+        Priority priority;
+
+        //ms the message may wait to go out before it is dropped, 0 to wait forever
+        //a big message that has started going out is always finished
+        unsigned int ttl;
+
+        //a message still waiting is replaced by a newer one with the same key and priority,
+        //so a slow peer only gets the latest. Empty for none
+        std::string key;
+
+        //file descriptors passed along over a unix domain socket, see Local.h
+        //copies are sent, so these stay the caller's to close
+        std::vector<int> fds;
+
+        EmitOptions(Priority priority = Priority::NORMAL, unsigned int ttl = 0, const std::string& key = "") :
+            priority(priority), ttl(ttl), key(key) {}
+    };
+
+    //cap on partly received big messages, which covers max_interleaved of the largest in every lane
+    constexpr size_t max_reassembly = priority_count * max_interleaved * (maximum_message_size + maximum_sock_val);
+
+    //a message waiting in an Outbox
+    struct Outgoing
+    {
+        //a whole frame, or the message to cut into chunks. Shared, so a broadcast
+        //is only encoded once no matter how many queues it sits in
+        std::shared_ptr<const std::string> bytes;
+        bool chunked;
+
+        //what the peer's flow control charges for it
+        size_t cost;
+
+        Priority priority;
+
+        //dropped if still waiting by then, default constructed for never
+        std::chrono::steady_clock::time_point deadline;
+
+        std::string key;
+
+        //how much of a chunked message has been sent, and under what id
+        size_t offset;
+        uint64_t id;
+
+        //the same message compressed, see Compress.h, and shared just like bytes
+        //nullptr until tried, and empty if it didn't come out any smaller
+        std::shared_ptr<const std::string> packed;
+        bool packed_chunked;
+
+        //descriptors that go with the first byte, nullptr for none
+        std::shared_ptr<const FileDescriptors> fds;
+
+        //for emitFile, where the data comes from. bytes then only holds what goes in front
+        //of it, see Files.h. nullptr for an ordinary message
+        std::shared_ptr<const FileSource> file;
+    };
+
+    //event_name has to fit in a frame header, and data in maximum_message_size
+    inline Outgoing makeOutgoing(const std::string& event_name, const std::string& data, const EmitOptions& opts = {})
+    {
+        Outgoing out;
+        out.cost = frame_header_size + event_name.size() + data.size();
+        out.priority = opts.priority;
+        if(opts.ttl > 0) out.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(opts.ttl);
+        out.key = opts.key;
+        out.chunked = !fitsFrame(event_name, data.size() ) || out.cost > chunk_size;
+        out.offset = 0;
+        out.id = 0;
+        out.packed_chunked = false;
+
+        if(!out.chunked)
+        {
+            out.bytes = std::make_shared<const std::string>(encodeFrame(event_name, data) );
+            return out;
+        }
+
+        std::string message;
+        message.reserve(sizeof(sock_size_type) + event_name.size() + data.size() );
+        message += packInt<sock_size_type>(static_cast<sock_size_type>(event_name.size() ) );
+        message += event_name;
+        message += data;
+        out.bytes = std::make_shared<const std::string>(std::move(message) );
+
+        return out;
+    }
+
+    //splits a message laid out as above, false if it is malformed
+    inline bool decodeMessage(const std::string& message, std::string& event_name, std::string& data)
+    {
+        if(message.size() < sizeof(sock_size_type) ) return false;
+        size_t event_size = unpackInt<sock_size_type>(message);
+        if(message.size() < sizeof(sock_size_type) + event_size) return false;
+
+        event_name.assign(message, sizeof(sock_size_type), event_size);
+        data.assign(message, sizeof(sock_size_type) + event_size, std::string::npos);
+
+        return true;
+    }
+
+    //the next chunk frame of a chunked message
+    inline std::string cutChunk(Outgoing& out)
+    {
+        //leaves room for the chunk header and a reliable wrapper
+        constexpr size_t payload_size = chunk_size - 32;
+        size_t size = std::min(payload_size, out.bytes->size() - out.offset);
+
+        uint8_t flags = 0;
+        if(out.offset == 0) flags |= chunk_first;
+        if(out.offset + size == out.bytes->size() ) flags |= chunk_last;
+
+        std::string data;
+        data.reserve(sizeof(uint64_t) + 1 + size);
+        data += packInt<uint64_t>(out.id);
+        data += static_cast<char>(flags);
+        data.append(*out.bytes, out.offset, size);
+        out.offset += size;
+
+        return encodeFrame(chunk_event, data);
+    }
+
+    //puts chunked messages back together on the receiving side
+    class Reassembly
+    {
+    private:
+        std::unordered_map<uint64_t, std::string> _partial;
+        size_t _bytes;
+
+    public:
+        Reassembly() : _bytes(0) {}
+
+        //nothing half arrived
+        bool empty() const {return _partial.empty();}
+
+        //returns true and fills event_name and data once a message is whole
+        //throws when the peer sends more than a message may hold
+        bool add(const std::string& chunk, std::string& event_name, std::string& data)
+        {
+            constexpr size_t header_size = sizeof(uint64_t) + 1;
+            if(chunk.size() < header_size) return false;
+
+            uint64_t id = unpackInt<uint64_t>(chunk);
+            uint8_t flags = static_cast<uint8_t>(chunk[sizeof(uint64_t)]);
+
+            if(flags & chunk_first)
+            {
+                auto old = _partial.find(id);
+                if(old != _partial.end() ) _bytes -= old->second.size();
+                _partial[id].clear();
+            }
+
+            //the start went missing with a dropped connection
+            auto found = _partial.find(id);
+            if(found == _partial.end() ) return false;
+
+            size_t size = chunk.size() - header_size;
+            if(found->second.size() + size > maximum_message_layout ||
+                _bytes + size > max_reassembly)
+            {
+                throw Error("Chunked message is too big", true);
+            }
+            found->second.append(chunk, header_size, size);
+            _bytes += size;
+
+            if(!(flags & chunk_last) ) return false;
+
+            std::string message = std::move(found->second);
+            _partial.erase(found);
+            _bytes -= message.size();
+
+            return decodeMessage(message, event_name, data);
+        }
+
+        void clear()
+        {
+            _partial.clear();
+            _bytes = 0;
+        }
+    };
+
+    //messages waiting for the socket, in a lane per Priority
+    //the highest lane with something waiting goes next, unless a lower one has been
+    //passed over starvation_limit times. Within a lane, small frames and big messages
+    //take turns, so a big one costs the small ones at most a chunk's worth of waiting
+    class Outbox
+    {
+    private:
+        struct Lane
+        {
+            std::deque<Outgoing> small;
+            std::deque<Outgoing> big;
+            //big messages that are part way out
+            std::deque<Outgoing> active;
+
+            //small frame bytes sent since a chunk last got a turn
+            size_t small_sent = 0;
+
+            //turns other lanes took while this one had something waiting
+            size_t passed = 0;
+
+            //keyed messages in small or big, which nothing has been sent of yet
+            std::unordered_map<std::string, Outgoing*> keyed;
+
+            bool ready() const {return !small.empty() || !active.empty();}
+        };
+
+        Lane _lanes[priority_count];
+
+        //what next() picked
+        Lane* _took_lane;
+        bool _took_big;
+
+        //messages dropped for outliving their ttl, or for a newer one with the same key
+        uint64_t _expired;
+        uint64_t _conflated;
+
+        Lane& lane(Priority priority) {return _lanes[static_cast<size_t>(priority)];}
+
+        //call before out leaves small or big
+        static void unindex(Lane& lane, const Outgoing& out)
+        {
+            if(out.key.empty() ) return;
+
+            auto found = lane.keyed.find(out.key);
+            if(found != lane.keyed.end() && found->second == &out) lane.keyed.erase(found);
+        }
+
+        static void promote(Lane& lane)
+        {
+            while(lane.active.size() < max_interleaved && !lane.big.empty() )
+            {
+                unindex(lane, lane.big.front() );
+                lane.active.push_back(std::move(lane.big.front() ) );
+                lane.big.pop_front();
+            }
+        }
+
+    public:
+        Outbox() : _took_lane(nullptr), _took_big(false), _expired(0), _conflated(0) {}
+
+        void push(Outgoing out)
+        {
+            Lane& to = lane(out.priority);
+
+            if(!out.key.empty() )
+            {
+                //takes the older one's place in line
+                auto found = to.keyed.find(out.key);
+                if(found != to.keyed.end() && found->second->chunked == out.chunked)
+                {
+                    *found->second = std::move(out);
+                    ++_conflated;
+                    return;
+                }
+            }
+
+            auto& queue = out.chunked ? to.big : to.small;
+            queue.push_back(std::move(out) );
+            if(!queue.back().key.empty() ) to.keyed[queue.back().key] = &queue.back();
+        }
+
+        //puts messages back ahead of everything in their lanes, keeping their order
+        void pushFront(std::deque<Outgoing>&& items)
+        {
+            for(auto it = items.rbegin(); it != items.rend(); ++it)
+            {
+                Lane& to = lane(it->priority);
+                if(it->offset > 0)
+                {
+                    to.active.push_front(std::move(*it) );
+                    continue;
+                }
+
+                //a newer one with the same key is already waiting
+                if(!it->key.empty() && to.keyed.count(it->key) > 0)
+                {
+                    ++_conflated;
+                    continue;
+                }
+
+                auto& queue = it->chunked ? to.big : to.small;
+                queue.push_front(std::move(*it) );
+                if(!queue.front().key.empty() ) to.keyed[queue.front().key] = &queue.front();
+            }
+        }
+
+        bool empty() const {return size() == 0;}
+
+        size_t size() const
+        {
+            size_t total = 0;
+            for(auto& it : _lanes) total += it.small.size() + it.big.size() + it.active.size();
+
+            return total;
+        }
+
+        //messages waiting in one lane
+        size_t depth(Priority priority) const
+        {
+            auto& it = _lanes[static_cast<size_t>(priority)];
+            return it.small.size() + it.big.size() + it.active.size();
+        }
+
+        //whose turn it is, or nullptr if nothing is waiting. Follow up with taken()
+        //whatever comes up past its deadline is dropped on the way
+        Outgoing* next(std::chrono::steady_clock::time_point now)
+        {
+            while(true)
+            {
+                _took_lane = nullptr;
+                for(auto& it : _lanes)
+                {
+                    promote(it);
+                    if(!it.ready() ) continue;
+                    if(_took_lane == nullptr || it.passed >= starvation_limit) _took_lane = &it;
+                }
+                if(_took_lane == nullptr) return nullptr;
+
+                Lane& from = *_took_lane;
+                _took_big = !from.active.empty() && (from.small.empty() || from.small_sent >= chunk_size);
+
+                auto& queue = _took_big ? from.active : from.small;
+                Outgoing& out = queue.front();
+                if(out.offset > 0 || out.deadline == std::chrono::steady_clock::time_point{} || now < out.deadline)
+                {
+                    return &out;
+                }
+
+                unindex(from, out);
+                queue.pop_front();
+                ++_expired;
+            }
+        }
+
+        uint64_t expired() const {return _expired;}
+
+        uint64_t conflated() const {return _conflated;}
+
+        //moves past what next() returned, after size bytes of it went out
+        void taken(size_t size, bool finished)
+        {
+            for(auto& it : _lanes)
+            {
+                if(&it != _took_lane && it.ready() ) ++it.passed;
+            }
+
+            Lane& from = *_took_lane;
+            from.passed = 0;
+
+            if(!_took_big)
+            {
+                unindex(from, from.small.front() );
+                from.small.pop_front();
+                from.small_sent += size;
+                return;
+            }
+
+            from.small_sent = 0;
+            Outgoing out = std::move(from.active.front() );
+            from.active.pop_front();
+            if(!finished) from.active.push_back(std::move(out) );
+        }
+
+        //big messages already part way out can't be finished on another connection
+        void dropStarted()
+        {
+            for(auto& it : _lanes)
+            {
+                it.active.erase(std::remove_if(it.active.begin(), it.active.end(), [](const Outgoing& out)
+                {
+                    return out.offset > 0;
+                }), it.active.end() );
+            }
+        }
+
+        //everything, oldest first within a lane and the lowest lane first,
+        //so that is what goes if the caller has to drop some
+        std::deque<Outgoing> takeAll()
+        {
+            std::deque<Outgoing> items;
+            for(size_t i = priority_count; i > 0; --i)
+            {
+                Lane& from = _lanes[i - 1];
+                for(auto& it : from.active) items.push_back(std::move(it) );
+                for(auto& it : from.big) items.push_back(std::move(it) );
+                for(auto& it : from.small) items.push_back(std::move(it) );
+                from = Lane{};
+            }
+
+            return items;
+        }
+
+        void clear() {takeAll();}
+    };
+}
+
+#endif /* defined(__NylonSock__Outbox__) */
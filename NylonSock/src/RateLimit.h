@@ -0,0 +1,78 @@
+//
+//  RateLimit.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__RateLimit__
+#define __NylonSock__RateLimit__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+
+namespace NylonSock
+{
+    //settings for Server::setRateLimit
+    struct RateLimitOptions
+    {
+        //frames a connection may send per second, 0 for no limit
+        double frames_per_sec = 0;
+        //frames it may send in one go after being quiet, at least 1
+        double frame_burst = 100;
+
+        //bytes a connection may send per second, 0 for no limit
+        double bytes_per_sec = 0;
+        //bytes it may send in one go after being quiet, at least one frame's worth
+        double byte_burst = 256 * 1024;
+
+        //frames handled for one connection per pass of the server loop before
+        //moving on to the next, so a busy connection can't starve the rest
+        size_t read_budget = 64;
+    };
+
+    class TokenBucket
+    {
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        double _rate;
+        double _burst;
+        double _tokens;
+        Clock::time_point _last;
+
+        void refill(Clock::time_point now)
+        {
+            std::chrono::duration<double> passed = now - _last;
+            _last = now;
+            _tokens = std::min(_burst, _tokens + passed.count() * _rate);
+        }
+
+    public:
+        TokenBucket(double rate, double burst) :
+            _rate(rate), _burst(std::max(burst, 1.0) ), _tokens(_burst), _last(Clock::now() ) {}
+
+        //something bigger than the whole burst goes through once the bucket is full,
+        //and leaves it in debt
+        bool take(double cost, Clock::time_point now = Clock::now() )
+        {
+            refill(now);
+            if(_tokens < std::min(cost, _burst) ) return false;
+
+            _tokens -= cost;
+            return true;
+        }
+
+        //ms until take(cost) will succeed
+        int wait(double cost, Clock::time_point now = Clock::now() )
+        {
+            refill(now);
+            double missing = std::min(cost, _burst) - _tokens;
+            if(missing <= 0) return 0;
+
+            return static_cast<int>(std::ceil(missing * 1000 / _rate) );
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__RateLimit__) */
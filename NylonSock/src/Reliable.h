@@ -0,0 +1,300 @@
+//
+//  Reliable.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Reliable__
+#define __NylonSock__Reliable__
+
+#include "Outbox.h"
+#include "Wire.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ How reliable delivery works:
+
+ The connecting side sends a hello holding the last sequence number it received
+ and its session token (empty the first time). The accepting side answers with a
+ welcome holding whether the session was resumed, the last sequence number it
+ received and the token. Both sides then resend whatever the other hasn't seen.
+
+ hello:   uint64_t received, token
+ welcome: uint8_t resumed, uint64_t received, token
+ data:    uint64_t sequence, frame
+ ack:     uint64_t received (cumulative)
+
+ Frames are numbered as they leave the Outbox, chunks included, so what is
+ still queued can be carried over to the next connection without numbering.
+ */
+
+namespace NylonSock
+{
+    const std::string reliable_hello = std::string{reserved_event_prefix} + "rh";
+    const std::string reliable_welcome = std::string{reserved_event_prefix} + "rw";
+    const std::string reliable_data = std::string{reserved_event_prefix} + "rd";
+    const std::string reliable_ack = std::string{reserved_event_prefix} + "ra";
+
+    //settings for Server::setReliable and Client::setReliable
+    struct ReliableOptions
+    {
+        //frames kept until the peer acks them. Past this the oldest are dropped and
+        //a reconnect that needed them starts a fresh session instead of resuming
+        size_t window = 4096;
+
+        //an ack goes out after this many frames, or sooner once the connection goes idle
+        size_t ack_every = 32;
+
+        //server only: ms a dropped session waits to be resumed
+        unsigned int linger = 30000;
+
+        //server only: cap on dropped sessions waiting to be resumed
+        size_t max_detached = 10000;
+    };
+
+    //one direction's worth of sequencing, plus what we've seen from the other side
+    class ReliableSession
+    {
+    private:
+        std::string _token;
+
+        uint64_t _next_seq;
+        uint64_t _recv_seq;
+        uint64_t _unacked;
+
+        std::deque<std::pair<uint64_t, std::string> > _retransmit;
+
+        //messages not yet numbered, kept while the session waits to be resumed
+        std::deque<Outgoing> _parked;
+
+        //chunked messages from the peer, kept with the session so a resume can finish them
+        Reassembly _reassembly;
+
+    public:
+        enum class Order
+        {
+            NEXT, DUPLICATE, GAP
+        };
+
+        ReliableSession(const std::string& token) :
+            _token(token), _next_seq(1), _recv_seq(0), _unacked(0) {}
+
+        const std::string& token() const {return _token;}
+
+        //the number the next push gets
+        uint64_t nextSeq() const {return _next_seq;}
+
+        uint64_t push(const std::string& frame, size_t window)
+        {
+            //the peer will notice the hole if it ever needs what falls off
+            if(window > 0 && _retransmit.size() >= window) _retransmit.pop_front();
+
+            uint64_t seq = _next_seq++;
+            _retransmit.emplace_back(seq, frame);
+
+            return seq;
+        }
+
+        //the peer has everything up to and including seq
+        void ack(uint64_t seq)
+        {
+            while(!_retransmit.empty() && _retransmit.front().first <= seq)
+            {
+                _retransmit.pop_front();
+            }
+        }
+
+        const std::deque<std::pair<uint64_t, std::string> >& backlog() const {return _retransmit;}
+
+        //hands back the unacked frames so they can be renumbered onto another session
+        std::vector<std::string> drain()
+        {
+            std::vector<std::string> frames;
+            frames.reserve(_retransmit.size() );
+            for(auto& it : _retransmit) frames.push_back(std::move(it.second) );
+            _retransmit.clear();
+
+            return frames;
+        }
+
+        //a gap means the sender had to drop frames we never got
+        Order receive(uint64_t seq)
+        {
+            if(seq <= _recv_seq) return Order::DUPLICATE;
+
+            Order order = seq == _recv_seq + 1 ? Order::NEXT : Order::GAP;
+            _recv_seq = seq;
+            ++_unacked;
+
+            return order;
+        }
+
+        uint64_t received() const {return _recv_seq;}
+
+        //holds messages that never made it out until a connection picks the session up
+        void park(Outgoing out, size_t window)
+        {
+            if(window > 0 && _parked.size() >= window)
+            {
+                //skipping a number lets the peer notice, as it does for the retransmit window
+                _parked.pop_front();
+                ++_next_seq;
+            }
+
+            _parked.push_back(std::move(out) );
+        }
+
+        void park(std::deque<Outgoing>&& items, size_t window)
+        {
+            for(auto& it : items) park(std::move(it), window);
+        }
+
+        std::deque<Outgoing> takeParked()
+        {
+            std::deque<Outgoing> items;
+            items.swap(_parked);
+
+            return items;
+        }
+
+        Reassembly& reassembly() {return _reassembly;}
+
+        bool ackDue(size_t ack_every) const {return _unacked > 0 && _unacked >= ack_every;}
+
+        bool ackPending() const {return _unacked > 0;}
+
+        uint64_t takeAck()
+        {
+            _unacked = 0;
+            return _recv_seq;
+        }
+    };
+
+    //server side sessions, both live ones and ones that lost their connection
+    //holding the table keeps sessions from moving between connections, which
+    //lets a broadcast reach every session exactly once
+    class ReliableSessions
+    {
+    private:
+        using Clock = std::chrono::steady_clock;
+        using EvictFunc = std::function<void()>;
+
+        ReliableOptions _opts;
+
+        //sessions with a connection, and how to take it away from that connection
+        std::unordered_map<std::string, std::pair<std::shared_ptr<ReliableSession>, EvictFunc> > _attached;
+
+        std::unordered_map<std::string, std::pair<Clock::time_point, std::shared_ptr<ReliableSession> > > _detached;
+        std::deque<std::pair<Clock::time_point, std::string> > _order;
+        std::recursive_mutex _mtx;
+
+        //caller holds _mtx
+        void prune()
+        {
+            auto now = Clock::now();
+            auto linger = std::chrono::milliseconds(_opts.linger);
+            while(!_order.empty() &&
+                (_order.front().first + linger <= now || _detached.size() > _opts.max_detached) )
+            {
+                auto found = _detached.find(_order.front().second);
+                //only erase if it wasn't resumed and dropped again since
+                if(found != _detached.end() && found->second.first == _order.front().first)
+                {
+                    _detached.erase(found);
+                }
+                _order.pop_front();
+            }
+        }
+
+    public:
+        ReliableSessions(const ReliableOptions& opts) : _opts(opts) {}
+
+        const ReliableOptions& options() const {return _opts;}
+
+        std::unique_lock<std::recursive_mutex> hold() {return std::unique_lock<std::recursive_mutex>{_mtx};}
+
+        std::shared_ptr<ReliableSession> create()
+        {
+            //tokens are what let a peer resume, so draw them from the os
+            std::random_device rd;
+            std::ostringstream oss;
+            for(int i = 0; i < 4; ++i)
+            {
+                oss << std::hex << std::setw(8) << std::setfill('0') << static_cast<uint32_t>(rd() );
+            }
+
+            return std::make_shared<ReliableSession>(oss.str() );
+        }
+
+        //removes and returns a session, or nullptr if it is unknown or expired
+        //a session still held by a connection is taken from it, as the peer
+        //evidently moved on before the server noticed the old connection die
+        std::shared_ptr<ReliableSession> resume(const std::string& token)
+        {
+            std::lock_guard<std::recursive_mutex> lock{_mtx};
+            prune();
+
+            auto found = _detached.find(token);
+            if(found != _detached.end() )
+            {
+                auto session = found->second.second;
+                _detached.erase(found);
+                return session;
+            }
+
+            auto live = _attached.find(token);
+            if(live == _attached.end() ) return nullptr;
+
+            auto session = live->second.first;
+            auto evict = std::move(live->second.second);
+            _attached.erase(live);
+            if(evict) evict();
+
+            return session;
+        }
+
+        void attach(const std::shared_ptr<ReliableSession>& session, EvictFunc evict)
+        {
+            std::lock_guard<std::recursive_mutex> lock{_mtx};
+            _attached[session->token()] = {session, std::move(evict)};
+        }
+
+        //parks a session whose connection dropped
+        void detach(const std::shared_ptr<ReliableSession>& session)
+        {
+            if(session == nullptr) return;
+
+            std::lock_guard<std::recursive_mutex> lock{_mtx};
+            auto live = _attached.find(session->token() );
+            if(live != _attached.end() && live->second.first == session) _attached.erase(live);
+
+            if(_opts.max_detached == 0) return;
+
+            auto now = Clock::now();
+            _detached[session->token()] = {now, session};
+            _order.emplace_back(now, session->token() );
+            prune();
+        }
+
+        //queues a message on every parked session so a broadcast isn't missed while reconnecting
+        void pushDetached(const Outgoing& out)
+        {
+            std::lock_guard<std::recursive_mutex> lock{_mtx};
+            for(auto& it : _detached) it.second.second->park(out, _opts.window);
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__Reliable__) */
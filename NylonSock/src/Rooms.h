@@ -0,0 +1,129 @@
+//
+//  Rooms.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Rooms__
+#define __NylonSock__Rooms__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace NylonSock
+{
+    //named groups of members, for Server::join and Server::to
+    //members of a room sit in a vector so a fanout walks plain memory, and every
+    //member remembers its slot in each room so join and leave don't have to search
+    template<class Member>
+    class Rooms
+    {
+    private:
+        struct Room
+        {
+            std::string name;
+            std::vector<Member*> members;
+        };
+
+        //unordered_map keeps a Room where it is while others come and go
+        std::unordered_map<std::string, Room> _rooms;
+
+        //for each member, its slot in every room it is in
+        std::unordered_map<const Member*, std::unordered_map<const Room*, size_t> > _joined;
+
+        //swaps the last member into the hole, so nothing else has to move
+        void remove(Room& room, size_t slot)
+        {
+            Member* last = room.members.back();
+            room.members.pop_back();
+            if(slot == room.members.size() ) return;
+
+            room.members[slot] = last;
+            _joined[last][&room] = slot;
+        }
+
+    public:
+        //false if member was already in the room
+        bool join(Member& member, const std::string& name)
+        {
+            Room& room = _rooms[name];
+            if(room.members.empty() ) room.name = name;
+
+            auto& slots = _joined[&member];
+            if(slots.count(&room) > 0) return false;
+
+            slots[&room] = room.members.size();
+            room.members.push_back(&member);
+
+            return true;
+        }
+
+        //false if member wasn't in the room
+        bool leave(const Member& member, const std::string& name)
+        {
+            auto found_room = _rooms.find(name);
+            auto found_member = _joined.find(&member);
+            if(found_room == _rooms.end() || found_member == _joined.end() ) return false;
+
+            Room& room = found_room->second;
+            auto& slots = found_member->second;
+            auto slot = slots.find(&room);
+            if(slot == slots.end() ) return false;
+
+            size_t index = slot->second;
+            slots.erase(slot);
+            if(slots.empty() ) _joined.erase(found_member);
+
+            remove(room, index);
+            if(room.members.empty() ) _rooms.erase(found_room);
+
+            return true;
+        }
+
+        //takes member out of every room, for when it disconnects
+        //returns the rooms that are gone now that it left
+        std::vector<std::string> leaveAll(const Member& member)
+        {
+            std::vector<std::string> emptied;
+            auto found = _joined.find(&member);
+            if(found == _joined.end() ) return emptied;
+
+            //remove() touches _joined, so take the slots out first
+            auto slots = std::move(found->second);
+            _joined.erase(found);
+
+            for(auto& it : slots)
+            {
+                auto room = _rooms.find(it.first->name);
+                remove(room->second, it.second);
+                if(!room->second.members.empty() ) continue;
+
+                emptied.push_back(std::move(room->second.name) );
+                _rooms.erase(room);
+            }
+
+            return emptied;
+        }
+
+        bool inRoom(const Member& member, const std::string& name) const
+        {
+            auto found_room = _rooms.find(name);
+            auto found_member = _joined.find(&member);
+            if(found_room == _rooms.end() || found_member == _joined.end() ) return false;
+
+            return found_member->second.count(&found_room->second) > 0;
+        }
+
+        //everyone in the room, or nullptr if it is empty
+        const std::vector<Member*>* members(const std::string& name) const
+        {
+            auto found = _rooms.find(name);
+            return found == _rooms.end() ? nullptr : &found->second.members;
+        }
+
+        //rooms with anyone in them
+        size_t size() const {return _rooms.size();}
+    };
+}
+
+#endif /* defined(__NylonSock__Rooms__) */
@@ -0,0 +1,321 @@
+//
+//  SharedMemory.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__SharedMemory__
+#define __NylonSock__SharedMemory__
+
+#include "Socket.h"
+#include "Wire.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ How shared memory works:
+
+ Over a unix domain socket, a Client that turned shared memory on makes a
+ memfd holding two rings, one each way, and an eventfd for each side to sleep
+ on, and offers them to the server as passed file descriptors. A server that
+ turned it on too maps them and answers with a switch frame. Everything it
+ writes after that goes through the ring instead of the socket. The client
+ does the same once the server's switch frame arrives. The socket stays open,
+ so either side still notices the other going away.
+
+ offer:  uint64_t ring size, with the memfd and both eventfds attached
+ switch: empty, the last frame on the socket in that direction
+
+ The bytes in a ring are the same frames the socket would carry. Each ring has
+ one writer and one reader, which only share the two positions. A side only
+ writes the other's eventfd when the other has said it is going to sleep, so
+ a busy pair of peers never makes a system call to talk.
+
+ Only on linux, and not with reliable delivery or passing file descriptors.
+ */
+
+namespace NylonSock
+{
+    const std::string shm_offer = std::string{reserved_event_prefix} + "mo";
+    const std::string shm_switch = std::string{reserved_event_prefix} + "ms";
+
+    //settings for Server::setSharedMemory and Client::setSharedMemory
+    struct SharedMemoryOptions
+    {
+        //bytes each way, rounded up to a power of two. Frames bigger than this still
+        //go through, just a piece at a time
+        size_t ring_size = 1 << 20;
+
+        //us the loop keeps looking at the ring before it goes to sleep. Catches the next
+        //frame without waiting on a wakeup, but keeps a core busy while it spins
+        unsigned int spin = 0;
+    };
+
+    //largest ring either side maps, each way
+    constexpr size_t max_ring_size = size_t{1} << 28;
+
+#ifdef __linux__
+    constexpr bool shared_memory_supported = true;
+#else
+    constexpr bool shared_memory_supported = false;
+#endif
+
+    //both directions between a Client and a Server, mapped by each
+    class SharedRing
+    {
+    private:
+        //positions only ever grow, so a full ring and an empty one look different
+        struct Ring
+        {
+            alignas(64) std::atomic<uint64_t> head;
+            alignas(64) std::atomic<uint64_t> tail;
+        };
+
+        //what a side has said it is waiting for
+        struct Side
+        {
+            alignas(64) std::atomic<uint32_t> sleeping;
+            std::atomic<uint32_t> blocked;
+        };
+
+        struct Header
+        {
+            //0 is the connecting side writing, 1 the accepting side
+            Ring rings[2];
+            Side sides[2];
+        };
+
+        static constexpr size_t page_size = 4096;
+        static constexpr size_t data_offset = (sizeof(Header) + page_size - 1) / page_size * page_size;
+
+        //the memfd, then the eventfd each side sleeps on
+        FileDescriptors _fds;
+        char* _map;
+        size_t _map_size;
+        size_t _size;
+
+        Ring* _in;
+        Ring* _out;
+        char* _in_data;
+        char* _out_data;
+        Side* _self;
+        Side* _peer;
+        int _self_port;
+        int _peer_port;
+
+        //our own positions, as the peer could scribble over the shared ones
+        uint64_t _in_head;
+        uint64_t _out_tail;
+
+        Header* header() {return reinterpret_cast<Header*>(_map);}
+
+        void attach(bool connecting)
+        {
+            int self = connecting ? 0 : 1;
+            _out = &header()->rings[self];
+            _in = &header()->rings[1 - self];
+            _out_data = _map + data_offset + self * _size;
+            _in_data = _map + data_offset + (1 - self) * _size;
+            _self = &header()->sides[self];
+            _peer = &header()->sides[1 - self];
+            _self_port = _fds.get()[1 + self];
+            _peer_port = _fds.get()[2 - self];
+
+            _in_head = _in->head.load(std::memory_order_relaxed);
+            _out_tail = _out->tail.load(std::memory_order_relaxed);
+        }
+
+        void map(int fd)
+        {
+#ifdef __linux__
+            void* where = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(where == MAP_FAILED) throw Error("Failed to map shared memory");
+            _map = static_cast<char*>(where);
+#endif
+        }
+
+        //wakes the peer if it is waiting on flag, once
+        void wake(std::atomic<uint32_t>& flag)
+        {
+#ifdef __linux__
+            //pairs with the fence in sleep(), so one of us sees the other
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(flag.load(std::memory_order_relaxed) == 0 || flag.exchange(0) == 0) return;
+
+            //a full counter already means a pending wake
+            uint64_t one = 1;
+            auto ignored = ::write(_peer_port, &one, sizeof(one) );
+            (void)ignored;
+#endif
+        }
+
+        static void check(uint64_t used, size_t size)
+        {
+            if(used > size) throw Error("The peer corrupted the shared memory ring", true);
+        }
+
+    public:
+        static size_t roundSize(size_t size)
+        {
+            size_t rounded = page_size;
+            while(rounded < size && rounded < max_ring_size) rounded <<= 1;
+
+            return rounded;
+        }
+
+        //makes a fresh pair of rings, for the connecting side
+        explicit SharedRing(size_t ring_size) : _map(nullptr), _size(roundSize(ring_size) )
+        {
+            _map_size = data_offset + 2 * _size;
+#ifdef __linux__
+            int memfd = memfd_create("nylonsock", MFD_CLOEXEC);
+            if(memfd < 0) throw Error("Failed to create shared memory");
+            _fds.push(memfd);
+
+            for(int i = 0; i < 2; ++i)
+            {
+                int port = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if(port < 0) throw Error("Failed to create eventfd");
+                _fds.push(port);
+            }
+
+            if(ftruncate(memfd, static_cast<off_t>(_map_size) ) != 0) throw Error("Failed to size shared memory");
+            map(memfd);
+
+            //a fresh memfd is zeroed, which is where every position starts
+            attach(true);
+#else
+            throw Error("Shared memory needs linux", true);
+#endif
+        }
+
+        //maps the rings offered by the connecting side, checking they are what it says
+        SharedRing(FileDescriptors fds, uint64_t ring_size) : _fds(std::move(fds) ), _map(nullptr), _size(0)
+        {
+            if(_fds.size() != 3 || ring_size != roundSize(ring_size) || ring_size > max_ring_size)
+            {
+                throw Error("Malformed shared memory offer", true);
+            }
+
+            _size = static_cast<size_t>(ring_size);
+            _map_size = data_offset + 2 * _size;
+#ifdef __linux__
+            struct stat info;
+            if(fstat(_fds.get()[0], &info) != 0 || static_cast<size_t>(info.st_size) != _map_size)
+            {
+                throw Error("Malformed shared memory offer", true);
+            }
+
+            map(_fds.get()[0]);
+            attach(false);
+#else
+            throw Error("Shared memory needs linux", true);
+#endif
+        }
+
+        ~SharedRing()
+        {
+#ifdef __linux__
+            if(_map != nullptr) munmap(_map, _map_size);
+#endif
+        }
+
+        SharedRing(const SharedRing&) = delete;
+        SharedRing& operator=(const SharedRing&) = delete;
+
+        size_t size() const {return _size;}
+
+        const std::vector<int>& fds() const {return _fds.get();}
+
+        //the eventfd to poll while sleeping
+        int port() const {return _self_port;}
+
+        //bytes the peer has written that we haven't read
+        size_t readable()
+        {
+            uint64_t used = _in->tail.load(std::memory_order_acquire) - _in_head;
+            check(used, _size);
+
+            return static_cast<size_t>(used);
+        }
+
+        //bytes we may write before the peer reads some
+        size_t room()
+        {
+            uint64_t used = _out_tail - _out->head.load(std::memory_order_acquire);
+            check(used, _size);
+
+            return _size - static_cast<size_t>(used);
+        }
+
+        //returns how much was taken, like trysend
+        size_t write(const char* data, size_t size)
+        {
+            size = std::min(size, room() );
+            if(size == 0) return 0;
+
+            size_t at = static_cast<size_t>(_out_tail & (_size - 1) );
+            size_t first = std::min(size, _size - at);
+            std::memcpy(_out_data + at, data, first);
+            std::memcpy(_out_data, data + first, size - first);
+
+            _out_tail += size;
+            _out->tail.store(_out_tail, std::memory_order_release);
+            wake(_peer->sleeping);
+
+            return size;
+        }
+
+        //appends up to max bytes to out, returns how many
+        size_t read(std::string& out, size_t max)
+        {
+            size_t size = std::min(max, readable() );
+            if(size == 0) return 0;
+
+            size_t at = static_cast<size_t>(_in_head & (_size - 1) );
+            size_t first = std::min(size, _size - at);
+            out.append(_in_data + at, first);
+            out.append(_in_data, size - first);
+
+            _in_head += size;
+            _in->head.store(_in_head, std::memory_order_release);
+            wake(_peer->blocked);
+
+            return size;
+        }
+
+        //says we are going to sleep on port(), for input and, if blocked, for room to write
+        //look at the ring again afterwards, as the peer may have just missed it
+        void sleep(bool blocked)
+        {
+            _self->sleeping.store(1, std::memory_order_relaxed);
+            if(blocked) _self->blocked.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        //takes back sleep(), draining port() if poll said it was readable
+        void awake(bool woken)
+        {
+            _self->sleeping.store(0, std::memory_order_relaxed);
+            _self->blocked.store(0, std::memory_order_relaxed);
+
+#ifdef __linux__
+            uint64_t count;
+            if(woken) while(::read(_self_port, &count, sizeof(count) ) > 0) {}
+#endif
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__SharedMemory__) */
@@ -21,13 +21,20 @@ constexpr int NSWOULDBLOCK = WSAEWOULDBLOCK;
 #elif defined(UNIX_HEADER)
 
 #include <arpa/inet.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/errno.h>
 #include <sys/signal.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#endif
+
 //make it easier for crossplatform
 constexpr char INVALID_SOCKET = -1;
 constexpr char SOCKET_ERROR = -1;
@@ -223,6 +230,13 @@ namespace NylonSock
         {
             return _sock;
         }
+
+        SOCKET release()
+        {
+            SOCKET sock = _sock;
+            _sock = INVALID_SOCKET;
+            return sock;
+        }
         
     };
     
@@ -233,6 +247,10 @@ namespace NylonSock
         addrinfo* _orig;
         addrinfo* _info;
         bool _man;
+
+        //what _info points at for a unix domain socket, which getaddrinfo can't make
+        addrinfo _local_info;
+        sockaddr_storage _local_addr;
     public:
         AddrWrapper(const char* node, const char* service, const addrinfo* hints)
         {
@@ -253,6 +271,38 @@ namespace NylonSock
             _orig = _info;
             _man = true;
         }
+
+        AddrWrapper(const std::string& path)
+        {
+#ifdef UNIX_HEADER
+            _local_addr = {};
+            sockaddr_un* addr = reinterpret_cast<sockaddr_un*>(&_local_addr);
+            if(path.empty() || path.size() >= sizeof(addr->sun_path) )
+            {
+                throw Error("The unix socket path " + path + " is empty or too long", true);
+            }
+
+            addr->sun_family = AF_UNIX;
+            std::memcpy(addr->sun_path, path.data(), path.size() );
+            socklen_t size = offsetof(sockaddr_un, sun_path) + path.size();
+
+            //an abstract name starts with a 0 rather than ending with one
+            if(path[0] == '@') addr->sun_path[0] = '\0';
+            else ++size;
+
+            _local_info = {};
+            _local_info.ai_family = AF_UNIX;
+            _local_info.ai_socktype = SOCK_STREAM;
+            _local_info.ai_addr = reinterpret_cast<sockaddr*>(&_local_addr);
+            _local_info.ai_addrlen = size;
+
+            _info = &_local_info;
+            _orig = _info;
+            _man = true;
+#else
+            throw Error("Unix domain sockets aren't supported here", true);
+#endif
+        }
         
         ~AddrWrapper()
         {
@@ -305,6 +355,12 @@ namespace NylonSock
         
     }
     
+    Socket::Socket(const std::string& path, bool autoconnect)
+    {
+        _info = std::make_unique<AddrWrapper>(path);
+        _sw = std::make_unique<SocketWrapper>(*_info->get(), autoconnect);
+    }
+
     Socket::Socket(SOCKET port, const sockaddr_storage* data)
     {
         //this is for storing data!
@@ -340,6 +396,11 @@ namespace NylonSock
     {
         return _sw.get()->get();
     }
+
+    SOCKET Socket::release()
+    {
+        return _sw->release();
+    }
     
     size_t Socket::size() const
     {
@@ -373,6 +434,23 @@ namespace NylonSock
             success = ::bind(sock.port(), sock->ai_addr, sock->ai_addrlen);
         }
 
+#ifdef UNIX_HEADER
+        //a unix socket file left behind by a server that is gone, as nothing answers on it
+        if(success == SOCKET_ERROR && sock->ai_family == AF_UNIX && errno == EADDRINUSE)
+        {
+            SOCKET probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            bool stale = probe != INVALID_SOCKET && ::connect(probe, sock->ai_addr, sock->ai_addrlen) == SOCKET_ERROR &&
+                errno == ECONNREFUSED;
+            if(probe != INVALID_SOCKET) close(probe);
+
+            if(stale)
+            {
+                ::unlink(reinterpret_cast<const sockaddr_un*>(sock->ai_addr)->sun_path);
+                success = ::bind(sock.port(), sock->ai_addr, sock->ai_addrlen);
+            }
+        }
+#endif
+
         //give up trying to bind socket
         if (success == SOCKET_ERROR)
         {
@@ -429,22 +507,49 @@ namespace NylonSock
         size_t size = 0;
         while(size != len)
         {
+            //pick up where the last partial send left off
+            auto pos = static_cast<const char*>(buf) + size;
 #ifdef PLAT_WIN
             //needs to be cast to const char* for winsock2
-            size += ::send(sock.port(), (const char*)buf, len, flags);
+            auto sent = ::send(sock.port(), pos, len - size, flags);
 #elif defined(UNIX_HEADER)
-            size += ::send(sock.port(), buf, len, flags);
+            auto sent = ::send(sock.port(), pos, len - size, flags);
 #endif
 
-            if(size == CLOSED)
+            if(sent == SOCKET_ERROR)
             {
                 throw Error("Failed to send data to socket");
             }
+
+            size += sent;
         }
         
         return size;
     }
     
+    size_t trysend(const Socket& sock, const void* buf, size_t len, int flags)
+    {
+        int NSerrno = 0;
+#ifdef PLAT_WIN
+        auto size = ::send(sock.port(), (const char*)buf, len, flags);
+        if(size == SOCKET_ERROR) NSerrno = WSAGetLastError();
+#elif defined(UNIX_HEADER)
+        auto size = ::send(sock.port(), buf, len, flags);
+        if(size == SOCKET_ERROR) NSerrno = errno;
+#endif
+        if(size == SOCKET_ERROR && NSerrno == NSWOULDBLOCK)
+        {
+            return 0;
+        }
+
+        if(size == SOCKET_ERROR)
+        {
+            throw Error("Failed to send data to socket");
+        }
+
+        return size;
+    }
+    
     size_t recv(const Socket& sock, void* buf, size_t len, int flags)
     {
         int NSerrno = 0;
@@ -511,6 +616,158 @@ namespace NylonSock
         return size;
     }
     
+    size_t trysendmany(const Socket& sock, const Datagram* grams, size_t count)
+    {
+        size_t sent = 0;
+#ifdef __linux__
+        mmsghdr msgs[max_datagram_batch];
+        iovec iovs[max_datagram_batch];
+        while(sent < count)
+        {
+            size_t batch = std::min(count - sent, max_datagram_batch);
+            for(size_t i = 0; i < batch; ++i)
+            {
+                const Datagram& gram = grams[sent + i];
+                iovs[i].iov_base = gram.data;
+                iovs[i].iov_len = gram.size;
+
+                msgs[i] = {};
+                msgs[i].msg_hdr.msg_name = gram.addr_size == 0 ? nullptr : const_cast<sockaddr_storage*>(&gram.addr);
+                msgs[i].msg_hdr.msg_namelen = gram.addr_size;
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int done = ::sendmmsg(sock.port(), msgs, static_cast<unsigned int>(batch), 0);
+            if(done == SOCKET_ERROR && errno == NSWOULDBLOCK) break;
+            if(done == SOCKET_ERROR && (errno == EBADF || errno == ENOTSOCK) ) throw Error("Failed to send data to socket");
+
+            //only the first failed, the ones behind it get another go
+            if(done == SOCKET_ERROR) done = 1;
+            sent += done;
+        }
+#else
+        for(; sent < count; ++sent)
+        {
+            const Datagram& gram = grams[sent];
+            auto dest = gram.addr_size == 0 ? nullptr : reinterpret_cast<const sockaddr*>(&gram.addr);
+
+            int NSerrno = 0;
+#ifdef PLAT_WIN
+            auto size = ::sendto(sock.port(), (const char*)gram.data, gram.size, 0, dest, gram.addr_size);
+            if(size == SOCKET_ERROR) NSerrno = WSAGetLastError();
+#elif defined(UNIX_HEADER)
+            auto size = ::sendto(sock.port(), gram.data, gram.size, 0, dest, gram.addr_size);
+            if(size == SOCKET_ERROR) NSerrno = errno;
+#endif
+            if(size == SOCKET_ERROR && NSerrno == NSWOULDBLOCK) break;
+        }
+#endif
+        return sent;
+    }
+
+    size_t recvmany(const Socket& sock, Datagram* grams, size_t count)
+    {
+        size_t received = 0;
+#ifdef __linux__
+        mmsghdr msgs[max_datagram_batch];
+        iovec iovs[max_datagram_batch];
+        while(received < count)
+        {
+            size_t batch = std::min(count - received, max_datagram_batch);
+            for(size_t i = 0; i < batch; ++i)
+            {
+                Datagram& gram = grams[received + i];
+                iovs[i].iov_base = gram.data;
+                iovs[i].iov_len = gram.size;
+
+                msgs[i] = {};
+                msgs[i].msg_hdr.msg_name = &gram.addr;
+                msgs[i].msg_hdr.msg_namelen = sizeof(gram.addr);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int done = ::recvmmsg(sock.port(), msgs, static_cast<unsigned int>(batch), MSG_DONTWAIT, nullptr);
+            if(done == SOCKET_ERROR && errno == NSWOULDBLOCK) break;
+
+            //an earlier datagram hit a closed port. Reading the error clears it
+            if(done == SOCKET_ERROR && errno == ECONNREFUSED) continue;
+            if(done == SOCKET_ERROR) throw Error(std::string{"Failed to receive data from socket."});
+
+            for(int i = 0; i < done; ++i)
+            {
+                grams[received + i].addr_size = msgs[i].msg_hdr.msg_namelen;
+                grams[received + i].size = msgs[i].msg_len;
+            }
+
+            received += done;
+            if(static_cast<size_t>(done) < batch) break;
+        }
+#else
+        while(received < count)
+        {
+            Datagram& gram = grams[received];
+
+            int NSerrno = 0;
+#ifdef PLAT_WIN
+            int addr_size = sizeof(gram.addr);
+            auto size = ::recvfrom(sock.port(), gram.data, gram.size, 0, (sockaddr*)&gram.addr, &addr_size);
+            if(size == SOCKET_ERROR) NSerrno = WSAGetLastError();
+
+            //windows throws away the rest of a datagram that didn't fit, and says so
+            if(size == SOCKET_ERROR && NSerrno == WSAEMSGSIZE) continue;
+#elif defined(UNIX_HEADER)
+            socklen_t addr_size = sizeof(gram.addr);
+            auto size = ::recvfrom(sock.port(), gram.data, gram.size, 0, (sockaddr*)&gram.addr, &addr_size);
+            if(size == SOCKET_ERROR) NSerrno = errno;
+            if(size == SOCKET_ERROR && NSerrno == ECONNREFUSED) continue;
+#endif
+            if(size == SOCKET_ERROR && NSerrno == NSWOULDBLOCK) break;
+
+            //an earlier datagram hit a closed port
+            if(size == SOCKET_ERROR && NSerrno == NSCONNRESET) continue;
+            if(size == SOCKET_ERROR) throw Error(std::string{"Failed to receive data from socket."});
+
+            gram.addr_size = static_cast<socklen_t>(addr_size);
+            gram.size = size;
+            ++received;
+        }
+#endif
+        return received;
+    }
+
+    size_t trysendfile(const Socket& sock, int fd, uint64_t offset, size_t len)
+    {
+#ifdef __linux__
+        off_t at = static_cast<off_t>(offset);
+        auto size = ::sendfile(sock.port(), fd, &at, len);
+        if(size == SOCKET_ERROR && errno == NSWOULDBLOCK) return 0;
+        if(size == SOCKET_ERROR) throw Error("Failed to send file to socket");
+
+        //the receiver was promised len bytes
+        if(size == 0 && len > 0) throw Error("The file being sent got shorter", true);
+
+        return size;
+#else
+        throw Error("Sending straight from a file needs linux", true);
+#endif
+    }
+
+    size_t trysplice(const Socket& sock, int fd, size_t len)
+    {
+#ifdef __linux__
+        auto size = ::splice(fd, nullptr, sock.port(), nullptr, len, SPLICE_F_NONBLOCK | SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(size == SOCKET_ERROR && errno == NSWOULDBLOCK) return 0;
+        if(size == SOCKET_ERROR) throw Error("Failed to splice pipe to socket");
+        if(size == 0 && len > 0) throw Error("The pipe being sent closed early", true);
+
+        return size;
+#else
+        throw Error("Splicing from a pipe needs linux", true);
+#endif
+    }
+
     sockaddr_storage getpeername(const Socket& sock)
     {
         //0 initialized again!
@@ -528,6 +785,34 @@ namespace NylonSock
         return t_data;
     }
     
+    std::pair<Socket, Socket> socketpair()
+    {
+#ifdef UNIX_HEADER
+        int fds[2];
+        if(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == SOCKET_ERROR)
+        {
+            throw Error("Failed to create socket pair");
+        }
+
+        return {Socket{fds[0], nullptr}, Socket{fds[1], nullptr}};
+#else
+        throw Error("Socket pairs need unix", true);
+#endif
+    }
+
+    sockaddr_storage getsockname(const Socket& sock)
+    {
+        sockaddr_storage t_data = {0};
+        socklen_t t_size = sizeof(t_data);
+        int port = ::getsockname(sock.port(), (sockaddr*)(&t_data), &t_size);
+        if(port == SOCKET_ERROR)
+        {
+            throw Error("Failed to get sockname");
+        }
+
+        return t_data;
+    }
+
     std::string gethostname()
     {
 		NSHelper _help_wrap;
@@ -799,41 +1084,72 @@ namespace NylonSock
         }
     }
 
-    pollfd& PollFDs::get_element(Socket* sock)
+    pollfd& PollFDs::get_element(SOCKET port)
     {
-        auto port = sock->port();
-        auto pfit = std::find_if(_pfs.begin(), _pfs.end(), [&port](const pollfd& obj)
-        {
-            return obj.fd == port;
-        });
-        if(pfit == _pfs.end())
-        {
-            _pfs.push_back({port, 0, 0});
-            return _pfs.back();
-        }
+        auto found = _index.find(port);
+        if(found != _index.end() ) return _pfs[found->second];
 
-        return *pfit;
+        _index[port] = _pfs.size();
+        _pfs.push_back({port, 0, 0});
+        return _pfs.back();
+    }
+
+    const pollfd* PollFDs::find_element(SOCKET port) const
+    {
+        auto found = _index.find(port);
+        if(found == _index.end() ) return nullptr;
+
+        return &_pfs[found->second];
     }
 
     void PollFDs::add_event(Socket* sock, const PollFDs::Events& event)
     {
-        auto& element = get_element(sock);
+        add_event(sock->port(), event);
+    }
+
+    void PollFDs::add_event(SOCKET port, const PollFDs::Events& event)
+    {
+        auto& element = get_element(port);
         element.events = element.events | map_event(event);
     }
 
-    void PollFDs::clear() {_pfs.clear();}
+    void PollFDs::clear()
+    {
+        _pfs.clear();
+        _index.clear();
+    }
 
     bool PollFDs::get_event(Socket* sock, const PollFDs::Events& event)
     {
-        return (get_element(sock).events & map_event(event) );
+        return (get_element(sock->port() ).events & map_event(event) );
+    }
+
+    bool PollFDs::get_event(SOCKET port, const PollFDs::Events& event) const
+    {
+        auto element = find_element(port);
+        return element != nullptr && (element->events & map_event(event) );
+    }
+
+    bool PollFDs::get_revent(Socket* sock, const PollFDs::Events& event) const
+    {
+        return get_revent(sock->port(), event);
+    }
+
+    bool PollFDs::get_revent(SOCKET port, const PollFDs::Events& event) const
+    {
+        auto element = find_element(port);
+        return element != nullptr && (element->revents & map_event(event) );
     }
 
     int poll(PollFDs& pollfds, unsigned int timeout)
     {
 #ifdef PLAT_WIN
-        char success = ::WSAPoll(pollfds.get(), pollfds.size(), timeout);
+        int success = ::WSAPoll(pollfds.get(), pollfds.size(), timeout);
 #elif defined(UNIX_HEADER)
-        char success = ::poll(pollfds.get(), pollfds.size(), timeout);
+        int success = ::poll(pollfds.get(), pollfds.size(), timeout);
+
+        //a signal cut the wait short, which is the same as nothing happening
+        if(success == SOCKET_ERROR && errno == EINTR) return 0;
 #endif
         if(success == SOCKET_ERROR)
         {
@@ -842,4 +1158,210 @@ namespace NylonSock
 
         return success;
     }
+
+    Waker::Waker() : _armed(false)
+    {
+#ifdef PLAT_WIN
+        //WSAPoll only takes sockets, so talk to ourselves over loopback udp
+        _read = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int addr_size = sizeof(addr);
+
+        if(_read == INVALID_SOCKET ||
+            ::bind(_read, (sockaddr*)(&addr), sizeof(addr) ) == SOCKET_ERROR ||
+            ::getsockname(_read, (sockaddr*)(&addr), &addr_size) == SOCKET_ERROR ||
+            ::connect(_read, (sockaddr*)(&addr), sizeof(addr) ) == SOCKET_ERROR)
+        {
+            throw Error("Failed to create waker");
+        }
+
+        u_long is_true = 1;
+        ioctlsocket(_read, FIONBIO, &is_true);
+        _write = _read;
+#elif defined(UNIX_HEADER)
+        int fds[2];
+        if(::pipe(fds) == SOCKET_ERROR)
+        {
+            throw Error("Failed to create waker");
+        }
+
+        _read = fds[0];
+        _write = fds[1];
+        ::fcntl(_read, F_SETFL, O_NONBLOCK);
+        ::fcntl(_write, F_SETFL, O_NONBLOCK);
+#endif
+    }
+
+    Waker::~Waker()
+    {
+#ifdef PLAT_WIN
+        closesocket(_read);
+#elif defined(UNIX_HEADER)
+        close(_read);
+        close(_write);
+#endif
+    }
+
+    void Waker::wake()
+    {
+        if(_armed.exchange(true) ) return;
+
+        constexpr char byte = 0;
+#ifdef PLAT_WIN
+        ::send(_write, &byte, sizeof(byte), 0);
+#elif defined(UNIX_HEADER)
+        //a full pipe already means a pending wake, so errors don't matter
+        auto ignored = ::write(_write, &byte, sizeof(byte) );
+        (void)ignored;
+#endif
+    }
+
+    void Waker::drain()
+    {
+        _armed = false;
+
+        constexpr size_t BUFFER_SIZE = 64;
+        char buffer[BUFFER_SIZE];
+#ifdef PLAT_WIN
+        while(::recv(_read, buffer, sizeof(buffer), 0) > 0) {}
+#elif defined(UNIX_HEADER)
+        while(::read(_read, buffer, sizeof(buffer) ) > 0) {}
+#endif
+    }
+
+    SOCKET Waker::port() const
+    {
+        return _read;
+    }
+
+    FileDescriptors::~FileDescriptors()
+    {
+#ifdef UNIX_HEADER
+        for(auto it : _fds) close(it);
+#endif
+    }
+
+    FileDescriptors& FileDescriptors::operator=(FileDescriptors&& that)
+    {
+        FileDescriptors old{std::move(*this)};
+        _fds = std::move(that._fds);
+        that._fds.clear();
+
+        return *this;
+    }
+
+    FileDescriptors FileDescriptors::duplicate(const std::vector<int>& fds)
+    {
+        FileDescriptors result;
+#ifdef UNIX_HEADER
+        for(auto it : fds)
+        {
+            int fd = ::fcntl(it, F_DUPFD_CLOEXEC, 0);
+            if(fd == SOCKET_ERROR) throw Error("Failed to duplicate file descriptor");
+            result.push(fd);
+        }
+#else
+        if(!fds.empty() ) throw Error("Passing file descriptors isn't supported here", true);
+#endif
+
+        return result;
+    }
+
+    FileDescriptors FileDescriptors::take(size_t count)
+    {
+        count = std::min(count, _fds.size() );
+        FileDescriptors result{std::vector<int>(_fds.begin(), _fds.begin() + count)};
+        _fds.erase(_fds.begin(), _fds.begin() + count);
+
+        return result;
+    }
+
+    std::vector<int> FileDescriptors::release()
+    {
+        std::vector<int> result = std::move(_fds);
+        _fds.clear();
+
+        return result;
+    }
+
+    size_t trysendfds(const Socket& sock, const void* buf, size_t len, const std::vector<int>& fds)
+    {
+#ifdef UNIX_HEADER
+        if(fds.empty() ) return trysend(sock, buf, len, 0);
+        if(fds.size() > max_passed_fds) throw Error("Too many file descriptors to pass at once", true);
+
+        iovec iov;
+        iov.iov_base = const_cast<void*>(buf);
+        iov.iov_len = len;
+
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size() ) );
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size() );
+        std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size() );
+
+        auto size = ::sendmsg(sock.port(), &msg, 0);
+        if(size == SOCKET_ERROR && errno == NSWOULDBLOCK) return 0;
+        if(size == SOCKET_ERROR) throw Error("Failed to send data to socket");
+
+        return size;
+#else
+        throw Error("Passing file descriptors isn't supported here", true);
+#endif
+    }
+
+    size_t recvfds(const Socket& sock, void* buf, size_t len, FileDescriptors& fds)
+    {
+#ifdef UNIX_HEADER
+        iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = len;
+
+        //a read never goes past a send that passed descriptors, so one send's worth is enough
+        char control[CMSG_SPACE(sizeof(int) * max_passed_fds)];
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+        flags |= MSG_CMSG_CLOEXEC;
+#endif
+        auto size = ::recvmsg(sock.port(), &msg, flags);
+        if(size == SOCKET_ERROR && errno == NSCONNRESET) throw PEER_RESET("Connection reset by peer");
+        if(size == SOCKET_ERROR && errno == NSWOULDBLOCK) return 0;
+        if(size == SOCKET_ERROR) throw Error(std::string{"Failed to receive data from socket."});
+
+        for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+        {
+            if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0) ) / sizeof(int);
+            for(size_t i = 0; i < count; ++i)
+            {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int) );
+                fds.push(fd);
+            }
+        }
+
+        if(msg.msg_flags & MSG_CTRUNC) throw Error("File descriptors passed to us were cut off", true);
+        if(size == 0) throw SOCK_CLOSED("Receive has failed due to socket being closed");
+
+        return size;
+#else
+        throw Error("Passing file descriptors isn't supported here", true);
+#endif
+    }
 }
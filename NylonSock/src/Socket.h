@@ -40,13 +40,17 @@ enum PortBlockers
 typedef int SOCKET;
 #endif
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <mutex>
 #include <set>
 #include <string>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 //Forward Declaration!
@@ -104,6 +108,8 @@ namespace NylonSock
     public:
         Socket(const char* node, const char* service, const addrinfo* hints, bool autoconnect = false);
         Socket(const std::string& node, const std::string& service, const addrinfo* hints, bool autoconnect = false);
+        //unix domain stream socket. A path starting with @ is in linux's abstract namespace
+        Socket(const std::string& path, bool autoconnect);
         Socket(SOCKET port, const sockaddr_storage* data);
         Socket(Socket&& that);
         ~Socket();
@@ -113,6 +119,10 @@ namespace NylonSock
 
         SOCKET port() const;
 
+        //lets go of the socket without shutting it down or closing it, for the caller to close
+        //shutting down one handed to another process would cut it off there too
+        SOCKET release();
+
         size_t size() const;
         bool operator ==(const Socket& that) const;
 
@@ -132,13 +142,56 @@ namespace NylonSock
     
     size_t send(const Socket& sock, const void* buf, size_t len, int flags);
     
+    //sends what a non blocking socket takes right now. Returns 0 instead of blocking
+    size_t trysend(const Socket& sock, const void* buf, size_t len, int flags);
+    
     size_t recv(const Socket& sock, void* buf, size_t len, int flags);
     
     size_t sendto(const Socket& sock, const void* buf, size_t len, unsigned int flags, const Socket& dest);
     
     size_t recvfrom(const Socket& sock, void* buf, size_t len, unsigned int flags, const Socket& dest);
-    
+
+    //one datagram for trysendmany or recvmany
+    struct Datagram
+    {
+        //where it goes or came from. An addr_size of 0 sends to what the socket is connected to
+        sockaddr_storage addr;
+        socklen_t addr_size;
+
+        //the caller's bytes. recvmany fills up to size and sets size to what arrived
+        char* data;
+        size_t size;
+    };
+
+    //most a udp datagram carries over ipv4
+    constexpr size_t max_datagram_size = 65507;
+
+    //most datagrams handed to one sendmmsg or recvmmsg
+    constexpr size_t max_datagram_batch = 64;
+
+    //sends datagrams off the front of grams on a non blocking udp socket, batched into
+    //sendmmsg where there is one. Returns how many went, 0 instead of blocking
+    //one the system refuses outright is dropped and counted, as the network could have lost it
+    size_t trysendmany(const Socket& sock, const Datagram* grams, size_t count);
+
+    //receives up to count datagrams, batched into recvmmsg where there is one. Returns how
+    //many, 0 instead of blocking. A datagram longer than its buffer is cut off
+    size_t recvmany(const Socket& sock, Datagram* grams, size_t count);
+
+    //sends up to len bytes of the file fd, from offset, without copying them through the process,
+    //using sendfile. Returns 0 instead of blocking, and throws if the file ends first. Only on linux
+    size_t trysendfile(const Socket& sock, int fd, uint64_t offset, size_t len);
+
+    //moves up to len bytes the pipe fd already holds to the socket, using splice. Returns 0
+    //instead of blocking, and throws if the pipe was empty. Only on linux
+    size_t trysplice(const Socket& sock, int fd, size_t len);
+
+    //two connected unix domain stream sockets, for talking within the process
+    std::pair<Socket, Socket> socketpair();
+
     sockaddr_storage getpeername(const Socket& sock);
+
+    sockaddr_storage getsockname(const Socket& sock);
     
     std::string gethostname();
     
@@ -212,11 +265,21 @@ namespace NylonSock
         };
     private:
         std::vector<pollfd> _pfs;
+        //where each port sits in _pfs, so lookups stay cheap with many sockets
+        std::unordered_map<SOCKET, size_t> _index;
         static short map_event(const Events& event);
-        pollfd& get_element(Socket* sock);
+        pollfd& get_element(SOCKET port);
+        const pollfd* find_element(SOCKET port) const;
     public:
         void add_event(Socket* sock, const Events& event);
+        void add_event(SOCKET port, const Events& event);
         bool get_event(Socket* sock, const Events& event);
+        //whether event was asked of port, false for ports that aren't in here
+        bool get_event(SOCKET port, const Events& event) const;
+
+        //what poll reported for the socket, false for sockets that weren't polled
+        bool get_revent(Socket* sock, const Events& event) const;
+        bool get_revent(SOCKET port, const Events& event) const;
         void clear();
 
         pollfd* get() {return &_pfs[0];}
@@ -224,6 +287,70 @@ namespace NylonSock
     };
 
     int poll(PollFDs& pollfds, unsigned int timeout);
+
+    //file descriptors that are closed along with this, for passing over unix domain sockets
+    class FileDescriptors
+    {
+    private:
+        std::vector<int> _fds;
+    public:
+        FileDescriptors() = default;
+        explicit FileDescriptors(std::vector<int> fds) : _fds(std::move(fds) ) {}
+        ~FileDescriptors();
+        FileDescriptors(const FileDescriptors& that) = delete;
+        FileDescriptors& operator=(const FileDescriptors& that) = delete;
+        FileDescriptors(FileDescriptors&& that) : _fds(std::move(that._fds) ) {that._fds.clear();}
+        FileDescriptors& operator=(FileDescriptors&& that);
+
+        //copies of fds, which stay the caller's to close
+        static FileDescriptors duplicate(const std::vector<int>& fds);
+
+        const std::vector<int>& get() const {return _fds;}
+        size_t size() const {return _fds.size();}
+
+        void push(int fd) {_fds.push_back(fd);}
+
+        //the first count, which this no longer closes
+        FileDescriptors take(size_t count);
+
+        //all of them, for the caller to close
+        std::vector<int> release();
+    };
+
+    //most file descriptors one send may pass, linux's SCM_MAX_FD
+    constexpr size_t max_passed_fds = 253;
+
+    //trysend on a unix domain socket, passing fds along with the first byte
+    //nothing is sent, fds included, when it returns 0
+    size_t trysendfds(const Socket& sock, const void* buf, size_t len, const std::vector<int>& fds);
+
+    //recv on a unix domain socket, adding whatever file descriptors came with the bytes to fds
+    size_t recvfds(const Socket& sock, void* buf, size_t len, FileDescriptors& fds);
+
+    //lets another thread cut a poll short
+    class Waker
+    {
+    private:
+        NSHelper _the_help{};
+
+        SOCKET _read;
+        SOCKET _write;
+
+        //only the first wake between drains has to write anything
+        std::atomic<bool> _armed;
+    public:
+        Waker();
+        ~Waker();
+        Waker(const Waker& that) = delete;
+        Waker& operator=(const Waker& that) = delete;
+
+        void wake();
+
+        //call when poll says port is readable, before looking at whatever woke it
+        void drain();
+
+        SOCKET port() const;
+    };
 }
 
 #endif /* defined(__NylonSock__Socket__) */
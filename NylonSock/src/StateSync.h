@@ -0,0 +1,284 @@
+//
+//  StateSync.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__StateSync__
+#define __NylonSock__StateSync__
+
+#include "Wire.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/*
+ How state sync works:
+
+ The server numbers every snapshot of a channel and remembers the last few.
+ Each client acks the versions it has rebuilt, and the next snapshot goes to it
+ as a delta against the newest version it acked, or whole (a keyframe) when
+ there is nothing usable to diff against or a keyframe is due. The client
+ rebuilds the whole snapshot and hands it to the on() function named after the
+ channel, so it never sees a delta.
+
+ state: uint8_t kind, uint16_t channel size, channel, uint64_t version,
+        uint64_t base version (0 for a keyframe), snapshot or delta
+ ack:   uint16_t channel size, channel, uint64_t version (0 asks for a keyframe)
+
+ delta: varint size of the new snapshot, then pairs of
+        varint bytes unchanged, varint n, n bytes xored with the old snapshot
+ */
+
+namespace NylonSock
+{
+    const std::string state_event = std::string{reserved_event_prefix} + "ss";
+    const std::string state_ack = std::string{reserved_event_prefix} + "sa";
+
+    constexpr uint8_t state_keyframe = 0;
+    constexpr uint8_t state_delta = 1;
+
+    //settings for Server::setStateSync
+    struct StateSyncOptions
+    {
+        //every nth snapshot goes out whole to everyone, so a client never drifts for long
+        unsigned int keyframe_every = 60;
+
+        //snapshots kept on both sides to diff against. A client more than this many
+        //versions behind gets a keyframe
+        size_t history = 8;
+    };
+
+    inline void putVarint(std::string& out, uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            out += static_cast<char>( (value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    //false if str ran out first
+    inline bool getVarint(const std::string& str, size_t& pos, uint64_t& value)
+    {
+        value = 0;
+        for(unsigned int shift = 0; shift < 64 && pos < str.size(); shift += 7)
+        {
+            uint8_t byte = static_cast<uint8_t>(str[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if(!(byte & 0x80) ) return true;
+        }
+
+        return false;
+    }
+
+    //what turns base into next. Bytes past the end of base count as zero
+    inline std::string diffState(const std::string& base, const std::string& next)
+    {
+        //a run of matching bytes shorter than this isn't worth a new pair
+        constexpr size_t min_skip = 4;
+
+        std::string delta;
+        putVarint(delta, next.size() );
+
+        auto xorAt = [&](size_t i) -> char
+        {
+            return i < base.size() ? static_cast<char>(base[i] ^ next[i]) : next[i];
+        };
+
+        //snapshots are mostly unchanged, so skip a word at a time where both have bytes
+        size_t overlap = std::min(base.size(), next.size() );
+        constexpr size_t word = sizeof(uint64_t);
+
+        size_t i = 0;
+        while(i < next.size() )
+        {
+            size_t start = i;
+            while(i + word <= overlap && std::memcmp(base.data() + i, next.data() + i, word) == 0) i += word;
+            while(i < next.size() && xorAt(i) == 0) ++i;
+            if(i == next.size() ) break;
+            putVarint(delta, i - start);
+
+            //changed bytes, running on through short stretches of unchanged ones
+            size_t changed = i;
+            size_t end = i;
+            while(end < next.size() )
+            {
+                if(xorAt(end) != 0)
+                {
+                    ++end;
+                    continue;
+                }
+
+                size_t same = end;
+                while(same < next.size() && same - end < min_skip && xorAt(same) == 0) ++same;
+                if(same - end >= min_skip || same == next.size() ) break;
+                end = same;
+            }
+
+            putVarint(delta, end - changed);
+            for(size_t j = changed; j < end; ++j) delta += xorAt(j);
+            i = end;
+        }
+
+        return delta;
+    }
+
+    //false if delta is malformed
+    inline bool patchState(const std::string& base, const std::string& delta, std::string& next)
+    {
+        size_t pos = 0;
+        uint64_t size;
+        if(!getVarint(delta, pos, size) || size > maximum_message_size) return false;
+
+        next.assign(base, 0, std::min<size_t>(base.size(), size) );
+        next.resize(size, '\0');
+
+        size_t at = 0;
+        while(pos < delta.size() )
+        {
+            uint64_t skip, count;
+            if(!getVarint(delta, pos, skip) || !getVarint(delta, pos, count) ) return false;
+            if(skip > size - at || count > size - at - skip || count > delta.size() - pos) return false;
+
+            at += skip;
+            for(size_t j = 0; j < count; ++j) next[at + j] ^= delta[pos + j];
+            at += count;
+            pos += count;
+        }
+
+        return true;
+    }
+
+    //the server's side of one channel, guarded by the Server
+    class StateChannel
+    {
+    private:
+        uint64_t _version;
+        std::deque<std::pair<uint64_t, std::shared_ptr<const std::string> > > _history;
+
+    public:
+        StateChannel() : _version(0) {}
+
+        //numbers snapshot and keeps it to diff later ones against
+        uint64_t push(std::string snapshot, size_t history)
+        {
+            _history.emplace_back(++_version, std::make_shared<const std::string>(std::move(snapshot) ) );
+            while(_history.size() > std::max<size_t>(history, 1) ) _history.pop_front();
+
+            return _version;
+        }
+
+        const std::string& latest() const {return *_history.back().second;}
+
+        //the snapshot of version, or nullptr if it is no longer kept
+        const std::string* find(uint64_t version) const
+        {
+            if(_history.empty() || version < _history.front().first || version > _version) return nullptr;
+            return _history[version - _history.front().first].second.get();
+        }
+    };
+
+    inline std::string encodeState(uint8_t kind, const std::string& channel, uint64_t version, uint64_t base,
+        const std::string& payload)
+    {
+        std::string data;
+        data.reserve(1 + sizeof(sock_size_type) + channel.size() + 2 * sizeof(uint64_t) + payload.size() );
+        data += static_cast<char>(kind);
+        data += packInt<sock_size_type>(static_cast<sock_size_type>(channel.size() ) );
+        data += channel;
+        data += packInt<uint64_t>(version);
+        data += packInt<uint64_t>(base);
+        data += payload;
+
+        return data;
+    }
+
+    inline std::string encodeStateAck(const std::string& channel, uint64_t version)
+    {
+        return encodeFrame(state_ack, packInt<sock_size_type>(static_cast<sock_size_type>(channel.size() ) ) + channel +
+            packInt<uint64_t>(version) );
+    }
+
+    //false if the ack is malformed
+    inline bool decodeStateAck(const std::string& datastr, std::string& channel, uint64_t& version)
+    {
+        if(datastr.size() < sizeof(sock_size_type) ) return false;
+        size_t channel_size = unpackInt<sock_size_type>(datastr);
+        if(datastr.size() < sizeof(sock_size_type) + channel_size + sizeof(uint64_t) ) return false;
+
+        channel.assign(datastr, sizeof(sock_size_type), channel_size);
+        version = unpackInt<uint64_t>(datastr, sizeof(sock_size_type) + channel_size);
+
+        return true;
+    }
+
+    //the client's side of every channel
+    class StateReceiver
+    {
+    private:
+        //recent snapshots of each channel, newest last
+        std::unordered_map<std::string, std::deque<std::pair<uint64_t, std::string> > > _channels;
+
+    public:
+        //rebuilds the snapshot in a state frame
+        //returns false if it can't be used. ack is what to tell the server either way,
+        //0 when the base was missing and a keyframe is needed
+        bool receive(const std::string& datastr, size_t history, std::string& channel, std::string& snapshot,
+            uint64_t& ack)
+        {
+            constexpr size_t fixed_size = 1 + sizeof(sock_size_type) + 2 * sizeof(uint64_t);
+            ack = 0;
+            if(datastr.size() < fixed_size) return false;
+
+            uint8_t kind = static_cast<uint8_t>(datastr[0]);
+            size_t channel_size = unpackInt<sock_size_type>(datastr, 1);
+            if(datastr.size() < fixed_size + channel_size) return false;
+
+            size_t pos = 1 + sizeof(sock_size_type);
+            channel.assign(datastr, pos, channel_size);
+            pos += channel_size;
+            uint64_t version = unpackInt<uint64_t>(datastr, pos);
+            uint64_t base = unpackInt<uint64_t>(datastr, pos + sizeof(uint64_t) );
+            pos += 2 * sizeof(uint64_t);
+
+            auto& kept = _channels[channel];
+
+            //conflation can make a newer one overtake this
+            if(!kept.empty() && version <= kept.back().first)
+            {
+                ack = kept.back().first;
+                return false;
+            }
+
+            if(kind == state_keyframe)
+            {
+                snapshot.assign(datastr, pos, std::string::npos);
+            }
+            else
+            {
+                auto found = std::find_if(kept.begin(), kept.end(), [base](const std::pair<uint64_t, std::string>& it)
+                {
+                    return it.first == base;
+                });
+                if(found == kept.end() || !patchState(found->second, datastr.substr(pos), snapshot) ) return false;
+            }
+
+            kept.emplace_back(version, snapshot);
+            while(kept.size() > std::max<size_t>(history, 1) ) kept.pop_front();
+            ack = version;
+
+            return true;
+        }
+
+        void clear() {_channels.clear();}
+    };
+}
+
+#endif /* defined(__NylonSock__StateSync__) */
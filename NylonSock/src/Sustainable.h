@@ -9,16 +9,41 @@
 #ifndef __NylonSock__Sustainable__
 #define __NylonSock__Sustainable__
 
+#include "Affinity.h"
+#include "BusyPoll.h"
+#include "Compress.h"
+#include "Files.h"
+#include "Flow.h"
+#include "Handoff.h"
+#include "Inproc.h"
+#include "Local.h"
+#include "Multicast.h"
+#include "Outbox.h"
+#include "RateLimit.h"
+#include "Reliable.h"
+#include "Rooms.h"
+#include "SharedMemory.h"
 #include "Socket.h"
+#include "StateSync.h"
+#include "TimerWheel.h"
+#include "Tuning.h"
+#include "Topics.h"
+#include "Uring.h"
+#include "Wire.h"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <iomanip>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -26,25 +51,11 @@
 #include <unordered_map>
 #include <vector>
 
-
-/*
- How data is sent:
- 
- bytes are assumed to be 8 bits
- 
- Beginning is uint16_t of content size in bytes
- Next is uint16_t of event name size in bytes
- Next is name
- Rest is data.
- 
- */
+//see Wire.h for how data is sent
 
 
 namespace NylonSock
 {
-    typedef uint16_t sock_size_type;
-    constexpr sock_size_type maximum_sock_val = std::numeric_limits<sock_size_type>::max();
-
     class FD_Set;
     class Socket;
 
@@ -58,6 +69,11 @@ namespace NylonSock
 
     template<class Self>
     using NoFunc = std::function<void(Self&)>;
+
+    //picks the file descriptor a file sent to an event is written to, or -1 to take it
+    //in memory like any other message. It stays the caller's to close
+    template<class Self>
+    using FileFunc = std::function<int(Self&)>;
     
     class TOO_BIG : public NylonSock::Error
     {
@@ -65,11 +81,46 @@ namespace NylonSock
         TOO_BIG(const std::string& what): Error(what) {}
     };
 
+    //the peer has us out of credit and the queue for it is full
+    class NO_CREDIT : public NylonSock::Error
+    {
+    public:
+        NO_CREDIT(const std::string& what): Error(what, true) {}
+    };
+
     class FAILED_CONVERT : public NylonSock::Error
     {
     public:
         FAILED_CONVERT(const std::string& what) : Error(what) {}
     };
+
+    //settings for Client::setReconnect
+    struct ReconnectPolicy
+    {
+        //the nth retry waits a random time up to base_delay * 2^n ms, capped at max_delay ms
+        unsigned int base_delay = 100;
+        unsigned int max_delay = 30000;
+
+        //emits kept while disconnected. The oldest are dropped first
+        size_t max_buffered = 1024;
+    };
+
+    const std::string heartbeat_ping = std::string{reserved_event_prefix} + "pi";
+    const std::string heartbeat_pong = std::string{reserved_event_prefix} + "po";
+
+    //settings for Server::setHeartbeat and Client::setHeartbeat
+    //all times are in ms, and 0 turns that part off
+    struct HeartbeatOptions
+    {
+        //time between pings. Pongs feed the round trip time of the socket
+        unsigned int interval = 5000;
+
+        //the connection is dropped after receiving nothing for this long
+        unsigned int idle_timeout = 15000;
+
+        //the connection is dropped if a frame takes longer than this to fully arrive
+        unsigned int read_timeout = 10000;
+    };
     
     class SockData
     {
@@ -78,7 +129,7 @@ namespace NylonSock
 
         void initializeByString(const std::string& data)
         {
-            if(data.size() > maximum_sock_val)
+            if(data.size() > maximum_message_size)
             {
                 //throw error because data is too large
                 throw TOO_BIG("The data size of " + std::to_string(data.size()) + " is too big.");
@@ -131,8 +182,11 @@ namespace NylonSock
         virtual ~ClientInterface() = default;
         void on(const std::string& event_name, SockFunc<T> func) {impl().on(event_name, func);}
         void on(const std::string& event_name, NoFunc<T> func) {impl().on(event_name, func);}
-        void emit(const std::string& event_name, const SockData& data) {impl().emit(event_name, data);}
-        bool getDestroy() const {impl().getDestroy();}
+        void emit(const std::string& event_name, const SockData& data, const EmitOptions& opts = {})
+        {
+            impl().emit(event_name, data, opts);
+        }
+        bool getDestroy() const {return static_cast<const T*>(this)->getDestroy();}
         
     };
 
@@ -145,367 +199,2906 @@ namespace NylonSock
         std::unordered_map<std::string, NoFunc<T> > _nofunctions;
         std::unique_ptr<PollFDs> _self_ps;
 
-        bool _destroy_flag;
+        //bytes received that don't make up a whole frame yet
+        std::string _inbuf;
+
+        //bytes of the frame being written that the socket hasn't taken yet
+        std::string _outbuf;
+        //descriptors that go with the first byte of _outbuf, when none of it went out yet
+        std::shared_ptr<const FileDescriptors> _outbuf_fds;
+
+        //file bytes that follow a chunk header straight from the file, see Files.h
+        //the first _outfile_ahead bytes of _outbuf go before them, the rest after
+        std::shared_ptr<const FileSource> _outfile;
+        uint64_t _outfile_at;
+        size_t _outfile_left;
+        size_t _outfile_ahead;
+        //the pipe the outbox waits on while it is empty, -1 for none
+        std::atomic<int> _outfile_wait;
+
+        //onFile's functions, and the messages being written out by them by chunk id
+        //only touched by the loop thread
+        struct Sinking
+        {
+            std::string event_name;
+            int fd;
+            uint64_t size;
+        };
+        std::unordered_map<std::string, FileFunc<T> > _file_sinks;
+        std::unordered_map<uint64_t, Sinking> _sinking;
+
+        //unix domain socket, which can pass file descriptors
+        bool _local;
+        //descriptors the peer passed, waiting for their fd frame. Only touched by the loop thread
+        FileDescriptors _fd_queue;
+        //those of the fd frame being handled, closed after unless the on() function takes them
+        FileDescriptors _handed_fds;
+
+        //library frames, which go ahead of anything in _outbox
+        std::deque<std::string> _control;
+
+        //emits waiting for the socket, guarded by _send_mtx
+        Outbox _outbox;
+        uint64_t _next_chunk_id;
+
+        //chunked messages from the peer, when there is no session to keep them in
+        Reassembly _reassembly;
+
+        //guards _client so an emit from another thread never races the teardown
+        //also guards everything reliability related
+        std::mutex _send_mtx;
+
+        std::atomic<bool> _destroy_flag;
+
+        //set when the connection should be dropped on the next update
+        std::atomic<bool> _kicked;
+
+        //reliable delivery, off while _session is nullptr
+        std::shared_ptr<ReliableSession> _session;
+        //only set on the accepting side
+        std::shared_ptr<ReliableSessions> _sessions;
+        ReliableOptions _reliable_opts;
+        bool _handshaked;
+
+        //heartbeats, off while _wheel is nullptr. Only touched by the loop thread
+        TimerWheel* _wheel;
+        HeartbeatOptions _heartbeat;
+        TimerWheel::TimerId _ping_timer;
+        TimerWheel::TimerId _watchdog_timer;
+        std::chrono::steady_clock::time_point _last_recv;
+        //when the oldest incomplete frame started arriving, default constructed when there is none
+        std::chrono::steady_clock::time_point _partial_since;
+
+        //also polled by update, so another thread can cut the wait short
+        Waker* _waker;
+
+        //inbound rate limit, off while nullptr. Only touched by the loop thread
+        std::unique_ptr<TokenBucket> _frame_bucket;
+        std::unique_ptr<TokenBucket> _byte_bucket;
+        bool _throttling;
+        std::atomic<uint64_t> _throttled;
+
+        //credit based flow control, guarded by _send_mtx
+        FlowCredit _credit;
+        //set when we hand out credit, _flow_opts.max_queued applies either way
+        bool _flow_on;
+        FlowOptions _flow_opts;
+
+        //state sync, what the peer acked of each channel guarded by _send_mtx,
+        //and the snapshots we rebuilt, only touched by the loop thread
+        std::unordered_map<std::string, uint64_t> _state_acks;
+        StateReceiver _state_rx;
+        StateSyncOptions _state_opts;
+
+        //compression, off while _compress_opts is nullptr. Guarded by _send_mtx,
+        //except _inflater, which only the loop thread touches
+        std::unique_ptr<CompressionOptions> _compress_opts;
+        //made the first time something is worth compressing
+        std::unique_ptr<Deflater> _deflater;
+        std::unique_ptr<Inflater> _inflater;
+        //the peer's compression hello, empty until it arrives
+        std::string _peer_compress;
+        std::atomic<bool> _peer_inflates;
+
+        //shared memory, off while _shm_opts is nullptr. What we write goes through _ring once
+        //_ring_out is set, and what we read once _ring_in is. Guarded by _send_mtx, though
+        //only the loop thread sets up _ring or touches _ring_in
+        std::unique_ptr<SharedMemoryOptions> _shm_opts;
+        //the connecting side makes the rings, on its first update after connecting
+        bool _shm_offers;
+        bool _shm_pending;
+        std::unique_ptr<SharedRing> _ring;
+        bool _ring_in;
+        bool _ring_out;
+        //our switch frame was written, and _ring_out waits for the socket to take it
+        bool _ring_switching;
+        //an in-process connection, on rings from the start, which never offers any
+        bool _inproc;
+
+        //multicast broadcasts. The accepting side has the server's _group, and _group_member
+        //is guarded by its lock. The connecting side's are only touched by the loop thread once set
+        std::shared_ptr<MulticastSender> _group;
+        bool _group_member;
+        std::unique_ptr<MulticastOptions> _group_opts;
+        std::unique_ptr<MulticastReceiver> _group_rx;
+        std::atomic<bool> _group_on;
+
+        //the io_uring loop that reads for us, see Uring.h, off while nullptr. Only touched by the
+        //loop thread, apart from _corked, which is guarded by _send_mtx
+        UringLoop<T>* _uring;
+        bool _batch_sends;
+        //while set, what is written collects in _outbuf, to go out in one send once unset
+        bool _corked;
+        //the loop saw the peer close, or the read fail
+        bool _recv_ended;
+
+        //spinning before the loop sleeps, off while nullptr
+        std::unique_ptr<BusyPollOptions> _busy_poll;
+        //socket options for a tcp connection, again after each reattach. nullptr to leave them
+        std::unique_ptr<TuningOptions> _tuning;
+
+        //smoothed round trip time and its variance, in microseconds. 0 until measured
+        std::atomic<int64_t> _srtt;
+        std::atomic<int64_t> _rttvar;
 
         T& impl() {return *static_cast<T*>(this);}
 
-        void emitSend(const std::string& event_name, const SockData& data, Socket& socket)
+        static bool isLocal(const Socket& sock)
         {
-            //sends data to server/client
+            return getsockname(sock).ss_family == AF_UNIX;
+        }
 
-            //assumes socket is already binded
-            std::string raw_data = data.getRaw();
-            
-            //size of event name
-            sock_size_type sizeofevent = htons(event_name.size() );
+        static uint64_t nowMicro()
+        {
+            using namespace std::chrono;
+            return duration_cast<microseconds>(steady_clock::now().time_since_epoch() ).count();
+        }
 
-            //size of data
-            sock_size_type sizeofstr = htons(raw_data.size() );
-            
-            //formatting data: size of eventname + size of data + eventname + data
-            auto event_cast = (char*)(&sizeofevent);
-            auto str_cast = (char*)(&sizeofstr);
+        void startHeartbeat()
+        {
+            if(_wheel == nullptr) return;
+            stopHeartbeat();
 
-            std::string format_str = 
-                std::string{event_cast, event_cast + sizeof(sizeofevent)} + //size of event
-                std::string{str_cast, str_cast + sizeof(sizeofstr)} + //size of data
-                event_name + //event
-                raw_data; //data
+            _last_recv = std::chrono::steady_clock::now();
+            _partial_since = {};
 
-            //sending total data
-            send(socket, format_str.c_str(), format_str.size(), 0);
-        }
+            if(_heartbeat.interval > 0)
+            {
+                _ping_timer = _wheel->schedule(std::chrono::milliseconds(_heartbeat.interval), [this]() {pingTimer();});
+            }
 
-        char recvData(Socket& sock)
-        {
-            auto castback = [](const std::string& str)
+            if(_heartbeat.idle_timeout > 0 || _heartbeat.read_timeout > 0)
             {
-                sock_size_type data;
+                _watchdog_timer = _wheel->schedule(std::chrono::milliseconds(0), [this]() {watchdog();});
+            }
+        }
 
-                std::memcpy(&data, str.c_str(), str.size() );
+        void stopHeartbeat()
+        {
+            if(_wheel == nullptr) return;
 
-                return ntohs(data);
-            };
+            _wheel->cancel(_ping_timer);
+            _wheel->cancel(_watchdog_timer);
+            _ping_timer = TimerWheel::no_timer;
+            _watchdog_timer = TimerWheel::no_timer;
+        }
 
-            size_t data_size = sizeof(sock_size_type);
+        void pingTimer()
+        {
+            _ping_timer = _wheel->schedule(std::chrono::milliseconds(_heartbeat.interval), [this]() {pingTimer();});
 
-            std::vector<char> eventlen(data_size), datalen(data_size);
-            
-            //receives event length from client
-            //also assumes socket is non blocking
-            char success = recv(sock, eventlen.data(), data_size, 0);
-            
-            //break when there is no info or an error
-            if(success <= 0) return success;
-            
-            //receive data length
-            recv(sock, datalen.data(), data_size, 0);
-            
-            //allocate buffers!
-            //char is not guaranteed 8 bit
-            std::vector<uint8_t> event, data;
-            std::string eventstr, datastr;
-            
-            //receive and convert event
-            sock_size_type eventlensize = castback({eventlen.begin(), eventlen.end()});
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_client == nullptr) return;
 
-            //only recv if eventname greater than 0
-            if(eventlensize > 0)
+            try
+            {
+                sendFrame(encodeFrame(heartbeat_ping, packInt<uint64_t>(nowMicro() ) ) );
+            }
+            catch(NylonSock::Error& e)
             {
-                event.resize(eventlensize, 0);
-                recv(sock, &(event[0]), eventlensize, 0);
-                eventstr.assign(event.begin(), event.end() );
+                _kicked = true;
             }
+        }
 
-            //receive and convert data
-            sock_size_type datalensize = castback({datalen.begin(), datalen.end()});
+        //rather than moving a deadline on every read, check on expiry and reschedule for what's left
+        void watchdog()
+        {
+            using namespace std::chrono;
+            _watchdog_timer = TimerWheel::no_timer;
 
-            if(datalensize > 0)
+            auto now = steady_clock::now();
+            auto deadline = steady_clock::time_point::max();
+            if(_heartbeat.idle_timeout > 0)
+            {
+                deadline = _last_recv + milliseconds(_heartbeat.idle_timeout);
+            }
+            if(_heartbeat.read_timeout > 0)
             {
-                data.resize(datalensize, 0);
-                recv(sock, &(data[0]), datalensize, 0);
-                datastr.assign(data.begin(), data.end() );
+                //nothing half read, so look again a whole timeout from now
+                auto since = _partial_since == steady_clock::time_point{} ? now : _partial_since;
+                deadline = std::min(deadline, since + milliseconds(_heartbeat.read_timeout) );
             }
 
-            eventCall(eventstr, SockData{datastr}, impl() );
+            if(deadline <= now)
+            {
+                _kicked = true;
+                return;
+            }
 
-            return NylonSock::SUCCESS;
+            auto left = duration_cast<milliseconds>(deadline - now) + milliseconds(1);
+            _watchdog_timer = _wheel->schedule(left, [this]() {watchdog();});
         }
 
-        void eventCall(const std::string& eventstr, SockData data, T& tclass)
+        //RFC 6298 smoothing
+        void sampleRtt(int64_t sample)
         {
-            //if the event is in the functions
-            auto efind = _functions.find(eventstr);
-            if(efind != _functions.end() )
+            if(sample < 0) return;
+
+            int64_t srtt = _srtt.load();
+            if(srtt == 0)
             {
-                //call it
-                (efind->second)(data, tclass);
+                _srtt = std::max<int64_t>(sample, 1);
+                _rttvar = sample / 2;
+                return;
             }
-            //else, the event is unknown, and the data gets tossed
+
+            int64_t diff = srtt > sample ? srtt - sample : sample - srtt;
+            _rttvar = (3 * _rttvar.load() + diff) / 4;
+            _srtt = std::max<int64_t>( (7 * srtt + sample) / 8, 1);
         }
 
-        void eventCall(const std::string& eventstr, T& tclass)
+        //caller holds _send_mtx
+        //true if all of it went out
+        bool write(const std::string& bytes)
         {
-            //ditto
-            auto efind = _nofunctions.find(eventstr);
-            if(efind != _nofunctions.end() )
+            //a slow peer shouldn't stall whoever is emitting, so whatever
+            //the socket won't take now waits for the next update
+            if(!_outbuf.empty() || _outfile_left > 0 || _corked)
             {
-                (efind->second)(tclass);
+                _outbuf += bytes;
+                return false;
             }
-        }
 
-    public:
-        ClientSocket(Socket&& sock) : 
-            _client(std::make_unique<Socket>(std::move(sock))), _destroy_flag(false) {}
+            size_t sent = sendSome(bytes.data(), bytes.size() );
+            if(sent != bytes.size() ) _outbuf.append(bytes, sent, std::string::npos);
 
-        void on(const std::string& event_name, SockFunc<T> func)
-        {
-            _functions[event_name] = func;
+            return _outbuf.empty();
         }
 
-        void on(const std::string& event_name, NoFunc<T> func)
+        //caller holds _send_mtx
+        //trysend, to whichever of the socket or the ring we write to
+        size_t sendSome(const char* data, size_t size)
         {
-            _nofunctions[event_name] = func;
+            return _ring_out ? _ring->write(data, size) : trysend(*_client, data, size, 0);
         }
 
-        void emit(const std::string& event_name, const SockData& data)
+        //caller holds _send_mtx
+        //writes until the socket is full, library frames first, then the outbox a frame or chunk at a time
+        void pump()
         {
-            //sends data to client
-            emitSend(event_name, data, *_client);
-        }
-
-        bool getDestroy() const {return _destroy_flag;}
+            if(_client == nullptr) return;
 
-        void update(unsigned int timeout)
-        {
-            try
+            auto now = std::chrono::steady_clock::now();
+            while(true)
             {
-                //lazy initialization
-                if(_self_ps == nullptr)
+                //frames pile up until uncorked, but not without end
+                constexpr size_t max_corked = 1 << 16;
+                if(_corked)
                 {
-                    _self_ps = std::make_unique<PollFDs>();
-                    _self_ps->add_event(_client.get(), PollFDs::Events::NSPOLLIN);
+                    if(_outfile_left > 0 || _outbuf.size() >= max_corked) return;
                 }
+                else
+                {
+                    //the rest of a file chunk's header, then the file bytes after it
+                    if(_outfile_left > 0 && (!flushOutbuf(_outfile_ahead) || !sendFileBody() ) ) return;
 
-                //see if we can recv
-                if(poll(*_self_ps, timeout) == 0) return;
-                char success = recvData(*_client);
-                if(success == NylonSock::SUCCESS) return;
-            }
-            catch (NylonSock::Error& e) {}
-
-            _destroy_flag = true;
-
-            eventCall("disconnect", impl() );
-
-            _client = nullptr;
-            _functions.clear();
-            _self_ps = nullptr;
-        }
+                    if(!flushOutbuf(_outbuf.size() ) ) return;
+                }
 
-    };
-    
-    //dummy
-    template<class UsrSock, class Dummy = void>
-    class Server;
-    
-    template <class UsrSock>
-    class Server<UsrSock, typename std::enable_if<std::is_base_of<ClientSocket<UsrSock>, UsrSock>::value>::type>
-    {
-    private:
-        using ServClientFunc = std::function<void (UsrSock&)>;
-        using IfFunc = std::function<bool (const UsrSock&)>;
+                //our switch frame is out, the peer reads the rest from the ring
+                if(_ring_switching)
+                {
+                    _ring_switching = false;
+                    _ring_out = true;
+                }
 
-        std::atomic<bool> _stop_thread;
-        std::unique_ptr<std::thread> _thread;
-        std::unique_ptr<PollFDs> _pollset;
-        std::unique_ptr<Socket> _server;
-        std::vector<std::unique_ptr<UsrSock> > _clients;
-        ServClientFunc _func;
-        std::mutex _clsz_rw;
+                if(!_control.empty() )
+                {
+                    std::string frame = std::move(_control.front() );
+                    _control.pop_front();
+                    write(frame);
+                    continue;
+                }
 
-        void createServer(const std::string& port)
-        {
-            addrinfo hints = {0};
-            //force server to be ipv6
-            //ipv4 and ipv6 addresses can connect
-            hints.ai_family = AF_INET6;
-            hints.ai_socktype = SOCK_STREAM;
-            hints.ai_protocol = IPPROTO_TCP;
-            hints.ai_flags = AI_PASSIVE;
-            
-            _server = std::make_unique<Socket>(nullptr, port.c_str(), &hints);
-			
-#ifdef PLAT_WIN
-			//needed because windows ipv6 doesn't accept ipv4
-			constexpr int n = 0;
-			setsockopt(*_server, IPPROTO_IPV6, IPV6_V6ONLY, &n, sizeof(n) );
-#endif
-            fcntl(*_server, O_NONBLOCK);
-            
-            bind(*_server);
-            
-            constexpr int backlog = 100;
-            listen(*_server, backlog);
-        }
+                //held until the handshake says what the peer is missing
+                if(_session != nullptr && !_handshaked) return;
 
-        void update()
-        {
-            //this is all accepting new clients
-            int count = poll(*_pollset, 100);
-            if (count > 0)
-            {
-                auto new_sock = accept(*_server);
+                _outfile_wait = -1;
+                Outgoing* out = _outbox.next(now);
+                if(out == nullptr) return;
 
+                //a pipe that is empty for now holds up what is behind it
+                size_t readable = 0;
+                bool closed = false;
+                if(out->file != nullptr && out->file->pipe)
                 {
-                    std::lock_guard<std::mutex> lock{_clsz_rw};
-                    //it is an actual socket
-                    _clients.push_back(std::make_unique<UsrSock>(std::move(new_sock) ) );
+                    readable = pipeReadable(out->file->fd.get()[0], closed);
+                    if(readable == 0 && !closed && fileSent(*out) < out->file->size)
+                    {
+                        _outfile_wait = out->file->fd.get()[0];
+                        return;
+                    }
                 }
 
-                //call the onConnect func
-                 _func(*_clients.back() );
+                if(out->offset == 0)
+                {
+                    //the peer is out of room, so wait for credit
+                    if(!_credit.canSend() ) return;
+                    _credit.sent(out->cost);
+
+                    if(_peer_inflates.load() && out->file == nullptr && out->cost >= _compress_opts->min_size) usePacked(*out);
 
-             }
+                    //a session's numbers are unique across connections, unlike a counter of ours
+                    if(out->chunked) out->id = _session != nullptr ? _session->nextSeq() : _next_chunk_id++;
+                }
 
-             //update all clients
-             auto it = _clients.begin();
-             while(it != _clients.end() )
-             {
-                auto sock = (*it).get();
-                if(!sock->getDestroy())
+                if(out->file != nullptr)
                 {
-                    constexpr unsigned int timeout = 0;
-                    sock->update(timeout);
-                    ++it;
+                    sendFileChunk(*out, readable, closed);
                     continue;
                 }
-                //kill the client
-                std::lock_guard<std::mutex> lock{_clsz_rw};
-                it = _clients.erase(it);
-             }
-        }
 
-        void thr_update()
-        {
-            while(true)
-            {
-                if(_stop_thread.load() ) break;
-                update();
+                std::shared_ptr<const std::string> whole;
+                std::string chunk;
+                bool finished = true;
+                if(out->chunked)
+                {
+                    chunk = cutChunk(*out);
+                    finished = out->offset == out->bytes->size();
+                }
+                else
+                {
+                    whole = out->bytes;
+                }
+                const std::string& frame = out->chunked ? chunk : *whole;
+                auto fds = out->fds;
+                _outbox.taken(frame.size(), finished);
+
+                if(_session != nullptr)
+                {
+                    uint64_t seq = _session->push(frame, _reliable_opts.window);
+                    write(wrapReliable(seq, frame) );
+                }
+                else if(fds != nullptr)
+                {
+                    //_outbuf is empty here, so the descriptors land on the frame's first byte
+                    size_t sent = trysendfds(*_client, frame.data(), frame.size(), fds->get() );
+                    if(sent == 0) _outbuf_fds = fds;
+                    if(sent != frame.size() ) _outbuf.append(frame, sent, std::string::npos);
+                }
+                else
+                {
+                    write(frame);
+                }
             }
         }
 
-    public:
-        Server(const std::string& port) : _stop_thread(true)
+        //caller holds _send_mtx
+        //sends the first size bytes of _outbuf, true once they are all out
+        bool flushOutbuf(size_t size)
         {
-            createServer(port);
+            if(size == 0) return true;
 
-            _pollset = std::make_unique<PollFDs>();
-            _pollset->add_event(_server.get(), PollFDs::Events::NSPOLLIN);
+            size_t sent = _outbuf_fds != nullptr ?
+                trysendfds(*_client, _outbuf.data(), size, _outbuf_fds->get() ) :
+                sendSome(_outbuf.data(), size);
+            if(sent > 0) _outbuf_fds = nullptr;
+            _outbuf.erase(0, sent);
+            _outfile_ahead -= std::min(sent, _outfile_ahead);
+
+            return sent == size;
         }
-        
-        Server(int port) : Server(std::to_string(port) ) {}
 
-        ~Server()
+        //caller holds _send_mtx
+        //sends what the socket takes of the file bytes after a chunk header, true once they are all out
+        bool sendFileBody()
         {
-            stop();
-            _thread->join();
+            int fd = _outfile->fd.get()[0];
+            size_t sent = _outfile->pipe ? trysplice(*_client, fd, _outfile_left) :
+                trysendfile(*_client, fd, _outfile_at, _outfile_left);
+            _outfile_at += sent;
+            _outfile_left -= sent;
+            if(_outfile_left > 0) return false;
+
+            _outfile = nullptr;
+            return true;
         }
 
-        Server(const Server& that) = delete;
+        //file bytes of an emitFile already sent
+        static uint64_t fileSent(const Outgoing& out)
+        {
+            return out.offset == 0 ? 0 : out.offset - out.bytes->size();
+        }
 
-        Server& operator=(const Server& that) = delete;
+        //caller holds _send_mtx
+        //the next chunk of an emitFile. out.bytes goes in the first one, ahead of the file
+        //readable and closed are what pipeReadable said of a pipe
+        void sendFileChunk(Outgoing& out, size_t readable, bool closed)
+        {
+            auto file = out.file;
+            uint64_t done = fileSent(out);
+            size_t head = out.offset == 0 ? out.bytes->size() : 0;
+
+            size_t body = static_cast<size_t>(std::min<uint64_t>(file->size - done, file_chunk_size - head) );
+            if(file->pipe) body = std::min(body, readable);
+            bool last = done + body == file->size || (file->pipe && closed);
+
+            uint8_t flags = 0;
+            if(out.offset == 0) flags |= chunk_first;
+            if(last) flags |= chunk_last;
+
+            //encodeFrame, with the length of what comes after
+            constexpr size_t chunk_header = sizeof(uint64_t) + 1;
+            std::string frame;
+            frame.reserve(frame_header_size + chunk_event.size() + chunk_header + head + body);
+            frame += packInt<sock_size_type>(static_cast<sock_size_type>(chunk_event.size() ) );
+            frame += packInt<sock_size_type>(static_cast<sock_size_type>(chunk_header + head + body) );
+            frame += chunk_event;
+            frame += packInt<uint64_t>(out.id);
+            frame += static_cast<char>(flags);
+            frame.append(*out.bytes, 0, head);
+
+            out.offset += head + body;
+            _outbox.taken(frame.size() + body, last);
+            if(file->pipe) _credit.sentMore(body);
+
+            //a session keeps what it sent, and a ring isn't a socket
+            if(zero_copy_files && _session == nullptr && !_ring_out)
+            {
+                write(frame);
+                if(body == 0) return;
+
+                _outfile = std::move(file);
+                _outfile_at = _outfile->offset + done;
+                _outfile_left = body;
+                _outfile_ahead = _outbuf.size();
+                return;
+            }
 
-        Server(Server&& that) = delete;
+            readFileSource(*file, file->offset + done, body, frame);
+            if(_session != nullptr)
+            {
+                uint64_t seq = _session->push(frame, _reliable_opts.window);
+                write(wrapReliable(seq, frame) );
+            }
+            else
+            {
+                write(frame);
+            }
+        }
 
-        Server& operator=(Server&& that) = delete;
-       
-        void onConnect(ServClientFunc func) {_func = func;}
-        
-        void emit(const std::string& event_name, SockData data)
+        //caller holds _send_mtx
+        //swaps in the compressed message, compressing it first unless a broadcast already did
+        void usePacked(Outgoing& out)
         {
-            std::lock_guard<std::mutex> lock{_clsz_rw};
-            for(auto& it : _clients)
+            if(out.packed == nullptr)
             {
-                if(!it->getDestroy() ) it->emit(event_name, data);
+                if(_deflater == nullptr) _deflater = std::make_unique<Deflater>(*_compress_opts);
+                _deflater->pack(out);
             }
+            if(out.packed->empty() ) return;
+
+            out.bytes = out.packed;
+            out.chunked = out.packed_chunked;
         }
 
-        unsigned long count() 
+        //caller holds _send_mtx
+        void sendFrame(const std::string& frame)
         {
-            std::lock_guard<std::mutex> lock {_clsz_rw};
-            return _clients.size();
+            _control.push_back(frame);
+            pump();
         }
 
-        void start()
+        void cork(bool on)
         {
-            //Prevents making too many threads
-            if(!_stop_thread.load() ) return;
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _corked = on;
+            if(!on) pump();
+        }
 
-            _stop_thread = false;
+        void flushOut()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            pump();
+        }
 
-            _thread = std::make_unique<std::thread>(&Server::thr_update, this);
+        //true while output waits for the socket to drain
+        bool outPending()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return (!_outbuf.empty() && !_ring_out) || _outfile_left > 0;
         }
 
-        void stop() {_stop_thread = true;}
+        static std::string wrapReliable(uint64_t seq, const std::string& frame)
+        {
+            return encodeFrame(reliable_data, packInt<uint64_t>(seq) + frame);
+        }
 
-        bool status() const {return !_stop_thread.load();}
-    };
-    
-    template <class T, class Dummy = void>
-    class Client;
+        //caller holds _send_mtx, and pumps afterwards
+        //queued rather than sent, as pumping numbers new frames onto the backlog
+        void sendBacklog()
+        {
+            for(auto& it : _session->backlog() ) _control.push_back(wrapReliable(it.first, it.second) );
+        }
 
-    //I really don't want to do any more work
-    template <class T>
-    class Client<T, typename std::enable_if<std::is_base_of<ClientSocket<T>, T>::value>::type>
-    {
-    private:
-        //see top of cpp file to see how data is sent
-        //client socket has similar interface
-        std::unique_ptr<T> _inter;
+        //caller holds _send_mtx
+        void sendHello()
+        {
+            sendFrame(encodeFrame(reliable_hello, packInt<uint64_t>(_session->received() ) + _session->token() ) );
+        }
 
-        std::atomic<bool> _stop_thread;
-        std::unique_ptr<std::thread> _thread;
-        
-        static Socket createListener(const std::string& ip, const std::string& port)
+        //caller holds _send_mtx
+        void sendAck()
         {
-            addrinfo hints = {0};
-            hints.ai_family = AF_UNSPEC;
-            hints.ai_socktype = SOCK_STREAM;
-            
-            return {ip, port, &hints, true};
+            sendFrame(encodeFrame(reliable_ack, packInt<uint64_t>(_session->takeAck() ) ) );
         }
 
-        void update()
+        void flushAck()
         {
-            class RAIIMe
-            {
-            private:
-                Client* _c;
-            public:
-                RAIIMe(Client* c) : _c(c) {};
-                ~RAIIMe() {_c->stop();};
-            };
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_client != nullptr && _session != nullptr && _handshaked && _session->ackPending() ) sendAck();
+        }
 
-            RAIIMe rm{this};
-            while(true)
+        //caller holds _send_mtx
+        //a resend after a reconnect would go without them, and so would a ring
+        bool canPassFds() const {return _local && _session == nullptr && _shm_opts == nullptr;}
+
+        //caller holds _send_mtx
+        void emitSend(const Outgoing& out)
+        {
+            if(out.fds != nullptr && !canPassFds() )
             {
-                if(_stop_thread.load() || _inter->getDestroy() ) break;
-                constexpr unsigned int timeout = 250;
-                _inter->update(timeout);
+                throw Error("File descriptors can only be passed over unix domain sockets without reliable delivery "
+                    "or shared memory", true);
             }
-        }
 
-    public:
-        Client(const std::string& ip, const std::string& port) : 
-            _inter(std::make_unique<T>(createListener(ip, port) ) ), _stop_thread(true) {}
+            //sends data to server/client
+            if(!_credit.canSend() && _outbox.size() >= _flow_opts.max_queued)
+            {
+                throw NO_CREDIT("Out of credit and too many emits are waiting.");
+            }
 
-        Client(const std::string& ip, int port) : Client(ip, std::to_string(port) ) {}
+            _outbox.push(out);
+
+            try
+            {
+                pump();
+            }
+            catch(NylonSock::Error& e)
+            {
+                //the message stays queued, the loop notices the dead socket
+                _kicked = true;
+            }
+
+            //the loop has to start watching for the socket to drain, or a pipe to fill
+            //while corked, the loop is busy with us and flushes once it is done
+            if( (!_outbuf.empty() || _outfile_left > 0 || _outfile_wait.load() >= 0) && !_corked && _waker != nullptr)
+            {
+                _waker->wake();
+            }
+        }
+
+        //caller holds _send_mtx
+        void sendGrant()
+        {
+            if(_flow_on && _client != nullptr && _credit.grantDue(_flow_opts) ) sendFrame(_credit.takeGrant(_flow_opts) );
+        }
+
+        //reads whatever the socket has into _inbuf
+        void recvData(Socket& sock)
+        {
+            constexpr size_t buffer_size = 16384;
+            char buffer[buffer_size];
+
+            //also assumes socket is non blocking
+            size_t size = _local ? recvfds(sock, buffer, buffer_size, _fd_queue) : recv(sock, buffer, buffer_size, 0);
+            
+            //break when there is no info
+            if(size == 0) return;
+
+            if(_fd_queue.size() > max_queued_fds) throw Error("Too many file descriptors are waiting for their frames", true);
+
+            _last_recv = std::chrono::steady_clock::now();
+            _inbuf.append(buffer, size);
+        }
+
+        //reads what the ring has into _inbuf, unless whole frames are still waiting their turn
+        void recvRing()
+        {
+            constexpr size_t max_read = 1 << 18;
+            if(peekFrame(_inbuf, 0) > 0) return;
+
+            if(_ring->read(_inbuf, max_read) > 0) _last_recv = std::chrono::steady_clock::now();
+        }
+
+        //caller holds _send_mtx, and pumps afterwards
+        //makes the rings and offers them to the peer
+        void offerRing()
+        {
+            _shm_pending = false;
+            if(!_local || _session != nullptr) return;
+
+            try
+            {
+                _ring = std::make_unique<SharedRing>(_shm_opts->ring_size);
+            }
+            catch(NylonSock::Error& e)
+            {
+                //out of memory or descriptors, or not on linux. The socket will do
+                return;
+            }
+
+            EmitOptions opts{Priority::HIGH};
+            opts.fds = _ring->fds();
+            _outbox.push(prepare(shm_offer, SockData{packInt<uint64_t>(_ring->size() )}, opts) );
+        }
+
+        //accepting side, maps the rings the peer offered and moves what we write onto them
+        void ringOffer(const std::string& datastr)
+        {
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_shm_opts != nullptr && !_shm_offers && _ring == nullptr && _session == nullptr &&
+                    datastr.size() >= sizeof(uint64_t) )
+                {
+                    try
+                    {
+                        _ring = std::make_unique<SharedRing>(std::move(_handed_fds), unpackInt<uint64_t>(datastr) );
+                        switchOut();
+                    }
+                    catch(NylonSock::Error& e)
+                    {
+                        //a bad offer leaves us on the socket
+                    }
+                }
+            }
+
+            if(_flow_opts.auto_grant) grant(1, frame_header_size + shm_offer.size() + datastr.size() );
+        }
+
+        //caller holds _send_mtx
+        //the switch frame is the last thing to go on the socket, the ring takes over once it is out
+        void switchOut()
+        {
+            write(encodeFrame(shm_switch, "") );
+            _ring_switching = true;
+            pump();
+        }
+
+        //the peer's next bytes are in the ring
+        void ringSwitch()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_ring == nullptr || _ring_in) throw Error("Unexpected switch to shared memory", true);
+
+            _ring_in = true;
+
+            //the connecting side follows the accepting side over
+            if(_shm_offers) switchOut();
+        }
+
+        //true if the ring has something for us. Otherwise tells the peer to wake us, and looks once more
+        bool ringBusy()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            bool blocked = _ring_out && !_outbuf.empty();
+            auto busy = [&]()
+            {
+                return (_ring_in && peekFrame(_inbuf, 0) == 0 && _ring->readable() > 0) || (blocked && _ring->room() > 0);
+            };
+
+            try
+            {
+                if(busy() ) return true;
+
+                _ring->sleep(blocked);
+                return busy();
+            }
+            catch(NylonSock::Error& e)
+            {
+                _kicked = true;
+            }
+
+            return true;
+        }
+
+        //false if the rate limit says the frame has to wait
+        bool admit(size_t frame_size)
+        {
+            if(_frame_bucket == nullptr && _byte_bucket == nullptr) return true;
+
+            auto now = std::chrono::steady_clock::now();
+            if( (_frame_bucket != nullptr && _frame_bucket->wait(1, now) > 0) ||
+                (_byte_bucket != nullptr && _byte_bucket->wait(frame_size, now) > 0) )
+            {
+                //counted once per stretch of being held back, not once per check
+                if(!_throttling) ++_throttled;
+                _throttling = true;
+                return false;
+            }
+
+            if(_frame_bucket != nullptr) _frame_bucket->take(1, now);
+            if(_byte_bucket != nullptr) _byte_bucket->take(frame_size, now);
+            _throttling = false;
+
+            return true;
+        }
+
+        //dispatches up to budget whole frames from _inbuf
+        //frames can arrive split across reads, so only whole ones go out
+        void dispatchBuffered(size_t budget)
+        {
+            size_t pos = 0;
+            std::string eventstr, datastr;
+            for(size_t handled = 0; handled < budget; ++handled)
+            {
+                size_t frame_size = peekFrame(_inbuf, pos);
+                if(frame_size == 0 || !admit(frame_size) ) break;
+
+                decodeFrame(_inbuf, pos, eventstr, datastr);
+                dispatch(eventstr, datastr);
+            }
+            _inbuf.erase(0, pos);
+
+            //read timeouts count from when the oldest incomplete frame started
+            //whole frames held back by the budget or rate limit don't count
+            if(_inbuf.empty() || peekFrame(_inbuf, 0) > 0) _partial_since = {};
+            else if(_partial_since == std::chrono::steady_clock::time_point{} || pos > 0)
+            {
+                _partial_since = std::chrono::steady_clock::now();
+            }
+        }
+
+        //writes a chunk of a message onFile asked for to its file, false if it isn't one
+        bool sinkChunk(const std::string& datastr)
+        {
+            constexpr size_t header_size = sizeof(uint64_t) + 1;
+            if( (_file_sinks.empty() && _sinking.empty() ) || datastr.size() < header_size) return false;
+
+            uint64_t id = unpackInt<uint64_t>(datastr);
+            uint8_t flags = static_cast<uint8_t>(datastr[sizeof(uint64_t)]);
+            size_t pos = header_size;
+
+            if(flags & chunk_first)
+            {
+                _sinking.erase(id);
+
+                //the event name leads the message, see makeOutgoing
+                if(datastr.size() < pos + sizeof(sock_size_type) ) return false;
+                size_t event_size = unpackInt<sock_size_type>(datastr, pos);
+                pos += sizeof(sock_size_type);
+                if(datastr.size() < pos + event_size) return false;
+
+                auto found = _file_sinks.find(datastr.substr(pos, event_size) );
+                if(found == _file_sinks.end() ) return false;
+
+                int fd = found->second(impl() );
+                if(fd < 0) return false;
+
+                _sinking[id] = Sinking{found->first, fd, 0};
+                pos += event_size;
+            }
+
+            auto found = _sinking.find(id);
+            if(found == _sinking.end() ) return false;
+
+            size_t size = datastr.size() - pos;
+            writeFile(found->second.fd, datastr.data() + pos, size);
+            found->second.size += size;
+            if(!(flags & chunk_last) ) return true;
+
+            Sinking done = std::move(found->second);
+            _sinking.erase(found);
+
+            //the on() function hears how much was written
+            eventCall(done.event_name, SockData{std::to_string(done.size)}, impl() );
+
+            if(_flow_opts.auto_grant) grant(1, frame_header_size + done.event_name.size() + done.size);
+
+            return true;
+        }
+
+        void dispatch(const std::string& eventstr, const std::string& datastr)
+        {
+            if(isReservedEvent(eventstr) )
+            {
+                reservedCall(eventstr, datastr);
+                return;
+            }
+
+            eventCall(eventstr, SockData{datastr}, impl() );
+
+            if(_flow_opts.auto_grant) grant(1, frame_header_size + eventstr.size() + datastr.size() );
+        }
+
+        //hands broadcasts that came through the group to the on() functions
+        void groupDispatch(const std::vector<std::string>& frames)
+        {
+            std::string eventstr, datastr;
+            for(auto& it : frames)
+            {
+                size_t pos = 0;
+                if(decodeFrame(it, pos, eventstr, datastr) && !isReservedEvent(eventstr) )
+                {
+                    eventCall(eventstr, SockData{datastr}, impl() );
+                }
+            }
+        }
+
+        //reads what the group sent, and asks over tcp for what it lost
+        void groupService(const PollFDs& ps)
+        {
+            std::vector<std::string> frames;
+            bool first = false;
+            try
+            {
+                if(ps.get_revent(_group_rx->port(), PollFDs::Events::NSPOLLIN) ) first = _group_rx->receive(frames);
+            }
+            catch(NylonSock::Error& e)
+            {
+                //the group is only a shortcut, what it drops is asked for below
+            }
+
+            auto missing = _group_rx->nackDue();
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_client == nullptr) return;
+
+                //the group works, so the server can stop sending broadcasts to us over tcp
+                if(first) sendFrame(encodeFrame(group_ready, "") );
+                for(auto& it : missing)
+                {
+                    sendFrame(encodeFrame(group_nack, packInt<uint64_t>(it.first) + packInt<uint64_t>(it.second) ) );
+                }
+            }
+
+            groupDispatch(frames);
+        }
+
+        //accepting side, counts the peer as a member of the group from here on
+        void groupReady()
+        {
+            if(_group == nullptr) return;
+
+            auto group = _group->lock();
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_client == nullptr || _session != nullptr || _group_member) return;
+
+            //queued behind the broadcasts it already has coming, which start comes after
+            _group_member = true;
+            _outbox.push(prepare(group_start, SockData{packInt<uint64_t>(_group->nextSeq() )}) );
+            pump();
+        }
+
+        void reservedCall(const std::string& eventstr, const std::string& datastr)
+        {
+            if(eventstr == reliable_data && datastr.size() >= sizeof(uint64_t) )
+            {
+                auto order = ReliableSession::Order::DUPLICATE;
+                {
+                    std::lock_guard<std::mutex> lock{_send_mtx};
+                    if(_session != nullptr) order = _session->receive(unpackInt<uint64_t>(datastr) );
+                }
+
+                //duplicates from a resend are dropped
+                if(order == ReliableSession::Order::DUPLICATE) return;
+
+                //the peer ran out of window while we were away
+                if(order == ReliableSession::Order::GAP) eventCall("session_reset", impl() );
+
+                size_t pos = sizeof(uint64_t);
+                std::string inner_event, inner_data;
+                if(decodeFrame(datastr, pos, inner_event, inner_data) ) dispatch(inner_event, inner_data);
+
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_client != nullptr && _session != nullptr && _session->ackDue(_reliable_opts.ack_every) ) sendAck();
+            }
+            else if(eventstr == reliable_ack && datastr.size() >= sizeof(uint64_t) )
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_session != nullptr) _session->ack(unpackInt<uint64_t>(datastr) );
+            }
+            else if(eventstr == flow_grant)
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_credit.receiveGrant(datastr) ) pump();
+            }
+            else if(eventstr == chunk_event)
+            {
+                if(sinkChunk(datastr) ) return;
+
+                bool whole = false;
+                std::string inner_event, inner_data;
+                {
+                    std::lock_guard<std::mutex> lock{_send_mtx};
+                    auto& reassembly = _session != nullptr ? _session->reassembly() : _reassembly;
+                    whole = reassembly.add(datastr, inner_event, inner_data);
+                }
+
+                if(whole) dispatch(inner_event, inner_data);
+            }
+            else if(eventstr == compressed_event)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{_send_mtx};
+                    if(_compress_opts == nullptr) return;
+                    if(_inflater == nullptr) _inflater = std::make_unique<Inflater>(_compress_opts->dictionary);
+                }
+
+                std::string inner_event, inner_data;
+                if(!_inflater->unpack(datastr, inner_event, inner_data) || inner_event == compressed_event) return;
+
+                dispatch(inner_event, inner_data);
+            }
+            else if(eventstr == fd_event && !datastr.empty() )
+            {
+                size_t count = static_cast<uint8_t>(datastr[0]);
+                if(count > _fd_queue.size() ) throw Error("File descriptors passed to us went missing", true);
+                _handed_fds = _fd_queue.take(count);
+
+                size_t pos = 1;
+                std::string inner_event, inner_data;
+                if(decodeFrame(datastr, pos, inner_event, inner_data) )
+                {
+                    if(inner_event == shm_offer) ringOffer(inner_data);
+                    else if(!isReservedEvent(inner_event) ) dispatch(inner_event, inner_data);
+                }
+
+                //whatever the on() function didn't take
+                _handed_fds = FileDescriptors{};
+            }
+            else if(eventstr == shm_switch)
+            {
+                ringSwitch();
+            }
+            else if(eventstr == compress_hello)
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                _peer_compress = datastr;
+                _peer_inflates = _compress_opts != nullptr && acceptsCompression(_peer_compress, *_compress_opts);
+            }
+            else if(eventstr == state_event)
+            {
+                std::string channel, snapshot;
+                uint64_t ack;
+                bool whole = _state_rx.receive(datastr, _state_opts.history, channel, snapshot, ack);
+
+                {
+                    std::lock_guard<std::mutex> lock{_send_mtx};
+                    if(_client != nullptr) sendFrame(encodeStateAck(channel, ack) );
+                }
+
+                if(whole) eventCall(channel, SockData{snapshot}, impl() );
+
+                if(_flow_opts.auto_grant) grant(1, frame_header_size + eventstr.size() + datastr.size() );
+            }
+            else if(eventstr == state_ack)
+            {
+                std::string channel;
+                uint64_t version;
+                if(!decodeStateAck(datastr, channel, version) ) return;
+
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                _state_acks[channel] = version;
+            }
+            else if(eventstr == heartbeat_ping)
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_client != nullptr) sendFrame(encodeFrame(heartbeat_pong, datastr) );
+            }
+            else if(eventstr == heartbeat_pong && datastr.size() >= sizeof(uint64_t) )
+            {
+                sampleRtt(static_cast<int64_t>(nowMicro() - unpackInt<uint64_t>(datastr) ) );
+            }
+            else if(eventstr == reliable_hello && datastr.size() >= sizeof(uint64_t) )
+            {
+                helloCall(unpackInt<uint64_t>(datastr), datastr.substr(sizeof(uint64_t) ) );
+            }
+            else if(eventstr == reliable_welcome && datastr.size() >= sizeof(uint64_t) + 1)
+            {
+                welcomeCall(datastr[0] != 0, unpackInt<uint64_t>(datastr, 1), datastr.substr(sizeof(uint64_t) + 1) );
+            }
+            else if(eventstr == group_join)
+            {
+                //a reliable connection resends broadcasts after resuming, which the group can't
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_group != nullptr && _session == nullptr && _client != nullptr) sendFrame(encodeFrame(group_info, _group->info() ) );
+            }
+            else if(eventstr == group_ready)
+            {
+                groupReady();
+            }
+            else if(eventstr == group_nack && datastr.size() >= 2 * sizeof(uint64_t) )
+            {
+                if(_group == nullptr) return;
+                auto frames = _group->resend(unpackInt<uint64_t>(datastr), unpackInt<uint64_t>(datastr, sizeof(uint64_t) ) );
+
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_client == nullptr) return;
+                for(auto& it : frames) _control.push_back(std::move(it) );
+                pump();
+            }
+            else if(eventstr == group_info)
+            {
+                if(_group_opts == nullptr || _group_rx != nullptr) return;
+
+                try
+                {
+                    _group_rx = std::make_unique<MulticastReceiver>(*_group_opts, datastr);
+                }
+                catch(NylonSock::Error& e)
+                {
+                    //can't join, so broadcasts keep coming over tcp
+                }
+            }
+            else if(eventstr == group_start && datastr.size() >= sizeof(uint64_t) )
+            {
+                std::vector<std::string> frames;
+                if(_group_rx != nullptr) _group_rx->start(unpackInt<uint64_t>(datastr), frames);
+                _group_on = _group_rx != nullptr;
+                groupDispatch(frames);
+
+                if(_flow_opts.auto_grant) grant(1, frame_header_size + eventstr.size() + datastr.size() );
+            }
+            else if(eventstr == group_resend && datastr.size() > sizeof(uint64_t) )
+            {
+                std::vector<std::string> frames;
+                if(_group_rx != nullptr) _group_rx->resent(unpackInt<uint64_t>(datastr), datastr.substr(sizeof(uint64_t) ), frames);
+                groupDispatch(frames);
+            }
+            else if(eventstr == group_gone && datastr.size() >= sizeof(uint64_t) )
+            {
+                std::vector<std::string> frames;
+                if(_group_rx != nullptr) _group_rx->gone(unpackInt<uint64_t>(datastr), frames);
+                groupDispatch(frames);
+            }
+            //else, the event is unknown, and the data gets tossed
+        }
+
+        //accepting side of the handshake
+        void helloCall(uint64_t peer_received, const std::string& token)
+        {
+            if(_sessions == nullptr) return;
+
+            //taken first, as resuming may kick the connection that held the session
+            auto hold = _sessions->hold();
+            auto old = token.empty() ? nullptr : _sessions->resume(token);
+
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_session == nullptr) return;
+
+            bool resumed = old != nullptr;
+            if(resumed)
+            {
+                //what the old connection never got out goes ahead of anything emitted since
+                _outbox.pushFront(old->takeParked() );
+                _session = old;
+                _session->ack(peer_received);
+            }
+
+            _sessions->attach(_session, [this]() {evictSession();});
+
+            sendFrame(encodeFrame(reliable_welcome,
+                std::string(1, resumed ? 1 : 0) + packInt<uint64_t>(_session->received() ) + _session->token() ) );
+
+            _handshaked = true;
+            sendBacklog();
+            pump();
+        }
+
+        //connecting side of the handshake
+        void welcomeCall(bool resumed, uint64_t peer_received, const std::string& token)
+        {
+            bool lost = false;
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_sessions != nullptr || _session == nullptr) return;
+
+                if(resumed)
+                {
+                    _session->ack(peer_received);
+                }
+                else
+                {
+                    //the peer forgot us, start numbering from scratch but keep what we haven't sent
+                    lost = !_session->token().empty();
+                    auto pending = _session->drain();
+                    _session = std::make_shared<ReliableSession>(token);
+                    for(auto& it : pending) _session->push(it, _reliable_opts.window);
+
+                    //the peer threw away the start of these
+                    _outbox.dropStarted();
+                }
+
+                _handshaked = true;
+                sendBacklog();
+                pump();
+            }
+
+            //tells the user that frames in flight may have been lost
+            if(lost) eventCall("session_reset", impl() );
+        }
+
+        //our session was resumed by a newer connection, so this one is stale
+        void evictSession()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_session != nullptr) _session->park(_outbox.takeAll(), _reliable_opts.window);
+            _session = nullptr;
+            _kicked = true;
+        }
+
+        //one pass over what poll reported, returns false once the connection is gone
+        bool service(const PollFDs& ps, size_t budget)
+        {
+            try
+            {
+                if(_shm_pending)
+                {
+                    std::lock_guard<std::mutex> lock{_send_mtx};
+                    offerRing();
+                }
+
+                if(_ring != nullptr) _ring->awake(ps.get_revent(_ring->port(), PollFDs::Events::NSPOLLIN) );
+
+                flushOut();
+
+                //a hangup or error shows up as a failed read
+                bool readable = ps.get_revent(_client.get(), PollFDs::Events::NSPOLLIN) ||
+                    ps.get_revent(_client.get(), PollFDs::Events::NSPOLLHUP) ||
+                    ps.get_revent(_client.get(), PollFDs::Events::NSPOLLERR);
+                if(readable) recvData(*_client);
+                if(_ring_in) recvRing();
+
+                //replies to what is handled here go out together
+                if(_batch_sends) cork(true);
+                dispatchBuffered(budget);
+                if(_batch_sends) cork(false);
+
+                if(_recv_ended) throw SOCK_CLOSED("The peer closed the connection");
+
+                if(_group_rx != nullptr) groupService(ps);
+
+                //idle, a good time to ack what we've been sent
+                if(!readable) flushAck();
+
+                return true;
+            }
+            catch (NylonSock::Error& e) {}
+
+            return false;
+        }
+
+        void teardown()
+        {
+            //the recv would keep the socket open
+            if(_uring != nullptr) _uring->forget(impl() );
+
+            {
+                //the accepting side parks the session so a reconnect can resume it
+                //done together with marking us dead so a broadcast lands in exactly one
+                std::unique_lock<std::recursive_mutex> hold;
+                if(_sessions != nullptr) hold = _sessions->hold();
+
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                _destroy_flag = true;
+                if(_sessions != nullptr)
+                {
+                    //whatever never went out waits with the session
+                    if(_handshaked)
+                    {
+                        _session->park(_outbox.takeAll(), _reliable_opts.window);
+                        _sessions->detach(_session);
+                    }
+                    _session = nullptr;
+                }
+                _handshaked = false;
+            }
+
+            stopHeartbeat();
+
+            eventCall("disconnect", impl() );
+
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _client = nullptr;
+            _functions.clear();
+            _file_sinks.clear();
+            _sinking.clear();
+            _self_ps = nullptr;
+            _inbuf.clear();
+            _outbuf.clear();
+            _outbuf_fds = nullptr;
+            _outfile = nullptr;
+            _outfile_left = 0;
+            _outfile_ahead = 0;
+            _outfile_wait = -1;
+            _corked = false;
+            _recv_ended = false;
+            _fd_queue = FileDescriptors{};
+            _control.clear();
+            _reassembly.clear();
+            _state_acks.clear();
+            _state_rx.clear();
+            _credit.reset();
+            _ring = nullptr;
+            _ring_in = false;
+            _ring_out = false;
+            _ring_switching = false;
+            _group_rx = nullptr;
+            _group_on = false;
+
+            //the outbox is kept, so a reconnecting client sends what it still holds
+        }
+
+        void eventCall(const std::string& eventstr, SockData data, T& tclass)
+        {
+            //if the event is in the functions
+            auto efind = _functions.find(eventstr);
+            if(efind != _functions.end() )
+            {
+                //call it
+                (efind->second)(data, tclass);
+            }
+            //else, the event is unknown, and the data gets tossed
+        }
+
+        void eventCall(const std::string& eventstr, T& tclass)
+        {
+            //ditto
+            auto efind = _nofunctions.find(eventstr);
+            if(efind != _nofunctions.end() )
+            {
+                (efind->second)(tclass);
+            }
+        }
+
+    public:
+        ClientSocket(Socket&& sock) : 
+            _client(std::make_unique<Socket>(std::move(sock))), _outfile_at(0), _outfile_left(0), _outfile_ahead(0),
+            _outfile_wait(-1), _local(isLocal(*_client) ), _next_chunk_id(1), _destroy_flag(false), _kicked(false),
+            _handshaked(false),
+            _wheel(nullptr), _ping_timer(TimerWheel::no_timer), _watchdog_timer(TimerWheel::no_timer),
+            _waker(nullptr), _throttling(false), _throttled(0), _flow_on(false), _peer_inflates(false),
+            _shm_offers(false), _shm_pending(false), _ring_in(false), _ring_out(false), _ring_switching(false), _inproc(false),
+            _group_member(false), _group_on(false), _uring(nullptr), _batch_sends(false), _corked(false), _recv_ended(false),
+            _srtt(0), _rttvar(0)
+        {
+            fcntl(*_client, O_NONBLOCK);
+        }
+
+        ~ClientSocket()
+        {
+            stopHeartbeat();
+        }
+
+        void on(const std::string& event_name, SockFunc<T> func)
+        {
+            _functions[event_name] = func;
+        }
+
+        void on(const std::string& event_name, NoFunc<T> func)
+        {
+            _nofunctions[event_name] = func;
+        }
+
+        //files sent to event_name with emitFile, or anything else chunked, are written to the
+        //descriptor func picks as they arrive, and on(event_name) is then called with the byte count
+        void onFile(const std::string& event_name, FileFunc<T> func)
+        {
+            _file_sinks[event_name] = func;
+        }
+
+        void emit(const std::string& event_name, const SockData& data, const EmitOptions& opts = {})
+        {
+            //sends data to client
+            tryEmit(event_name, data, opts);
+        }
+
+        //same as emit, but returns false if there is no connection to queue it on
+        bool tryEmit(const std::string& event_name, const SockData& data, const EmitOptions& opts = {})
+        {
+            return tryEmit(prepare(event_name, data, opts) );
+        }
+
+        //sends size bytes of the file at path from offset, or what is written to a pipe, without
+        //holding it in memory. See Files.h. Throws if it can't be opened
+        void emitFile(const std::string& event_name, const std::string& path, uint64_t offset = 0,
+            uint64_t size = whole_file, const EmitOptions& opts = {})
+        {
+            tryEmit(prepareFile(event_name, path, offset, size, opts) );
+        }
+
+        //for a message prepared once and sent to many sockets
+        bool tryEmit(const Outgoing& out)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_client == nullptr) return false;
+
+            emitSend(out);
+            return true;
+        }
+
+        static Outgoing prepare(const std::string& event_name, const SockData& data, const EmitOptions& opts = {})
+        {
+            if(event_name.size() > maximum_sock_val)
+            {
+                throw TOO_BIG("The event name size of " + std::to_string(event_name.size() ) + " is too big.");
+            }
+
+            if(opts.fds.empty() ) return makeOutgoing(event_name, data.getRaw(), opts);
+
+            //the descriptors ride on one frame, so the message can't be cut into chunks
+            constexpr size_t wrapper_size = 8;
+            if(opts.fds.size() > max_passed_fds || frame_header_size + event_name.size() + data.getRaw().size() +
+                wrapper_size > chunk_size)
+            {
+                throw TOO_BIG("A message passing file descriptors has to fit in " + std::to_string(chunk_size) + " bytes.");
+            }
+
+            std::string inner = encodeFrame(event_name, data.getRaw() );
+            auto out = makeOutgoing(fd_event, std::string(1, static_cast<char>(opts.fds.size() ) ) + inner, opts);
+
+            //the peer's flow control counts the message inside
+            out.cost = inner.size();
+            out.fds = std::make_shared<const FileDescriptors>(FileDescriptors::duplicate(opts.fds) );
+
+            return out;
+        }
+
+        //an Outgoing for emitFile, which only holds the event name and reads the file as it goes
+        static Outgoing prepareFile(const std::string& event_name, const std::string& path, uint64_t offset = 0,
+            uint64_t size = whole_file, const EmitOptions& opts = {})
+        {
+            if(event_name.size() > maximum_sock_val)
+            {
+                throw TOO_BIG("The event name size of " + std::to_string(event_name.size() ) + " is too big.");
+            }
+            if(!opts.fds.empty() ) throw Error("A file can't pass file descriptors along with it", true);
+
+            auto out = makeOutgoing(event_name, "", opts);
+            out.file = openFileSource(path, offset, size);
+            out.bytes = std::make_shared<const std::string>(
+                packInt<sock_size_type>(static_cast<sock_size_type>(event_name.size() ) ) + event_name);
+            out.chunked = true;
+
+            //a pipe's bytes are charged as they go
+            if(!out.file->pipe) out.cost += out.file->size;
+
+            return out;
+        }
+
+        //true if emits can pass file descriptors over this connection
+        bool passesFds()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return canPassFds();
+        }
+
+        //file descriptors passed along with the message being handled, for the on()
+        //function to take and close. Any it leaves are closed once it returns
+        std::vector<int> takeFds() {return _handed_fds.release();}
+
+        //turns on sequenced delivery with acks and session resumption
+        //sessions is the server's table of dropped sessions, or nullptr on the connecting side
+        void initReliable(const ReliableOptions& opts, std::shared_ptr<ReliableSessions> sessions)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _reliable_opts = opts;
+            _sessions = sessions;
+            _handshaked = false;
+            _session = _sessions != nullptr ? _sessions->create() : std::make_shared<ReliableSession>("");
+
+            if(_sessions == nullptr && _client != nullptr) sendHello();
+        }
+
+        //pings the peer and drops the connection when it goes quiet
+        //wheel belongs to the loop thread that updates this socket
+        void initHeartbeat(const HeartbeatOptions& opts, TimerWheel* wheel)
+        {
+            stopHeartbeat();
+            _heartbeat = opts;
+            _wheel = wheel;
+
+            if(_client != nullptr) startHeartbeat();
+        }
+
+        //update stops waiting once waker is woken, and output that has to wait for
+        //the socket wakes it so the loop starts watching for the socket to drain
+        void initWaker(Waker* waker) {_waker = waker;}
+
+        //smoothed round trip time measured by heartbeats, 0 until the first pong
+        std::chrono::microseconds rtt() const {return std::chrono::microseconds(_srtt.load() );}
+
+        std::chrono::microseconds rttVariance() const {return std::chrono::microseconds(_rttvar.load() );}
+
+        //swaps in a freshly connected socket after a disconnect, and for an in-process
+        //connection its rings. Registered functions are left for the caller to restore
+        void reattach(Socket&& sock, std::unique_ptr<SharedRing> ring = nullptr)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _client = std::make_unique<Socket>(std::move(sock) );
+            fcntl(*_client, O_NONBLOCK);
+            _local = isLocal(*_client);
+            if(_busy_poll != nullptr && !_local) setBusyPoll(*_client, _busy_poll->busy_poll);
+            if(_tuning != nullptr && !_local) tuneConnection(*_client, *_tuning);
+            _self_ps = nullptr;
+            _inbuf.clear();
+            _outbuf.clear();
+            _outbuf_fds = nullptr;
+            _outfile = nullptr;
+            _outfile_left = 0;
+            _outfile_ahead = 0;
+            _outfile_wait = -1;
+            _corked = false;
+            _recv_ended = false;
+            _sinking.clear();
+            _fd_queue = FileDescriptors{};
+            _control.clear();
+            _reassembly.clear();
+            _state_acks.clear();
+            //a new server numbers its channels from 1 again
+            _state_rx.clear();
+            _peer_compress.clear();
+            _peer_inflates = false;
+            _ring = std::move(ring);
+            _ring_in = _inproc;
+            _ring_out = _inproc;
+            _ring_switching = false;
+            _shm_pending = _shm_offers;
+            _group_rx = nullptr;
+            _group_on = false;
+            _handshaked = false;
+            _kicked = false;
+            _destroy_flag = false;
+
+            //without a session, the peer can't finish what it got part of
+            if(_session == nullptr) _outbox.dropStarted();
+
+            //picks the session back up where it left off
+            if(_session != nullptr && _sessions == nullptr) sendHello();
+
+            //the new peer says again what it inflates
+            if(_compress_opts != nullptr) _control.push_back(encodeCompressHello(*_compress_opts) );
+
+            //and where its group is
+            if(_group_opts != nullptr && _session == nullptr) _control.push_back(encodeFrame(group_join, "") );
+
+            //credit is counted per connection, so start over and let the new peer say how much it takes
+            _credit.reset();
+            sendGrant();
+            pump();
+
+            startHeartbeat();
+        }
+
+        bool getDestroy() const {return _destroy_flag.load();}
+
+        //false while a reliable connection is still handshaking or has been superseded
+        //one whose socket failed still takes emits, they wait with the session once the loop drops it
+        bool ready()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_session != nullptr) return _handshaked;
+
+            return !_kicked.load();
+        }
+
+        //adds what this connection is waiting on to ps, for loops that poll many sockets at once
+        void pollInto(PollFDs& ps)
+        {
+            if(_client == nullptr) return;
+
+            //while whole frames are waiting their turn, reading more only grows the buffer,
+            //so leave it to tcp to hold the peer back
+            if(peekFrame(_inbuf, 0) == 0) ps.add_event(_client.get(), PollFDs::Events::NSPOLLIN);
+            if(outPending() ) ps.add_event(_client.get(), PollFDs::Events::NSPOLLOUT);
+            if(_ring != nullptr) ps.add_event(_ring->port(), PollFDs::Events::NSPOLLIN);
+            if(_group_rx != nullptr) ps.add_event(_group_rx->port(), PollFDs::Events::NSPOLLIN);
+
+            int pipe = _outfile_wait.load();
+            if(pipe >= 0) ps.add_event(pipe, PollFDs::Events::NSPOLLIN);
+        }
+
+        //ms until frames already buffered may be dispatched, or the group is due to be asked
+        //for what it lost, -1 if neither. Call after pollInto, just before polling, as with a
+        //ring it may tell the peer we are going to sleep
+        int backlogWait()
+        {
+            if(_ring != nullptr && ringBusy() ) return 0;
+
+            int group_wait = _group_rx != nullptr ? _group_rx->nackWait() : -1;
+            size_t frame_size = peekFrame(_inbuf, 0);
+            if(frame_size == 0) return group_wait;
+
+            int wait = 0;
+            if(_frame_bucket != nullptr) wait = std::max(wait, _frame_bucket->wait(1) );
+            if(_byte_bucket != nullptr) wait = std::max(wait, _byte_bucket->wait(frame_size) );
+
+            return group_wait >= 0 ? std::min(wait, group_wait) : wait;
+        }
+
+        //handles what ps reported, dispatching at most budget frames
+        void update(const PollFDs& ps, size_t budget)
+        {
+            if(!_kicked.load() && service(ps, budget) ) return;
+
+            teardown();
+        }
+
+        void update(unsigned int timeout)
+        {
+            if(_kicked.load() || _client == nullptr)
+            {
+                teardown();
+                return;
+            }
+
+            //lazy initialization
+            if(_self_ps == nullptr) _self_ps = std::make_unique<PollFDs>();
+
+            _self_ps->clear();
+
+            //what spinning finds is handled without a system call
+            if(_ring_in && _shm_opts->spin > 0 && spinRing(_shm_opts->spin) )
+            {
+                update(*_self_ps, std::numeric_limits<size_t>::max() );
+                return;
+            }
+
+            pollInto(*_self_ps);
+            if(_waker != nullptr) _self_ps->add_event(_waker->port(), PollFDs::Events::NSPOLLIN);
+            if(_uring != nullptr) _uring->watch(impl(), *_self_ps);
+
+            int wait = backlogWait();
+            if(wait >= 0 && static_cast<unsigned int>(wait) < timeout) timeout = wait;
+
+            try
+            {
+                //see if we can recv, spinning a while first if asked to
+                unsigned int spin = _busy_poll != nullptr ? _busy_poll->spin : 0;
+                if(_uring != nullptr) _uring->wait(*_self_ps, static_cast<int>(timeout), spin);
+                else if(spin == 0 || timeout == 0 || !spinPoll(*_self_ps, spin) ) poll(*_self_ps, timeout);
+            }
+            catch (NylonSock::Error& e)
+            {
+                teardown();
+                return;
+            }
+
+            if(_waker != nullptr && _self_ps->get_revent(_waker->port(), PollFDs::Events::NSPOLLIN) ) _waker->drain();
+
+            update(*_self_ps, std::numeric_limits<size_t>::max() );
+        }
+
+        //for the loop thread, looks at the ring for up to us microseconds, true if something came
+        bool spinRing(unsigned int us)
+        {
+            auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+            do
+            {
+                if(ringReadable() ) return true;
+            }
+            while(std::chrono::steady_clock::now() < end);
+
+            return false;
+        }
+
+        //caps what the peer may send. Frames over the limit stay unread until the
+        //limit allows them, which in turn pushes back on the peer through tcp
+        void initRateLimit(const RateLimitOptions& opts)
+        {
+            _frame_bucket = nullptr;
+            _byte_bucket = nullptr;
+            if(opts.frames_per_sec > 0) _frame_bucket = std::make_unique<TokenBucket>(opts.frames_per_sec, opts.frame_burst);
+            if(opts.bytes_per_sec > 0) _byte_bucket = std::make_unique<TokenBucket>(opts.bytes_per_sec, opts.byte_burst);
+        }
+
+        //hands out credit so the peer can't send faster than we get through it
+        //the peer holds back once the first grant arrives
+        void initFlowControl(const FlowOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _flow_opts = opts;
+            _flow_opts.frames = std::max<uint64_t>(_flow_opts.frames, 1);
+            _flow_opts.bytes = std::max<uint64_t>(_flow_opts.bytes, 1);
+            _flow_on = true;
+
+            sendGrant();
+        }
+
+        //lets the peer send frames and bytes more. Only needed with auto_grant off,
+        //after finishing with what the on() functions were given. Safe from any thread
+        void grant(uint64_t frames, uint64_t bytes)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(!_flow_on) return;
+
+            _credit.done(frames, bytes);
+
+            try
+            {
+                sendGrant();
+            }
+            catch(NylonSock::Error& e)
+            {
+                _kicked = true;
+            }
+        }
+
+        //how many times this connection has been held back by the rate limit
+        uint64_t throttled() const {return _throttled.load();}
+
+        //how many snapshots of a state sync channel to keep for diffing against
+        void initStateSync(const StateSyncOptions& opts) {_state_opts = opts;}
+
+        //compresses emits of at least opts.min_size once the peer says it can inflate them
+        void initCompression(const CompressionOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _compress_opts = std::make_unique<CompressionOptions>(opts);
+            _deflater = nullptr;
+            _peer_inflates = acceptsCompression(_peer_compress, opts);
+
+            if(_client != nullptr) sendFrame(encodeCompressHello(opts) );
+        }
+
+        //true once the peer has said it inflates what we would compress
+        bool peerInflates() const {return _peer_inflates.load();}
+
+        //moves the connection onto shared memory rings, if it is a unix domain socket
+        //and the peer turned it on as well. offer is for the connecting side, which makes them
+        void initSharedMemory(const SharedMemoryOptions& opts, bool offer)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _shm_opts = std::make_unique<SharedMemoryOptions>(opts);
+            _shm_offers = offer && !_inproc;
+            _shm_pending = _shm_offers && _client != nullptr;
+        }
+
+        //for an in-process connection, sends and receives through ring from here on
+        //the socket only tells us when the peer goes away. Again after each reattach
+        void initInproc(std::unique_ptr<SharedRing> ring)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            if(_shm_opts == nullptr) _shm_opts = std::make_unique<SharedMemoryOptions>();
+            _inproc = true;
+            _shm_offers = false;
+            _shm_pending = false;
+            _ring = std::move(ring);
+            _ring_in = true;
+            _ring_out = true;
+            _ring_switching = false;
+            pump();
+        }
+
+        //true once both directions go through shared memory
+        bool sharedMemory()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return _ring_in && _ring_out;
+        }
+
+        //accepting side, hands out the server's group to a peer that asks for it
+        void initMulticast(std::shared_ptr<MulticastSender> group) {_group = group;}
+
+        //connecting side, asks the peer for its group and joins it. Not with reliable delivery
+        void initMulticast(const MulticastOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _group_opts = std::make_unique<MulticastOptions>(opts);
+            if(_client != nullptr && _session == nullptr) sendFrame(encodeFrame(group_join, "") );
+        }
+
+        //accepting side, caller holds the group's lock. True once the peer gets broadcasts from the group
+        bool groupMember() const {return _group_member;}
+
+        //connecting side, true once broadcasts come through the group
+        bool multicast() const {return _group_on.load();}
+
+        //for the loop thread, true if the ring holds bytes we haven't read
+        bool ringReadable()
+        {
+            if(!_ring_in || peekFrame(_inbuf, 0) > 0) return false;
+
+            try
+            {
+                return _ring->readable() > 0;
+            }
+            catch(NylonSock::Error& e)
+            {
+                //ringBusy drops us
+                return true;
+            }
+        }
+
+        //for the loop thread, true if it reads from a ring
+        bool readsRing() const {return _ring_in;}
+
+        //has loop read for this socket, see Uring.h. The loop has to outlive it
+        //with batch_sends, replies written while frames are handled go out in one send after
+        void initUring(const UringOptions& opts, UringLoop<T>* loop)
+        {
+            _uring = loop;
+            _batch_sends = opts.batch_sends && !_local;
+        }
+
+        //spins before update(timeout) sleeps, and sets SO_BUSY_POLL on a tcp socket
+        void initBusyPoll(const BusyPollOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _busy_poll = std::make_unique<BusyPollOptions>(opts);
+            if(_client != nullptr && !_local) setBusyPoll(*_client, opts.busy_poll);
+        }
+
+        //sets opts on a tcp socket, see Tuning.h
+        void initTuning(const TuningOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            _tuning = std::make_unique<TuningOptions>(opts);
+            if(_client != nullptr && !_local) tuneConnection(*_client, opts);
+        }
+
+        //for the loop thread, lets go of a tcp connection with nothing half read or half sent, for
+        //another process to carry on with, see Handoff.h. It disconnects like a dropped one, but
+        //stays open. Returns the socket for the caller to close, -1 if it has to stay
+        SOCKET handOff()
+        {
+            SOCKET port;
+            {
+                std::lock_guard<std::mutex> lock{_send_mtx};
+                if(_client == nullptr || _local || _destroy_flag.load() || _kicked.load() ) return -1;
+
+                //what was set up when it connected doesn't go with it, and a recv may have read ahead
+                if(_session != nullptr || _shm_opts != nullptr || _group != nullptr || _uring != nullptr) return -1;
+                if(!_inbuf.empty() || !_outbuf.empty() || _outfile != nullptr || !_outbox.empty() || !_control.empty() ||
+                    !_sinking.empty() || !_reassembly.empty() || _fd_queue.size() > 0)
+                {
+                    return -1;
+                }
+
+                port = _client->release();
+            }
+
+            teardown();
+            return port;
+        }
+
+        //the socket, for loops that wait on it themselves, -1 once it is gone
+        SOCKET port() const {return _client != nullptr ? _client->port() : -1;}
+
+        //true for a unix domain socket, which the io_uring loop leaves to recvmsg
+        bool local() const {return _local;}
+
+        //for the loop thread, bytes the loop read for us
+        void received(const char* data, size_t size)
+        {
+            _last_recv = std::chrono::steady_clock::now();
+            _inbuf.append(data, size);
+        }
+
+        //for the loop thread, the loop's read saw the peer close, or failed
+        //the connection is dropped once whatever arrived before is handled
+        void receiveEnded() {_recv_ended = true;}
+
+        //newest version of channel the peer has rebuilt, 0 for none
+        uint64_t stateAcked(const std::string& channel)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            auto found = _state_acks.find(channel);
+            return found == _state_acks.end() ? 0 : found->second;
+        }
+
+        //emits in one lane still waiting for the socket
+        size_t queueDepth(Priority priority)
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return _outbox.depth(priority);
+        }
+
+        //emits dropped for outliving their ttl
+        uint64_t expired()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return _outbox.expired();
+        }
+
+        //emits replaced by a newer one with the same key before they went out
+        uint64_t conflated()
+        {
+            std::lock_guard<std::mutex> lock{_send_mtx};
+            return _outbox.conflated();
+        }
+
+    };
+    
+    //dummy
+    template<class UsrSock, class Dummy = void>
+    class Server;
+    
+    template <class UsrSock>
+    class Server<UsrSock, typename std::enable_if<std::is_base_of<ClientSocket<UsrSock>, UsrSock>::value>::type>
+    {
+    private:
+        using ServClientFunc = std::function<void (UsrSock&)>;
+        using IfFunc = std::function<bool (const UsrSock&)>;
+    public:
+        typedef LoopTimers::TimerId TimerId;
+    private:
+
+        std::atomic<bool> _stop_thread;
+        std::unique_ptr<std::thread> _thread;
+        std::unique_ptr<PollFDs> _pollset;
+        std::unique_ptr<Socket> _server;
+
+        //declared before _clients, as their timers have to be cancelled first
+        TimerWheel _timers;
+        Waker _waker;
+        LoopTimers _user_timers;
+        //and as they hold onto it. nullptr while the loop polls
+        std::unique_ptr<UringLoop<UsrSock> > _uring;
+        UringOptions _uring_opts;
+        std::unique_ptr<BusyPollOptions> _busy_poll;
+        std::unique_ptr<AffinityOptions> _affinity;
+        std::unique_ptr<TuningOptions> _tuning;
+        std::vector<std::unique_ptr<UsrSock> > _clients;
+        ServClientFunc _func;
+        std::mutex _clsz_rw;
+
+        //guarded by _clsz_rw, members are taken out before they are destroyed
+        Rooms<UsrSock> _rooms;
+        Topics<UsrSock> _topics;
+
+        //state sync channels, guarded by _clsz_rw
+        std::unordered_map<std::string, StateChannel> _states;
+        StateSyncOptions _state_opts;
+
+        //table of dropped sessions, nullptr unless reliable delivery is on
+        std::shared_ptr<ReliableSessions> _sessions;
+
+        //nullptr unless heartbeats are on
+        std::unique_ptr<HeartbeatOptions> _heartbeat;
+
+        //nullptr unless flow control is on
+        std::unique_ptr<FlowOptions> _flow;
+
+        //nullptr unless compression is on. _deflater compresses broadcasts, guarded by _clsz_rw
+        std::unique_ptr<CompressionOptions> _compression;
+        std::unique_ptr<Deflater> _deflater;
+
+        //nullptr unless shared memory is on
+        std::unique_ptr<SharedMemoryOptions> _shm;
+
+        //nullptr unless multicast is on
+        std::shared_ptr<MulticastSender> _multicast;
+
+        RateLimitOptions _rate_limit;
+        size_t _next_turn;
+
+        //where a unix domain server listens, empty for tcp
+        std::string _unix_path;
+        //what an in-process server listens as, empty otherwise. It has no _server, its
+        //clients wait in _inproc_pending, guarded by _inproc_mtx, until the loop takes them
+        std::string _inproc_name;
+        std::mutex _inproc_mtx;
+        std::vector<InprocEnd> _inproc_pending;
+        //where a successor asks for the listener, nullptr without setHandoff
+        std::unique_ptr<Socket> _handoff;
+        std::string _handoff_path;
+        HandoffOptions _handoff_opts;
+        std::atomic<bool> _handed_off;
+        //connections handed to us by a predecessor, taken on by the loop's first pass
+        FileDescriptors _adopted;
+        //throttle, expiry and conflation counts of clients that already left
+        std::atomic<uint64_t> _throttled_gone;
+        std::atomic<uint64_t> _expired_gone;
+        std::atomic<uint64_t> _conflated_gone;
+
+        //steer is set for a listener that joins its port's group steered by cpu
+        void createServer(const std::string& port, const AffinityOptions* steer)
+        {
+            if(steer != nullptr && (isInprocAddress(port) || isUnixAddress(port) ) )
+            {
+                throw Error("Only a tcp server can be steered by cpu", true);
+            }
+
+            if(isInprocAddress(port) )
+            {
+                _inproc_name = inprocName(port);
+                InprocListeners::listen(_inproc_name, [this]() {return connectInproc();});
+                return;
+            }
+
+            if(isUnixAddress(port) )
+            {
+                _unix_path = unixPath(port);
+                _server = std::make_unique<Socket>(_unix_path, false);
+                fcntl(*_server, O_NONBLOCK);
+                bind(*_server);
+
+                constexpr int backlog = 100;
+                listen(*_server, backlog);
+                return;
+            }
+
+            addrinfo hints = {0};
+            //force server to be ipv6
+            //ipv4 and ipv6 addresses can connect
+            hints.ai_family = AF_INET6;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_protocol = IPPROTO_TCP;
+            hints.ai_flags = AI_PASSIVE;
+            
+            _server = std::make_unique<Socket>(nullptr, port.c_str(), &hints);
+			
+#ifdef PLAT_WIN
+			//needed because windows ipv6 doesn't accept ipv4
+			constexpr int n = 0;
+			setsockopt(*_server, IPPROTO_IPV6, IPV6_V6ONLY, &n, sizeof(n) );
+#endif
+            if(steer != nullptr) steerToCpu(*_server, steer->cpus.front() );
+            fcntl(*_server, O_NONBLOCK);
+            
+            bind(*_server);
+            
+            constexpr int backlog = 100;
+            listen(*_server, backlog);
+        }
+
+        //called by the connecting thread, with the listener table locked
+        InprocEnd connectInproc()
+        {
+            auto ends = InprocListeners::pair(_shm != nullptr ? _shm->ring_size : SharedMemoryOptions{}.ring_size);
+            {
+                std::lock_guard<std::mutex> lock{_inproc_mtx};
+                _inproc_pending.push_back(std::move(ends.first) );
+            }
+            _waker.wake();
+
+            return std::move(ends.second);
+        }
+
+        void acceptClients()
+        {
+            //take everything waiting, but leave some time for the clients we have
+            constexpr int max_accepts = 64;
+            for(int i = 0; i < max_accepts; ++i)
+            {
+                std::unique_ptr<UsrSock> usr_sock;
+                try
+                {
+                    usr_sock = std::make_unique<UsrSock>(accept(*_server) );
+                }
+                catch(NylonSock::Error& e)
+                {
+                    //nothing left to accept
+                    break;
+                }
+
+                addClient(std::move(usr_sock) );
+            }
+        }
+
+        //what the io_uring accepted while the loop waited
+        void acceptUring()
+        {
+            std::vector<SOCKET> accepted;
+            accepted.swap(_uring->accepted() );
+
+            for(auto port : accepted) addClient(std::make_unique<UsrSock>(Socket(port, nullptr) ) );
+        }
+
+        void acceptInproc()
+        {
+            std::vector<InprocEnd> pending;
+            {
+                std::lock_guard<std::mutex> lock{_inproc_mtx};
+                pending.swap(_inproc_pending);
+            }
+
+            for(auto& it : pending)
+            {
+                auto usr_sock = std::make_unique<UsrSock>(std::move(*it.sock) );
+                usr_sock->initInproc(std::move(it.ring) );
+                addClient(std::move(usr_sock) );
+            }
+        }
+
+        void adoptClients()
+        {
+            for(auto port : _adopted.release() ) addClient(std::make_unique<UsrSock>(Socket(port, nullptr) ) );
+        }
+
+        //a successor asked for the listener. The listener goes first, so if the successor goes away
+        //halfway, it is the connections picked to go along that are lost, and their clients reconnect
+        void handOff()
+        {
+            std::unique_ptr<Socket> successor;
+            try
+            {
+                successor = std::make_unique<Socket>(accept(*_handoff) );
+                Handoff::sendListener(*successor, _server->port() );
+            }
+            catch(NylonSock::Error& e)
+            {
+                return;
+            }
+
+            //the successor accepts from here on, what we accepted before stays ours
+            if(_uring != nullptr) _uring->unlisten();
+            FileDescriptors listener;
+            listener.push(_server->release() );
+            _server = nullptr;
+            //the socket file is the successor's now
+            _unix_path.clear();
+
+            FileDescriptors connections;
+            if(_handoff_opts.connections)
+            {
+                for(auto& it : _clients)
+                {
+                    SOCKET port = it->handOff();
+                    if(port >= 0) connections.push(port);
+                }
+            }
+
+            //gone before the successor hears the end, so it may listen for its own successor there
+            _handoff = nullptr;
+            removeUnixPath(_handoff_path);
+            _handoff_path.clear();
+            _handed_off = true;
+
+            try
+            {
+                Handoff::sendRest(*successor, connections.get() );
+            }
+            catch(NylonSock::Error& e)
+            {
+            }
+        }
+
+        void addClient(std::unique_ptr<UsrSock> usr_sock)
+        {
+            if(_sessions != nullptr) usr_sock->initReliable(_sessions->options(), _sessions);
+            if(_heartbeat != nullptr) usr_sock->initHeartbeat(*_heartbeat, &_timers);
+            usr_sock->initRateLimit(_rate_limit);
+            if(_flow != nullptr) usr_sock->initFlowControl(*_flow);
+            if(_compression != nullptr) usr_sock->initCompression(*_compression);
+            if(_shm != nullptr) usr_sock->initSharedMemory(*_shm, false);
+            if(_multicast != nullptr) usr_sock->initMulticast(_multicast);
+            if(_uring != nullptr) usr_sock->initUring(_uring_opts, _uring.get() );
+            if(_busy_poll != nullptr) usr_sock->initBusyPoll(*_busy_poll);
+            if(_tuning != nullptr) usr_sock->initTuning(*_tuning);
+            usr_sock->initStateSync(_state_opts);
+            usr_sock->initWaker(&_waker);
+
+            {
+                std::lock_guard<std::mutex> lock{_clsz_rw};
+                //it is an actual socket
+                _clients.push_back(std::move(usr_sock) );
+            }
+
+            //call the onConnect func
+            if(_func) _func(*_clients.back() );
+        }
+
+        //waits at most max_timeout ms for something to happen
+        void update(int max_timeout)
+        {
+            if(_adopted.size() > 0) adoptClients();
+
+            _user_timers.run();
+            _timers.advance();
+
+            //wake up for the next timer, but check at least this often
+            int timeout = _timers.timeout();
+            if(timeout < 0 || timeout > max_timeout) timeout = max_timeout;
+
+            //what spinning finds is still polled for, but without waiting
+            if(_shm != nullptr && _shm->spin > 0 && spinRings() ) timeout = 0;
+
+            if(_multicast != nullptr)
+            {
+                _multicast->beat();
+                timeout = std::min(timeout, _multicast->beatWait() );
+            }
+
+            //one poll covers the listener, the waker and every client
+            _pollset->clear();
+            if(_server != nullptr) _pollset->add_event(_server.get(), PollFDs::Events::NSPOLLIN);
+            if(_handoff != nullptr) _pollset->add_event(_handoff.get(), PollFDs::Events::NSPOLLIN);
+            _pollset->add_event(_waker.port(), PollFDs::Events::NSPOLLIN);
+            for(auto& it : _clients)
+            {
+                it->pollInto(*_pollset);
+                if(_uring != nullptr) _uring->watch(*it, *_pollset);
+
+                //frames left over from the last pass, come back as soon as they may go
+                int wait = it->backlogWait();
+                if(wait >= 0 && wait < timeout) timeout = wait;
+            }
+
+            //spinning a while first, if asked to
+            unsigned int spin = _busy_poll != nullptr ? _busy_poll->spin : 0;
+            if(_uring != nullptr) _uring->wait(*_pollset, timeout, spin);
+            else if(spin == 0 || timeout == 0 || !spinPoll(*_pollset, spin) ) poll(*_pollset, timeout);
+            if(_pollset->get_revent(_waker.port(), PollFDs::Events::NSPOLLIN) ) _waker.drain();
+
+            //clients accepted below weren't polled, they get their turn next pass
+            size_t polled = _clients.size();
+            if(_uring != nullptr) acceptUring();
+            else if(_server != nullptr && _pollset->get_revent(_server.get(), PollFDs::Events::NSPOLLIN) ) acceptClients();
+            if(!_inproc_name.empty() ) acceptInproc();
+            if(_handoff != nullptr && _pollset->get_revent(_handoff.get(), PollFDs::Events::NSPOLLIN) ) handOff();
+
+            //each client gets at most read_budget frames before the next one's turn,
+            //starting one further along every pass so nobody is always served last
+            for(size_t i = 0; i < polled; ++i)
+            {
+                auto sock = _clients[(_next_turn + i) % polled].get();
+                if(!sock->getDestroy() ) sock->update(*_pollset, _rate_limit.read_budget);
+            }
+            if(polled > 0) _next_turn = (_next_turn + 1) % polled;
+
+            //kill the dead clients
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            auto dead = std::remove_if(_clients.begin(), _clients.end(), [this](const std::unique_ptr<UsrSock>& sock)
+            {
+                if(!sock->getDestroy() ) return false;
+
+                _throttled_gone += sock->throttled();
+                _expired_gone += sock->expired();
+                _conflated_gone += sock->conflated();
+                _rooms.leaveAll(*sock);
+                _topics.unsubscribeAll(*sock);
+                return true;
+            });
+            _clients.erase(dead, _clients.end() );
+        }
+
+        //looks at the rings of clients on shared memory for up to _shm->spin us, true if something came
+        bool spinRings()
+        {
+            if(std::none_of(_clients.begin(), _clients.end(), [](const std::unique_ptr<UsrSock>& it) {return it->readsRing();}) )
+            {
+                return false;
+            }
+
+            auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(_shm->spin);
+            do
+            {
+                for(auto& it : _clients)
+                {
+                    if(it->ringReadable() ) return true;
+                }
+            }
+            while(std::chrono::steady_clock::now() < end);
+
+            return false;
+        }
+
+        void thr_update()
+        {
+            if(_affinity != nullptr)
+            {
+                int node = applyAffinity(*_affinity);
+                if(_uring != nullptr) _uring->placeOn(node);
+            }
+            else if(_busy_poll != nullptr) pinThread(_busy_poll->cpu);
+
+            while(true)
+            {
+                if(_stop_thread.load() ) break;
+
+                constexpr int max_timeout = 100;
+                update(max_timeout);
+            }
+        }
+
+        //caller holds _clsz_rw
+        void fanout(Outgoing& out, UsrSock& sock)
+        {
+            if(sock.getDestroy() || !sock.ready() ) return;
+
+            //file descriptors only go to clients on this host
+            if(out.fds != nullptr && !sock.passesFds() ) return;
+
+            //compressed once, for the first client that takes it, and shared from then on
+            if(out.packed == nullptr && _deflater != nullptr && out.cost >= _compression->min_size && sock.peerInflates() )
+            {
+                _deflater->pack(out);
+            }
+
+            try
+            {
+                sock.tryEmit(out);
+            }
+            catch(NO_CREDIT& e)
+            {
+                //a client this far behind misses the broadcast rather than holding up the rest
+            }
+        }
+
+        void emitRoom(const std::string& name, const std::string& event_name, const SockData& data, const EmitOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            auto members = _rooms.members(name);
+            if(members == nullptr) return;
+
+            //encoded once and shared by every member's queue
+            auto out = UsrSock::prepare(event_name, data, opts);
+            for(auto it : *members) fanout(out, *it);
+        }
+
+    public:
+        //what to() hands back
+        class Room
+        {
+        private:
+            Server& _server;
+            std::string _name;
+
+        public:
+            Room(Server& server, const std::string& name) : _server(server), _name(name) {}
+
+            //same as Server::emit, but only to the room's members
+            void emit(const std::string& event_name, const SockData& data, const EmitOptions& opts = {})
+            {
+                _server.emitRoom(_name, event_name, data, opts);
+            }
+
+            size_t size() {return _server.roomSize(_name);}
+        };
+
+        Server(const std::string& port) :
+            _stop_thread(true), _user_timers(_timers, [this]() {_waker.wake();}), _next_turn(0), _handed_off(false),
+            _throttled_gone(0), _expired_gone(0), _conflated_gone(0)
+        {
+            createServer(port, nullptr);
+
+            _pollset = std::make_unique<PollFDs>();
+        }
+        
+        Server(int port) : Server(std::to_string(port) ) {}
+
+        //a tcp server run as opts says, whose listener takes the connections its port gets on
+        //opts.cpus' first cpu, when other servers on the port take the rest. See Affinity.h
+        Server(const std::string& port, const AffinityOptions& opts) :
+            _stop_thread(true), _user_timers(_timers, [this]() {_waker.wake();}), _next_turn(0), _handed_off(false),
+            _throttled_gone(0), _expired_gone(0), _conflated_gone(0)
+        {
+            if(opts.cpus.empty() ) throw Error("Steering by cpu needs a cpu", true);
+            checkCpus(opts.cpus);
+            createServer(port, &opts);
+
+            _affinity = std::make_unique<AffinityOptions>(opts);
+            _pollset = std::make_unique<PollFDs>();
+        }
+
+        Server(int port, const AffinityOptions& opts) : Server(std::to_string(port), opts) {}
+
+        //a server on a listener this process was given, from inheritSystemd() or takeOver(), see
+        //Handoff.h. Connections handed along are taken on once it runs, calling onConnect for each
+        explicit Server(InheritedSockets inherited) :
+            _stop_thread(true), _user_timers(_timers, [this]() {_waker.wake();}), _next_turn(0), _handed_off(false),
+            _throttled_gone(0), _expired_gone(0), _conflated_gone(0)
+        {
+            if(inherited.listener.size() != 1) throw Error("A server takes one listener", true);
+
+            SOCKET port = inherited.listener.release().front();
+            _server = std::make_unique<Socket>(port, nullptr);
+            if(!isListening(port) ) throw Error("The socket to take on isn't listening", true);
+            fcntl(*_server, O_NONBLOCK);
+
+            _adopted = std::move(inherited.connections);
+            _pollset = std::make_unique<PollFDs>();
+        }
+
+        ~Server()
+        {
+            //no client may connect to what is about to go away
+            if(!_inproc_name.empty() ) InprocListeners::close(_inproc_name);
+
+            stop();
+            if(_thread != nullptr) _thread->join();
+            removeUnixPath(_unix_path);
+            removeUnixPath(_handoff_path);
+        }
+
+        Server(const Server& that) = delete;
+
+        Server& operator=(const Server& that) = delete;
+
+        Server(Server&& that) = delete;
+
+        Server& operator=(Server&& that) = delete;
+       
+        void onConnect(ServClientFunc func) {_func = func;}
+
+        //pings every client and drops the ones that go quiet. Call before start()
+        void setHeartbeat(const HeartbeatOptions& opts = {})
+        {
+            _heartbeat = std::make_unique<HeartbeatOptions>(opts);
+        }
+
+        //sequenced delivery with acks, letting reconnecting clients resume their session
+        //clients have to turn it on as well. Call before start()
+        void setReliable(const ReliableOptions& opts = {})
+        {
+            _sessions = std::make_shared<ReliableSessions>(opts);
+        }
+
+        //gives every client credit to send with, so none can get further ahead of
+        //the on() functions than opts allows. Call before start()
+        void setFlowControl(const FlowOptions& opts = {})
+        {
+            _flow = std::make_unique<FlowOptions>(opts);
+        }
+
+        //compresses emits to clients that turned compression on as well, once they are
+        //at least opts.min_size. Call before start()
+        void setCompression(const CompressionOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            _compression = std::make_unique<CompressionOptions>(opts);
+            _deflater = std::make_unique<Deflater>(opts);
+        }
+
+        //moves clients on a unix domain socket that turned shared memory on as well onto
+        //a pair of rings in shared memory. Call before start()
+        void setSharedMemory(const SharedMemoryOptions& opts = {})
+        {
+            _shm = std::make_unique<SharedMemoryOptions>(opts);
+        }
+
+        //sends broadcasts that fit in a datagram once, to a multicast group, rather than to
+        //each client that turned multicast on as well. Only Server::emit goes through the
+        //group, and only for a tcp server. Call before start()
+        void setMulticast(const MulticastOptions& opts = {})
+        {
+            if(_server == nullptr) throw Error("Multicast needs a tcp server", true);
+
+            auto name = getsockname(*_server);
+            unsigned short port = 0;
+            if(name.ss_family == AF_INET) port = ntohs(reinterpret_cast<const sockaddr_in*>(&name)->sin_port);
+            else if(name.ss_family == AF_INET6) port = ntohs(reinterpret_cast<const sockaddr_in6*>(&name)->sin6_port);
+            else throw Error("Multicast needs a tcp server", true);
+
+            _multicast = std::make_shared<MulticastSender>(opts, port);
+        }
+
+        //waits on an io_uring instead of poll, see Uring.h. Where the kernel can't, the loop
+        //stays on poll, which uring() tells. Call before start()
+        void setUring(const UringOptions& opts = {})
+        {
+            try
+            {
+                _uring = std::make_unique<UringLoop<UsrSock> >(opts);
+            }
+            catch(NylonSock::Error& e)
+            {
+                return;
+            }
+
+            _uring_opts = opts;
+            if(_server != nullptr) _uring->listen(*_server);
+            _uring->wakeOn(_waker.port() );
+        }
+
+        //true if the loop waits on an io_uring
+        bool uring() const {return _uring != nullptr;}
+
+        //has the loop spin before it sleeps, trading a busy core for latency, see BusyPoll.h.
+        //Throws if opts.cpu can't be used. Call before start()
+        void setBusyPoll(const BusyPollOptions& opts = {})
+        {
+            checkCpu(opts.cpu);
+            _busy_poll = std::make_unique<BusyPollOptions>(opts);
+        }
+
+        //pins the loop thread to opts.cpus, with its memory on their node, see Affinity.h.
+        //Throws if a cpu can't be used. Call before start()
+        void setAffinity(const AffinityOptions& opts)
+        {
+            checkCpus(opts.cpus);
+            _affinity = std::make_unique<AffinityOptions>(opts);
+        }
+
+        //socket options for the listener and each tcp connection it accepts, like
+        //TuningOptions::lowLatency(), see Tuning.h. Throws if the listener refuses one. Call before start()
+        void setTuning(const TuningOptions& opts)
+        {
+            if(_server != nullptr && getsockname(*_server).ss_family != AF_UNIX) tuneListener(*_server, opts);
+            _tuning = std::make_unique<TuningOptions>(opts);
+        }
+
+        //waits on address, like "unix:/run/game-handoff.sock", for a successor's takeOver(), and
+        //hands it the listener, see Handoff.h. Call before start()
+        void setHandoff(const std::string& address, const HandoffOptions& opts = {})
+        {
+            if(!isUnixAddress(address) ) throw Error("A handoff goes over a unix domain socket", true);
+            if(_server == nullptr) throw Error("Only a server with a listener can hand it off", true);
+
+            _handoff_path = unixPath(address);
+            _handoff = std::make_unique<Socket>(_handoff_path, false);
+            fcntl(*_handoff, O_NONBLOCK);
+            bind(*_handoff);
+
+            constexpr int backlog = 1;
+            listen(*_handoff, backlog);
+            _handoff_opts = opts;
+        }
+
+        //true once a successor took the listener. Clients that stayed are still served,
+        //and stop() can wait for count() to reach 0
+        bool handedOff() const {return _handed_off.load();}
+
+        //limits how fast each client may send, and how much of one client is handled
+        //before the others get a turn. Call before start()
+        void setRateLimit(const RateLimitOptions& opts)
+        {
+            _rate_limit = opts;
+            if(_rate_limit.read_budget == 0) _rate_limit.read_budget = 1;
+        }
+
+        //how many times clients have been held back by the rate limit
+        uint64_t throttled()
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            uint64_t total = _throttled_gone.load();
+            for(auto& it : _clients) total += it->throttled();
+
+            return total;
+        }
+
+        //emits in one lane still waiting for the socket, across all clients
+        size_t queueDepth(Priority priority)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            size_t total = 0;
+            for(auto& it : _clients) total += it->queueDepth(priority);
+
+            return total;
+        }
+
+        //emits dropped for outliving their ttl, across all clients
+        uint64_t expired()
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            uint64_t total = _expired_gone.load();
+            for(auto& it : _clients) total += it->expired();
+
+            return total;
+        }
+
+        //emits replaced by a newer one with the same key, across all clients
+        uint64_t conflated()
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            uint64_t total = _conflated_gone.load();
+            for(auto& it : _clients) total += it->conflated();
+
+            return total;
+        }
+        
+        //opts pick the lane it waits in on each client, how long it may wait there,
+        //and the key a newer emit replaces it by
+        void emit(const std::string& event_name, SockData data, const EmitOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+
+            //keeps sessions from hopping connections halfway through
+            std::unique_lock<std::recursive_mutex> hold;
+            if(_sessions != nullptr) hold = _sessions->hold();
+
+            //encoded once and shared by every client's queue
+            auto out = UsrSock::prepare(event_name, data, opts);
+
+            //one datagram to the group stands in for each member's copy
+            std::unique_lock<std::mutex> group;
+            if(_multicast != nullptr && out.fds == nullptr && !out.chunked && _multicast->fits(*out.bytes) )
+            {
+                group = _multicast->lock();
+                _multicast->publish(out.bytes);
+            }
+
+            for(auto& it : _clients)
+            {
+                if(group.owns_lock() && it->groupMember() ) continue;
+                fanout(out, *it);
+            }
+
+            //clients in the middle of reconnecting get it once they resume
+            if(_sessions != nullptr && out.fds == nullptr) _sessions->pushDetached(out);
+        }
+
+        //puts sock in a room, which exists while anyone is in it. A client leaves
+        //all its rooms when it disconnects. Safe from any thread
+        //false if sock was already in the room
+        bool join(UsrSock& sock, const std::string& room)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            return _rooms.join(sock, room);
+        }
+
+        //false if sock wasn't in the room. Safe from any thread
+        bool leave(UsrSock& sock, const std::string& room)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            return _rooms.leave(sock, room);
+        }
+
+        bool inRoom(const UsrSock& sock, const std::string& room)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            return _rooms.inRoom(sock, room);
+        }
+
+        size_t roomSize(const std::string& room)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            auto members = _rooms.members(room);
+            return members == nullptr ? 0 : members->size();
+        }
+
+        //server.to("lobby").emit(...) sends to everyone in the lobby
+        Room to(const std::string& room) {return Room(*this, room);}
+
+        //subscribes sock to topics matching pattern, see Topics.h. A client is
+        //unsubscribed from everything when it disconnects. Safe from any thread
+        //false if sock was already subscribed, throws BAD_PATTERN for a malformed pattern
+        bool subscribe(UsrSock& sock, const std::string& pattern)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            return _topics.subscribe(sock, pattern);
+        }
+
+        //false if sock wasn't subscribed to pattern. Safe from any thread
+        bool unsubscribe(UsrSock& sock, const std::string& pattern)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            return _topics.unsubscribe(sock, pattern);
+        }
+
+        //how often keyframes go out and how much history deltas may use. Call before start()
+        void setStateSync(const StateSyncOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            _state_opts = opts;
+        }
+
+        //sends the latest snapshot of channel to every client, as a delta against the
+        //newest one it acked where that is smaller. Clients get the whole snapshot in
+        //on(channel). A client that falls behind only gets the newest snapshot
+        void syncState(const std::string& channel, const SockData& state)
+        {
+            if(channel.size() > maximum_sock_val)
+            {
+                throw TOO_BIG("The channel name size of " + std::to_string(channel.size() ) + " is too big.");
+            }
+
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            auto& chan = _states[channel];
+            uint64_t version = chan.push(state.getRaw(), _state_opts.history);
+            bool keyframe_due = _state_opts.keyframe_every > 0 && version % _state_opts.keyframe_every == 0;
+
+            //a queued snapshot nobody has started on is replaced by this one
+            EmitOptions opts{Priority::NORMAL, 0, state_event + channel};
+
+            //clients acked the same few versions, so each frame is built once and shared
+            std::unordered_map<uint64_t, Outgoing> frames;
+            for(auto& it : _clients)
+            {
+                if(it->getDestroy() || !it->ready() ) continue;
+
+                uint64_t base = keyframe_due ? 0 : it->stateAcked(channel);
+                const std::string* old = base == 0 ? nullptr : chan.find(base);
+                if(old == nullptr) base = 0;
+
+                auto found = frames.find(base);
+                if(found == frames.end() )
+                {
+                    std::string data;
+                    if(old != nullptr)
+                    {
+                        auto delta = diffState(*old, chan.latest() );
+                        if(delta.size() < chan.latest().size() ) data = encodeState(state_delta, channel, version, base, delta);
+                    }
+                    if(data.empty() ) data = encodeState(state_keyframe, channel, version, 0, chan.latest() );
+
+                    found = frames.emplace(base, makeOutgoing(state_event, data, opts) ).first;
+                }
+
+                fanout(found->second, *it);
+            }
+        }
+
+        //emits to every client subscribed to a pattern matching topic, once each
+        void publish(const std::string& topic, const std::string& event_name, const SockData& data,
+            const EmitOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_clsz_rw};
+            auto subscribers = _topics.subscribers(topic);
+            if(subscribers.empty() ) return;
+
+            //encoded once and shared by every subscriber's queue
+            auto out = UsrSock::prepare(event_name, data, opts);
+            for(auto it : subscribers) fanout(out, *it);
+        }
+
+        //runs func on the loop thread once milli ms have passed. Safe from any thread
+        TimerId setTimeout(unsigned int milli, std::function<void ()> func)
+        {
+            return _user_timers.setTimeout(milli, func);
+        }
+
+        //runs func on the loop thread every milli ms until cleared. Safe from any thread
+        TimerId setInterval(unsigned int milli, std::function<void ()> func)
+        {
+            return _user_timers.setInterval(milli, func);
+        }
+
+        //unknown or already finished timers are ignored
+        void clearTimer(TimerId id) {_user_timers.clearTimer(id);}
+
+        unsigned long count() 
+        {
+            std::lock_guard<std::mutex> lock {_clsz_rw};
+            return _clients.size();
+        }
+
+        void start()
+        {
+            //Prevents making too many threads
+            if(!_stop_thread.load() ) return;
+
+            _stop_thread = false;
+
+            _thread = std::make_unique<std::thread>(&Server::thr_update, this);
+        }
+
+        void stop() {_stop_thread = true;}
+
+        bool status() const {return !_stop_thread.load();}
+
+        //one pass of what start() runs, on the calling thread instead, waiting at most
+        //timeout ms. With an in-process client driven by its get().update(0), a benchmark
+        //runs both ends on one thread. Not while started
+        void step(unsigned int timeout = 0)
+        {
+            if(status() ) return;
+            update(static_cast<int>(timeout) );
+        }
+    };
+    
+    template <class T, class Dummy = void>
+    class Client;
+
+    //I really don't want to do any more work
+    template <class T>
+    class Client<T, typename std::enable_if<std::is_base_of<ClientSocket<T>, T>::value>::type>
+    {
+    public:
+        typedef LoopTimers::TimerId TimerId;
+    private:
+        //declared before _inter, as its timers have to be cancelled first
+        TimerWheel _timers;
+        Waker _waker;
+        LoopTimers _user_timers;
+
+        //the rings of an in-process connection, between connecting and handing them to _inter
+        //declared before _inter, as making _inter fills it in
+        std::unique_ptr<SharedRing> _inproc_ring;
+
+        //before _inter too, as it holds onto it. nullptr while the loop polls
+        std::unique_ptr<UringLoop<T> > _uring;
+
+        //only for pinning the loop thread, _inter does the spinning
+        std::unique_ptr<BusyPollOptions> _busy_poll;
+        std::unique_ptr<AffinityOptions> _affinity;
+        //kept for reconnecting with fast open, _inter tunes the socket
+        std::unique_ptr<TuningOptions> _tuning;
+
+        //see top of cpp file to see how data is sent
+        //client socket has similar interface
+        std::unique_ptr<T> _inter;
+
+        std::atomic<bool> _stop_thread;
+        std::unique_ptr<std::thread> _thread;
+
+        std::string _ip;
+        std::string _port;
+
+        //nullptr when reconnecting is turned off
+        std::unique_ptr<ReconnectPolicy> _reconnect;
+        unsigned int _attempt;
+        std::mt19937 _rng;
+
+        //emits that arrived while the connection was down
+        std::deque<Outgoing> _buffered;
+
+        //copies of everything passed to on, replayed onto a reconnected socket
+        std::unordered_map<std::string, SockFunc<T> > _functions;
+        std::unordered_map<std::string, NoFunc<T> > _nofunctions;
+        std::unordered_map<std::string, FileFunc<T> > _file_functions;
+
+        //serializes emit against reconnecting
+        std::mutex _emit_mtx;
+        
+        //sends what was buffered in the order it was emitted. False if some is left, with _emit_mtx held
+        bool flushBuffered()
+        {
+            while(!_buffered.empty() )
+            {
+                if(!_inter->tryEmit(_buffered.front() ) ) return false;
+                _buffered.pop_front();
+            }
+
+            return true;
+        }
+
+        void emitPrepared(Outgoing out)
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            //older emits still waiting go out first, so this can't jump ahead of them
+            if(flushBuffered() && _inter->tryEmit(out) ) return;
+            if(_reconnect == nullptr) return;
+
+            //hold onto it until the connection comes back
+            if(_reconnect->max_buffered == 0) return;
+            if(_buffered.size() >= _reconnect->max_buffered) _buffered.pop_front();
+            _buffered.push_back(std::move(out) );
+        }
+
+        //ring is set for an in-process server, tuning is for reconnects
+        static Socket createListener(const std::string& ip, const std::string& port, std::unique_ptr<SharedRing>& ring,
+            const TuningOptions* tuning = nullptr)
+        {
+            if(isInprocAddress(ip) )
+            {
+                auto end = InprocListeners::connect(inprocName(ip) );
+                ring = std::move(end.ring);
+                return std::move(*end.sock);
+            }
+
+            if(isUnixAddress(ip) ) return {unixPath(ip), true};
+
+            addrinfo hints = {0};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+
+            if(tuning != nullptr && tuning->fast_open > 0)
+            {
+                //only the first address, as fast open has to be asked for before connecting
+                Socket sock{ip, port, &hints, false};
+                tuneConnect(sock, *tuning);
+                connect(sock);
+                return sock;
+            }
+            
+            return {ip, port, &hints, true};
+        }
+
+        void runTimers()
+        {
+            _user_timers.run();
+            _timers.advance();
+        }
+
+        void sleepFor(unsigned int milli)
+        {
+            //sleep in slices so stop() doesn't have to wait out a long backoff
+            constexpr unsigned int slice = 10;
+            auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(milli);
+            while(!_stop_thread.load() && std::chrono::steady_clock::now() < end)
+            {
+                //timers keep going while the connection is down
+                runTimers();
+                std::this_thread::sleep_for(std::chrono::milliseconds(slice) );
+            }
+        }
+
+        void reconnect()
+        {
+            //exponential backoff with full jitter, so a server restart isn't
+            //greeted by every client at the exact same moment
+            constexpr unsigned int max_shift = 16;
+            uint64_t delay = static_cast<uint64_t>(_reconnect->base_delay) << std::min(_attempt, max_shift);
+            delay = std::min<uint64_t>(delay, _reconnect->max_delay);
+
+            std::uniform_int_distribution<uint64_t> dist(0, delay);
+            sleepFor(static_cast<unsigned int>(dist(_rng) ) );
+            if(_stop_thread.load() ) return;
+
+            try
+            {
+                auto sock = createListener(_ip, _port, _inproc_ring, _tuning.get() );
+
+                std::lock_guard<std::mutex> lock{_emit_mtx};
+                _inter->reattach(std::move(sock), std::move(_inproc_ring) );
+
+                for(auto& it : _functions) _inter->on(it.first, it.second);
+                for(auto& it : _nofunctions) _inter->on(it.first, it.second);
+                for(auto& it : _file_functions) _inter->onFile(it.first, it.second);
+
+                //whatever is left goes out ahead of the next emit, or after the next reconnect
+                flushBuffered();
+
+                _attempt = 0;
+            }
+            catch(NylonSock::Error& e)
+            {
+                ++_attempt;
+            }
+        }
+
+        void update()
+        {
+            class RAIIMe
+            {
+            private:
+                Client* _c;
+            public:
+                RAIIMe(Client* c) : _c(c) {};
+                ~RAIIMe() {_c->stop();};
+            };
+
+            RAIIMe rm{this};
+            if(_affinity != nullptr)
+            {
+                int node = applyAffinity(*_affinity);
+                if(_uring != nullptr) _uring->placeOn(node);
+            }
+            else if(_busy_poll != nullptr) pinThread(_busy_poll->cpu);
+
+            while(true)
+            {
+                if(_stop_thread.load() ) break;
+                if(_inter->getDestroy() )
+                {
+                    //without a policy a dead socket ends the thread
+                    if(_reconnect == nullptr) break;
+                    reconnect();
+                    continue;
+                }
+                runTimers();
+
+                //wake up for the next timer, but check the socket at least this often
+                constexpr int poll_timeout = 250;
+                int timeout = _timers.timeout();
+                if(timeout < 0 || timeout > poll_timeout) timeout = poll_timeout;
+                _inter->update(timeout);
+            }
+        }
+
+    public:
+        Client(const std::string& ip, const std::string& port) : 
+            _user_timers(_timers, [this]() {_waker.wake();}),
+            _inter(std::make_unique<T>(createListener(ip, port, _inproc_ring) ) ), _stop_thread(true),
+            _ip(ip), _port(port), _attempt(0), _rng(std::random_device{}() )
+        {
+            _inter->initWaker(&_waker);
+            if(_inproc_ring != nullptr) _inter->initInproc(std::move(_inproc_ring) );
+        }
+
+        Client(const std::string& ip, int port) : Client(ip, std::to_string(port) ) {}
+
+        //for a unix domain socket, like "unix:/run/game.sock", or a server in this process, like "inproc:bench"
+        explicit Client(const std::string& address) : Client(address, "") {}
 
         ~Client()
         {
             stop();
-            _thread->join();
+            if(_thread != nullptr) _thread->join();
         }
 
         Client(const Client& that) = delete;
@@ -518,17 +3111,181 @@ namespace NylonSock
 
         void on(const std::string& event_name, SockFunc<T> func)
         {
-            if(!_stop_thread.load() ) _inter->on(event_name, func);
+            if(_stop_thread.load() ) return;
+
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _functions[event_name] = func;
+            _inter->on(event_name, func);
         }
 
         void on(const std::string& event_name, NoFunc<T> func)
         {
-            if(!_stop_thread.load() ) _inter->on(event_name, func);
+            if(_stop_thread.load() ) return;
+
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _nofunctions[event_name] = func;
+            _inter->on(event_name, func);
+        }
+
+        //opts pick the lane it waits in, how long it may wait, reconnecting included,
+        //and the key a newer emit replaces it by
+        void emit(const std::string& event_name, const SockData& data, const EmitOptions& opts = {})
+        {
+            if(_stop_thread.load() ) return;
+
+            //caught here rather than when a buffered one is flushed
+            if(!opts.fds.empty() && !_inter->passesFds() )
+            {
+                throw Error("File descriptors can only be passed over unix domain sockets without reliable delivery", true);
+            }
+
+            emitPrepared(T::prepare(event_name, data, opts) );
+        }
+
+        //sends size bytes of the file at path from offset, or what is written to a pipe,
+        //without holding it in memory. See Files.h. Throws if it can't be opened
+        void emitFile(const std::string& event_name, const std::string& path, uint64_t offset = 0,
+            uint64_t size = whole_file, const EmitOptions& opts = {})
+        {
+            if(_stop_thread.load() ) return;
+
+            emitPrepared(T::prepareFile(event_name, path, offset, size, opts) );
+        }
+
+        //files the server sends to event_name are written to the descriptor func picks as they
+        //arrive, and on(event_name) is then called with the byte count
+        void onFile(const std::string& event_name, FileFunc<T> func)
+        {
+            if(_stop_thread.load() ) return;
+
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _file_functions[event_name] = func;
+            _inter->onFile(event_name, func);
+        }
+
+        //runs func on the loop thread once milli ms have passed. Safe from any thread
+        TimerId setTimeout(unsigned int milli, std::function<void ()> func)
+        {
+            return _user_timers.setTimeout(milli, func);
+        }
+
+        //runs func on the loop thread every milli ms until cleared. Safe from any thread
+        TimerId setInterval(unsigned int milli, std::function<void ()> func)
+        {
+            return _user_timers.setInterval(milli, func);
+        }
+
+        //unknown or already finished timers are ignored
+        void clearTimer(TimerId id) {_user_timers.clearTimer(id);}
+
+        //gives the server credit to send with, so it can't get further ahead of
+        //the on() functions than opts allows. Call before start()
+        void setFlowControl(const FlowOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _inter->initFlowControl(opts);
+        }
+
+        //compresses emits to the server, if it turned compression on as well, once they
+        //are at least opts.min_size. Call before start()
+        void setCompression(const CompressionOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _inter->initCompression(opts);
+        }
+
+        //moves the connection onto a pair of rings in shared memory, if it is a unix domain
+        //socket and the server turned shared memory on as well. Call before start()
+        void setSharedMemory(const SharedMemoryOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _inter->initSharedMemory(opts, true);
+        }
+
+        //waits on an io_uring instead of poll, see Uring.h. Where the kernel can't, the loop
+        //stays on poll, which uring() tells. Call before start()
+        void setUring(const UringOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            try
+            {
+                _uring = std::make_unique<UringLoop<T> >(opts);
+            }
+            catch(NylonSock::Error& e)
+            {
+                return;
+            }
+
+            _uring->wakeOn(_waker.port() );
+            _inter->initUring(opts, _uring.get() );
+        }
+
+        //true if the loop waits on an io_uring
+        bool uring() const {return _uring != nullptr;}
+
+        //has the loop spin before it sleeps, trading a busy core for latency, see BusyPoll.h.
+        //Throws if opts.cpu can't be used. Call before start()
+        void setBusyPoll(const BusyPollOptions& opts = {})
+        {
+            checkCpu(opts.cpu);
+
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _busy_poll = std::make_unique<BusyPollOptions>(opts);
+            _inter->initBusyPoll(opts);
+        }
+
+        //pins the loop thread to opts.cpus, with its memory on their node, see Affinity.h.
+        //Throws if a cpu can't be used. Call before start()
+        void setAffinity(const AffinityOptions& opts)
+        {
+            checkCpus(opts.cpus);
+            _affinity = std::make_unique<AffinityOptions>(opts);
         }
 
-        void emit(const std::string& event_name, const SockData& data)
+        //socket options for a tcp connection, like TuningOptions::lowLatency(), kept across
+        //reconnects, see Tuning.h. Call before start()
+        void setTuning(const TuningOptions& opts)
         {
-            if(!_stop_thread.load() ) _inter->emit(event_name, data);
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _tuning = std::make_unique<TuningOptions>(opts);
+            _inter->initTuning(opts);
+        }
+
+        //joins the server's multicast group, if it turned multicast on, and takes its
+        //broadcasts from there. Not with reliable delivery. Call before start()
+        void setMulticast(const MulticastOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _inter->initMulticast(opts);
+        }
+
+        //how many snapshots of each state sync channel to keep for the server to diff
+        //against. Should be at least the server's history. Call before start()
+        void setStateSync(const StateSyncOptions& opts)
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _inter->initStateSync(opts);
+        }
+
+        //keeps the client alive across server drops. Call before start()
+        void setReconnect(const ReconnectPolicy& policy)
+        {
+            _reconnect = std::make_unique<ReconnectPolicy>(policy);
+        }
+
+        //pings the server and drops the connection when it goes quiet
+        //with setReconnect, a quiet server is treated like a dropped one. Call before start()
+        void setHeartbeat(const HeartbeatOptions& opts = {})
+        {
+            _inter->initHeartbeat(opts, &_timers);
+        }
+
+        //sequenced delivery with acks, resuming the session after a reconnect
+        //the server has to turn it on as well. Call before start()
+        void setReliable(const ReliableOptions& opts = {})
+        {
+            std::lock_guard<std::mutex> lock{_emit_mtx};
+            _inter->initReliable(opts, nullptr);
         }
 
         void start()
@@ -536,6 +3293,9 @@ namespace NylonSock
             //Prevents making too many threads
             if(!_stop_thread.load() ) return;
 
+            //reap a thread that exited on its own
+            if(_thread != nullptr) _thread->join();
+
             _stop_thread = false;
 
             _thread = std::make_unique<std::thread>(&Client<T>::update, this);
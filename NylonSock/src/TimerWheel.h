@@ -0,0 +1,321 @@
+//
+//  TimerWheel.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__TimerWheel__
+#define __NylonSock__TimerWheel__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ Hierarchical timing wheel
+
+ Each level has wheel_slots slots, and a slot on level n covers
+ wheel_slots^n ticks. A timer goes on the lowest level that can reach its
+ expiry, and whenever a level wraps around, the matching slot of the level
+ above is cascaded down. Scheduling, cancelling and each tick are O(1) no
+ matter how many timers are waiting.
+
+ Not thread safe, it belongs to whichever thread runs the loop.
+ LoopTimers puts a front on it that any thread can use.
+ */
+
+namespace NylonSock
+{
+    class TimerWheel
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Callback = std::function<void()>;
+        typedef uint64_t TimerId;
+
+        //never handed out, so it can stand for "no timer"
+        static constexpr TimerId no_timer = 0;
+
+    private:
+        static constexpr unsigned int slot_bits = 6;
+        static constexpr uint64_t wheel_slots = 1 << slot_bits;
+        static constexpr uint64_t slot_mask = wheel_slots - 1;
+        static constexpr unsigned int wheel_levels = 6;
+
+        struct Timer;
+        using Slot = std::list<Timer>;
+
+        struct Timer
+        {
+            TimerId id;
+            uint64_t expire;
+            Callback func;
+            Slot* owner;
+        };
+
+        std::array<std::array<Slot, wheel_slots>, wheel_levels> _wheel;
+        std::unordered_map<TimerId, Slot::iterator> _timers;
+
+        Clock::time_point _start;
+        std::chrono::milliseconds _tick;
+        uint64_t _now;
+        TimerId _next_id;
+
+        void place(Slot& from, Slot::iterator it)
+        {
+            uint64_t delta = it->expire > _now ? it->expire - _now : 0;
+
+            unsigned int level = 0;
+            while(level + 1 < wheel_levels && delta >= (uint64_t{1} << (slot_bits * (level + 1) ) ) ) ++level;
+
+            //anything past the last level waits in it and gets placed again later
+            uint64_t max_delta = (uint64_t{1} << (slot_bits * wheel_levels) ) - 1;
+            uint64_t expire = delta > max_delta ? _now + max_delta : std::max(it->expire, _now);
+
+            Slot& to = _wheel[level][(expire >> (slot_bits * level) ) & slot_mask];
+            to.splice(to.end(), from, it);
+            it->owner = &to;
+        }
+
+        void cascade(unsigned int level)
+        {
+            Slot& slot = _wheel[level][(_now >> (slot_bits * level) ) & slot_mask];
+            while(!slot.empty() ) place(slot, slot.begin() );
+        }
+
+        void fire(Slot& slot)
+        {
+            //pulled out first so callbacks can schedule into the same slot safely
+            Slot due;
+            due.splice(due.end(), slot);
+            for(auto& it : due) it.owner = &due;
+
+            while(!due.empty() )
+            {
+                auto it = due.begin();
+                Callback func = std::move(it->func);
+                _timers.erase(it->id);
+                due.erase(it);
+
+                func();
+            }
+        }
+
+        void step()
+        {
+            ++_now;
+
+            //wrapped around, so pull the next slot of the level above down
+            for(unsigned int level = 1; level < wheel_levels; ++level)
+            {
+                if( (_now & ( (uint64_t{1} << (slot_bits * level) ) - 1) ) != 0) break;
+                cascade(level);
+            }
+
+            fire(_wheel[0][_now & slot_mask]);
+        }
+
+        uint64_t ticksAt(Clock::time_point when) const
+        {
+            if(when <= _start) return 0;
+            return std::chrono::duration_cast<std::chrono::milliseconds>(when - _start).count() / _tick.count();
+        }
+
+    public:
+        TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(1) ) :
+            _start(Clock::now() ), _tick(tick.count() > 0 ? tick : std::chrono::milliseconds(1) ),
+            _now(0), _next_id(1) {}
+
+        TimerWheel(const TimerWheel& that) = delete;
+        TimerWheel& operator=(const TimerWheel& that) = delete;
+
+        //runs func once delay has passed, rounded up to the next tick
+        TimerId schedule(std::chrono::milliseconds delay, Callback func)
+        {
+            uint64_t ticks = delay.count() <= 0 ? 1 :
+                (static_cast<uint64_t>(delay.count() ) + _tick.count() - 1) / _tick.count();
+
+            //catch up first so the delay counts from now, not from the last advance
+            uint64_t now = ticksAt(Clock::now() );
+            uint64_t expire = std::max(now, _now) + ticks;
+
+            TimerId id = _next_id++;
+            Slot pending;
+            pending.push_back({id, expire, std::move(func), &pending});
+            auto it = pending.begin();
+            place(pending, it);
+            _timers[id] = it;
+
+            return id;
+        }
+
+        //returns false if the timer already ran or never existed
+        bool cancel(TimerId id)
+        {
+            auto found = _timers.find(id);
+            if(found == _timers.end() ) return false;
+
+            auto it = found->second;
+            it->owner->erase(it);
+            _timers.erase(found);
+
+            return true;
+        }
+
+        //runs every timer that is due by now, returns how many ran
+        size_t advance(Clock::time_point now = Clock::now() )
+        {
+            uint64_t target = ticksAt(now);
+            size_t before = _timers.size();
+
+            //nothing to wait on, so skip straight there
+            if(_timers.empty() && target > _now) _now = target;
+            while(_now < target) step();
+
+            return before > _timers.size() ? before - _timers.size() : 0;
+        }
+
+        //ms until the loop should call advance again, or -1 if there is nothing to wait on
+        //may wake early when a higher level needs cascading, but never late
+        int timeout() const
+        {
+            if(_timers.empty() ) return -1;
+
+            for(uint64_t i = 1; i <= wheel_slots; ++i)
+            {
+                if(!_wheel[0][(_now + i) & slot_mask].empty() )
+                {
+                    //count from the wall clock, the wheel may be behind it
+                    auto when = _start + _tick * static_cast<int64_t>(_now + i);
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(when - Clock::now() ).count();
+                    return left > 0 ? static_cast<int>(left) : 0;
+                }
+
+                //the level above cascades on the wrap, check back then
+                if( ( (_now + i) & slot_mask) == 0) break;
+            }
+
+            uint64_t to_wrap = wheel_slots - (_now & slot_mask);
+            auto when = _start + _tick * static_cast<int64_t>(_now + to_wrap);
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(when - Clock::now() ).count();
+            return left > 0 ? static_cast<int>(left) : 0;
+        }
+
+        size_t size() const {return _timers.size();}
+    };
+
+    //setTimeout and friends for user code
+    //any thread may call them, but the callbacks always run on the loop thread
+    class LoopTimers
+    {
+    public:
+        typedef uint64_t TimerId;
+        using WakeFunc = std::function<void()>;
+
+    private:
+        TimerWheel& _wheel;
+        WakeFunc _wake;
+
+        std::atomic<std::thread::id> _owner;
+        std::atomic<TimerId> _next_id;
+
+        std::mutex _mtx;
+        std::vector<std::function<void()> > _pending;
+
+        //our ids to whatever the wheel currently calls them, loop thread only
+        std::unordered_map<TimerId, TimerWheel::TimerId> _live;
+
+        //runs op on the loop thread, now if we are already on it
+        void post(std::function<void()> op)
+        {
+            if(std::this_thread::get_id() == _owner.load() )
+            {
+                op();
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{_mtx};
+                _pending.push_back(std::move(op) );
+            }
+
+            //the loop might be asleep with a timeout that is now too long
+            if(_wake) _wake();
+        }
+
+        void arm(TimerId id, std::chrono::milliseconds delay, std::shared_ptr<TimerWheel::Callback> func, bool repeat)
+        {
+            _live[id] = _wheel.schedule(delay, [this, id, delay, func, repeat]()
+            {
+                //rearmed before the call so the callback can clear it
+                if(repeat) arm(id, delay, func, repeat);
+                else _live.erase(id);
+
+                (*func)();
+            });
+        }
+
+        TimerId add(unsigned int milli, TimerWheel::Callback func, bool repeat)
+        {
+            TimerId id = _next_id++;
+            auto shared = std::make_shared<TimerWheel::Callback>(std::move(func) );
+            auto delay = std::chrono::milliseconds(milli);
+            post([this, id, delay, shared, repeat]() {arm(id, delay, shared, repeat);});
+
+            return id;
+        }
+
+    public:
+        LoopTimers(TimerWheel& wheel, WakeFunc wake) :
+            _wheel(wheel), _wake(std::move(wake) ), _owner(std::thread::id{}), _next_id(1) {}
+
+        LoopTimers(const LoopTimers& that) = delete;
+        LoopTimers& operator=(const LoopTimers& that) = delete;
+
+        TimerId setTimeout(unsigned int milli, TimerWheel::Callback func)
+        {
+            return add(milli, std::move(func), false);
+        }
+
+        TimerId setInterval(unsigned int milli, TimerWheel::Callback func)
+        {
+            return add(milli, std::move(func), true);
+        }
+
+        void clearTimer(TimerId id)
+        {
+            post([this, id]()
+            {
+                auto found = _live.find(id);
+                if(found == _live.end() ) return;
+
+                _wheel.cancel(found->second);
+                _live.erase(found);
+            });
+        }
+
+        //called by the loop thread each time around, before advancing the wheel
+        void run()
+        {
+            _owner = std::this_thread::get_id();
+
+            std::vector<std::function<void()> > ops;
+            {
+                std::lock_guard<std::mutex> lock{_mtx};
+                ops.swap(_pending);
+            }
+
+            for(auto& it : ops) it();
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__TimerWheel__) */
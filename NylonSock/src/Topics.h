@@ -0,0 +1,218 @@
+//
+//  Topics.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Topics__
+#define __NylonSock__Topics__
+
+#include "Rooms.h"
+#include "Socket.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+ How topics are matched:
+
+ Topics are split into segments on '.', like game.42.score. A pattern segment
+ of * matches exactly one segment, and a final segment of # matches whatever is
+ left, nothing included, so game.# matches game as well as game.42.chat.
+
+ Patterns are kept in a trie of segments, so a publish walks the trie once,
+ trying the literal segment, * and # at every level, whatever the number of
+ patterns.
+ */
+
+namespace NylonSock
+{
+    //# somewhere other than the end of a pattern, or an empty topic
+    class BAD_PATTERN : public NylonSock::Error
+    {
+    public:
+        BAD_PATTERN(const std::string& what) : Error(what, true) {}
+    };
+
+    constexpr char topic_separator = '.';
+
+    inline std::vector<std::string> splitTopic(const std::string& topic)
+    {
+        if(topic.empty() ) throw BAD_PATTERN("A topic can't be empty.");
+
+        std::vector<std::string> segments;
+        size_t start = 0;
+        while(true)
+        {
+            size_t end = topic.find(topic_separator, start);
+            segments.push_back(topic.substr(start, end - start) );
+            if(end == std::string::npos) break;
+            start = end + 1;
+        }
+
+        return segments;
+    }
+
+    //who is subscribed to what, for Server::subscribe and Server::publish
+    template<class Member>
+    class Topics
+    {
+    private:
+        struct Node
+        {
+            std::unordered_map<std::string, std::unique_ptr<Node> > children;
+            //the * and # children, kept apart so matching never hashes them
+            std::unique_ptr<Node> any;
+            std::unique_ptr<Node> rest;
+
+            //the pattern ending here, empty while nobody is subscribed to it
+            std::string pattern;
+
+            bool unused() const {return pattern.empty() && children.empty() && any == nullptr && rest == nullptr;}
+        };
+
+        Node _root;
+
+        //subscribers of each pattern, which also handles a member leaving everything at once
+        Rooms<Member> _subs;
+
+        //adds an empty link for a new literal segment
+        static std::unique_ptr<Node>& child(Node& node, const std::string& segment)
+        {
+            if(segment == "*") return node.any;
+            if(segment == "#") return node.rest;
+            return node.children[segment];
+        }
+
+        static Node* find(Node& node, const std::string& segment)
+        {
+            if(segment == "*") return node.any.get();
+            if(segment == "#") return node.rest.get();
+
+            auto found = node.children.find(segment);
+            return found == node.children.end() ? nullptr : found->second.get();
+        }
+
+        static void match(const Node& node, const std::vector<std::string>& segments, size_t i,
+            std::vector<const Node*>& found)
+        {
+            if(node.rest != nullptr && !node.rest->pattern.empty() ) found.push_back(node.rest.get() );
+
+            if(i == segments.size() )
+            {
+                if(!node.pattern.empty() ) found.push_back(&node);
+                return;
+            }
+
+            auto literal = node.children.find(segments[i]);
+            if(literal != node.children.end() ) match(*literal->second, segments, i + 1, found);
+            if(node.any != nullptr) match(*node.any, segments, i + 1, found);
+        }
+
+        //takes the pattern's node out of the trie, and any parents left with nothing in them
+        void prune(const std::string& pattern)
+        {
+            auto segments = splitTopic(pattern);
+
+            std::vector<std::pair<Node*, const std::string*> > path;
+            Node* node = &_root;
+            for(auto& it : segments)
+            {
+                Node* next = find(*node, it);
+                if(next == nullptr) return;
+
+                path.emplace_back(node, &it);
+                node = next;
+            }
+            node->pattern.clear();
+
+            for(auto it = path.rbegin(); it != path.rend(); ++it)
+            {
+                Node& parent = *it->first;
+                const std::string& segment = *it->second;
+                if(!find(parent, segment)->unused() ) return;
+
+                if(segment == "*") parent.any = nullptr;
+                else if(segment == "#") parent.rest = nullptr;
+                else parent.children.erase(segment);
+            }
+        }
+
+    public:
+        //false if member was already subscribed to pattern
+        bool subscribe(Member& member, const std::string& pattern)
+        {
+            auto segments = splitTopic(pattern);
+            for(size_t i = 0; i + 1 < segments.size(); ++i)
+            {
+                if(segments[i] == "#") throw BAD_PATTERN("# has to be the last segment of " + pattern + ".");
+            }
+
+            if(!_subs.join(member, pattern) ) return false;
+
+            Node* node = &_root;
+            for(auto& it : segments)
+            {
+                auto& next = child(*node, it);
+                if(next == nullptr) next = std::make_unique<Node>();
+                node = next.get();
+            }
+            node->pattern = pattern;
+
+            return true;
+        }
+
+        //false if member wasn't subscribed to pattern
+        bool unsubscribe(const Member& member, const std::string& pattern)
+        {
+            if(!_subs.leave(member, pattern) ) return false;
+            if(_subs.members(pattern) == nullptr) prune(pattern);
+
+            return true;
+        }
+
+        //for when member disconnects
+        void unsubscribeAll(const Member& member)
+        {
+            for(auto& it : _subs.leaveAll(member) ) prune(it);
+        }
+
+        //everyone subscribed to a pattern matching topic, each once
+        std::vector<Member*> subscribers(const std::string& topic) const
+        {
+            std::vector<const Node*> found;
+            match(_root, splitTopic(topic), 0, found);
+
+            std::vector<Member*> result;
+            if(found.size() == 1)
+            {
+                result = *_subs.members(found.front()->pattern);
+                return result;
+            }
+
+            //a member may be subscribed to more than one of the patterns
+            size_t total = 0;
+            for(auto node : found) total += _subs.members(node->pattern)->size();
+            result.reserve(total);
+
+            std::unordered_set<Member*> seen;
+            seen.reserve(total);
+            for(auto node : found)
+            {
+                for(auto it : *_subs.members(node->pattern) )
+                {
+                    if(seen.insert(it).second) result.push_back(it);
+                }
+            }
+
+            return result;
+        }
+
+        //patterns anyone is subscribed to
+        size_t size() const {return _subs.size();}
+    };
+}
+
+#endif /* defined(__NylonSock__Topics__) */
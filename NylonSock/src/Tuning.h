@@ -0,0 +1,177 @@
+//
+//  Tuning.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Tuning__
+#define __NylonSock__Tuning__
+
+#include "Socket.h"
+
+#ifdef UNIX_HEADER
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+/*
+ How tuning works:
+
+ setTuning applies a TuningOptions to a Server's listener and to every tcp
+ connection it accepts, or to a Client's connection, again after each
+ reconnect. Unix domain sockets and in-process connections are left alone.
+ Fields left at 0 or false leave the system's default. lowLatency() and
+ bulk() are the two profiles, a starting point to change fields on.
+
+ no_delay turns off Nagle, so a small emit goes out right away rather than
+ waiting for the ack of the one before it, which the peer may hold back for
+ up to 40ms. A loop already writes each pass's frames in one send, so
+ turning it off costs few extra packets.
+
+ send_buffer and receive_buffer set SO_SNDBUF and SO_RCVBUF. On linux that
+ turns off the kernel's own sizing of the buffer, which already grows it up
+ to net.ipv4.tcp_rmem, so only set them to go past that, or to cap memory.
+ Set on the listener, they are in place before the handshake picks the
+ window scale.
+
+ defer_accept has the listener hold a connection until its first bytes
+ arrive, or that many seconds pass. A Client only speaks first with
+ reliable delivery, so with anything else it only delays the accept.
+ fast_open lets a connecting peer that was here before send its first bytes
+ with the SYN. On the listener it is the queue length for such connections,
+ and needs bit 2 of net.ipv4.tcp_fastopen. A Client's first connect is made
+ by its constructor, so only its reconnects use it.
+
+ user_timeout drops a connection whose sent bytes go unacknowledged for that
+ many ms, instead of linux's retransmits running for minutes. keepalive has
+ the kernel probe a quiet connection after keepalive_idle seconds, every
+ keepalive_interval, and drop it after keepalive_count go unanswered.
+ */
+
+namespace NylonSock
+{
+    //settings for Server::setTuning and Client::setTuning
+    struct TuningOptions
+    {
+        //TCP_NODELAY, sending small emits straight away instead of batching them with Nagle
+        bool no_delay = false;
+
+        //bytes for SO_SNDBUF and SO_RCVBUF, 0 to let the system size them
+        int send_buffer = 0;
+        int receive_buffer = 0;
+
+        //seconds TCP_DEFER_ACCEPT holds a connection until its first bytes, 0 for off. Only on linux
+        int defer_accept = 0;
+
+        //TCP_FASTOPEN queue on the listener, reconnects with TCP_FASTOPEN_CONNECT, 0 for off. Only on linux
+        int fast_open = 0;
+
+        //ms TCP_USER_TIMEOUT lets sent bytes go unacknowledged, 0 for the system's. Only on linux
+        unsigned int user_timeout = 0;
+
+        //seconds of quiet before SO_KEEPALIVE probes, 0 for off
+        int keepalive_idle = 0;
+        int keepalive_interval = 0;
+        int keepalive_count = 0;
+
+        //small messages that should go right away, on peers that notice a dead connection quickly
+        static TuningOptions lowLatency()
+        {
+            TuningOptions opts;
+            opts.no_delay = true;
+            opts.fast_open = 256;
+            opts.user_timeout = 10000;
+            opts.keepalive_idle = 10;
+            opts.keepalive_interval = 5;
+            opts.keepalive_count = 3;
+            return opts;
+        }
+
+        //big messages, where the window matters more than each packet
+        static TuningOptions bulk()
+        {
+            TuningOptions opts;
+            opts.send_buffer = 4 << 20;
+            opts.receive_buffer = 4 << 20;
+            opts.keepalive_idle = 60;
+            opts.keepalive_interval = 10;
+            opts.keepalive_count = 5;
+            return opts;
+        }
+    };
+
+    namespace Tune
+    {
+        inline void set(const Socket& sock, int level, int name, int value)
+        {
+            setsockopt(sock, level, name, &value, sizeof(value) );
+        }
+
+        //what a listener and a connection share. Throws if the system refuses one
+        inline void common(const Socket& sock, const TuningOptions& opts)
+        {
+            if(opts.send_buffer > 0) set(sock, SOL_SOCKET, SO_SNDBUF, opts.send_buffer);
+            if(opts.receive_buffer > 0) set(sock, SOL_SOCKET, SO_RCVBUF, opts.receive_buffer);
+            if(opts.no_delay) set(sock, IPPROTO_TCP, TCP_NODELAY, 1);
+#ifdef TCP_USER_TIMEOUT
+            if(opts.user_timeout > 0) set(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(opts.user_timeout) );
+#endif
+            if(opts.keepalive_idle <= 0) return;
+
+            set(sock, SOL_SOCKET, SO_KEEPALIVE, 1);
+#ifdef TCP_KEEPIDLE
+            set(sock, IPPROTO_TCP, TCP_KEEPIDLE, opts.keepalive_idle);
+#endif
+#ifdef TCP_KEEPINTVL
+            if(opts.keepalive_interval > 0) set(sock, IPPROTO_TCP, TCP_KEEPINTVL, opts.keepalive_interval);
+#endif
+#ifdef TCP_KEEPCNT
+            if(opts.keepalive_count > 0) set(sock, IPPROTO_TCP, TCP_KEEPCNT, opts.keepalive_count);
+#endif
+        }
+    }
+
+    //tunes a tcp listener, so connections it accepts start out that way. Throws if the system refuses
+    inline void tuneListener(const Socket& sock, const TuningOptions& opts)
+    {
+        Tune::common(sock, opts);
+#ifdef TCP_DEFER_ACCEPT
+        if(opts.defer_accept > 0) Tune::set(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts.defer_accept);
+#endif
+#ifdef TCP_FASTOPEN
+        if(opts.fast_open > 0) Tune::set(sock, IPPROTO_TCP, TCP_FASTOPEN, opts.fast_open);
+#endif
+    }
+
+    //tunes a tcp connection. False if the system refused something, which is left as it was
+    inline bool tuneConnection(const Socket& sock, const TuningOptions& opts)
+    {
+        try
+        {
+            Tune::common(sock, opts);
+        }
+        catch(NylonSock::Error& e)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    //has a socket that isn't connected yet send its first bytes with the SYN, if opts asks for it
+    inline void tuneConnect(const Socket& sock, const TuningOptions& opts)
+    {
+#ifdef TCP_FASTOPEN_CONNECT
+        if(opts.fast_open <= 0) return;
+        try
+        {
+            Tune::set(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+        }
+        catch(NylonSock::Error& e)
+        {
+            //an older kernel connects the usual way
+        }
+#endif
+    }
+}
+
+#endif /* defined(__NylonSock__Tuning__) */
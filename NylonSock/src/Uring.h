@@ -0,0 +1,766 @@
+//
+//  Uring.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Uring__
+#define __NylonSock__Uring__
+
+#include "Affinity.h"
+#include "Socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+//multishot recv is the newest thing used, so headers that have it have everything
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+#define NYLONSOCK_URING
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ How the io_uring loop works:
+
+ With setUring, a Server or Client loop waits on an io_uring instead of
+ poll. Each tcp socket gets one multishot recv, which stays armed and has the
+ kernel put whatever arrives into a ring of buffers it picks from, so reading
+ costs no system call of its own. The listener gets one multishot accept, and
+ the waker one multishot poll. Anything else the loop waits on, like a socket
+ draining or a unix domain socket, is polled for once per pass, queued along
+ with the wait. A busy loop ends up making one io_uring_enter per pass,
+ whatever the number of messages in it.
+
+ Writes still go straight to the socket, as emit has to know what it took.
+ Instead, replies written while a connection's frames are handled collect in
+ its buffer and go out in one send once they are all handled.
+
+ A recv holds onto its socket until it is cancelled, so a connection that is
+ dropped is forgotten, which cancels it, before the socket can really close.
+ While whole frames are waiting their turn, the recv is cancelled as well, so
+ tcp holds the peer back the same as it does with poll. A recv reads all the
+ socket has, so a socket is handed at most max_handed bytes a pass, and the
+ recv stops until the rest is handed over.
+
+ Needs linux 6.0. On anything older, or when io_uring is turned off, setUring
+ leaves the loop on poll.
+ */
+
+namespace NylonSock
+{
+    //settings for Server::setUring and Client::setUring
+    struct UringOptions
+    {
+        //submission queue entries, the completion queue gets four times as many
+        unsigned int entries = 256;
+
+        //buffers the kernel receives into, a power of two, and the bytes in each
+        unsigned int buffers = 512;
+        unsigned int buffer_size = 16384;
+
+        //replies written while a connection's frames are handled go out in one send after
+        bool batch_sends = true;
+    };
+
+#ifdef NYLONSOCK_URING
+    constexpr bool uring_supported = true;
+#else
+    constexpr bool uring_supported = false;
+#endif
+
+    //an io_uring and a ring of buffers for its recvs, on raw system calls so there is nothing to link
+    class Uring
+    {
+    public:
+        struct Completion
+        {
+            uint64_t user_data;
+            int32_t res;
+            uint32_t flags;
+
+#ifdef NYLONSOCK_URING
+            //still armed, more completions of the same request follow
+            bool more() const {return (flags & IORING_CQE_F_MORE) != 0;}
+            bool hasBuffer() const {return (flags & IORING_CQE_F_BUFFER) != 0;}
+            uint16_t bufferId() const {return static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);}
+#else
+            bool more() const {return false;}
+            bool hasBuffer() const {return false;}
+            uint16_t bufferId() const {return 0;}
+#endif
+        };
+
+#ifdef NYLONSOCK_URING
+    private:
+        static constexpr uint16_t buffer_group = 0;
+
+        int _fd;
+
+        void* _rings;
+        size_t _rings_size;
+        io_uring_sqe* _sqes;
+        size_t _sqes_size;
+
+        uint32_t* _sq_head;
+        uint32_t* _sq_tail;
+        uint32_t* _sq_flags;
+        uint32_t _sq_mask;
+        uint32_t _sq_entries;
+        uint32_t* _cq_head;
+        uint32_t* _cq_tail;
+        uint32_t _cq_mask;
+        io_uring_cqe* _cqes;
+
+        io_uring_buf_ring* _buf_ring;
+        size_t _buf_ring_size;
+        char* _buffers;
+        size_t _buffers_size;
+        uint32_t _buf_mask;
+        uint16_t _buf_tail;
+        unsigned int _buffer_size;
+
+        static size_t pageRound(size_t size)
+        {
+            constexpr size_t page_size = 4096;
+            return (size + page_size - 1) / page_size * page_size;
+        }
+
+        void release()
+        {
+            if(_buffers != nullptr) ::munmap(_buffers, _buffers_size);
+            if(_buf_ring != nullptr) ::munmap(_buf_ring, _buf_ring_size);
+            if(_sqes != nullptr) ::munmap(_sqes, _sqes_size);
+            if(_rings != nullptr) ::munmap(_rings, _rings_size);
+            if(_fd >= 0) ::close(_fd);
+        }
+
+        io_uring_sqe& next()
+        {
+            //full, so hand the kernel what it has
+            if(_sq_entries - (*_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) ) == 0) enter(0);
+            if(_sq_entries - (*_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) ) == 0)
+            {
+                throw Error("The io_uring submission queue is stuck", true);
+            }
+
+            //the array is set up to map each entry to itself
+            io_uring_sqe& sqe = _sqes[*_sq_tail & _sq_mask];
+            std::memset(&sqe, 0, sizeof(sqe) );
+            __atomic_store_n(_sq_tail, *_sq_tail + 1, __ATOMIC_RELEASE);
+
+            return sqe;
+        }
+
+        //a multishot recv on a socketpair, which needs 6.0. Anything older fails somewhere along the way
+        void probe()
+        {
+            constexpr uint64_t probe_data = ~uint64_t{0};
+            auto socks = socketpair();
+            recv(socks.first.port(), probe_data);
+            if(::send(socks.second.port(), "x", 1, 0) != 1) throw Error("Failed to probe io_uring");
+
+            bool works = false;
+            bool armed = true;
+            bool cancelled = false;
+            for(int i = 0; i < 10 && armed; ++i)
+            {
+                enter(100);
+                reap([&](const Completion& c)
+                {
+                    if(c.user_data != probe_data) return;
+                    if(c.hasBuffer() ) recycle(c.bufferId() );
+                    if(c.res == 1 && c.more() ) works = true;
+                    if(!c.more() ) armed = false;
+                });
+
+                if(armed && !cancelled) cancel(probe_data);
+                cancelled = true;
+            }
+
+            if(!works || armed) throw Error("This kernel's io_uring has no multishot recv", true);
+        }
+
+    public:
+        explicit Uring(const UringOptions& opts) : _fd(-1), _rings(nullptr), _sqes(nullptr), _buf_ring(nullptr),
+            _buffers(nullptr), _buf_tail(0), _buffer_size(opts.buffer_size)
+        {
+            try
+            {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params) );
+                params.flags = IORING_SETUP_CQSIZE;
+                params.cq_entries = 4 * opts.entries;
+
+                _fd = static_cast<int>(::syscall(__NR_io_uring_setup, opts.entries, &params) );
+                if(_fd < 0) throw Error("Failed to set up io_uring");
+
+                constexpr uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+                if( (params.features & needed) != needed) throw Error("This kernel's io_uring is too old", true);
+
+                _rings_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                    params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe) );
+                _rings = ::mmap(nullptr, _rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+                    IORING_OFF_SQ_RING);
+                if(_rings == MAP_FAILED)
+                {
+                    _rings = nullptr;
+                    throw Error("Failed to map the io_uring");
+                }
+
+                _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+                void* sqes = ::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+                    IORING_OFF_SQES);
+                if(sqes == MAP_FAILED) throw Error("Failed to map the io_uring");
+                _sqes = static_cast<io_uring_sqe*>(sqes);
+
+                char* rings = static_cast<char*>(_rings);
+                _sq_head = reinterpret_cast<uint32_t*>(rings + params.sq_off.head);
+                _sq_tail = reinterpret_cast<uint32_t*>(rings + params.sq_off.tail);
+                _sq_flags = reinterpret_cast<uint32_t*>(rings + params.sq_off.flags);
+                _sq_mask = *reinterpret_cast<uint32_t*>(rings + params.sq_off.ring_mask);
+                _sq_entries = params.sq_entries;
+                _cq_head = reinterpret_cast<uint32_t*>(rings + params.cq_off.head);
+                _cq_tail = reinterpret_cast<uint32_t*>(rings + params.cq_off.tail);
+                _cq_mask = *reinterpret_cast<uint32_t*>(rings + params.cq_off.ring_mask);
+                _cqes = reinterpret_cast<io_uring_cqe*>(rings + params.cq_off.cqes);
+
+                uint32_t* array = reinterpret_cast<uint32_t*>(rings + params.sq_off.array);
+                for(uint32_t i = 0; i < _sq_entries; ++i) array[i] = i;
+
+                //the buffers the recvs pick from
+                uint32_t count = 1;
+                while(count < opts.buffers && count < (1u << 15) ) count <<= 1;
+                _buf_mask = count - 1;
+
+                _buf_ring_size = pageRound(count * sizeof(io_uring_buf) );
+                void* buf_ring = ::mmap(nullptr, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(buf_ring == MAP_FAILED) throw Error("Failed to make the io_uring buffers");
+                _buf_ring = static_cast<io_uring_buf_ring*>(buf_ring);
+
+                _buffers_size = pageRound(static_cast<size_t>(count) * _buffer_size);
+                void* buffers = ::mmap(nullptr, _buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(buffers == MAP_FAILED) throw Error("Failed to make the io_uring buffers");
+                _buffers = static_cast<char*>(buffers);
+
+                io_uring_buf_reg reg;
+                std::memset(&reg, 0, sizeof(reg) );
+                reg.ring_addr = reinterpret_cast<uint64_t>(_buf_ring);
+                reg.ring_entries = count;
+                reg.bgid = buffer_group;
+                if(::syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+                {
+                    throw Error("Failed to register the io_uring buffers");
+                }
+
+                for(uint32_t i = 0; i < count; ++i) recycle(static_cast<uint16_t>(i) );
+
+                probe();
+            }
+            catch(NylonSock::Error& e)
+            {
+                release();
+                throw;
+            }
+        }
+
+        ~Uring() {release();}
+
+        Uring(const Uring& that) = delete;
+        Uring& operator=(const Uring& that) = delete;
+
+        //submits what is queued, then waits up to timeout ms for a completion, -1 for as long as it takes
+        void enter(int timeout)
+        {
+            uint32_t submit = *_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+
+            //completions the kernel couldn't fit wait for a call to flush them
+            bool overflow = (__atomic_load_n(_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) != 0;
+            if(submit == 0 && timeout == 0 && !overflow) return;
+
+            unsigned int flags = 0;
+            unsigned int wait = 0;
+            __kernel_timespec ts = {timeout / 1000, (timeout % 1000) * 1000000LL};
+            io_uring_getevents_arg arg;
+            std::memset(&arg, 0, sizeof(arg) );
+            if(timeout != 0 || overflow)
+            {
+                flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+                wait = timeout != 0 ? 1 : 0;
+                if(timeout > 0) arg.ts = reinterpret_cast<uint64_t>(&ts);
+            }
+
+            long result = ::syscall(__NR_io_uring_enter, _fd, submit, wait, flags,
+                flags & IORING_ENTER_EXT_ARG ? &arg : nullptr, sizeof(arg) );
+
+            //a signal or a timeout is the same as nothing happening, and busy means completions are waiting
+            if(result < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+            {
+                throw Error("Failed to enter io_uring");
+            }
+        }
+
+        //calls func on each completion, oldest first
+        template<class Func>
+        void reap(Func func)
+        {
+            uint32_t head = *_cq_head;
+            uint32_t tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+            for(; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+                Completion c{cqe.user_data, cqe.res, cqe.flags};
+                __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+
+                func(c);
+            }
+        }
+
+        //what a recv completion with IORING_CQE_F_BUFFER put in buffer id
+        const char* buffer(uint16_t id) const {return _buffers + static_cast<size_t>(id) * _buffer_size;}
+
+        //hands buffer id back to the kernel, once what was in it is copied out
+        void recycle(uint16_t id)
+        {
+            //not _buf_ring->bufs, which the header's flex array macro moves to 8 bytes in under c++
+            io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(_buf_ring)[_buf_tail & _buf_mask];
+            buf.addr = reinterpret_cast<uint64_t>(buffer(id) );
+            buf.len = _buffer_size;
+            buf.bid = id;
+            ++_buf_tail;
+            __atomic_store_n(&_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE);
+        }
+
+        //a completion for each connection accepted on port, until one comes without IORING_CQE_F_MORE
+        void accept(int port, uint64_t user_data)
+        {
+            auto& sqe = next();
+            sqe.opcode = IORING_OP_ACCEPT;
+            sqe.fd = port;
+            sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe.user_data = user_data;
+        }
+
+        //a completion for each read into one of the buffers, until one comes without IORING_CQE_F_MORE
+        void recv(int port, uint64_t user_data)
+        {
+            auto& sqe = next();
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = port;
+            sqe.ioprio = IORING_RECV_MULTISHOT;
+            sqe.flags = IOSQE_BUFFER_SELECT;
+            sqe.buf_group = buffer_group;
+            sqe.user_data = user_data;
+        }
+
+        void poll(int port, short events, uint64_t user_data, bool multishot)
+        {
+            auto& sqe = next();
+            sqe.opcode = IORING_OP_POLL_ADD;
+            sqe.fd = port;
+            sqe.poll32_events = static_cast<uint16_t>(events);
+            sqe.len = multishot ? IORING_POLL_ADD_MULTI : 0;
+            sqe.user_data = user_data;
+        }
+
+        //the removal's own completion comes with user_data 0
+        void pollRemove(uint64_t user_data)
+        {
+            auto& sqe = next();
+            sqe.opcode = IORING_OP_POLL_REMOVE;
+            sqe.addr = user_data;
+        }
+
+        //the cancel's own completion comes with user_data 0
+        void cancel(uint64_t user_data)
+        {
+            auto& sqe = next();
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.addr = user_data;
+        }
+
+        //moves the buffer pool to node, see Affinity.h. False if it stayed where it was
+        bool placeOn(int node)
+        {
+            bool moved = placeOnNode(_buffers, _buffers_size, node);
+            return placeOnNode(_buf_ring, _buf_ring_size, node) && moved;
+        }
+#else
+    public:
+        explicit Uring(const UringOptions& opts) {throw Error("io_uring needs linux 6.0", true);}
+
+        void enter(int timeout) {}
+
+        template<class Func>
+        void reap(Func func) {}
+
+        const char* buffer(uint16_t id) const {return nullptr;}
+        void recycle(uint16_t id) {}
+        void accept(int port, uint64_t user_data) {}
+        void recv(int port, uint64_t user_data) {}
+        void poll(int port, short events, uint64_t user_data, bool multishot) {}
+        void pollRemove(uint64_t user_data) {}
+        void cancel(uint64_t user_data) {}
+        bool placeOn(int node) {return false;}
+#endif
+    };
+
+    //the waiting part of a Server or Client loop, see the top of this file. Sock is a
+    //ClientSocket. Only touched by the loop thread
+    template<class Sock>
+    class UringLoop
+    {
+    private:
+        enum Kind : uint64_t
+        {
+            ignored, recv_kind, poll_kind, accept_kind, wake_kind
+        };
+
+        static constexpr unsigned int kind_bits = 3;
+        //a recv's tag is its socket's token and which recv of that socket it is
+        static constexpr unsigned int arm_bits = 16;
+        //a poll's tag is the pass it was made in and its place in the PollFDs
+        static constexpr unsigned int index_bits = 37;
+        static constexpr uint64_t pass_mask = (uint64_t{1} << (64 - kind_bits - index_bits) ) - 1;
+
+        static uint64_t tag(uint64_t value, Kind kind) {return value << kind_bits | kind;}
+
+        //most bytes a socket is handed in one pass, as a recv only stops once the socket is empty
+        static constexpr size_t max_handed = 1 << 18;
+
+        //a socket we recv for
+        struct Watch
+        {
+            Sock* sock;
+            SOCKET port;
+            uint64_t arm;
+            bool receiving;
+
+            //what came past max_handed, handed over in later passes, and the peer closing after it
+            std::string pending;
+            size_t pending_at;
+            bool ended;
+
+            uint64_t handed_pass;
+            size_t handed;
+        };
+
+        Uring _ring;
+
+        //by token, which is never reused, so a late completion can't land on the wrong socket
+        std::unordered_map<uint64_t, Watch> _watches;
+        std::unordered_map<const Sock*, uint64_t> _tokens;
+        //and by port, as polls mustn't report what the recv reads
+        std::unordered_map<SOCKET, uint64_t> _ports;
+        uint64_t _next_token;
+
+        SOCKET _listener;
+        bool _accepting;
+        std::vector<SOCKET> _accepted;
+
+        SOCKET _waker;
+        bool _waking;
+
+        //the pass being waited on, and its one shot polls that haven't fired
+        uint64_t _pass;
+        pollfd* _fds;
+        std::vector<bool> _polling;
+        size_t _waker_at;
+
+        //a socket was handed something before the wait, which mustn't hold it up
+        bool _handing;
+
+        uint64_t recvTag(uint64_t token, const Watch& watch)
+        {
+            return tag(token << arm_bits | (watch.arm & ( (uint64_t{1} << arm_bits) - 1) ), recv_kind);
+        }
+
+        //true if the loop has something to do about it
+        bool received(uint64_t value, const Uring::Completion& c)
+        {
+            bool more = c.more();
+            auto found = _watches.find(value >> arm_bits);
+            if(found == _watches.end() )
+            {
+                if(c.hasBuffer() ) _ring.recycle(c.bufferId() );
+                return false;
+            }
+
+            Watch& watch = found->second;
+            if(watch.handed_pass != _pass)
+            {
+                watch.handed_pass = _pass;
+                watch.handed = 0;
+            }
+
+            //a cancelled one finishing after its replacement started is no news
+            bool current = (value & ( (uint64_t{1} << arm_bits) - 1) ) == (watch.arm & ( (uint64_t{1} << arm_bits) - 1) );
+            if(c.hasBuffer() )
+            {
+                const char* data = _ring.buffer(c.bufferId() );
+                size_t size = c.res > 0 ? static_cast<size_t>(c.res) : 0;
+                if(watch.pending.empty() && watch.handed < max_handed)
+                {
+                    watch.sock->received(data, size);
+                    watch.handed += size;
+                }
+                else
+                {
+                    //the recv reads all the socket has, so it is stopped until this is handed over
+                    watch.pending.append(data, size);
+                    if(more && current && watch.receiving)
+                    {
+                        _ring.cancel(recvTag(found->first, watch) );
+                        watch.receiving = false;
+                    }
+                }
+                _ring.recycle(c.bufferId() );
+            }
+
+            if(!more && current) watch.receiving = false;
+
+            //out of buffers or cancelled, it is started again next pass if still wanted
+            if(!more && c.res != -ENOBUFS && c.res != -ECANCELED && c.res <= 0) watch.ended = true;
+
+            return c.res != -ECANCELED || c.hasBuffer();
+        }
+
+        //gives the socket what is pending, or tells it the peer closed once nothing is
+        void hand(Watch& watch)
+        {
+            size_t left = watch.pending.size() - watch.pending_at;
+            if(left > 0)
+            {
+                size_t size = left < max_handed ? left : max_handed;
+                watch.sock->received(&watch.pending[watch.pending_at], size);
+                watch.pending_at += size;
+                if(watch.pending_at == watch.pending.size() )
+                {
+                    watch.pending.clear();
+                    watch.pending_at = 0;
+                }
+                _handing = true;
+            }
+            else if(watch.ended)
+            {
+                watch.sock->receiveEnded();
+                _handing = true;
+            }
+        }
+
+        bool polled(uint64_t value, const Uring::Completion& c)
+        {
+            size_t index = static_cast<size_t>(value & ( (uint64_t{1} << index_bits) - 1) );
+            if( (value >> index_bits) != (_pass & pass_mask) || index >= _polling.size() || !_polling[index]) return false;
+
+            _polling[index] = false;
+            if(c.res <= 0) return false;
+
+            short revents = static_cast<short>(c.res);
+            if(_ports.count(_fds[index].fd) > 0) revents &= ~(POLLIN | POLLHUP | POLLERR);
+            _fds[index].revents = revents;
+
+            return true;
+        }
+
+    public:
+        //throws when the kernel can't do it, so the caller can stay on poll
+        explicit UringLoop(const UringOptions& opts) : _ring(opts), _next_token(1), _listener(-1), _accepting(false),
+            _waker(-1), _waking(false), _pass(0), _fds(nullptr), _waker_at(0), _handing(false) {}
+
+        //accepted connections turn up in accepted()
+        void listen(const Socket& listener) {_listener = listener.port();}
+
+        //stops accepting, for a listener that is handed on. What was accepted still turns up in accepted()
+        void unlisten()
+        {
+            if(_accepting)
+            {
+                _ring.cancel(tag(0, accept_kind) );
+                _ring.enter(0);
+            }
+            _listener = -1;
+        }
+
+        //wait reports port readable in the PollFDs when it is, with no poll per pass
+        void wakeOn(SOCKET port) {_waker = port;}
+
+        //connections accepted during the last wait, for the caller to take
+        std::vector<SOCKET>& accepted() {return _accepted;}
+
+        //moves the buffers the kernel reads into to node, for a loop thread that runs there
+        bool placeOn(int node) {return _ring.placeOn(node);}
+
+        //call for each socket once pollInto added it to ps, before wait
+        void watch(Sock& sock, const PollFDs& ps)
+        {
+            SOCKET port = sock.port();
+
+            //a Client's socket is swapped for a new one when it reconnects
+            auto found = _tokens.find(&sock);
+            if(found != _tokens.end() && _watches[found->second].port != port)
+            {
+                forget(sock);
+                found = _tokens.end();
+            }
+
+            //unix domain sockets may carry file descriptors, which recvmsg has to pick up
+            if(port < 0 || sock.local() ) return;
+
+            if(found == _tokens.end() )
+            {
+                uint64_t token = _next_token++;
+                _watches[token] = Watch{&sock, port, 0, false, {}, 0, false, 0, 0};
+                _ports[port] = token;
+                found = _tokens.emplace(&sock, token).first;
+            }
+
+            //pollInto leaves reading out while whole frames wait their turn
+            Watch& watch = _watches[found->second];
+            bool wanted = ps.get_event(port, PollFDs::Events::NSPOLLIN);
+            if(wanted) hand(watch);
+
+            bool reading = wanted && watch.pending.empty() && !watch.ended;
+            if(reading && !watch.receiving)
+            {
+                ++watch.arm;
+                _ring.recv(port, recvTag(found->second, watch) );
+            }
+            if(!reading && watch.receiving) _ring.cancel(recvTag(found->second, watch) );
+            watch.receiving = reading;
+        }
+
+        //call once sock's socket is closed, or is about to be. What it still has coming is dropped
+        void forget(const Sock& sock)
+        {
+            auto found = _tokens.find(&sock);
+            if(found == _tokens.end() ) return;
+
+            auto watch = _watches.find(found->second);
+            if(watch->second.receiving)
+            {
+                _ring.cancel(recvTag(found->second, watch->second) );
+
+                //lets go of the socket now rather than whenever the loop next waits
+                _ring.enter(0);
+            }
+
+            _ports.erase(watch->second.port);
+            _watches.erase(watch);
+            _tokens.erase(found);
+        }
+
+        //as poll(ps, timeout), only the sockets watched were read already, and handed what came
+        //the first spin us of the wait are spent looking at the completion queue instead of sleeping
+        void wait(PollFDs& ps, int timeout, unsigned int spin = 0)
+        {
+            ++_pass;
+            if(_handing) timeout = 0;
+            _handing = false;
+
+            size_t count = ps.size();
+            _fds = count > 0 ? ps.get() : nullptr;
+            _polling.assign(count, false);
+            _waker_at = count;
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                pollfd& it = _fds[i];
+                it.revents = 0;
+                if(it.fd == _waker) _waker_at = i;
+                if(it.fd == _waker || it.fd == _listener) continue;
+
+                short events = it.events;
+                if(_ports.count(it.fd) > 0) events &= ~POLLIN;
+                if(events == 0) continue;
+
+                _ring.poll(it.fd, events, tag( (_pass & pass_mask) << index_bits | i, poll_kind), false);
+                _polling[i] = true;
+            }
+
+            if(_listener >= 0 && !_accepting)
+            {
+                _ring.accept(_listener, tag(0, accept_kind) );
+                _accepting = true;
+            }
+            if(_waker >= 0 && !_waking)
+            {
+                _ring.poll(_waker, POLLIN, tag(0, wake_kind), true);
+                _waking = true;
+            }
+
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout, 0) );
+            auto spin_end = std::chrono::steady_clock::now() + std::chrono::microseconds(spin);
+            bool news = false;
+            while(true)
+            {
+                //once the first enter has submitted what was queued, looking costs no system call
+                bool spinning = spin > 0 && timeout != 0 && std::chrono::steady_clock::now() < spin_end;
+                _ring.enter(spinning ? 0 : timeout);
+                _ring.reap([this, &news](const Uring::Completion& c)
+                {
+                    uint64_t value = c.user_data >> kind_bits;
+                    bool more = c.more();
+                    switch(c.user_data & ( (uint64_t{1} << kind_bits) - 1) )
+                    {
+                        case recv_kind:
+                            news |= received(value, c);
+                            break;
+                        case poll_kind:
+                            news |= polled(value, c);
+                            break;
+                        case accept_kind:
+                            if(c.res >= 0) _accepted.push_back(c.res);
+                            if(!more) _accepting = false;
+                            news = true;
+                            break;
+                        case wake_kind:
+                            if(c.res > 0 && _waker_at < _polling.size() ) _fds[_waker_at].revents = POLLIN;
+                            if(!more) _waking = false;
+                            news = true;
+                            break;
+                        default:
+                            break;
+                    }
+                });
+                if(news || timeout == 0) break;
+                if(spinning)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                //all that came was the last pass's polls going away, which doesn't end the wait
+                if(timeout > 0)
+                {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now() );
+                    if(left.count() <= 0) break;
+                    timeout = static_cast<int>(left.count() );
+                }
+            }
+
+            //the rest go, as each holds onto what it polls. Queued for the next wait
+            for(size_t i = 0; i < count; ++i)
+            {
+                if(_polling[i]) _ring.pollRemove(tag( (_pass & pass_mask) << index_bits | i, poll_kind) );
+            }
+            _fds = nullptr;
+        }
+    };
+}
+
+#endif /* defined(__NylonSock__Uring__) */
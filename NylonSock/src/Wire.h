@@ -0,0 +1,120 @@
+//
+//  Wire.h
+//  NylonSock
+//
+
+#ifndef __NylonSock__Wire__
+#define __NylonSock__Wire__
+
+#include "Socket.h"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+/*
+ How a frame looks on the wire:
+
+ bytes are assumed to be 8 bits
+ all integers are big endian
+
+ uint16_t of event name size in bytes
+ uint16_t of data size in bytes
+ event name
+ data
+
+ Event names starting with reserved_event_prefix belong to the library
+ (acks, handshakes, ...) and are never handed to on() functions.
+ */
+
+namespace NylonSock
+{
+    typedef uint16_t sock_size_type;
+    constexpr sock_size_type maximum_sock_val = std::numeric_limits<sock_size_type>::max();
+
+    constexpr size_t frame_header_size = 2 * sizeof(sock_size_type);
+
+    //largest data one emit may carry. Anything too big for a single frame is sent in chunks, see Outbox.h
+    constexpr size_t maximum_message_size = 64 * 1024 * 1024;
+
+    constexpr char reserved_event_prefix = '\x01';
+
+    inline bool isReservedEvent(const std::string& event_name)
+    {
+        return !event_name.empty() && event_name[0] == reserved_event_prefix;
+    }
+
+    template<typename T>
+    std::string packInt(T value)
+    {
+        std::string result(sizeof(T), '\0');
+        for(size_t i = sizeof(T); i > 0; --i)
+        {
+            result[i - 1] = static_cast<char>(value & 0xFF);
+            value = static_cast<T>(value >> 8);
+        }
+
+        return result;
+    }
+
+    template<typename T>
+    T unpackInt(const std::string& str, size_t pos = 0)
+    {
+        T result = 0;
+        for(size_t i = 0; i < sizeof(T); ++i)
+        {
+            result = static_cast<T>( (result << 8) | static_cast<uint8_t>(str[pos + i]) );
+        }
+
+        return result;
+    }
+
+    //returns false when the frame can't be described by the header
+    inline bool fitsFrame(const std::string& event_name, size_t data_size)
+    {
+        return event_name.size() <= maximum_sock_val && data_size <= maximum_sock_val;
+    }
+
+    //size of event + size of data + event + data
+    inline std::string encodeFrame(const std::string& event_name, const std::string& data)
+    {
+        std::string result;
+        result.reserve(frame_header_size + event_name.size() + data.size() );
+        result += packInt<sock_size_type>(static_cast<sock_size_type>(event_name.size() ) );
+        result += packInt<sock_size_type>(static_cast<sock_size_type>(data.size() ) );
+        result += event_name;
+        result += data;
+
+        return result;
+    }
+
+    //size of the frame starting at pos, or 0 if it hasn't fully arrived yet
+    inline size_t peekFrame(const std::string& buf, size_t pos)
+    {
+        if(buf.size() - pos < frame_header_size) return 0;
+
+        size_t frame_size = frame_header_size + unpackInt<sock_size_type>(buf, pos) +
+            unpackInt<sock_size_type>(buf, pos + sizeof(sock_size_type) );
+        return buf.size() - pos < frame_size ? 0 : frame_size;
+    }
+
+    //pulls one complete frame off the front of buf starting at pos
+    //returns false, leaving pos untouched, if the frame hasn't fully arrived yet
+    inline bool decodeFrame(const std::string& buf, size_t& pos, std::string& event_name, std::string& data)
+    {
+        if(buf.size() - pos < frame_header_size) return false;
+
+        size_t event_size = unpackInt<sock_size_type>(buf, pos);
+        size_t data_size = unpackInt<sock_size_type>(buf, pos + sizeof(sock_size_type) );
+        if(buf.size() - pos < frame_header_size + event_size + data_size) return false;
+
+        size_t start = pos + frame_header_size;
+        event_name.assign(buf, start, event_size);
+        data.assign(buf, start + event_size, data_size);
+        pos = start + event_size + data_size;
+
+        return true;
+    }
+}
+
+#endif /* defined(__NylonSock__Wire__) */
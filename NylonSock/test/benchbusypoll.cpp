@@ -0,0 +1,109 @@
+//
+//  benchbusypoll.cpp
+//  NylonSock
+//
+
+#include <NylonSock.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace NylonSock;
+using Clock = std::chrono::steady_clock;
+
+class BenchClient : public ClientSocket<BenchClient>
+{
+public:
+    BenchClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//cpu seconds this process has used, both loops and this thread together
+static double cpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void run(unsigned int spin, int port, int round_trips, int gap)
+{
+    BusyPollOptions opts;
+    opts.spin = spin;
+    opts.busy_poll = spin;
+
+    Server<BenchClient> server{port};
+    if(spin > 0) server.setBusyPoll(opts);
+    server.onConnect([](BenchClient& sock)
+    {
+        sock.on("ping", [](SockData data, BenchClient& sock) {sock.emit("pong", data);});
+    });
+    server.start();
+
+    Client<BenchClient> client{"127.0.0.1", port};
+    if(spin > 0) client.setBusyPoll(opts);
+    client.start();
+
+    std::vector<double> rtts;
+    rtts.reserve(round_trips);
+    std::atomic<int> received{0};
+    Clock::time_point sent;
+    client.on("pong", [&](SockData, BenchClient&)
+    {
+        rtts.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count() );
+        ++received;
+    });
+
+    //one ping at a time with a quiet gap after each, the way a game's input arrives,
+    //which is where a loop that has gone to sleep costs the most
+    auto wall = Clock::now();
+    double cpu = cpuSeconds();
+    for(int i = 0; i < round_trips; ++i)
+    {
+        sent = Clock::now();
+        client.emit("ping", {"x"});
+
+        auto give_up = Clock::now() + std::chrono::seconds(5);
+        while(received.load() <= i && Clock::now() < give_up) std::this_thread::sleep_for(std::chrono::microseconds(20) );
+        if(received.load() <= i) break;
+
+        std::this_thread::sleep_for(std::chrono::microseconds(gap) );
+    }
+    cpu = cpuSeconds() - cpu;
+    double seconds = std::chrono::duration<double>(Clock::now() - wall).count();
+
+    if(received.load() < round_trips)
+    {
+        std::printf("spin %4u us: timed out\n", spin);
+    }
+    else
+    {
+        std::sort(rtts.begin(), rtts.end() );
+        auto at = [&](double fraction) {return rtts[static_cast<size_t>(fraction * (rtts.size() - 1) )];};
+        std::printf("spin %4u us: rtt p50 %7.1f us  p99 %7.1f us  p99.9 %7.1f us  cpu %3.0f%%\n", spin, at(0.5), at(0.99),
+            at(0.999), 100 * cpu / seconds);
+    }
+
+    client.stop();
+    server.stop();
+}
+
+//p99 round trip time against the cpu it costs, over tcp loopback, for a few spin times
+//usage: BenchBusyPoll [port, 34910 by default] [us between pings, 1000 by default] [round trips, 2000 by default]
+int main(int argc, const char* argv[])
+{
+    int port = argc > 1 ? std::atoi(argv[1]) : 34910;
+    int gap = argc > 2 ? std::max(0, std::atoi(argv[2]) ) : 1000;
+    int round_trips = argc > 3 ? std::max(1, std::atoi(argv[3]) ) : 2000;
+
+    for(unsigned int spin : {0u, 10u, 50u, 200u, 2000u}) run(spin, port++, round_trips, gap);
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+//
+//  benchsharedmemory.cpp
+//  NylonSock
+//
+
+#include <NylonSock.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace NylonSock;
+using Clock = std::chrono::steady_clock;
+
+class BenchClient : public ClientSocket<BenchClient>
+{
+public:
+    BenchClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+struct Mode
+{
+    const char* name;
+    bool tcp;
+    bool shared_memory;
+    unsigned int spin;
+};
+
+static bool waitFor(std::function<bool ()> done, unsigned int milli = 10000)
+{
+    auto end = Clock::now() + std::chrono::milliseconds(milli);
+    while(!done() && Clock::now() < end) std::this_thread::sleep_for(std::chrono::microseconds(50) );
+    return done();
+}
+
+static void run(const Mode& mode, int port, int round_trips)
+{
+    std::string path = "/tmp/nylonsock-benchsharedmemory-" + std::to_string(::getpid() ) + "-" + std::to_string(port);
+    std::string address = mode.tcp ? std::to_string(port) : "unix:" + path;
+
+    SharedMemoryOptions opts;
+    opts.spin = mode.spin;
+
+    const int bulk = 4 * round_trips;
+    std::atomic<int> bulk_received{0};
+
+    Server<BenchClient> server{address};
+    if(mode.shared_memory) server.setSharedMemory(opts);
+    server.onConnect([&](BenchClient& sock)
+    {
+        sock.on("ping", [](SockData data, BenchClient& sock) {sock.emit("pong", data);});
+        sock.on("bulk", [&](SockData data, BenchClient& sock)
+        {
+            if(++bulk_received == bulk) sock.emit("bulk done", {""});
+        });
+    });
+    server.start();
+
+    Client<BenchClient> client{mode.tcp ? "127.0.0.1" : address, mode.tcp ? std::to_string(port) : ""};
+    if(mode.shared_memory) client.setSharedMemory(opts);
+    client.start();
+
+    //round trips one after another, each timed on its own, all on the client's loop
+    std::vector<double> rtts;
+    rtts.reserve(round_trips);
+    std::atomic<int> timed{0};
+    Clock::time_point sent;
+    std::atomic<bool> bulk_done{false};
+    client.on("pong", [&](SockData data, BenchClient& sock)
+    {
+        rtts.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count() );
+        if(++timed == round_trips) return;
+        sent = Clock::now();
+        sock.emit("ping", data);
+    });
+    client.on("bulk done", [&](SockData data, BenchClient& sock) {bulk_done = true;});
+
+    if(mode.shared_memory && !waitFor([&]() {return client.get().sharedMemory();}) )
+    {
+        std::printf("%-16s never switched to shared memory\n", mode.name);
+        return;
+    }
+
+    client.setTimeout(0, [&]()
+    {
+        sent = Clock::now();
+        client.get().emit("ping", {"x"});
+    });
+    waitFor([&]() {return timed.load() == round_trips;}, 60000);
+
+    const std::string payload(100, 'b');
+    auto start = Clock::now();
+    for(int i = 0; i < bulk; ++i) client.emit("bulk", {payload});
+    waitFor([&]() {return bulk_done.load();}, 60000);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if(timed.load() == round_trips)
+    {
+        std::sort(rtts.begin(), rtts.end() );
+        auto at = [&](double fraction) {return rtts[static_cast<size_t>(fraction * (rtts.size() - 1) )];};
+        std::printf("%-16s rtt p50 %7.2f us  p99 %7.2f us", mode.name, at(0.5), at(0.99) );
+    }
+    else std::printf("%-16s rtt timed out          ", mode.name);
+    if(bulk_done.load() ) std::printf("  bulk %10.0f msg/s\n", bulk / seconds);
+    else std::printf("  bulk timed out\n");
+
+    client.stop();
+    server.stop();
+}
+
+//ping pong round trips and one way bulk messages over tcp loopback, a unix domain
+//socket and the shared memory ring, with client and server in this process
+//usage: BenchSharedMemory [port, 34900 by default] [round trips, 50000 by default]
+int main(int argc, const char* argv[])
+{
+    int port = argc > 1 ? std::atoi(argv[1]) : 34900;
+    int round_trips = argc > 2 ? std::max(1, std::atoi(argv[2]) ) : 50000;
+
+    const std::vector<Mode> modes{
+        {"tcp loopback", true, false, 0},
+        {"unix", false, false, 0},
+        {"shm", false, true, 0},
+        {"shm spin 50us", false, true, 50}};
+
+    for(auto& it : modes) run(it, port++, round_trips);
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+//
+//  benchtopics.cpp
+//  NylonSock
+//
+
+#include <Topics.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+
+struct Member
+{
+    int id;
+};
+
+static double millisSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//subscribes, publishes to and unsubscribes a million subscriptions
+//usage: BenchTopics [1 in how many patterns has a wildcard, 10 by default]
+int main(int argc, const char* argv[])
+{
+    constexpr int members = 100000;
+    constexpr int subscriptions = 1000000;
+    constexpr int games = 10000;
+    constexpr int publishes = 10000;
+    const std::vector<std::string> channels{"score", "chat", "position", "state", "event"};
+
+    unsigned int wildcard_every = argc > 1 ? std::max(1, std::atoi(argv[1]) ) : 10;
+
+    std::mt19937 rng{37};
+    std::vector<Member> all(members);
+    for(int i = 0; i < members; ++i) all[i].id = i;
+
+    Topics<Member> topics;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < subscriptions; ++i)
+    {
+        std::string game = "game." + std::to_string(rng() % games);
+        std::string pattern;
+        switch(rng() % (2 * wildcard_every) )
+        {
+        case 0:
+            pattern = "game.*." + channels[rng() % channels.size()];
+            break;
+        case 1:
+            pattern = game + ".#";
+            break;
+        default:
+            pattern = game + "." + channels[rng() % channels.size()];
+        }
+        topics.subscribe(all[i % members], pattern);
+    }
+    std::cout << subscriptions << " subscriptions in " << millisSince(start) << " ms, " << topics.size() <<
+        " patterns" << std::endl;
+
+    size_t reached = 0;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < publishes; ++i)
+    {
+        reached += topics.subscribers("game." + std::to_string(rng() % games) + "." + channels[rng() % channels.size()]).size();
+    }
+    double took = millisSince(start);
+    std::cout << publishes << " publishes in " << took << " ms, " << 1000 * took / publishes << " us each, " <<
+        static_cast<double>(reached) / publishes << " subscribers each" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    for(auto& it : all) topics.unsubscribeAll(it);
+    std::cout << members << " members unsubscribed in " << millisSince(start) << " ms, " << topics.size() <<
+        " patterns left" << std::endl;
+
+    return 0;
+}
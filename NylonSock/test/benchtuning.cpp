@@ -0,0 +1,130 @@
+//
+//  benchtuning.cpp
+//  NylonSock
+//
+
+#include <NylonSock.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NylonSock;
+using Clock = std::chrono::steady_clock;
+
+class BenchClient : public ClientSocket<BenchClient>
+{
+public:
+    BenchClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+struct Profile
+{
+    const char* name;
+    //nullptr to leave the system's defaults
+    const TuningOptions* opts;
+};
+
+static bool waitFor(const std::atomic<int>& count, int target)
+{
+    auto give_up = Clock::now() + std::chrono::seconds(10);
+    while(count.load() < target && Clock::now() < give_up) std::this_thread::sleep_for(std::chrono::microseconds(10) );
+    return count.load() >= target;
+}
+
+//a message sent in two writes and then answered, which Nagle and delayed acks stall
+static void writeWriteRead(const Profile& profile, int port, int rounds)
+{
+    Server<BenchClient> server{port};
+    if(profile.opts != nullptr) server.setTuning(*profile.opts);
+    server.onConnect([](BenchClient& sock)
+    {
+        sock.on("first half", [](SockData, BenchClient&) {});
+        sock.on("second half", [](SockData data, BenchClient& sock) {sock.emit("answer", data);});
+    });
+    server.start();
+
+    Client<BenchClient> client{"127.0.0.1", port};
+    if(profile.opts != nullptr) client.setTuning(*profile.opts);
+    client.start();
+    std::atomic<int> answers{0};
+    client.on("answer", [&](SockData, BenchClient&) {++answers;});
+
+    std::vector<double> rtts;
+    for(int i = 0; i < rounds; ++i)
+    {
+        auto sent = Clock::now();
+        client.emit("first half", {"x"});
+        //long enough for the first write to have left on its own
+        std::this_thread::sleep_for(std::chrono::microseconds(50) );
+        client.emit("second half", {"y"});
+        if(!waitFor(answers, i + 1) ) break;
+        rtts.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count() );
+    }
+
+    if(static_cast<int>(rtts.size() ) < rounds)
+    {
+        std::printf("%-12s write-write-read timed out\n", profile.name);
+    }
+    else
+    {
+        std::sort(rtts.begin(), rtts.end() );
+        std::printf("%-12s write-write-read p50 %8.1f us  p99 %8.1f us\n", profile.name, rtts[rtts.size() / 2],
+            rtts[rtts.size() * 99 / 100]);
+    }
+
+    client.stop();
+    server.stop();
+}
+
+//big messages one way, as fast as the loop takes them
+static void bulk(const Profile& profile, int port, int messages)
+{
+    constexpr size_t size = 256 << 10;
+
+    Server<BenchClient> server{port};
+    if(profile.opts != nullptr) server.setTuning(*profile.opts);
+    std::atomic<int> received{0};
+    server.onConnect([&](BenchClient& sock)
+    {
+        sock.on("bulk", [&](SockData, BenchClient&) {++received;});
+    });
+    server.start();
+
+    Client<BenchClient> client{"127.0.0.1", port};
+    if(profile.opts != nullptr) client.setTuning(*profile.opts);
+    client.start();
+
+    const std::string blob(size, 'x');
+    auto start = Clock::now();
+    for(int i = 0; i < messages; ++i) client.emit("bulk", {blob});
+    bool done = waitFor(received, messages);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if(done) std::printf("%-12s bulk %d x 256KiB %8.0f MB/s\n", profile.name, messages, messages * size / seconds / 1e6);
+    else std::printf("%-12s bulk timed out\n", profile.name);
+
+    client.stop();
+    server.stop();
+}
+
+//the tuning profiles over tcp loopback, against the system's defaults
+//usage: BenchTuning [port, 34920 by default]
+int main(int argc, const char* argv[])
+{
+    int port = argc > 1 ? std::atoi(argv[1]) : 34920;
+
+    const TuningOptions low_latency = TuningOptions::lowLatency();
+    const TuningOptions bulk_profile = TuningOptions::bulk();
+    const std::vector<Profile> profiles{{"defaults", nullptr}, {"lowLatency", &low_latency}, {"bulk", &bulk_profile}};
+
+    for(auto& it : profiles) writeWriteRead(it, port++, 300);
+    for(auto& it : profiles) bulk(it, port++, 1000);
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+//
+//  check.h
+//  NylonSock
+//
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+//counts what failed, so a test runs through and main returns checkResult()
+inline int& checkFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+inline void checkThat(bool ok, const char* what, const char* file, int line)
+{
+    if(ok) return;
+
+    ++checkFailures();
+    std::cerr << file << ":" << line << ": failed: " << what << std::endl;
+}
+
+#define CHECK(cond) checkThat( (cond), #cond, __FILE__, __LINE__)
+
+//waits up to milli ms for done to turn true, for what another thread does
+inline bool waitFor(std::function<bool ()> done, unsigned int milli = 5000)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(milli);
+    while(!done() )
+    {
+        if(std::chrono::steady_clock::now() >= end) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1) );
+    }
+
+    return true;
+}
+
+inline int checkResult()
+{
+    if(checkFailures() == 0) std::cout << "passed" << std::endl;
+    return checkFailures() == 0 ? 0 : 1;
+}
+
+#endif /* CHECK_H */
@@ -0,0 +1,144 @@
+//
+//  relay.h
+//  NylonSock
+//
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//passes bytes between a unix domain socket at path and one at target, so a test
+//can cut every connection going through it, the way a network failure would
+class Relay
+{
+private:
+    std::string _path;
+    std::string _target;
+    int _listener;
+
+    std::atomic<bool> _stop;
+    std::atomic<unsigned int> _cuts;
+    std::thread _thread;
+
+    static sockaddr_un address(const std::string& path)
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    void run()
+    {
+        //accepted and onward ends of each connection
+        std::vector<std::pair<int, int> > links;
+        unsigned int cuts = 0;
+
+        while(!_stop.load() )
+        {
+            if(cuts != _cuts.load() )
+            {
+                cuts = _cuts.load();
+                for(auto& it : links)
+                {
+                    ::close(it.first);
+                    ::close(it.second);
+                }
+                links.clear();
+            }
+
+            std::vector<pollfd> fds{{_listener, POLLIN, 0}};
+            for(auto& it : links)
+            {
+                fds.push_back({it.first, POLLIN, 0});
+                fds.push_back({it.second, POLLIN, 0});
+            }
+            if(::poll(fds.data(), fds.size(), 5) <= 0) continue;
+
+            std::vector<bool> dead(links.size(), false);
+            for(size_t i = 1; i < fds.size(); ++i)
+            {
+                if(fds[i].revents == 0) continue;
+
+                auto& link = links[(i - 1) / 2];
+                int to = fds[i].fd == link.first ? link.second : link.first;
+                char buffer[65536];
+                ssize_t size = ::recv(fds[i].fd, buffer, sizeof(buffer), 0);
+                if(size <= 0 || ::send(to, buffer, size, MSG_NOSIGNAL) != size) dead[(i - 1) / 2] = true;
+            }
+
+            //one end went away, so the other goes too
+            std::vector<std::pair<int, int> > open;
+            for(size_t i = 0; i < links.size(); ++i)
+            {
+                if(!dead[i])
+                {
+                    open.push_back(links[i]);
+                    continue;
+                }
+                ::close(links[i].first);
+                ::close(links[i].second);
+            }
+            links.swap(open);
+
+            if(fds[0].revents & POLLIN)
+            {
+                int accepted = ::accept(_listener, nullptr, nullptr);
+                int onward = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                auto addr = address(_target);
+                if(accepted >= 0 && ::connect(onward, reinterpret_cast<sockaddr*>(&addr), sizeof(addr) ) == 0)
+                {
+                    links.emplace_back(accepted, onward);
+                }
+                else
+                {
+                    if(accepted >= 0) ::close(accepted);
+                    ::close(onward);
+                }
+            }
+        }
+
+        for(auto& it : links)
+        {
+            ::close(it.first);
+            ::close(it.second);
+        }
+    }
+
+public:
+    Relay(const std::string& path, const std::string& target) :
+        _path(path), _target(target), _listener(::socket(AF_UNIX, SOCK_STREAM, 0) ), _stop(false), _cuts(0)
+    {
+        ::unlink(_path.c_str() );
+        auto addr = address(_path);
+        ::bind(_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr) );
+        ::listen(_listener, 16);
+        _thread = std::thread{[this]() {run();}};
+    }
+
+    ~Relay()
+    {
+        _stop = true;
+        _thread.join();
+        ::close(_listener);
+        ::unlink(_path.c_str() );
+    }
+
+    Relay(const Relay& that) = delete;
+    Relay& operator=(const Relay& that) = delete;
+
+    //drops every connection going through, bytes still in flight included
+    void cut() {++_cuts;}
+};
+
+#endif
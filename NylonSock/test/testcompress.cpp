@@ -0,0 +1,165 @@
+//
+//  testcompress.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+
+class EchoClient : public ClientSocket<EchoClient>
+{
+public:
+    EchoClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//text that compresses, but not down to nothing
+static std::string text(size_t size, unsigned int seed)
+{
+    static const std::vector<std::string> words{"player", "score", "position", "health", "42", "{", "}", ":", ","};
+    std::mt19937 rng{seed};
+    std::string result;
+    while(result.size() < size) result += words[rng() % words.size()];
+    result.resize(size);
+    return result;
+}
+
+#ifdef NYLONSOCK_ZLIB
+//inflates what pack made of out, false if it doesn't come back the same
+static bool roundTrips(const Outgoing& out, const std::string& event_name, const std::string& data,
+    const std::string& dictionary = "")
+{
+    std::string compressed_name, deflated;
+    if(out.packed_chunked)
+    {
+        if(!decodeMessage(*out.packed, compressed_name, deflated) ) return false;
+    }
+    else
+    {
+        size_t pos = 0;
+        if(!decodeFrame(*out.packed, pos, compressed_name, deflated) || pos != out.packed->size() ) return false;
+    }
+    if(compressed_name != compressed_event) return false;
+
+    Inflater inflater{dictionary};
+    std::string inflated_name, inflated_data;
+    return inflater.unpack(deflated, inflated_name, inflated_data) && inflated_name == event_name && inflated_data == data;
+}
+
+static void packAndUnpack()
+{
+    CompressionOptions opts;
+    Deflater deflater{opts};
+
+    //fits one frame before and after
+    auto small = makeOutgoing("state", text(4000, 1) );
+    deflater.pack(small);
+    CHECK(!small.packed->empty() && !small.packed_chunked);
+    CHECK(small.packed->size() < small.bytes->size() );
+    CHECK(roundTrips(small, "state", text(4000, 1) ) );
+
+    //still needs chunks once compressed
+    auto big = makeOutgoing("level", text(400000, 2) );
+    deflater.pack(big);
+    CHECK(!big.packed->empty() && big.packed_chunked);
+    CHECK(roundTrips(big, "level", text(400000, 2) ) );
+
+    //the same deflater again, as every message starts afresh
+    deflater.pack(small);
+    CHECK(roundTrips(small, "state", text(4000, 1) ) );
+
+    //noise doesn't get any smaller, so it goes as it is
+    std::mt19937 rng{39};
+    std::string noise(4000, 0);
+    for(auto& c : noise) c = static_cast<char>(rng() );
+    auto random = makeOutgoing("noise", noise);
+    deflater.pack(random);
+    CHECK(random.packed->empty() );
+}
+
+static void dictionaries()
+{
+    CompressionOptions opts;
+    opts.dictionary = "player score position health";
+    Deflater deflater{opts};
+
+    auto out = makeOutgoing("state", text(2000, 3) );
+    deflater.pack(out);
+    CHECK(roundTrips(out, "state", text(2000, 3), opts.dictionary) );
+    CHECK(!roundTrips(out, "state", text(2000, 3), "something else") );
+
+    //peers only compress for each other with the same dictionary
+    std::string hello = encodeCompressHello(opts);
+    size_t pos = 0;
+    std::string event_name, data;
+    decodeFrame(hello, pos, event_name, data);
+    CHECK(event_name == compress_hello);
+    CHECK(acceptsCompression(data, opts) );
+    CHECK(!acceptsCompression(data, CompressionOptions{}) );
+    CHECK(!acceptsCompression("", opts) );
+}
+#endif
+
+//messages big and small come back the same through a compressing server
+static void echoes()
+{
+    const std::string address = "inproc:testcompress";
+
+    Server<EchoClient> server{address};
+    server.setCompression();
+    server.onConnect([](EchoClient& sock)
+    {
+        sock.on("echo", [](SockData data, EchoClient& sock) {sock.emit("echoed", data);});
+    });
+    server.start();
+
+    Client<EchoClient> client{address};
+    client.setCompression();
+    client.start();
+
+    std::mutex mtx;
+    std::vector<std::string> echoed;
+    client.on("echoed", [&](SockData data, EchoClient&)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        echoed.push_back(data.getRaw() );
+    });
+
+    const std::vector<std::string> sent{"tiny", text(4000, 4), text(300000, 5), "", text(600, 6)};
+    for(auto& it : sent) client.emit("echo", {it});
+
+    CHECK(waitFor([&]()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return echoed.size() == sent.size();
+    }) );
+
+    //a big message may be overtaken by smaller ones, so only what came back counts
+    std::lock_guard<std::mutex> lock{mtx};
+    auto expected = sent;
+    std::sort(expected.begin(), expected.end() );
+    std::sort(echoed.begin(), echoed.end() );
+    CHECK(echoed == expected);
+
+    client.stop();
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+#ifdef NYLONSOCK_ZLIB
+    packAndUnpack();
+    dictionaries();
+#endif
+    echoes();
+
+    return checkResult();
+}
@@ -0,0 +1,152 @@
+//
+//  testdatagram.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class Peer : public DatagramSocket<Peer>
+{
+public:
+    Peer(const DatagramPeer& peer) : DatagramSocket(peer) {}
+};
+
+//udp has no unix or inproc form, so look for a free port on loopback
+static std::unique_ptr<DatagramServer<Peer> > makeServer(int& port, const DatagramOptions& opts)
+{
+    for(int i = 0; i < 50; ++i)
+    {
+        port = 41000 + (::getpid() + i * 97) % 20000;
+        try
+        {
+            return std::make_unique<DatagramServer<Peer> >(port, opts);
+        }
+        catch(NylonSock::Error& e)
+        {
+        }
+    }
+
+    CHECK(!"no free udp port");
+    return nullptr;
+}
+
+//a sequenced message as a peer would send it, so the numbers can be picked
+static std::string sequenced(uint32_t epoch, uint64_t seq, const std::string& data)
+{
+    return encodeFrame(datagram_sequenced, packInt<uint32_t>(epoch) + packInt<uint64_t>(seq) + encodeFrame("pos", data) );
+}
+
+//late and repeated numbers are dropped, and a new epoch starts the count over
+static void staleAreDropped()
+{
+    DatagramOptions opts;
+    opts.sequenced = true;
+    int port = 0;
+    auto server = makeServer(port, opts);
+    if(server == nullptr) return;
+
+    std::mutex mtx;
+    std::vector<std::string> seen;
+    std::atomic<Peer*> peer{nullptr};
+    server->onConnect([&](Peer& sock)
+    {
+        peer = &sock;
+        sock.on("pos", [&](SockData data, Peer&)
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            seen.push_back(data.getRaw() );
+        });
+    });
+    server->start();
+
+    //sends raw datagrams, so the test decides the order
+    DatagramClient<Peer> client{"127.0.0.1", port};
+    DatagramChannel& channel = *client.get().peer().channel;
+    auto send = [&](const std::string& bytes)
+    {
+        channel.send(client.get().peer(), std::make_shared<const std::string>(bytes) );
+    };
+
+    send(sequenced(7, 5, "a") );
+    CHECK(waitFor([&]() {std::lock_guard<std::mutex> lock{mtx}; return seen.size() == 1;}) );
+
+    //older, then the same again, then newer
+    send(sequenced(7, 3, "b") );
+    send(sequenced(7, 5, "c") );
+    send(sequenced(7, 6, "d") );
+    CHECK(waitFor([&]() {std::lock_guard<std::mutex> lock{mtx}; return seen.size() == 2;}) );
+
+    //the peer started over, then a late one from before that
+    send(sequenced(9, 1, "e") );
+    send(sequenced(9, 1, "f") );
+    send(sequenced(9, 2, "g") );
+    CHECK(waitFor([&]() {std::lock_guard<std::mutex> lock{mtx}; return seen.size() == 4;}) );
+
+    CHECK(waitFor([&]() {return peer.load() != nullptr && peer.load()->stale() == 3;}) );
+    std::lock_guard<std::mutex> lock{mtx};
+    CHECK( (seen == std::vector<std::string>{"a", "d", "e", "g"}) );
+
+    server->stop();
+}
+
+//more than one recvmmsg worth waiting at once all gets handled
+static void burstsArrive()
+{
+    constexpr int count = static_cast<int>(max_datagram_batch) * 2 + 10;
+
+    int port = 0;
+    auto server = makeServer(port, {});
+    if(server == nullptr) return;
+
+    std::mutex mtx;
+    std::vector<std::string> seen;
+    server->onConnect([&](Peer& sock)
+    {
+        sock.on("burst", [&](SockData data, Peer& sock)
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            seen.push_back(data.getRaw() );
+            sock.emit("back", data);
+        });
+    });
+
+    std::atomic<int> back{0};
+    DatagramClient<Peer> client{"127.0.0.1", port};
+    client.on("back", [&back](SockData, Peer&) {++back;});
+
+    //all sent before the server reads any of it
+    for(int i = 0; i < count; ++i) client.emit("burst", {std::to_string(i)});
+    server->start();
+    client.start();
+
+    CHECK(waitFor([&]() {std::lock_guard<std::mutex> lock{mtx}; return seen.size() == count;}) );
+    CHECK(waitFor([&]() {return back.load() == count;}) );
+    CHECK(server->count() == 1);
+    CHECK(server->dropped() == 0);
+
+    std::lock_guard<std::mutex> lock{mtx};
+    for(int i = 0; i < static_cast<int>(seen.size() ); ++i) CHECK(seen[i] == std::to_string(i) );
+
+    client.stop();
+    server->stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    staleAreDropped();
+    burstsArrive();
+
+    return checkResult();
+}
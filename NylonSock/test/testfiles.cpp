@@ -0,0 +1,204 @@
+//
+//  testfiles.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class FileClient : public ClientSocket<FileClient>
+{
+public:
+    FileClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+static std::string path(const std::string& name)
+{
+    return "/tmp/nylonsock-testfiles-" + name + "-" + std::to_string(::getpid() );
+}
+
+static std::string readAll(const std::string& name)
+{
+    std::ifstream file{name, std::ios::binary};
+    std::stringstream result;
+    result << file.rdbuf();
+    return result.str();
+}
+
+//bytes that don't repeat along the chunk size, so a chunk out of place shows
+static std::string pattern(size_t size)
+{
+    std::string result(size, 0);
+    uint32_t x = 2463534242u;
+    for(auto& it : result)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        it = static_cast<char>(x);
+    }
+
+    return result;
+}
+
+//a server writing every "file" it gets to sink, and counting what on() says was written
+struct Receiver
+{
+    std::string sink;
+    Server<FileClient> server;
+    std::mutex mtx;
+    int fd = -1;
+    std::atomic<int> done{0};
+    std::atomic<uint64_t> size{0};
+    std::string after;
+
+    Receiver(const std::string& address, bool reliable) : sink(path("sink") ), server(address)
+    {
+        if(reliable) server.setReliable();
+        server.onConnect([this](FileClient& sock)
+        {
+            sock.onFile("file", [this](FileClient&)
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                fd = ::open(sink.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                return fd;
+            });
+            sock.on("file", [this](SockData data, FileClient&)
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                ::close(fd);
+                size = std::stoull(data.getRaw() );
+                ++done;
+            });
+            sock.on("after", [this](SockData data, FileClient&)
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                after = data.getRaw();
+                ++done;
+            });
+        });
+        server.start();
+    }
+
+    ~Receiver()
+    {
+        server.stop();
+        ::unlink(sink.c_str() );
+    }
+};
+
+//a range of a file starting part way in and spanning several chunks comes out the same
+//with reliable on the bytes are read into the chunks rather than sent straight from the file
+static void rangeArrives(bool reliable)
+{
+    const std::string address = "unix:" + path("range");
+    const std::string source = path("source");
+    const uint64_t offset = 1000;
+    const uint64_t size = 3 * file_chunk_size + 123;
+
+    auto data = pattern(offset + size + 5000);
+    {
+        std::ofstream file{source, std::ios::binary};
+        file.write(data.data(), data.size() );
+    }
+
+    Receiver receiver{address, reliable};
+    Client<FileClient> client{address};
+    if(reliable) client.setReliable();
+    client.start();
+
+    client.emitFile("file", source, offset, size);
+    client.emit("after", {"after"});
+    CHECK(waitFor([&]() {return receiver.done.load() == 2;}) );
+    CHECK(receiver.size.load() == size);
+    CHECK(readAll(receiver.sink) == data.substr(offset, size) );
+    {
+        std::lock_guard<std::mutex> lock{receiver.mtx};
+        CHECK(receiver.after == "after");
+    }
+
+    //the rest of the file, when no size is given
+    client.emitFile("file", source, offset + size);
+    CHECK(waitFor([&]() {return receiver.done.load() == 3;}) );
+    CHECK(readAll(receiver.sink) == data.substr(offset + size) );
+
+    client.stop();
+    ::unlink(source.c_str() );
+}
+
+//a pipe goes out as it is written, until its writer closes it
+static void pipeArrives()
+{
+    const std::string address = "unix:" + path("pipe");
+    const std::string fifo = path("fifo");
+    constexpr size_t piece = 100000;
+    constexpr int pieces = 10;
+
+    auto data = pattern(piece * pieces);
+    ::unlink(fifo.c_str() );
+    CHECK(::mkfifo(fifo.c_str(), 0600) == 0);
+
+    Receiver receiver{address, false};
+    Client<FileClient> client{address};
+    client.start();
+
+    std::thread writer([&]()
+    {
+        int fd = ::open(fifo.c_str(), O_WRONLY);
+        for(int i = 0; i < pieces; ++i)
+        {
+            CHECK(::write(fd, data.data() + i * piece, piece) == static_cast<ssize_t>(piece) );
+            std::this_thread::sleep_for(std::chrono::milliseconds(5) );
+        }
+        ::close(fd);
+    });
+
+    client.emitFile("file", fifo);
+    client.emit("after", {"after"});
+    CHECK(waitFor([&]() {return receiver.done.load() == 2;}) );
+    writer.join();
+
+    CHECK(receiver.size.load() == data.size() );
+    CHECK(readAll(receiver.sink) == data);
+
+    //only size bytes are taken from a pipe that has more, written in one go as
+    //the pipe may be closed once they are
+    std::thread capped([&]()
+    {
+        int fd = ::open(fifo.c_str(), O_WRONLY);
+        CHECK(::write(fd, data.data(), 20000) == 20000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100) );
+        ::close(fd);
+    });
+    client.emitFile("file", fifo, 0, 5000);
+    CHECK(waitFor([&]() {return receiver.done.load() == 3;}) );
+    capped.join();
+    CHECK(readAll(receiver.sink) == data.substr(0, 5000) );
+
+    client.stop();
+    ::unlink(fifo.c_str() );
+}
+
+int main(int argc, const char* argv[])
+{
+    rangeArrives(false);
+    rangeArrives(true);
+    pipeArrives();
+
+    return checkResult();
+}
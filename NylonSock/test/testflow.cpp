@@ -0,0 +1,143 @@
+//
+//  testflow.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace NylonSock;
+
+class JobClient : public ClientSocket<JobClient>
+{
+public:
+    JobClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//the grant as it arrives, without the frame header
+static std::string grantData(const std::string& frame)
+{
+    size_t pos = 0;
+    std::string event_name, data;
+    decodeFrame(frame, pos, event_name, data);
+    return data;
+}
+
+static void credit()
+{
+    FlowOptions opts;
+    opts.frames = 4;
+    opts.bytes = 1000;
+
+    FlowCredit receiver;
+    CHECK(receiver.grantDue(opts) );
+    std::string grant = grantData(receiver.takeGrant(opts) );
+    CHECK(!receiver.grantDue(opts) );
+
+    FlowCredit sender;
+    CHECK(!sender.limited() && sender.canSend() );
+    CHECK(!sender.receiveGrant("short") );
+    CHECK(sender.receiveGrant(grant) );
+    CHECK(sender.limited() );
+
+    for(int i = 0; i < 4; ++i)
+    {
+        CHECK(sender.canSend() );
+        sender.sent(10);
+    }
+    CHECK(!sender.canSend() );
+
+    //half the window done brings the next grant, counted as a total from the start
+    receiver.done(2, 20);
+    CHECK(!receiver.grantDue(opts) );
+    receiver.done(1, 10);
+    CHECK(receiver.grantDue(opts) );
+    CHECK(sender.receiveGrant(grantData(receiver.takeGrant(opts) ) ) );
+    CHECK(sender.canSend() );
+
+    //a frame bigger than what's left still goes while any byte credit is left
+    sender.sent(990);
+    CHECK(!sender.canSend() );
+
+    sender.reset();
+    CHECK(!sender.limited() && sender.canSend() );
+}
+
+//a server that hands credit back only when told to holds its client to the window
+static void heldToTheWindow()
+{
+    const std::string address = "inproc:testflow";
+    constexpr int window = 8;
+    constexpr int max_queued = 4;
+
+    std::atomic<int> received{0};
+    std::atomic<JobClient*> peer{nullptr};
+
+    Server<JobClient> server{address};
+    FlowOptions server_opts;
+    server_opts.frames = window;
+    server_opts.auto_grant = false;
+    server.setFlowControl(server_opts);
+    server.onConnect([&](JobClient& sock)
+    {
+        peer = &sock;
+        sock.on("hello", [](SockData, JobClient& sock) {sock.emit("ready", {""});});
+        sock.on("job", [&](SockData, JobClient&) {++received;});
+    });
+    server.start();
+
+    Client<JobClient> client{address};
+    FlowOptions client_opts;
+    client_opts.max_queued = max_queued;
+    client.setFlowControl(client_opts);
+    client.start();
+
+    //the server's grant goes out before ready, so the client has it once ready is back
+    std::atomic<bool> ready{false};
+    client.on("ready", [&](SockData, JobClient&) {ready = true;});
+    client.emit("hello", {""});
+    CHECK(waitFor([&]() {return ready.load();}) );
+
+    //hello took one frame of the window
+    int sent = 0;
+    bool refused = false;
+    for(int i = 0; i < window + max_queued + 4 && !refused; ++i)
+    {
+        try
+        {
+            client.emit("job", {"work"});
+            ++sent;
+        }
+        catch(NO_CREDIT& e)
+        {
+            refused = true;
+        }
+    }
+    CHECK(refused);
+    CHECK(sent == window - 1 + max_queued);
+
+    CHECK(waitFor([&]() {return received.load() == window - 1;}) );
+    std::this_thread::sleep_for(std::chrono::milliseconds(50) );
+    CHECK(received.load() == window - 1);
+
+    //the server finishing with the first jobs lets the rest through
+    peer.load()->grant(window, window * 64);
+    CHECK(waitFor([&]() {return received.load() == sent;}) );
+
+    client.stop();
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    credit();
+    heldToTheWindow();
+
+    return checkResult();
+}
@@ -0,0 +1,280 @@
+//
+//  testhandoff.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class HandClient : public ClientSocket<HandClient>
+{
+public:
+    HandClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+using Clients = std::vector<std::unique_ptr<Client<HandClient> > >;
+
+static std::string handoffAddress()
+{
+    return "unix:/tmp/nylonsock-testhandoff-" + std::to_string(::getpid() );
+}
+
+//only tcp connections are handed along, so look for a free port
+static std::unique_ptr<Server<HandClient> > makeServer(int& port)
+{
+    for(int i = 0; i < 50; ++i)
+    {
+        port = 41000 + (::getpid() + i * 79) % 20000;
+        try
+        {
+            return std::make_unique<Server<HandClient> >(port);
+        }
+        catch(NylonSock::Error& e)
+        {
+        }
+    }
+
+    CHECK(!"no free tcp port");
+    return nullptr;
+}
+
+//answers every ping with name, so a client can tell which server it is talking to
+static void answerAs(Server<HandClient>& server, const std::string& name)
+{
+    server.onConnect([name](HandClient& sock)
+    {
+        sock.on("ping", [name](SockData, HandClient& sock) {sock.emit("pong", {name});});
+    });
+}
+
+//who answered each client's pings, by client and server
+struct Answers
+{
+    std::mutex mtx;
+    std::map<std::pair<size_t, std::string>, int> got;
+
+    void listen(Client<HandClient>& client, size_t index)
+    {
+        client.on("pong", [this, index](SockData data, HandClient&)
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            ++got[{index, data.getRaw()}];
+        });
+    }
+
+    int count(size_t index, const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return got[{index, name}];
+    }
+};
+
+static std::unique_ptr<Client<HandClient> > connect(int port, Answers& answers, size_t index, bool reliable)
+{
+    auto client = std::make_unique<Client<HandClient> >("127.0.0.1", port);
+    if(reliable) client->setReliable();
+    client->start();
+    answers.listen(*client, index);
+
+    return client;
+}
+
+//pings from a client, then waits for it to be answered by name once more
+static bool ping(Clients& clients, Answers& answers, size_t index, const std::string& name)
+{
+    int before = answers.count(index, name);
+    clients[index]->emit("ping", {"ping"});
+
+    return waitFor([&]() {return answers.count(index, name) == before + 1;});
+}
+
+static bool pingAll(Clients& clients, Answers& answers, const std::string& name)
+{
+    bool answered = true;
+    for(size_t i = 0; i < clients.size(); ++i) answered = ping(clients, answers, i, name) && answered;
+
+    return answered;
+}
+
+//the successor gets the listener with what is queued on it, and the connections, which go on
+//talking without reconnecting
+static void connectionsMove()
+{
+    int port = 0;
+    auto old_server = makeServer(port);
+    if(old_server == nullptr) return;
+
+    HandoffOptions opts;
+    opts.connections = true;
+    answerAs(*old_server, "old");
+    old_server->setHandoff(handoffAddress(), opts);
+    old_server->start();
+
+    Answers answers;
+    Clients clients;
+    for(size_t i = 0; i < 3; ++i) clients.push_back(connect(port, answers, i, false) );
+    CHECK(waitFor([&]() {return old_server->count() == 3;}) );
+    CHECK(pingAll(clients, answers, "old") );
+
+    auto inherited = takeOver(handoffAddress() );
+    CHECK(inherited.connections.size() == 3);
+    CHECK(waitFor([&]() {return old_server->handedOff() && old_server->count() == 0;}) );
+
+    //nothing accepts until the new server runs, so this one waits in the listener's queue
+    clients.push_back(connect(port, answers, clients.size(), false) );
+
+    Server<HandClient> new_server{std::move(inherited)};
+    answerAs(new_server, "new");
+    new_server.start();
+    CHECK(waitFor([&]() {return new_server.count() == 4;}) );
+
+    CHECK(pingAll(clients, answers, "new") );
+    for(auto& it : clients) CHECK(!it->get().getDestroy() );
+    for(size_t i = 0; i < 3; ++i) CHECK(answers.count(i, "old") == 1);
+
+    for(auto& it : clients) it->stop();
+    new_server.stop();
+    old_server->stop();
+}
+
+//a reliable connection has state the bytes alone don't carry, so only the listener moves
+static void reliableKeepsConnections()
+{
+    int port = 0;
+    auto old_server = makeServer(port);
+    if(old_server == nullptr) return;
+
+    HandoffOptions opts;
+    opts.connections = true;
+    old_server->setReliable();
+    answerAs(*old_server, "old");
+    old_server->setHandoff(handoffAddress(), opts);
+    old_server->start();
+
+    Answers answers;
+    Clients clients;
+    clients.push_back(connect(port, answers, 0, true) );
+    CHECK(pingAll(clients, answers, "old") );
+
+    auto inherited = takeOver(handoffAddress() );
+    CHECK(inherited.connections.size() == 0);
+    CHECK(waitFor([&]() {return old_server->handedOff();}) );
+
+    Server<HandClient> new_server{std::move(inherited)};
+    new_server.setReliable();
+    answerAs(new_server, "new");
+    new_server.start();
+
+    //the old one is still served where it was, newcomers go to the successor
+    clients.push_back(connect(port, answers, 1, true) );
+    CHECK(waitFor([&]() {return new_server.count() == 1;}) );
+    CHECK(old_server->count() == 1);
+
+    CHECK(ping(clients, answers, 0, "old") );
+    CHECK(ping(clients, answers, 1, "new") );
+    CHECK(answers.count(0, "new") == 0 && answers.count(1, "old") == 0);
+    CHECK(!clients[0]->get().getDestroy() );
+
+    for(auto& it : clients) it->stop();
+    new_server.stop();
+    old_server->stop();
+}
+
+//a listener passed down the way systemd does it, on fd 3 with LISTEN_PID and LISTEN_FDS
+static void systemdListener()
+{
+    constexpr int first_fd = 3;
+
+    int listener = -1, port = 0;
+    for(int i = 0; i < 50 && listener < 0; ++i)
+    {
+        port = 41000 + (::getpid() + i * 73) % 20000;
+        listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port) );
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr) ) != 0)
+        {
+            ::close(listener);
+            listener = -1;
+        }
+    }
+    CHECK(listener >= 0);
+    if(listener < 0) return;
+
+    //whatever the test was started with on fd 3 is put back after
+    int saved = listener == first_fd ? -1 : ::fcntl(first_fd, F_DUPFD_CLOEXEC, 10);
+    if(listener != first_fd)
+    {
+        CHECK(::dup2(listener, first_fd) == first_fd);
+        ::close(listener);
+    }
+
+    const std::string pid = std::to_string(::getpid() );
+    ::setenv("LISTEN_FDS", "1", 1);
+
+    //not for this process, or not listening yet, it isn't taken
+    ::setenv("LISTEN_PID", std::to_string(::getpid() + 1).c_str(), 1);
+    bool refused = false;
+    try {inheritSystemd();} catch(NylonSock::Error& e) {refused = true;}
+    CHECK(refused);
+
+    ::setenv("LISTEN_PID", pid.c_str(), 1);
+    refused = false;
+    try {inheritSystemd();} catch(NylonSock::Error& e) {refused = true;}
+    CHECK(refused);
+
+    CHECK(::listen(first_fd, 16) == 0);
+    refused = false;
+    try {inheritSystemd(1);} catch(NylonSock::Error& e) {refused = true;}
+    CHECK(refused);
+
+    {
+        Server<HandClient> server{inheritSystemd()};
+        answerAs(server, "systemd");
+        server.start();
+
+        Answers answers;
+        Clients clients;
+        clients.push_back(connect(port, answers, 0, false) );
+        CHECK(pingAll(clients, answers, "systemd") );
+
+        clients[0]->stop();
+        server.stop();
+    }
+
+    ::unsetenv("LISTEN_PID");
+    ::unsetenv("LISTEN_FDS");
+    if(saved >= 0)
+    {
+        ::dup2(saved, first_fd);
+        ::close(saved);
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    connectionsMove();
+    reliableKeepsConnections();
+    systemdListener();
+
+    return checkResult();
+}
@@ -0,0 +1,159 @@
+//
+//  testheartbeat.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class BeatClient : public ClientSocket<BeatClient>
+{
+public:
+    BeatClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+static std::string path(const std::string& name)
+{
+    return "/tmp/nylonsock-testheartbeat-" + name + "-" + std::to_string(::getpid() );
+}
+
+static sockaddr_un address(const std::string& name)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    name.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+//a peer that connects and then never says anything, not even a pong
+static int silentPeer(const std::string& name)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    auto addr = address(name);
+    CHECK(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr) ) == 0);
+    return fd;
+}
+
+static void sleepFor(unsigned int milli)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milli) );
+}
+
+//a peer that never answers is dropped, one that only answers pings is kept, and both ends get an rtt
+static void idleIsReaped()
+{
+    const std::string name = path("idle");
+
+    HeartbeatOptions opts;
+    opts.interval = 50;
+    opts.idle_timeout = 300;
+    opts.read_timeout = 0;
+
+    Server<BeatClient> server{"unix:" + name};
+    server.setHeartbeat(opts);
+    std::atomic<BeatClient*> served{nullptr};
+    server.onConnect([&served](BeatClient& sock) {if(served.load() == nullptr) served = &sock;});
+    server.start();
+
+    //never emits anything, only the pongs the library sends for it
+    Client<BeatClient> quiet{"unix:" + name};
+    quiet.setHeartbeat(opts);
+    quiet.start();
+    CHECK(waitFor([&]() {return server.count() == 1 && served.load() != nullptr;}) );
+
+    int silent = silentPeer(name);
+    CHECK(waitFor([&]() {return server.count() == 2;}) );
+    CHECK(waitFor([&]() {return server.count() == 1;}) );
+
+    //well past the idle timeout, so only the heartbeats can have kept it
+    sleepFor(opts.idle_timeout * 3);
+    CHECK(server.count() == 1);
+
+    CHECK(waitFor([&]() {return quiet.get().rtt().count() > 0 && served.load()->rtt().count() > 0;}) );
+
+    ::close(silent);
+    quiet.stop();
+    server.stop();
+}
+
+//a client drops a server that stops answering, the same way
+static void quietServerIsDropped()
+{
+    const std::string name = path("server");
+    ::unlink(name.c_str() );
+
+    //listens, but nothing ever reads or answers
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    auto addr = address(name);
+    CHECK(::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr) ) == 0);
+    CHECK(::listen(listener, 4) == 0);
+
+    HeartbeatOptions opts;
+    opts.interval = 50;
+    opts.idle_timeout = 300;
+    opts.read_timeout = 0;
+
+    Client<BeatClient> client{"unix:" + name};
+    client.setHeartbeat(opts);
+    client.start();
+    std::atomic<bool> dropped{false};
+    client.on("disconnect", [&dropped](BeatClient&) {dropped = true;});
+
+    CHECK(waitFor([&]() {return dropped.load();}) );
+    CHECK(client.get().rtt().count() == 0);
+
+    client.stop();
+    ::close(listener);
+    ::unlink(name.c_str() );
+}
+
+//half a frame that never finishes is dropped, while a silent peer is left alone
+static void slowFrameIsReaped()
+{
+    const std::string name = path("read");
+
+    HeartbeatOptions opts;
+    opts.interval = 0;
+    opts.idle_timeout = 0;
+    opts.read_timeout = 200;
+
+    Server<BeatClient> server{"unix:" + name};
+    server.setHeartbeat(opts);
+    server.start();
+
+    int silent = silentPeer(name);
+    int partial = silentPeer(name);
+    CHECK(waitFor([&]() {return server.count() == 2;}) );
+
+    char byte = 0;
+    CHECK(::send(partial, &byte, 1, MSG_NOSIGNAL) == 1);
+    CHECK(waitFor([&]() {return server.count() == 1;}) );
+
+    sleepFor(opts.read_timeout * 3);
+    CHECK(server.count() == 1);
+
+    ::close(silent);
+    ::close(partial);
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    idleIsReaped();
+    quietServerIsDropped();
+    slowFrameIsReaped();
+
+    return checkResult();
+}
@@ -0,0 +1,130 @@
+//
+//  testlocal.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class PipeClient : public ClientSocket<PipeClient>
+{
+public:
+    PipeClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//the server writes into pipes the client hands it, which only works if the descriptors made it across
+static void passesDescriptors()
+{
+    const std::string path = "/tmp/nylonsock-testlocal-" + std::to_string(::getpid() );
+    constexpr int rounds = 50;
+
+    std::atomic<int> bad{0};
+    Server<PipeClient> server{"unix:" + path};
+    server.onConnect([&](PipeClient& sock)
+    {
+        sock.on("pipe", [&](SockData data, PipeClient& sock)
+        {
+            auto fds = sock.takeFds();
+            if(fds.size() != 1 || ::write(fds.front(), data.getRaw().data(), data.getRaw().size() ) !=
+                static_cast<ssize_t>(data.getRaw().size() ) )
+            {
+                ++bad;
+            }
+            for(auto fd : fds) ::close(fd);
+        });
+
+        //descriptors the on() function leaves are closed for it
+        sock.on("ignored", [](SockData, PipeClient&) {});
+    });
+    server.start();
+
+    Client<PipeClient> client{"unix:" + path};
+    client.start();
+
+    bool all_arrived = true;
+    for(int i = 0; i < rounds; ++i)
+    {
+        int ends[2];
+        CHECK(::pipe(ends) == 0);
+
+        std::string word = "round " + std::to_string(i);
+        EmitOptions opts;
+        opts.fds = {ends[1]};
+        client.emit(i % 2 == 0 ? "pipe" : "ignored", {word}, opts);
+
+        //a copy was sent, so ours is still open and ours to close
+        CHECK(::fcntl(ends[1], F_GETFD) != -1);
+        ::close(ends[1]);
+
+        //the read end only sees eof once every copy of the write end is closed
+        std::string got;
+        char buffer[64];
+        ssize_t size;
+        while( (size = ::read(ends[0], buffer, sizeof(buffer) ) ) > 0) got.append(buffer, size);
+        ::close(ends[0]);
+
+        all_arrived = all_arrived && got == (i % 2 == 0 ? word : "");
+    }
+    CHECK(all_arrived);
+    CHECK(bad.load() == 0);
+
+    //descriptors ride on one frame, so there is a cap on them
+    EmitOptions too_many;
+    too_many.fds.assign(max_passed_fds + 1, STDOUT_FILENO);
+    bool thrown = false;
+    try
+    {
+        client.emit("pipe", {""}, too_many);
+    }
+    catch(TOO_BIG& e)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    client.stop();
+    server.stop();
+}
+
+//anything other than a unix domain socket refuses them
+static void needsUnix()
+{
+    Server<PipeClient> server{"inproc:testlocal"};
+    server.start();
+    Client<PipeClient> client{"inproc:testlocal"};
+    client.start();
+
+    EmitOptions opts;
+    opts.fds = {STDOUT_FILENO};
+    bool thrown = false;
+    try
+    {
+        client.emit("pipe", {""}, opts);
+    }
+    catch(NylonSock::Error& e)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    client.stop();
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    passesDescriptors();
+    needsUnix();
+
+    return checkResult();
+}
@@ -0,0 +1,178 @@
+//
+//  testmulticast.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class GroupClient : public ClientSocket<GroupClient>
+{
+public:
+    GroupClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//multicast needs tcp, and the group's udp port is the same number, so look for a free one
+static std::unique_ptr<Server<GroupClient> > makeServer(int& port)
+{
+    for(int i = 0; i < 50; ++i)
+    {
+        port = 41000 + (::getpid() + i * 89) % 20000;
+        try
+        {
+            return std::make_unique<Server<GroupClient> >(port);
+        }
+        catch(NylonSock::Error& e)
+        {
+        }
+    }
+
+    CHECK(!"no free tcp port");
+    return nullptr;
+}
+
+//what a client heard, checked for order as it comes
+struct Heard
+{
+    std::mutex mtx;
+    std::vector<int> got;
+    bool in_order = true;
+
+    void add(int value)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        in_order = in_order && (got.empty() || value > got.back() );
+        got.push_back(value);
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return got.size();
+    }
+
+    int last()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return got.empty() ? -1 : got.back();
+    }
+};
+
+static std::string payload(int value)
+{
+    std::string data = std::to_string(value) + " ";
+    data.resize(1300, 'x');
+    return data;
+}
+
+//the client's loop is held up while the server broadcasts more than its group socket
+//can hold, so the kernel drops the rest and they have to come back over tcp.
+//history is how many broadcasts the server keeps for that
+static void lostAreResent(size_t history, const std::string& group)
+{
+    //twice the most the receiver asks for, as linux doubles it, over the size of one
+    constexpr int count = 2 * (4 << 20) / 1300 + 1000;
+
+    int port = 0;
+    auto server = makeServer(port);
+    if(server == nullptr) return;
+
+    MulticastOptions opts;
+    opts.group = group;
+    opts.local_address = "127.0.0.1";
+    opts.history = history;
+    server->setMulticast(opts);
+    server->start();
+
+    Client<GroupClient> client{"127.0.0.1", port};
+    client.setMulticast(opts);
+    client.start();
+
+    Heard heard;
+    std::atomic<bool> held{false}, release{false};
+    client.on("hold", [&](SockData, GroupClient&)
+    {
+        held = true;
+        waitFor([&]() {return release.load();});
+    });
+    client.on("n", [&heard](SockData data, GroupClient&) {heard.add(std::stoi(data.getRaw() ) );});
+
+    //join, info, ready and start, after which broadcasts go to the group
+    CHECK(waitFor([&]() {return client.get().multicast();}) );
+
+    server->emit("hold", {"hold"});
+    CHECK(waitFor([&]() {return held.load();}) );
+    for(int i = 0; i < count; ++i) server->emit("n", {payload(i)});
+    release = true;
+
+    //the last ones are always kept, so they arrive whatever else is given up on
+    CHECK(waitFor([&]() {return heard.last() == count - 1;}, 20000) );
+    CHECK(heard.in_order);
+    if(history >= static_cast<size_t>(count) ) CHECK(heard.size() == count);
+    else CHECK(heard.size() < static_cast<size_t>(count) && heard.size() >= history);
+    CHECK(client.get().multicast() );
+
+    client.stop();
+    server->stop();
+}
+
+//a client that never hears the group keeps getting broadcasts over tcp
+static void silentGroupStaysOnTcp()
+{
+    constexpr int count = 100;
+
+    int port = 0;
+    auto server = makeServer(port);
+    if(server == nullptr) return;
+
+    MulticastOptions opts;
+    opts.group = "239.255.42.97";
+    opts.local_address = "127.0.0.1";
+    server->setMulticast(opts);
+    server->start();
+
+    //joins on an interface that isn't there, like a network that drops multicast
+    MulticastOptions nowhere = opts;
+    nowhere.local_address = "203.0.113.1";
+    Client<GroupClient> client{"127.0.0.1", port};
+    client.setMulticast(nowhere);
+    client.start();
+
+    Heard heard;
+    client.on("n", [&heard](SockData data, GroupClient&) {heard.add(std::stoi(data.getRaw() ) );});
+    CHECK(waitFor([&]() {return server->count() == 1;}) );
+
+    //several group heartbeats go by unheard
+    std::this_thread::sleep_for(std::chrono::milliseconds(opts.heartbeat * 5) );
+    CHECK(!client.get().multicast() );
+
+    for(int i = 0; i < count; ++i) server->emit("n", {payload(i)});
+    CHECK(waitFor([&]() {return heard.size() == count;}) );
+    CHECK(heard.in_order);
+    CHECK(!client.get().multicast() );
+
+    client.stop();
+    server->stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    silentGroupStaysOnTcp();
+    //everything kept, so every lost one is resent
+    lostAreResent(1 << 16, "239.255.42.98");
+    //too little kept, so the oldest are gone and skipped
+    lostAreResent(100, "239.255.42.99");
+
+    return checkResult();
+}
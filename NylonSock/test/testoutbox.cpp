@@ -0,0 +1,194 @@
+//
+//  testoutbox.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <Outbox.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+using Clock = std::chrono::steady_clock;
+
+static Outgoing message(const std::string& data, const EmitOptions& opts = {})
+{
+    return makeOutgoing("e", data, opts);
+}
+
+//what leaves the outbox, as the data of each message in the order it finished
+//a big message counts once, when its last chunk goes
+static std::vector<std::string> drain(Outbox& outbox, Clock::time_point now = Clock::now() )
+{
+    std::vector<std::string> sent;
+    while(Outgoing* out = outbox.next(now) )
+    {
+        if(!out->chunked)
+        {
+            std::string event_name, data;
+            size_t pos = 0;
+            decodeFrame(*out->bytes, pos, event_name, data);
+            sent.push_back(data);
+            outbox.taken(out->bytes->size(), true);
+            continue;
+        }
+
+        size_t size = cutChunk(*out).size();
+        bool finished = out->offset == out->bytes->size();
+        if(finished) sent.push_back(out->bytes->substr(sizeof(sock_size_type) + 1, 3) );
+        outbox.taken(size, finished);
+    }
+
+    return sent;
+}
+
+static void highestLaneFirst()
+{
+    Outbox outbox;
+    outbox.push(message("low", {Priority::LOW}) );
+    outbox.push(message("normal 1") );
+    outbox.push(message("high", {Priority::HIGH}) );
+    outbox.push(message("normal 2") );
+    CHECK(outbox.size() == 4);
+    CHECK(outbox.depth(Priority::NORMAL) == 2);
+
+    auto sent = drain(outbox);
+    CHECK( (sent == std::vector<std::string>{"high", "normal 1", "normal 2", "low"}) );
+    CHECK(outbox.empty() );
+}
+
+//a lower lane gets a turn after starvation_limit frames went ahead of it
+static void lowerLanesArentStarved()
+{
+    Outbox outbox;
+    for(size_t i = 0; i < 3 * starvation_limit; ++i) outbox.push(message("high", {Priority::HIGH}) );
+    outbox.push(message("low", {Priority::LOW}) );
+
+    auto sent = drain(outbox);
+    size_t at = 0;
+    while(at < sent.size() && sent[at] != "low") ++at;
+    CHECK(at == starvation_limit);
+}
+
+//small frames emitted after a big message don't wait for all of it
+static void bigMessagesTakeTurns()
+{
+    Outbox outbox;
+    outbox.push(message("big" + std::string(8 * chunk_size, 'x') ) );
+    for(int i = 0; i < 3; ++i) outbox.push(message("small " + std::to_string(i) ) );
+
+    auto sent = drain(outbox);
+    CHECK( (sent == std::vector<std::string>{"small 0", "small 1", "small 2", "big"}) );
+}
+
+//what was taken out goes back ahead of everything pushed since, in the same order
+static void putBackInOrder()
+{
+    Outbox outbox;
+    outbox.push(message("a") );
+    outbox.push(message("b", {Priority::HIGH}) );
+    auto taken = outbox.takeAll();
+    CHECK(outbox.empty() );
+
+    outbox.push(message("c") );
+    outbox.pushFront(std::move(taken) );
+
+    auto sent = drain(outbox);
+    CHECK( (sent == std::vector<std::string>{"b", "a", "c"}) );
+}
+
+//messages still waiting past their ttl are dropped, the rest go out
+static void expiredAreDropped()
+{
+    Outbox outbox;
+    outbox.push(message("short lived", {Priority::NORMAL, 10}) );
+    outbox.push(message("forever") );
+    outbox.push(message("long lived", {Priority::NORMAL, 60000}) );
+
+    auto sent = drain(outbox, Clock::now() + std::chrono::seconds(1) );
+    CHECK( (sent == std::vector<std::string>{"forever", "long lived"}) );
+    CHECK(outbox.expired() == 1);
+}
+
+//a big message that started going out is finished, however late
+static void startedAreFinished()
+{
+    Outbox outbox;
+    outbox.push(message("big" + std::string(4 * chunk_size, 'x'), {Priority::NORMAL, 10}) );
+    outbox.push(message("big" + std::string(4 * chunk_size, 'y'), {Priority::NORMAL, 10}) );
+
+    //both are interleaved, so both have a chunk out before the deadline
+    for(int i = 0; i < 2; ++i)
+    {
+        Outgoing* out = outbox.next(Clock::now() );
+        CHECK(out != nullptr);
+        if(out == nullptr) return;
+        outbox.taken(cutChunk(*out).size(), false);
+    }
+
+    auto sent = drain(outbox, Clock::now() + std::chrono::seconds(1) );
+    CHECK(sent.size() == 2);
+    CHECK(outbox.expired() == 0);
+
+    //one that never started is dropped whole
+    outbox.push(message("big" + std::string(4 * chunk_size, 'z'), {Priority::NORMAL, 10}) );
+    CHECK(drain(outbox, Clock::now() + std::chrono::seconds(1) ).empty() );
+    CHECK(outbox.expired() == 1);
+}
+
+//a newer emit with the same key takes the older one's place in line
+static void conflates()
+{
+    Outbox outbox;
+    outbox.push(message("first") );
+    outbox.push(message("position 1", {Priority::NORMAL, 0, "position"}) );
+    outbox.push(message("second") );
+    outbox.push(message("position 2", {Priority::NORMAL, 0, "position"}) );
+    //same key in another lane is a different message
+    outbox.push(message("position low", {Priority::LOW, 0, "position"}) );
+    CHECK(outbox.conflated() == 1);
+
+    auto sent = drain(outbox);
+    CHECK( (sent == std::vector<std::string>{"first", "position 2", "second", "position low"}) );
+
+    //once it has left, the key is free again
+    outbox.push(message("position 3", {Priority::NORMAL, 0, "position"}) );
+    CHECK( (drain(outbox) == std::vector<std::string>{"position 3"}) );
+    CHECK(outbox.conflated() == 1);
+}
+
+//a big message part way out is finished, and the newer one goes after it
+static void startedArentReplaced()
+{
+    Outbox outbox;
+    outbox.push(message("bg1" + std::string(4 * chunk_size, 'x'), {Priority::NORMAL, 0, "level"}) );
+
+    Outgoing* out = outbox.next(Clock::now() );
+    CHECK(out != nullptr);
+    if(out == nullptr) return;
+    outbox.taken(cutChunk(*out).size(), false);
+
+    outbox.push(message("bg2" + std::string(4 * chunk_size, 'y'), {Priority::NORMAL, 0, "level"}) );
+    CHECK(outbox.conflated() == 0);
+    CHECK(outbox.size() == 2);
+
+    auto sent = drain(outbox);
+    CHECK( (sent == std::vector<std::string>{"bg1", "bg2"}) );
+}
+
+int main(int argc, const char* argv[])
+{
+    highestLaneFirst();
+    lowerLanesArentStarved();
+    bigMessagesTakeTurns();
+    putBackInOrder();
+    expiredAreDropped();
+    startedAreFinished();
+    conflates();
+    startedArentReplaced();
+
+    return checkResult();
+}
@@ -0,0 +1,123 @@
+//
+//  testperf.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace NylonSock;
+
+class BenchClient : public ClientSocket<BenchClient>
+{
+public:
+    BenchClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//what came back, checked against what was sent
+struct Tally
+{
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t out_of_order = 0;
+    uint64_t last = 0;
+
+    void receive(const std::string& data)
+    {
+        uint64_t number = std::stoull(data.substr(0, data.find(' ') ) );
+        if(number != last + 1) ++out_of_order;
+        last = number;
+        ++count;
+        bytes += data.size();
+    }
+};
+
+//the same workload every run, both ends on this thread through Server::step and
+//an in-process client that is never started, so the counts never change and the
+//time printed only measures framing, dispatch and allocation
+int main(int argc, const char* argv[])
+{
+    constexpr uint64_t batches = 2000;
+    constexpr uint64_t batch_size = 64;
+    constexpr uint64_t big_every = 100;
+    constexpr size_t big_size = 100000;
+    constexpr uint64_t broadcasts = 10000;
+    //passes of both loops allowed for each batch before giving up
+    constexpr int max_passes = 10000;
+
+    Server<BenchClient> server{"inproc:testperf"};
+    Tally at_server, pongs, news;
+    server.onConnect([&at_server](BenchClient& sock)
+    {
+        sock.on("ping", [&at_server](SockData data, BenchClient& sock)
+        {
+            at_server.receive(data.getRaw() );
+            sock.emit("pong", data);
+        });
+    });
+
+    Client<BenchClient> client{"inproc:testperf"};
+    auto& sock = client.get();
+    sock.on("pong", [&pongs](SockData data, BenchClient&) {pongs.receive(data.getRaw() );});
+    sock.on("news", [&news](SockData data, BenchClient&) {news.receive(data.getRaw() );});
+
+    for(int i = 0; i < max_passes && server.count() == 0; ++i) server.step();
+    CHECK(server.count() == 1);
+
+    auto pump = [&](std::function<bool ()> done)
+    {
+        for(int i = 0; i < max_passes && !done(); ++i)
+        {
+            sock.update(0);
+            server.step();
+            sock.update(0);
+        }
+        return done();
+    };
+
+    auto started = std::chrono::steady_clock::now();
+
+    //round trips, a batch at a time, with a big message now and then
+    uint64_t sent = 0, sent_bytes = 0;
+    bool kept_up = true;
+    for(uint64_t batch = 0; batch < batches && kept_up; ++batch)
+    {
+        for(uint64_t i = 0; i < batch_size; ++i)
+        {
+            std::string data = std::to_string(++sent) + " ping";
+            if(sent % big_every == 0) data.resize(big_size, 'x');
+            sent_bytes += data.size();
+            sock.emit("ping", {data});
+        }
+        kept_up = pump([&]() {return pongs.count == sent;});
+    }
+    CHECK(kept_up);
+
+    //one to many, from the server's side
+    for(uint64_t i = 1; i <= broadcasts; ++i) server.emit("news", std::to_string(i) + " news");
+    CHECK(pump([&]() {return news.count == broadcasts;}) );
+
+    auto took = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    CHECK(at_server.count == batches * batch_size);
+    CHECK(at_server.bytes == sent_bytes);
+    CHECK(pongs.count == batches * batch_size);
+    CHECK(pongs.bytes == sent_bytes);
+    CHECK(news.count == broadcasts);
+    //big messages may be overtaken by the small ones behind them
+    CHECK(pongs.out_of_order <= 2 * (batches * batch_size / big_every) );
+    CHECK(news.out_of_order == 0);
+
+    uint64_t messages = 2 * batches * batch_size + broadcasts;
+    std::cout << messages << " messages, " << 2 * sent_bytes << " bytes in " << took << " s, " <<
+        static_cast<uint64_t>(messages / took) << " messages/s" << std::endl;
+
+    return checkResult();
+}
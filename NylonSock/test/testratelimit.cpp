@@ -0,0 +1,147 @@
+//
+//  testratelimit.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+
+class LimitClient : public ClientSocket<LimitClient>
+{
+public:
+    LimitClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//a client with thousands of frames waiting can't keep another from being heard,
+//both ends on this thread so every pass is counted
+static void floodCantStarve()
+{
+    constexpr size_t budget = 8;
+    constexpr int floods = 2000;
+    constexpr int max_passes = 10000;
+    const std::string address = "inproc:testratelimit-flood";
+
+    Server<LimitClient> server{address};
+    RateLimitOptions opts;
+    opts.read_budget = budget;
+    server.setRateLimit(opts);
+
+    int flooded = 0, flooded_at_hello = -1;
+    bool in_order = true;
+    server.onConnect([&](LimitClient& sock)
+    {
+        sock.on("flood", [&](SockData data, LimitClient&)
+        {
+            in_order = in_order && data.getRaw() == std::to_string(flooded);
+            ++flooded;
+        });
+        sock.on("hello", [&](SockData, LimitClient&) {flooded_at_hello = flooded;});
+    });
+
+    Client<LimitClient> flooder{address};
+    for(int i = 0; i < max_passes && server.count() == 0; ++i) server.step();
+    Client<LimitClient> quiet{address};
+    for(int i = 0; i < max_passes && server.count() == 1; ++i) server.step();
+    CHECK(server.count() == 2);
+
+    for(int i = 0; i < floods; ++i) flooder.get().emit("flood", {std::to_string(i)});
+    quiet.get().emit("hello", {"hi"});
+    flooder.get().update(0);
+    quiet.get().update(0);
+
+    auto pump = [&](std::function<bool ()> done)
+    {
+        for(int i = 0; i < max_passes && !done(); ++i)
+        {
+            flooder.get().update(0);
+            quiet.get().update(0);
+            server.step();
+        }
+        return done();
+    };
+
+    //heard within a couple of turns, not after the whole flood
+    CHECK(pump([&]() {return flooded_at_hello >= 0;}) );
+    CHECK(flooded_at_hello <= static_cast<int>(budget * 2) );
+
+    CHECK(pump([&]() {return flooded == floods;}) );
+    CHECK(in_order);
+}
+
+//frames over the limit wait their turn, none go missing
+static void limitedAreDelayed()
+{
+    constexpr int count = 50;
+    constexpr double rate = 100;
+    constexpr double burst = 10;
+    const std::string address = "inproc:testratelimit-limited";
+
+    Server<LimitClient> server{address};
+    RateLimitOptions opts;
+    opts.frames_per_sec = rate;
+    opts.frame_burst = burst;
+    server.setRateLimit(opts);
+
+    std::mutex mtx;
+    std::vector<std::string> got;
+    server.onConnect([&](LimitClient& sock)
+    {
+        sock.on("msg", [&](SockData data, LimitClient&)
+        {
+            std::lock_guard<std::mutex> lock{mtx};
+            got.push_back(data.getRaw() );
+        });
+    });
+    server.start();
+
+    Client<LimitClient> client{address};
+    client.start();
+    CHECK(waitFor([&]() {return server.count() == 1;}) );
+
+    auto started = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; ++i) client.emit("msg", {std::to_string(i)});
+
+    //never more than the burst plus what the rate has allowed since
+    auto allowed = [&]()
+    {
+        std::chrono::duration<double> passed = std::chrono::steady_clock::now() - started;
+        return burst + rate * passed.count() + 1;
+    };
+    bool within = true;
+    CHECK(waitFor([&]()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        within = within && got.size() <= allowed();
+        return got.size() == count;
+    }) );
+    CHECK(within);
+
+    //the frames past the burst can't have gone faster than the rate
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - started;
+    CHECK(took.count() >= (count - burst) / rate * 0.9);
+    CHECK(server.throttled() > 0);
+
+    std::lock_guard<std::mutex> lock{mtx};
+    for(int i = 0; i < static_cast<int>(got.size() ); ++i) CHECK(got[i] == std::to_string(i) );
+
+    client.stop();
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    floodCantStarve();
+    limitedAreDelayed();
+
+    return checkResult();
+}
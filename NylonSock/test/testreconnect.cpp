@@ -0,0 +1,101 @@
+//
+//  testreconnect.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NylonSock;
+
+class CountClient : public ClientSocket<CountClient>
+{
+public:
+    CountClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+struct Received
+{
+    std::mutex mtx;
+    std::vector<int> numbers;
+};
+
+static std::unique_ptr<Server<CountClient> > makeServer(const std::string& address, Received& received)
+{
+    auto server = std::make_unique<Server<CountClient> >(address);
+    server->onConnect([&received](CountClient& sock)
+    {
+        sock.on("n", [&received](SockData data, CountClient&)
+        {
+            std::lock_guard<std::mutex> lock{received.mtx};
+            received.numbers.push_back(std::stoi(data.getRaw() ) );
+        });
+    });
+    server->start();
+    return server;
+}
+
+//emits made while the connection is down, and while it comes back, reach the new server in order
+static void emitsKeepTheirOrder()
+{
+    const std::string address = "inproc:testreconnect";
+    constexpr int total = 2000;
+
+    Received before, after;
+    auto server = makeServer(address, before);
+
+    Client<CountClient> client{address};
+    ReconnectPolicy policy;
+    policy.base_delay = 5;
+    policy.max_delay = 20;
+    policy.max_buffered = total;
+    client.setReconnect(policy);
+    client.start();
+    CHECK(waitFor([&]() {return server->count() == 1;}) );
+
+    std::atomic<int> sent{0};
+    std::thread emitter{[&]()
+    {
+        for(int i = 0; i < total; ++i)
+        {
+            client.emit("n", {std::to_string(i)});
+            sent = i + 1;
+            if(i % 50 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1) );
+        }
+    }};
+
+    CHECK(waitFor([&]() {return sent.load() > total / 4;}) );
+    server = nullptr;
+    server = makeServer(address, after);
+    emitter.join();
+
+    CHECK(waitFor([&]()
+    {
+        std::lock_guard<std::mutex> lock{after.mtx};
+        return !after.numbers.empty() && after.numbers.back() == total - 1;
+    }) );
+
+    std::lock_guard<std::mutex> lock{after.mtx};
+    bool ordered = true;
+    for(size_t i = 1; i < after.numbers.size(); ++i) ordered = ordered && after.numbers[i - 1] < after.numbers[i];
+    CHECK(ordered);
+
+    client.stop();
+    server = nullptr;
+}
+
+int main(int argc, const char* argv[])
+{
+    emitsKeepTheirOrder();
+
+    return checkResult();
+}
@@ -0,0 +1,108 @@
+//
+//  testreliable.cpp
+//  NylonSock
+//
+
+#include "check.h"
+#include "relay.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace NylonSock;
+
+class SeqClient : public ClientSocket<SeqClient>
+{
+public:
+    SeqClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//counts numbers that arrive one after another, and any that don't
+struct Sequence
+{
+    std::atomic<int> last{0};
+    std::atomic<int> out_of_order{0};
+
+    void receive(int number)
+    {
+        if(number != last.load() + 1) ++out_of_order;
+        last = number;
+    }
+};
+
+//both directions go on in order, with nothing lost or repeated, while the connection
+//underneath is cut again and again and the session resumed
+static void resumesAcrossCuts()
+{
+    const std::string path = "/tmp/nylonsock-testreliable-" + std::to_string(::getpid() );
+    constexpr int total = 5000;
+    constexpr int cut_every = 1000;
+
+    ReliableOptions opts;
+    opts.window = 2 * total;
+
+    Sequence at_server, at_client;
+    std::atomic<int> resets{0};
+    std::atomic<int> connects{0};
+
+    Server<SeqClient> server{"unix:" + path};
+    server.setReliable(opts);
+    server.onConnect([&](SeqClient& sock)
+    {
+        ++connects;
+        sock.on("up", [&](SockData data, SeqClient&) {at_server.receive(data);});
+    });
+    server.start();
+
+    Relay relay{path + "-relay", path};
+    Client<SeqClient> client{"unix:" + path + "-relay"};
+    ReconnectPolicy policy;
+    policy.base_delay = 5;
+    policy.max_delay = 20;
+    policy.max_buffered = total;
+    client.setReconnect(policy);
+    client.setReliable(opts);
+    client.start();
+    client.on("down", [&](SockData data, SeqClient&) {at_client.receive(data);});
+    client.on("session_reset", [&](SeqClient&) {++resets;});
+    //a broadcast skips a connection that is still handshaking, so wait for the first emit through
+    client.emit("up", 1);
+    CHECK(waitFor([&]() {return at_server.last.load() == 1;}) );
+
+    std::thread down{[&]()
+    {
+        for(int i = 1; i <= total; ++i)
+        {
+            server.emit("down", i);
+            if(i % 100 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1) );
+        }
+    }};
+    for(int i = 2; i <= total; ++i)
+    {
+        client.emit("up", i);
+        if(i % cut_every == 0) relay.cut();
+        if(i % 100 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1) );
+    }
+    down.join();
+
+    CHECK(waitFor([&]() {return at_server.last.load() == total && at_client.last.load() == total;}, 10000) );
+    CHECK(at_server.out_of_order.load() == 0);
+    CHECK(at_client.out_of_order.load() == 0);
+    CHECK(resets.load() == 0);
+    //the cuts really did make it reconnect
+    CHECK(connects.load() > 1);
+
+    client.stop();
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    resumesAcrossCuts();
+
+    return checkResult();
+}
@@ -0,0 +1,150 @@
+//
+//  testrooms.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+
+struct Member
+{
+    int id;
+};
+
+static std::vector<int> ids(const std::vector<Member*>* members)
+{
+    std::vector<int> result;
+    if(members != nullptr) for(auto it : *members) result.push_back(it->id);
+    return result;
+}
+
+//the last member moves into the hole, and is still found there afterwards
+static void swapRemove()
+{
+    Rooms<Member> rooms;
+    Member a{1}, b{2}, c{3}, d{4};
+    for(auto it : {&a, &b, &c, &d}) CHECK(rooms.join(*it, "red") );
+    CHECK(!rooms.join(a, "red") );
+    CHECK( (ids(rooms.members("red") ) == std::vector<int>{1, 2, 3, 4}) );
+
+    CHECK(rooms.leave(b, "red") );
+    CHECK( (ids(rooms.members("red") ) == std::vector<int>{1, 4, 3}) );
+    CHECK(!rooms.leave(b, "red") );
+    CHECK(!rooms.inRoom(b, "red") );
+
+    //d sits where b was now, so leaving has to look there
+    CHECK(rooms.leave(d, "red") );
+    CHECK( (ids(rooms.members("red") ) == std::vector<int>{1, 3}) );
+    CHECK(rooms.inRoom(a, "red") && rooms.inRoom(c, "red") && !rooms.inRoom(d, "red") );
+
+    CHECK(rooms.leave(a, "red") );
+    CHECK(rooms.leave(c, "red") );
+    CHECK(rooms.members("red") == nullptr);
+    CHECK(rooms.size() == 0);
+    CHECK(!rooms.leave(a, "nowhere") );
+}
+
+//leaveAll empties a member out of everything, and says which rooms went with it
+static void leavingEverything()
+{
+    Rooms<Member> rooms;
+    Member a{1}, b{2}, c{3};
+    rooms.join(a, "red");
+    rooms.join(a, "blue");
+    rooms.join(a, "green");
+    rooms.join(b, "red");
+    rooms.join(c, "red");
+    rooms.join(c, "blue");
+    CHECK(rooms.size() == 3);
+
+    auto emptied = rooms.leaveAll(a);
+    CHECK( (emptied == std::vector<std::string>{"green"}) );
+    CHECK(rooms.size() == 2);
+    CHECK( (ids(rooms.members("red") ) == std::vector<int>{3, 2}) );
+    CHECK( (ids(rooms.members("blue") ) == std::vector<int>{3}) );
+
+    //b's slot was moved by a leaving, and c's by b
+    CHECK(rooms.leave(b, "red") );
+    CHECK( (ids(rooms.members("red") ) == std::vector<int>{3}) );
+
+    emptied = rooms.leaveAll(c);
+    std::sort(emptied.begin(), emptied.end() );
+    CHECK( (emptied == std::vector<std::string>{"blue", "red"}) );
+    CHECK(rooms.size() == 0);
+    CHECK(rooms.leaveAll(c).empty() );
+}
+
+class RoomClient : public ClientSocket<RoomClient>
+{
+public:
+    RoomClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//to(room).emit only reaches the room, and a client that goes away leaves its rooms
+static void serverRooms()
+{
+    const std::string address = "inproc:testrooms";
+
+    Server<RoomClient> server{address};
+    server.onConnect([&server](RoomClient& sock)
+    {
+        sock.on("join", [&server](SockData data, RoomClient& sock) {server.join(sock, data.getRaw() );});
+        sock.on("leave", [&server](SockData data, RoomClient& sock) {server.leave(sock, data.getRaw() );});
+    });
+    server.start();
+
+    constexpr int count = 3;
+    std::vector<std::unique_ptr<Client<RoomClient> > > clients;
+    std::vector<std::unique_ptr<std::atomic<int> > > heard;
+    for(int i = 0; i < count; ++i)
+    {
+        clients.push_back(std::make_unique<Client<RoomClient> >(address) );
+        heard.push_back(std::make_unique<std::atomic<int> >(0) );
+        auto& counter = *heard.back();
+        clients.back()->start();
+        clients.back()->on("said", [&counter](SockData, RoomClient&) {++counter;});
+    }
+
+    //everyone in red, the first two in blue as well
+    for(int i = 0; i < count; ++i) clients[i]->emit("join", {"red"});
+    clients[0]->emit("join", {"blue"});
+    clients[1]->emit("join", {"blue"});
+    CHECK(waitFor([&]() {return server.roomSize("red") == 3 && server.to("blue").size() == 2;}) );
+
+    server.to("blue").emit("said", {"hi blue"});
+    server.to("nobody").emit("said", {"hi nobody"});
+    CHECK(waitFor([&]() {return heard[0]->load() == 1 && heard[1]->load() == 1;}) );
+
+    clients[0]->emit("leave", {"blue"});
+    CHECK(waitFor([&]() {return server.roomSize("blue") == 1;}) );
+
+    //the second client goes away, taking blue with it
+    clients[1] = nullptr;
+    CHECK(waitFor([&]() {return server.count() == count - 1;}) );
+    CHECK(waitFor([&]() {return server.roomSize("red") == 2 && server.roomSize("blue") == 0;}) );
+
+    server.to("red").emit("said", {"hi red"});
+    CHECK(waitFor([&]() {return heard[0]->load() == 2 && heard[2]->load() == 1;}) );
+    CHECK(heard[1]->load() == 1);
+
+    for(auto& it : clients) if(it != nullptr) it->stop();
+    server.stop();
+}
+
+int main(int argc, const char* argv[])
+{
+    swapRemove();
+    leavingEverything();
+    serverRooms();
+
+    return checkResult();
+}
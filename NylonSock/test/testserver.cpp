@@ -13,9 +13,6 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
-#include <algorithm>
-#include <map>
-#include <vector>
 
 int main(int argc, const char* argv[])
 {
@@ -26,54 +23,35 @@ int main(int argc, const char* argv[])
     //this is the port num -|
 	Server<InClient> serv{3490};
 
-    /*
-        We can get away with this being thread safe
-        by only accessing the map in onConnect
-        since our server's update loop runs in a single thread
-    */
-    std::map<std::string, std::vector<InClient*> > rooms;
-
-	serv.onConnect([&serv, &rooms](InClient& sock)
+	serv.onConnect([&serv](InClient& sock)
 	{
         sock.on("usrname", [&serv](SockData data, InClient& sock)
         {
             sock.usrname = data.getRaw();
         });
 
-        sock.on("room", [&serv, &rooms](SockData data, InClient& sock)
+        sock.on("room", [&serv](SockData data, InClient& sock)
         {
             sock.room = data.getRaw();
 
-            rooms[sock.room].push_back(&sock);
+            serv.join(sock, sock.room);
 
             std::cout << sock.usrname + " joined the server at room " + sock.room << std::endl;
-            for(auto& it : rooms[sock.room])
-            {
-                it->emit("msgSend", {sock.usrname + " joined the room."});
-            }
+            serv.to(sock.room).emit("msgSend", {sock.usrname + " joined the room."});
         });
 
-        sock.on("msgGet", [&serv, &rooms](SockData data, InClient& sock)
+        sock.on("msgGet", [&serv](SockData data, InClient& sock)
         {
-            for(auto& it : rooms[sock.room])
-            {
-                it->emit("msgSend", {sock.usrname + ": " + data.getRaw()});
-            }
+            serv.to(sock.room).emit("msgSend", {sock.usrname + ": " + data.getRaw()});
         });
 
-        sock.on("disconnect", [&serv, &rooms](InClient& sock)
+        sock.on("disconnect", [&serv](InClient& sock)
         {
+            //the server takes sock out of its room once this returns
             if(!sock.usrname.empty())
             {
-                auto& vec = rooms[sock.room];
-                vec.erase(std::remove(vec.begin(), vec.end(), &sock), vec.end());
-
                 std::cout << sock.usrname + " left the server." << std::endl;
-                std::string room = sock.room;
-                for(auto& it : rooms[sock.room])
-                {
-                    it->emit("msgSend", {sock.usrname + " left the server."});
-                }
+                serv.to(sock.room).emit("msgSend", {sock.usrname + " left the server."});
             }
         });
     });
@@ -0,0 +1,158 @@
+//
+//  teststatesync.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+
+class SyncClient : public ClientSocket<SyncClient>
+{
+public:
+    SyncClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+static bool roundTrips(const std::string& base, const std::string& next)
+{
+    std::string patched;
+    return patchState(base, diffState(base, next), patched) && patched == next;
+}
+
+static void diffAndPatch()
+{
+    CHECK(roundTrips("", "") );
+    CHECK(roundTrips("", "grown from nothing") );
+    CHECK(roundTrips("shrunk to nothing", "") );
+    CHECK(roundTrips("the same", "the same") );
+    CHECK(roundTrips("short", "short and then longer") );
+    CHECK(roundTrips("long and then cut", "long") );
+
+    //a big snapshot with a few scattered changes makes a small delta
+    std::mt19937 rng{7};
+    std::string base(64 * 1024, 0);
+    for(auto& c : base) c = static_cast<char>(rng() );
+    std::string next = base;
+    for(int i = 0; i < 16; ++i) next[rng() % next.size()] ^= 0x5A;
+    CHECK(roundTrips(base, next) );
+    CHECK(diffState(base, next).size() < 1024);
+
+    for(int round = 0; round < 200; ++round)
+    {
+        std::string a(rng() % 300, 0), b(rng() % 300, 0);
+        for(auto& c : a) c = static_cast<char>(rng() % 4);
+        for(auto& c : b) c = static_cast<char>(rng() % 4);
+        CHECK(roundTrips(a, b) );
+    }
+
+    //a cut off delta is refused rather than patched into garbage
+    std::string delta = diffState(base, next), patched;
+    CHECK(!patchState(base, delta.substr(0, delta.size() / 2), patched) || patched != next);
+}
+
+static void channelHistory()
+{
+    StateChannel channel;
+    CHECK(channel.push("one", 2) == 1);
+    CHECK(channel.push("two", 2) == 2);
+    CHECK(channel.push("three", 2) == 3);
+    CHECK(channel.latest() == "three");
+    CHECK(channel.find(1) == nullptr);
+    CHECK(channel.find(2) != nullptr && *channel.find(2) == "two");
+    CHECK(channel.find(4) == nullptr);
+}
+
+static void receiverOrdering()
+{
+    StateReceiver receiver;
+    std::string channel, snapshot;
+    uint64_t ack;
+
+    CHECK(receiver.receive(encodeState(state_keyframe, "world", 1, 0, "first"), 4, channel, snapshot, ack) );
+    CHECK(channel == "world" && snapshot == "first" && ack == 1);
+
+    CHECK(receiver.receive(encodeState(state_delta, "world", 2, 1, diffState("first", "second") ), 4, channel, snapshot, ack) );
+    CHECK(snapshot == "second" && ack == 2);
+
+    //an older version, overtaken by a newer one, is dropped and the newest acked again
+    CHECK(!receiver.receive(encodeState(state_keyframe, "world", 1, 0, "first"), 4, channel, snapshot, ack) );
+    CHECK(ack == 2);
+
+    //a delta on a base that was never seen asks for a keyframe
+    CHECK(!receiver.receive(encodeState(state_delta, "world", 4, 3, diffState("third", "fourth") ), 4, channel, snapshot, ack) );
+    CHECK(ack == 0);
+
+    CHECK(!receiver.receive("short", 4, channel, snapshot, ack) );
+
+    //once cleared, a new server's first version counts again
+    receiver.clear();
+    CHECK(receiver.receive(encodeState(state_keyframe, "world", 1, 0, "again"), 4, channel, snapshot, ack) );
+    CHECK(snapshot == "again");
+}
+
+//a client that reconnects to a fresh server, which numbers its channels from 1 again,
+//still gets that server's first keyframe
+static void reconnectToFreshServer()
+{
+    const std::string address = "inproc:teststatesync";
+
+    std::mutex mtx;
+    std::vector<std::string> seen;
+
+    auto server = std::make_unique<Server<SyncClient> >(address);
+    server->start();
+
+    Client<SyncClient> client{address};
+    ReconnectPolicy policy;
+    policy.base_delay = 5;
+    policy.max_delay = 20;
+    client.setReconnect(policy);
+    client.start();
+    client.on("world", [&](SockData data, SyncClient&)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        seen.push_back(data.getRaw() );
+    });
+
+    CHECK(waitFor([&]() {return server->count() == 1;}) );
+    for(int i = 0; i < 5; ++i) server->syncState("world", {"old world " + std::to_string(i)});
+    CHECK(waitFor([&]()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return !seen.empty() && seen.back() == "old world 4";
+    }) );
+
+    server = nullptr;
+    server = std::make_unique<Server<SyncClient> >(address);
+    server->start();
+    CHECK(waitFor([&]() {return server->count() == 1;}) );
+
+    server->syncState("world", {"new world"});
+    CHECK(waitFor([&]()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return seen.back() == "new world";
+    }) );
+
+    client.stop();
+    server = nullptr;
+}
+
+int main(int argc, const char* argv[])
+{
+    diffAndPatch();
+    channelHistory();
+    receiverOrdering();
+    reconnectToFreshServer();
+
+    return checkResult();
+}
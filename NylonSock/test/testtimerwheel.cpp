@@ -0,0 +1,158 @@
+//
+//  testtimerwheel.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <TimerWheel.h>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace NylonSock;
+using std::chrono::milliseconds;
+
+//a wheel driven with made up times, counted from just before it was made, so nothing waits
+struct Wheel
+{
+    TimerWheel::Clock::time_point started = TimerWheel::Clock::now();
+    TimerWheel wheel;
+
+    TimerWheel::Clock::time_point at(int64_t milli) const
+    {
+        return started + milliseconds(milli);
+    }
+};
+
+static void firesOnTime()
+{
+    Wheel fake;
+    auto& wheel = fake.wheel;
+    CHECK(wheel.timeout() == -1);
+
+    int fired = 0;
+    wheel.schedule(milliseconds(100), [&]() {++fired;});
+    CHECK(wheel.size() == 1);
+    CHECK(wheel.timeout() >= 0);
+
+    CHECK(wheel.advance(fake.at(50) ) == 0);
+    CHECK(fired == 0);
+    CHECK(wheel.advance(fake.at(200) ) == 1);
+    CHECK(fired == 1);
+    CHECK(wheel.size() == 0);
+
+    //past every level, so it is placed again on the way
+    wheel.schedule(milliseconds(20 * 60 * 1000), [&]() {++fired;});
+    wheel.advance(fake.at(20 * 60 * 1000 - 1000) );
+    CHECK(fired == 1);
+    wheel.advance(fake.at(20 * 60 * 1000 + 1000) );
+    CHECK(fired == 2);
+}
+
+//timers spread over several levels cascade down and each fires close to when it was due
+static void cascades()
+{
+    Wheel fake;
+    auto& wheel = fake.wheel;
+    std::mt19937 rng{28};
+
+    constexpr int count = 2000;
+    constexpr int64_t longest = 400000;
+    std::vector<int64_t> due(count), ran(count, -1);
+
+    int64_t clock = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        due[i] = 1 + rng() % longest;
+        wheel.schedule(milliseconds(due[i]), [&, i]() {ran[i] = clock;});
+    }
+
+    for(clock = 1; clock <= longest + 10; ++clock) wheel.advance(fake.at(clock) );
+
+    bool on_time = true;
+    for(int i = 0; i < count; ++i) on_time = on_time && ran[i] >= due[i] && ran[i] <= due[i] + 5;
+    CHECK(on_time);
+    CHECK(wheel.size() == 0);
+}
+
+static void cancels()
+{
+    Wheel fake;
+    auto& wheel = fake.wheel;
+    int fired = 0;
+
+    auto id = wheel.schedule(milliseconds(10), [&]() {++fired;});
+    auto far = wheel.schedule(milliseconds(100000), [&]() {++fired;});
+    CHECK(wheel.cancel(id) );
+    CHECK(!wheel.cancel(id) );
+    CHECK(!wheel.cancel(TimerWheel::no_timer) );
+    CHECK(wheel.cancel(far) );
+
+    wheel.advance(fake.at(200000) );
+    CHECK(fired == 0);
+    CHECK(wheel.timeout() == -1);
+}
+
+//a callback may schedule and cancel others, the one after it in the same slot included
+static void callbacksReschedule()
+{
+    Wheel fake;
+    auto& wheel = fake.wheel;
+    int fired = 0;
+
+    TimerWheel::TimerId second = TimerWheel::no_timer;
+    wheel.schedule(milliseconds(10), [&]()
+    {
+        ++fired;
+        wheel.cancel(second);
+        wheel.schedule(milliseconds(10), [&]() {++fired;});
+    });
+    second = wheel.schedule(milliseconds(10), [&]() {fired += 100;});
+
+    wheel.advance(fake.at(15) );
+    CHECK(fired == 1);
+    wheel.advance(fake.at(40) );
+    CHECK(fired == 2);
+}
+
+static void loopTimers()
+{
+    Wheel fake;
+    auto& wheel = fake.wheel;
+    int woken = 0;
+    LoopTimers timers{wheel, [&]() {++woken;}};
+
+    //not the loop thread yet, so these wait for run
+    int once = 0, repeated = 0;
+    timers.setTimeout(10, [&]() {++once;});
+    auto interval = timers.setInterval(10, [&]() {++repeated;});
+    CHECK(wheel.size() == 0);
+    CHECK(woken == 2);
+
+    timers.run();
+    CHECK(wheel.size() == 2);
+
+    for(int64_t milli = 1; milli <= 55; ++milli) wheel.advance(fake.at(milli) );
+    CHECK(once == 1);
+    CHECK(repeated >= 4 && repeated <= 5);
+
+    //on the loop thread now, so clearing happens right away
+    timers.clearTimer(interval);
+    CHECK(wheel.size() == 0);
+    wheel.advance(fake.at(200) );
+    CHECK(repeated <= 5);
+}
+
+int main(int argc, const char* argv[])
+{
+    firesOnTime();
+    cascades();
+    cancels();
+    callbacksReschedule();
+    loopTimers();
+
+    return checkResult();
+}
@@ -0,0 +1,169 @@
+//
+//  testtopics.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <Topics.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace NylonSock;
+
+struct Member
+{
+    int id;
+};
+
+static std::set<int> ids(const std::vector<Member*>& members)
+{
+    std::set<int> result;
+    for(auto it : members) result.insert(it->id);
+    return result;
+}
+
+//the rules spelled out in Topics.h, one segment at a time
+static bool matches(const std::vector<std::string>& pattern, const std::vector<std::string>& topic, size_t p = 0, size_t t = 0)
+{
+    if(p == pattern.size() ) return t == topic.size();
+    if(pattern[p] == "#") return true;
+    if(t == topic.size() ) return false;
+    if(pattern[p] != "*" && pattern[p] != topic[t]) return false;
+    return matches(pattern, topic, p + 1, t + 1);
+}
+
+static void wildcards()
+{
+    Topics<Member> topics;
+    Member exact{1}, one{2}, rest{3}, everything{4};
+    topics.subscribe(exact, "game.42.score");
+    topics.subscribe(one, "game.*.score");
+    topics.subscribe(rest, "game.#");
+    topics.subscribe(everything, "#");
+
+    CHECK( (ids(topics.subscribers("game.42.score") ) == std::set<int>{1, 2, 3, 4}) );
+    CHECK( (ids(topics.subscribers("game.7.score") ) == std::set<int>{2, 3, 4}) );
+    CHECK( (ids(topics.subscribers("game.42.chat") ) == std::set<int>{3, 4}) );
+    //# matches nothing at all as well
+    CHECK( (ids(topics.subscribers("game") ) == std::set<int>{3, 4}) );
+    CHECK( (ids(topics.subscribers("lobby") ) == std::set<int>{4}) );
+    CHECK( (ids(topics.subscribers("game.42.score.extra") ) == std::set<int>{3, 4}) );
+}
+
+//a member on several matching patterns is only listed once
+static void eachOnce()
+{
+    Topics<Member> topics;
+    Member member{1};
+    CHECK(topics.subscribe(member, "a.b") );
+    CHECK(topics.subscribe(member, "a.*") );
+    CHECK(topics.subscribe(member, "a.#") );
+    CHECK(!topics.subscribe(member, "a.b") );
+
+    CHECK(topics.subscribers("a.b").size() == 1);
+    CHECK(topics.size() == 3);
+}
+
+static void unsubscribing()
+{
+    Topics<Member> topics;
+    Member first{1}, second{2};
+    topics.subscribe(first, "a.*.c");
+    topics.subscribe(second, "a.*.c");
+    topics.subscribe(first, "a.#");
+
+    CHECK(topics.unsubscribe(first, "a.*.c") );
+    CHECK(!topics.unsubscribe(first, "a.*.c") );
+    CHECK( (ids(topics.subscribers("a.b.c") ) == std::set<int>{1, 2}) );
+
+    topics.unsubscribeAll(first);
+    CHECK( (ids(topics.subscribers("a.b.c") ) == std::set<int>{2}) );
+    CHECK(topics.subscribers("a.b").empty() );
+
+    //subscribing again after the trie was pruned
+    topics.unsubscribe(second, "a.*.c");
+    CHECK(topics.size() == 0);
+    CHECK(topics.subscribers("a.b.c").empty() );
+    topics.subscribe(second, "a.*.c");
+    CHECK( (ids(topics.subscribers("a.b.c") ) == std::set<int>{2}) );
+}
+
+static void badPatterns()
+{
+    Topics<Member> topics;
+    Member member{1};
+
+    bool thrown = false;
+    try {topics.subscribe(member, "a.#.c");} catch(BAD_PATTERN& e) {thrown = true;}
+    CHECK(thrown);
+
+    thrown = false;
+    try {topics.subscribers("");} catch(BAD_PATTERN& e) {thrown = true;}
+    CHECK(thrown);
+
+    CHECK(topics.size() == 0);
+}
+
+//random patterns and topics over a small alphabet, checked against matches()
+static void againstTheRules()
+{
+    std::mt19937 rng{37};
+    const std::vector<std::string> words{"a", "b", "c", "*", "#"};
+
+    auto make = [&](bool pattern)
+    {
+        std::vector<std::string> segments(1 + rng() % 4);
+        for(size_t i = 0; i < segments.size(); ++i)
+        {
+            segments[i] = words[rng() % (pattern ? (i + 1 == segments.size() ? 5 : 4) : 3)];
+        }
+        return segments;
+    };
+    auto join = [](const std::vector<std::string>& segments)
+    {
+        std::string result;
+        for(auto& it : segments) result += (result.empty() ? "" : ".") + it;
+        return result;
+    };
+
+    Topics<Member> topics;
+    std::vector<Member> members(200);
+    std::vector<std::vector<std::string> > patterns;
+    for(size_t i = 0; i < members.size(); ++i)
+    {
+        members[i].id = static_cast<int>(i);
+        patterns.push_back(make(true) );
+        topics.subscribe(members[i], join(patterns.back() ) );
+    }
+
+    bool agrees = true;
+    for(int round = 0; round < 500; ++round)
+    {
+        auto topic = make(false);
+        std::set<int> expected;
+        for(size_t i = 0; i < members.size(); ++i)
+        {
+            if(matches(patterns[i], topic) ) expected.insert(static_cast<int>(i) );
+        }
+
+        auto found = topics.subscribers(join(topic) );
+        agrees = agrees && ids(found) == expected && found.size() == expected.size();
+    }
+    CHECK(agrees);
+}
+
+int main(int argc, const char* argv[])
+{
+    wildcards();
+    eachOnce();
+    unsubscribing();
+    badPatterns();
+    againstTheRules();
+
+    return checkResult();
+}
@@ -0,0 +1,132 @@
+//
+//  testuring.cpp
+//  NylonSock
+//
+
+#include "check.h"
+
+#include <NylonSock.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace NylonSock;
+
+class RingClient : public ClientSocket<RingClient>
+{
+public:
+    RingClient(Socket&& sock) : ClientSocket(std::move(sock) ) {}
+};
+
+//the ring only takes tcp sockets, so look for a free port
+static std::unique_ptr<Server<RingClient> > makeServer(int& port)
+{
+    for(int i = 0; i < 50; ++i)
+    {
+        port = 41000 + (::getpid() + i * 83) % 20000;
+        try
+        {
+            return std::make_unique<Server<RingClient> >(port);
+        }
+        catch(NylonSock::Error& e)
+        {
+        }
+    }
+
+    CHECK(!"no free tcp port");
+    return nullptr;
+}
+
+//sizes up to a little under a chunk, so frames straddle the ring's buffers
+static std::string message(int value)
+{
+    std::string data = std::to_string(value) + " ";
+    data.resize(data.size() + (value * 7919) % 15000, 'x');
+    return data;
+}
+
+//what one end heard, checked for order and content as it comes
+struct Heard
+{
+    std::mutex mtx;
+    int count = 0;
+    bool in_order = true;
+
+    void add(const std::string& data)
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        in_order = in_order && data == message(count);
+        ++count;
+    }
+
+    int size()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        return count;
+    }
+};
+
+//echoes, then a broadcast, with both loops on the ring or both on poll.
+//false if the ring was asked for and the kernel doesn't have it
+static bool echoes(bool ring)
+{
+    constexpr int count = 3000;
+
+    int port = 0;
+    auto server = makeServer(port);
+    if(server == nullptr) return true;
+
+    //a small budget, so frames wait their turn and the recv is stopped and armed again
+    RateLimitOptions limit;
+    limit.read_budget = 2;
+    server->setRateLimit(limit);
+    if(ring) server->setUring();
+    if(ring && !server->uring() ) return false;
+    CHECK(!server->uring() || ring);
+
+    Heard at_server;
+    server->onConnect([&at_server](RingClient& sock)
+    {
+        sock.on("m", [&at_server](SockData data, RingClient& sock)
+        {
+            at_server.add(data.getRaw() );
+            sock.emit("r", data);
+        });
+    });
+    server->start();
+
+    Client<RingClient> client{"127.0.0.1", port};
+    if(ring) client.setUring();
+    CHECK(client.uring() == ring);
+    client.start();
+
+    Heard echoed, news;
+    client.on("r", [&echoed](SockData data, RingClient&) {echoed.add(data.getRaw() );});
+    client.on("news", [&news](SockData data, RingClient&) {news.add(data.getRaw() );});
+
+    for(int i = 0; i < count; ++i) client.emit("m", {message(i)});
+    CHECK(waitFor([&]() {return echoed.size() == count;}, 20000) );
+    CHECK(at_server.size() == count && at_server.in_order);
+    CHECK(echoed.in_order);
+
+    for(int i = 0; i < count; ++i) server->emit("news", {message(i)});
+    CHECK(waitFor([&]() {return news.size() == count;}, 20000) );
+    CHECK(news.in_order);
+
+    client.stop();
+    server->stop();
+    return true;
+}
+
+int main(int argc, const char* argv[])
+{
+    echoes(false);
+    if(!echoes(true) ) std::cout << "io_uring isn't supported here, only poll was tested" << std::endl;
+
+    return checkResult();
+}